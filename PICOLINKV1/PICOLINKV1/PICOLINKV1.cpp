@@ -16,13 +16,21 @@
 #include <mutex>
 #include <atomic>
 #include <algorithm>
+#include <memory>
+#include <functional>
+#include <unordered_map>
 #include <cctype>
 #include <SetupAPI.h>
+#include <objidl.h>
+#include <gdiplus.h>
 #pragma comment(lib, "setupapi.lib")
+#pragma comment(lib, "gdiplus.lib")
 
 // GLOBAL SYNCHRONIZATION OBJECTS
 std::mutex serialMutex; // Protects hSerial and related serial calls (e.g., PurgeComm, ReadFile, WriteFile)
 std::atomic<bool> protocolActive(false); // Flag: True when an upload/protocol sequence is in progress
+std::atomic<bool> downloadActive(false); // True while download frames arrive; they are binary, so not logged raw
+std::atomic<bool> transferBusy(false); // A button's transfer thread is running; see StartTransfer()
 std::mutex msgMutex;    // Protects serialMessages
 std::string serialMessages; // Shared buffer for incoming serial data
 
@@ -32,6 +40,8 @@ std::string serialMessages; // Shared buffer for incoming serial data
 #define IDC_UPLOAD       101
 #define IDC_DOWNLOAD     102
 #define IDC_DEBUG        103
+#define IDC_CONVERT      106 // 104 and 105 are IDM_ABOUT and IDM_EXIT
+#define IDC_LINKTEST     107
 
 // --- PROTOCOL CONSTANTS (Exact search strings) ---
 // Note: These must match the Pico's output EXACTLY, including \r\n if Pico adds it.
@@ -43,6 +53,52 @@ const size_t BLOCK_SIZE = 512;
 const int READY_TIMEOUT_SECONDS = 10;
 const int ACK_TIMEOUT_SECONDS = 5;
 const int UPLOAD_OK_TIMEOUT_SECONDS = 100;
+// --- UPLOAD2 CONFIG ---
+// Windowed, CRC-checked upload. Must match the SERIAL UPLOAD section of the Pico sketch.
+const char UPLOAD2_MAGIC[2] = { 'U', '2' };
+const size_t UPLOAD2_HEADER_BYTES = 8;
+const size_t UPLOAD2_BLOCK_SIZE = 1024; // Asked for; the Pico may grant less
+const size_t UPLOAD2_WINDOW = 8;        // Blocks in flight
+const int UPLOAD2_RESEND_MS = 500;      // Resend the oldest block after this long without an ACK
+const int UPLOAD2_MAX_RESENDS = 10;     // Per block, before giving up
+const size_t LINK_TEST_BYTES = 128 * 1024;
+
+// Downloads (Pico -> PC): the Pico offers "DLOFFER <file> <size> <crc>", we answer
+// "DLGET <offset> <chunk> <window>" and it streams frames: the magic, the file
+// offset (u32 LE), the length (u16 LE), the data, then the CRC-32 of everything
+// after the magic. "DLACK <n>" (cumulative) grants more credit, "DLNAK <n>" asks
+// for a resend from n. The Pico finishes with "DLEND <size> <crc>" or "DLERR <reason>",
+// sent as the data of a frame flagged with DL_TEXT_FLAG so file data cannot pass for it.
+const uint8_t DL_MAGIC[2] = { 0xA5, 'D' };
+const size_t DL_HEADER_BYTES = 8;
+const uint16_t DL_TEXT_FLAG = 0x4000; // In the length field
+const size_t DL_CHUNK = 2048; // Asked for; the Pico may send less
+const size_t DL_WINDOW = 8;   // Chunks of credit past the last ACK
+const int DL_TIMEOUT_SECONDS = 10;
+
+// Block compression in the LZ4 block format, asked for with " lz" after UPLOAD2 and
+// DLGET (granted with " lz" after READY2). Each block is compressed on its own, and
+// a frame's length field has LZ_FRAME_FLAG set when its data is compressed.
+const size_t LZ_MIN_MATCH = 4;
+const size_t LZ_LAST_LITERALS = 5; // LZ4: a block ends with at least this many literals
+const size_t LZ_MATCH_LIMIT = 12;  // LZ4: no match starts this close to the end
+const int LZ_HASH_BITS = 12;
+const uint16_t LZ_FRAME_FLAG = 0x8000;
+// Delta sync: re-uploading an edited file sends only what changed. "HASH <file>"
+// gives the size and CRC-32 of the Pico's copy, "SYNC <file> <block>" its block
+// checksums; the delta goes up with UPLOAD2 as <file>.dlt and "PATCH <file> <block>
+// <size> <crc>" rebuilds the file from it. Must match the DELTA SYNC section of the Pico sketch.
+const size_t SYNC_MIN_BLOCK = 256;  // The block is about the square root of the file size, within these
+const size_t SYNC_MAX_BLOCK = 4096;
+const char SYNC_COPY = 'C';    // Delta record: blocks of the Pico's copy (first, count: u32 LE)
+const char SYNC_LITERAL = 'L'; // Delta record: new bytes (length: u32 LE, then the bytes)
+// --- .565 IMAGE CONFIG ---
+// Must match the NATIVE RGB565 IMAGES section of the Pico sketch.
+const char IMG565_MAGIC[4] = { 'I', '5', '6', '5' };
+const size_t IMG565_HEADER_BYTES = 16;
+const uint8_t IMG565_FLAG_RLE = 0x01;
+const uint16_t IMG565_ROW_RAW = 0x8000;
+const int IMG565_MAX_SIDE = 240; // Converted images are scaled down to fit the screen
 
 
 // Global Variables:
@@ -50,6 +106,7 @@ HINSTANCE hInst;                    // current instance
 WCHAR szTitle[MAX_LOADSTRING];      // The title bar text
 WCHAR szWindowClass[MAX_LOADSTRING];  // the main window class name
 HWND hDebug;
+HWND hConvert;                      // "Convert images to .565" checkbox
 HANDLE hSerial = INVALID_HANDLE_VALUE; // Serial port handle
 
 // Forward declarations
@@ -61,7 +118,15 @@ void CreateUI(HWND hWnd);
 bool OpenSerialPort(const std::wstring& portName);
 void Log(const std::string& msg);
 void FlushSerialMessagesToLog(); // Function to display raw serial output
-void UploadFile();
+void UploadFile(bool convertImages);
+bool UploadPayload(const std::string& filename, const std::vector<char>& payload);
+bool UploadPayloadLegacy(const std::string& filename, const std::vector<char>& payload);
+bool SyncPayload(const std::string& filename, const std::vector<char>& payload);
+void RunLinkTest();
+bool ReceiveDownload(const std::string& offerLine, bool compress, std::wstring& savedPath);
+bool IsConvertibleImage(const std::string& path);
+bool ConvertImageTo565(const std::string& path, std::vector<char>& out);
+void Encode565(const std::vector<uint16_t>& pixels, int width, int height, std::vector<char>& out);
 void SendData(const char* data, DWORD size);
 void PicoListenerThread();
 
@@ -118,12 +183,19 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
     UNREFERENCED_PARAMETER(hPrevInstance);
     UNREFERENCED_PARAMETER(lpCmdLine);
 
+    // GDI+ decodes PNG/BMP for the .565 converter
+    Gdiplus::GdiplusStartupInput gdiplusInput;
+    ULONG_PTR gdiplusToken = 0;
+    Gdiplus::GdiplusStartup(&gdiplusToken, &gdiplusInput, nullptr);
+
     LoadStringW(hInstance, IDS_APP_TITLE, szTitle, MAX_LOADSTRING);
     LoadStringW(hInstance, IDC_PICOLINKV1, szWindowClass, MAX_LOADSTRING);
     MyRegisterClass(hInstance);
 
-    if (!InitInstance(hInstance, nCmdShow))
+    if (!InitInstance(hInstance, nCmdShow)) {
+        Gdiplus::GdiplusShutdown(gdiplusToken);
         return FALSE;
+    }
 
     HACCEL hAccelTable = LoadAccelerators(hInstance, MAKEINTRESOURCE(IDC_PICOLINKV1));
     MSG msg;
@@ -138,6 +210,7 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
         }
     }
 
+    Gdiplus::GdiplusShutdown(gdiplusToken);
     return (int)msg.wParam;
 }
 
@@ -169,9 +242,9 @@ BOOL InitInstance(HINSTANCE hInstance, int nCmdShow)
     const int btnWidth = 160;
     const int margin = 20;
 
-    // Initial client width matches button right edge + margin
-    const int clientWidth = btnX + btnWidth + margin;
-    const int clientHeight = 220;
+    // Initial client width matches the right edge of the second button + margin
+    const int clientWidth = btnX + 2 * btnWidth + 10 + margin;
+    const int clientHeight = 245;
 
     RECT rc = { 0, 0, clientWidth, clientHeight };
     AdjustWindowRect(&rc, WS_OVERLAPPEDWINDOW, FALSE);
@@ -397,47 +470,456 @@ bool WaitForPicoResponse(const std::string& expectedMsg, const std::string& erro
     }
 }
 
-// *** CRITICAL UPLOAD FUNCTION WITH ACK FLOW CONTROL ***
-void UploadFile()
+// ----------------------------------------------------
+// .565 IMAGE CONVERTER
+// ----------------------------------------------------
+// Images the Pico shows with "pic". Converting here means the Pico only copies
+// bytes from flash to the display, with no per-pixel work on the device.
+bool IsConvertibleImage(const std::string& path)
 {
-    // 1. Immediately SET the flag. This tells the listener thread to STOP logging data.
-    protocolActive.store(true);
+    std::string ext = std::filesystem::path(path).extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+    return ext == ".png" || ext == ".bmp" || ext == ".jpg" || ext == ".jpeg" || ext == ".gif";
+}
 
-    // Use a try/finally or RAII style scope guard to ensure the flag is cleared on exit
-    class ProtocolScopeGuard {
-    public:
-        ~ProtocolScopeGuard() {
-            protocolActive.store(false);
-            // After protocol ends, immediately flush any delayed messages
-            FlushSerialMessagesToLog();
+// RLE packs one row: 0x80|(n-1) + pixel for a run of n, n-1 + n pixels for literals.
+// Pixels are written big-endian, the order the display expects on the wire.
+static void PackRow565(const uint16_t* px, int width, std::vector<uint8_t>& packed)
+{
+    auto putPixel = [&](uint16_t c) {
+        packed.push_back((uint8_t)(c >> 8));
+        packed.push_back((uint8_t)(c & 0xFF));
+    };
+    auto runAt = [&](int i) {
+        int n = 1;
+        while (i + n < width && n < 128 && px[i + n] == px[i]) n++;
+        return n;
+    };
+
+    packed.clear();
+    int i = 0;
+    while (i < width) {
+        int run = runAt(i);
+        if (run >= 3) {
+            packed.push_back((uint8_t)(0x80 | (run - 1)));
+            putPixel(px[i]);
+            i += run;
+            continue;
         }
-    } guard;
-    protocolActive.store(true);
-    OPENFILENAMEA ofn;
-    char szFile[MAX_PATH] = { 0 };
-    // ... [File selection code remains the same] ...
-    ZeroMemory(&ofn, sizeof(ofn));
-    ofn.lStructSize = sizeof(ofn);
-    ofn.lpstrFile = szFile;
-    ofn.nMaxFile = sizeof(szFile);
-    ofn.lpstrFilter = "All Files\0*.*\0";
-    ofn.lpstrTitle = "Select File to Upload";
-    ofn.Flags = OFN_PATHMUSTEXIST | OFN_FILEMUSTEXIST;
+        // Literal up to the next run worth packing
+        int end = i + 1;
+        while (end < width && end - i < 128 && runAt(end) < 3) end++;
+        packed.push_back((uint8_t)(end - i - 1));
+        for (; i < end; i++) putPixel(px[i]);
+    }
+}
 
-    if (!GetOpenFileNameA(&ofn)) {
-        Log("Upload canceled.");
-        return;
+// Builds a .565 file from RGB565 pixels, top row first. Rows are RLE packed when
+// that makes the file smaller; a row that does not shrink is stored unpacked.
+void Encode565(const std::vector<uint16_t>& pixels, int width, int height, std::vector<char>& out)
+{
+    const size_t rowBytes = (size_t)width * 2;
+    std::vector<char> packedData;
+    std::vector<uint8_t> row;
+    for (int y = 0; y < height; y++) {
+        const uint16_t* px = pixels.data() + (size_t)y * width;
+        PackRow565(px, width, row);
+        bool raw = row.size() >= rowBytes;
+        if (raw) {
+            row.clear();
+            for (int x = 0; x < width; x++) {
+                row.push_back((uint8_t)(px[x] >> 8));
+                row.push_back((uint8_t)(px[x] & 0xFF));
+            }
+        }
+        uint16_t prefix = (uint16_t)row.size() | (raw ? IMG565_ROW_RAW : 0);
+        packedData.push_back((char)(prefix & 0xFF));
+        packedData.push_back((char)(prefix >> 8));
+        packedData.insert(packedData.end(), row.begin(), row.end());
+    }
+    const bool rle = packedData.size() < rowBytes * height;
+
+    out.assign(IMG565_HEADER_BYTES, 0);
+    memcpy(out.data(), IMG565_MAGIC, sizeof(IMG565_MAGIC));
+    out[4] = (char)(width & 0xFF);
+    out[5] = (char)(width >> 8);
+    out[6] = (char)(height & 0xFF);
+    out[7] = (char)(height >> 8);
+    out[8] = rle ? IMG565_FLAG_RLE : 0;
+    if (rle) {
+        out.insert(out.end(), packedData.begin(), packedData.end());
+    } else {
+        for (uint16_t c : pixels) {
+            out.push_back((char)(c >> 8));
+            out.push_back((char)(c & 0xFF));
+        }
     }
+}
 
-    std::ifstream file(szFile, std::ios::binary | std::ios::ate);
-    if (!file) {
-        Log("ERROR: Failed to open file.");
-        return;
+// Loads an image with GDI+, scales it to fit the Pico screen and encodes it.
+bool ConvertImageTo565(const std::string& path, std::vector<char>& out)
+{
+    std::wstring wpath = std::filesystem::path(path).wstring();
+    Gdiplus::Bitmap source(wpath.c_str());
+    if (source.GetLastStatus() != Gdiplus::Ok) {
+        Log("ERROR: Could not decode image: " + path);
+        return false;
     }
 
-    size_t filesize_s = (size_t)file.tellg();
-    file.seekg(0, std::ios::beg);
-    std::string filename = std::filesystem::path(szFile).filename().string();
+    int width = (int)source.GetWidth();
+    int height = (int)source.GetHeight();
+    if (width <= 0 || height <= 0) return false;
+
+    // Only ever scale down; an image that already fits is converted pixel for pixel.
+    Gdiplus::Bitmap* image = &source;
+    std::unique_ptr<Gdiplus::Bitmap> scaled;
+    if (width > IMG565_MAX_SIDE || height > IMG565_MAX_SIDE) {
+        double scale = std::min((double)IMG565_MAX_SIDE / width, (double)IMG565_MAX_SIDE / height);
+        int dw = (std::max)(1, (int)(width * scale + 0.5));
+        int dh = (std::max)(1, (int)(height * scale + 0.5));
+        scaled.reset(new Gdiplus::Bitmap(dw, dh, PixelFormat24bppRGB));
+        Gdiplus::Graphics g(scaled.get());
+        g.SetInterpolationMode(Gdiplus::InterpolationModeHighQualityBicubic);
+        g.SetPixelOffsetMode(Gdiplus::PixelOffsetModeHighQuality);
+        Gdiplus::ImageAttributes attrs;
+        attrs.SetWrapMode(Gdiplus::WrapModeTileFlipXY); // No dark fringe at the edges
+        g.DrawImage(&source, Gdiplus::Rect(0, 0, dw, dh), 0, 0, width, height, Gdiplus::UnitPixel, &attrs);
+        image = scaled.get();
+        Log("Scaled " + std::to_string(width) + "x" + std::to_string(height) + " to " +
+            std::to_string(dw) + "x" + std::to_string(dh));
+        width = dw;
+        height = dh;
+    }
+
+    Gdiplus::Rect rect(0, 0, width, height);
+    Gdiplus::BitmapData data;
+    if (image->LockBits(&rect, Gdiplus::ImageLockModeRead, PixelFormat24bppRGB, &data) != Gdiplus::Ok) {
+        Log("ERROR: Could not read image pixels.");
+        return false;
+    }
+    std::vector<uint16_t> pixels((size_t)width * height);
+    for (int y = 0; y < height; y++) {
+        const uint8_t* bgr = (const uint8_t*)data.Scan0 + (ptrdiff_t)y * data.Stride;
+        for (int x = 0; x < width; x++, bgr += 3) {
+            // Same truncation as the Pico's BMP decoder, so a converted BMP matches it exactly
+            pixels[(size_t)y * width + x] = (uint16_t)(((bgr[2] & 0xF8) << 8) | ((bgr[1] & 0xFC) << 3) | (bgr[0] >> 3));
+        }
+    }
+    image->UnlockBits(&data);
+
+    Encode565(pixels, width, height, out);
+    return true;
+}
+
+// Keeps the listener thread from logging protocol traffic while an upload runs.
+class ProtocolScopeGuard {
+public:
+    ProtocolScopeGuard() { protocolActive.store(true); }
+    ~ProtocolScopeGuard() {
+        protocolActive.store(false);
+        // After protocol ends, immediately flush any delayed messages
+        FlushSerialMessagesToLog();
+    }
+};
+
+// Takes the first complete line the Pico sent, without its line ending.
+static bool TakePicoLine(std::string& line)
+{
+    std::lock_guard<std::mutex> lock(msgMutex);
+    size_t pos = serialMessages.find('\n');
+    if (pos == std::string::npos) {
+        return false;
+    }
+    line = serialMessages.substr(0, pos);
+    serialMessages.erase(0, pos + 1);
+    if (!line.empty() && line.back() == '\r') {
+        line.pop_back();
+    }
+    return true;
+}
+
+// Waits for a line starting with prefix. Other lines are dropped.
+static bool WaitForPicoLine(const std::string& prefix, std::string& line, int timeoutSeconds)
+{
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(timeoutSeconds);
+    while (std::chrono::steady_clock::now() < deadline) {
+        if (!TakePicoLine(line)) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        else if (line.compare(0, prefix.size(), prefix) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// CRC-32 as in zlib and PNG; the Pico checks every UPLOAD2 frame with it.
+static uint32_t Crc32Update(uint32_t crc, const uint8_t* data, size_t len)
+{
+    static uint32_t table[256];
+    static bool tableReady = false;
+    if (!tableReady) {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+        tableReady = true;
+    }
+    crc = ~crc;
+    while (len--) crc = table[(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+// Compresses one block into dst. Returns the compressed size, or 0 when it would not
+// fit in cap: the block goes raw then. Same format, and the same LZ4 end-of-block
+// rules, as the Pico's lzCompress().
+static size_t LzCompress(const uint8_t* src, size_t len, uint8_t* dst, size_t cap)
+{
+    std::vector<uint32_t> table(static_cast<size_t>(1) << LZ_HASH_BITS, UINT32_MAX);
+    size_t ip = 0, anchor = 0, op = 0;
+    auto putLength = [&](size_t n) {
+        for (; n >= 255; n -= 255) {
+            if (op >= cap) return false;
+            dst[op++] = 255;
+        }
+        if (op >= cap) return false;
+        dst[op++] = static_cast<uint8_t>(n);
+        return true;
+    };
+    auto sequence = [&](size_t matchLen, size_t offset) {
+        const size_t lit = ip - anchor, token = op++;
+        if (token >= cap) return false;
+        dst[token] = static_cast<uint8_t>(std::min(lit, static_cast<size_t>(15)) << 4);
+        if (lit >= 15 && !putLength(lit - 15)) return false;
+        if (lit > cap - op) return false;
+        memcpy(dst + op, src + anchor, lit);
+        op += lit;
+        if (matchLen == 0) return true;
+        if (cap - op < 2) return false;
+        dst[op++] = static_cast<uint8_t>(offset);
+        dst[op++] = static_cast<uint8_t>(offset >> 8);
+        const size_t m = matchLen - LZ_MIN_MATCH;
+        dst[token] |= static_cast<uint8_t>(std::min(m, static_cast<size_t>(15)));
+        return m < 15 || putLength(m - 15);
+    };
+    while (ip + LZ_MATCH_LIMIT <= len) {
+        uint32_t v, r;
+        memcpy(&v, src + ip, 4);
+        const uint32_t h = (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+        const uint32_t ref = table[h];
+        table[h] = static_cast<uint32_t>(ip);
+        if (ref != UINT32_MAX && ip - ref <= 0xFFFF && (memcpy(&r, src + ref, 4), r == v)) {
+            size_t m = LZ_MIN_MATCH;
+            while (ip + m < len - LZ_LAST_LITERALS && src[ref + m] == src[ip + m]) m++;
+            if (!sequence(m, ip - ref)) return 0;
+            ip += m;
+            anchor = ip;
+        }
+        else {
+            ip++;
+        }
+    }
+    ip = len;
+    return sequence(0, 0) ? op : 0;
+}
+
+// Decompresses one block into dst. Returns its size, or -1 when the data is
+// malformed or would not fit in cap.
+static int LzDecompress(const uint8_t* src, size_t len, uint8_t* dst, size_t cap)
+{
+    size_t ip = 0, op = 0;
+    auto getLength = [&](size_t& n) {
+        uint8_t b;
+        do {
+            if (ip >= len) return false;
+            b = src[ip++];
+            n += b;
+        } while (b == 255);
+        return true;
+    };
+    while (ip < len) {
+        const uint8_t token = src[ip++];
+        size_t lit = token >> 4, m = token & 15;
+        if (lit == 15 && !getLength(lit)) return -1;
+        if (lit > len - ip || lit > cap - op) return -1;
+        memcpy(dst + op, src + ip, lit);
+        ip += lit;
+        op += lit;
+        if (ip == len) break; // The last sequence has no match
+        if (len - ip < 2) return -1;
+        const size_t offset = src[ip] | (src[ip + 1] << 8);
+        ip += 2;
+        if (m == 15 && !getLength(m)) return -1;
+        m += LZ_MIN_MATCH;
+        if (offset == 0 || offset > op || m > cap - op) return -1;
+        for (; m > 0; --m, ++op) dst[op] = dst[op - offset]; // May overlap itself
+    }
+    return static_cast<int>(op);
+}
+
+// Writes all of data, continuing after partial writes. SendData() only reports those,
+// which would cut a frame in half.
+static bool SendAll(const char* data, size_t size)
+{
+    std::lock_guard<std::mutex> lock(serialMutex);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(ACK_TIMEOUT_SECONDS);
+    while (size > 0 && hSerial != INVALID_HANDLE_VALUE && std::chrono::steady_clock::now() < deadline) {
+        DWORD written = 0;
+        if (!WriteFile(hSerial, data, static_cast<DWORD>(size), &written, NULL)) {
+            Log("FATAL WRITE ERROR: WriteFile failed (Error " + std::to_string(GetLastError()) + ").");
+            return false;
+        }
+        data += written;
+        size -= written;
+    }
+    return size == 0;
+}
+
+// "U2", sequence number, length, data, then the CRC-32 of everything after the magic.
+// With compress, a block that shrinks goes compressed. Adds the frame's data bytes to linkBytes.
+static bool SendUpload2Frame(const std::vector<char>& payload, size_t blockSize, uint32_t seq, bool compress, size_t& linkBytes)
+{
+    const size_t offset = static_cast<size_t>(seq) * blockSize;
+    const uint8_t* block = reinterpret_cast<const uint8_t*>(payload.data()) + offset;
+    const uint16_t len = static_cast<uint16_t>(std::min(blockSize, payload.size() - offset));
+    std::vector<char> frame(UPLOAD2_HEADER_BYTES + len + 4);
+    uint8_t* p = reinterpret_cast<uint8_t*>(frame.data());
+    uint16_t wireLen = len, lengthField = len;
+    size_t packed = compress && len > 1 ? LzCompress(block, len, p + UPLOAD2_HEADER_BYTES, len - 1) : 0;
+    if (packed) {
+        wireLen = static_cast<uint16_t>(packed);
+        lengthField = wireLen | LZ_FRAME_FLAG;
+        frame.resize(UPLOAD2_HEADER_BYTES + wireLen + 4);
+        p = reinterpret_cast<uint8_t*>(frame.data());
+    }
+    else {
+        memcpy(p + UPLOAD2_HEADER_BYTES, block, len);
+    }
+    p[0] = UPLOAD2_MAGIC[0];
+    p[1] = UPLOAD2_MAGIC[1];
+    for (int i = 0; i < 4; ++i) p[2 + i] = static_cast<uint8_t>(seq >> (8 * i));
+    p[6] = static_cast<uint8_t>(lengthField);
+    p[7] = static_cast<uint8_t>(lengthField >> 8);
+    uint32_t crc = Crc32Update(0, p + 2, UPLOAD2_HEADER_BYTES - 2 + wireLen);
+    for (int i = 0; i < 4; ++i) p[UPLOAD2_HEADER_BYTES + wireLen + i] = static_cast<uint8_t>(crc >> (8 * i));
+    linkBytes += wireLen;
+    return SendAll(frame.data(), frame.size());
+}
+
+enum class Upload2Result { Ok, Failed, Unsupported };
+
+// UPLOAD2: up to `window` CRC-checked frames in flight. The Pico acknowledges
+// cumulatively ("ACK2 <n>": blocks below n are taken) and asks for single blocks
+// again with "NAK2 <n>"; the oldest block is also resent when its ACK is late.
+// compress asks for compressed blocks, used when the Pico grants them.
+// Unsupported means the Pico runs firmware without UPLOAD2.
+static Upload2Result UploadPayload2(const std::string& filename, const std::vector<char>& payload, bool compress)
+{
+    {
+        std::lock_guard<std::mutex> msgLock(msgMutex);
+        serialMessages.clear();
+    }
+    std::stringstream cmd;
+    cmd << "UPLOAD2 " << filename << " " << payload.size() << " " << UPLOAD2_BLOCK_SIZE << " " << UPLOAD2_WINDOW << (compress ? " lz" : "") << "\r\n";
+    std::string command_str = cmd.str();
+    SendData(command_str.c_str(), static_cast<DWORD>(command_str.size()));
+    Log("Sent upload command: " + command_str.substr(0, command_str.size() - 2));
+
+    // READY2 <block> <window>, or the old firmware's unknown-command error
+    std::string line;
+    size_t blockSize = 0, window = 0;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(READY_TIMEOUT_SECONDS);
+    while (blockSize == 0) {
+        if (std::chrono::steady_clock::now() > deadline) {
+            Log("ERROR: Pico did not send READY2 (Timeout).");
+            return Upload2Result::Failed;
+        }
+        if (!TakePicoLine(line)) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+        if (line.find("Unknown command") != std::string::npos) {
+            return Upload2Result::Unsupported;
+        }
+        if (line.compare(0, 6, "FATAL ") == 0) {
+            Log("ERROR: " + line);
+            return Upload2Result::Failed;
+        }
+        if (line.compare(0, 7, "READY2 ") == 0) {
+            std::string mode;
+            std::istringstream(line.substr(7)) >> blockSize >> window >> mode;
+            compress = compress && mode == "lz"; // Firmware without compression grants none
+            if (blockSize == 0 || window == 0) {
+                Log("ERROR: Bad READY2 line: " + line);
+                return Upload2Result::Failed;
+            }
+        }
+    }
+    Log("Pico READY2: " + std::to_string(blockSize) + "-byte blocks, window " + std::to_string(window) + (compress ? ", compressed" : ""));
+
+    typedef std::chrono::steady_clock Clock;
+    const uint32_t blocks = static_cast<uint32_t>((payload.size() + blockSize - 1) / blockSize);
+    std::vector<Clock::time_point> sentAt(blocks);
+    std::vector<int> resends(blocks, 0);
+    uint32_t base = 0, next = 0, resent = 0;
+    size_t linkBytes = 0;
+    auto resend = [&](uint32_t seq) {
+        if (++resends[seq] > UPLOAD2_MAX_RESENDS) {
+            Log("ERROR: Block #" + std::to_string(seq) + " failed " + std::to_string(UPLOAD2_MAX_RESENDS) + " times.");
+            return false;
+        }
+        resent++;
+        sentAt[seq] = Clock::now();
+        return SendUpload2Frame(payload, blockSize, seq, compress, linkBytes);
+    };
+
+    while (base < blocks) {
+        while (next < blocks && next < base + window) {
+            if (!SendUpload2Frame(payload, blockSize, next, compress, linkBytes)) {
+                Log("Upload aborted: write to the Pico failed.");
+                return Upload2Result::Failed;
+            }
+            sentAt[next++] = Clock::now();
+        }
+        bool heard = false;
+        while (base < blocks && TakePicoLine(line)) { // UPLOAD_OK follows the last ACK2
+            heard = true;
+            if (line.compare(0, 5, "ACK2 ") == 0) {
+                uint32_t n = static_cast<uint32_t>(strtoul(line.c_str() + 5, nullptr, 10));
+                if (n > base && n <= next) base = n;
+            }
+            else if (line.compare(0, 5, "NAK2 ") == 0) {
+                uint32_t n = static_cast<uint32_t>(strtoul(line.c_str() + 5, nullptr, 10));
+                if (n >= base && n < next && !resend(n)) return Upload2Result::Failed;
+            }
+            else if (line.compare(0, 6, "FATAL ") == 0) {
+                Log("ERROR: " + line);
+                return Upload2Result::Failed;
+            }
+        }
+        if (base < next && Clock::now() - sentAt[base] > std::chrono::milliseconds(UPLOAD2_RESEND_MS)) {
+            if (!resend(base)) return Upload2Result::Failed;
+        }
+        if (!heard) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    if (!WaitForPicoLine("UPLOAD_OK", line, UPLOAD_OK_TIMEOUT_SECONDS)) {
+        Log("ERROR: Pico did not confirm UPLOAD_OK (Timeout).");
+        return Upload2Result::Failed;
+    }
+    Log("SUCCESS: File transfer complete. Total bytes sent: " + std::to_string(payload.size()) +
+        (compress ? ", " + std::to_string(linkBytes) + " over the link" : "") +
+        (resent ? ", " + std::to_string(resent) + " blocks resent" : ""));
+    return Upload2Result::Ok;
+}
+
+// The original stop-and-wait UPLOAD: one 512-byte block, then a text ACK.
+bool UploadPayloadLegacy(const std::string& filename, const std::vector<char>& payload)
+{
+    size_t filesize_s = payload.size();
 
     // Step 1: Send UPLOAD header
     std::stringstream cmd;
@@ -475,24 +957,22 @@ void UploadFile()
     // 3. CRITICAL: Wait immediately for the READY response.
     if (!WaitForPicoResponse(READY_MSG, "ERROR: Pico did not send READY", READY_TIMEOUT_SECONDS)) {
         Log("Upload aborted due to missing READY message.");
-        return;
+        return false;
     }
 
     Log("Pico READY received, sending file with ACK flow control...");
 
-    // ... [rest of the upload logic remains the same] ...
-    std::vector<char> buffer(BLOCK_SIZE);
     size_t sent = 0;
     bool success = true;
     size_t block_counter = 0;
 
     // Step 3: Send file in 512-byte chunks and wait for ACK after each
-    while ((file.read(buffer.data(), BLOCK_SIZE) || file.gcount() > 0) && success) {
-        size_t bytes = file.gcount();
+    while (sent < filesize_s && success) {
+        size_t bytes = std::min(BLOCK_SIZE, filesize_s - sent);
         block_counter++;
 
         if (bytes > 0) {
-            SendData(buffer.data(), static_cast<DWORD>(bytes));
+            SendData(payload.data() + sent, static_cast<DWORD>(bytes));
             sent += bytes;
 
             // Only wait for ACK if we know more data is coming.
@@ -504,19 +984,368 @@ void UploadFile()
             }
         }
     }
-    file.close();
 
     if (!success) {
         Log("Upload aborted due to missing ACK.");
-        return;
+        return false;
     }
 
-    // Step 4: Wait for UPLOAD_OK from Pico 
-    if (!WaitForPicoResponse(UPLOAD_OK_MSG, "ERROR: Pico did not confirm UPLOAD_OK", UPLOAD_OK_TIMEOUT_SECONDS)) {
-        return;
+    // Step 4: Wait for UPLOAD_OK from Pico. The line carries the name and size.
+    std::string line;
+    if (!WaitForPicoLine("UPLOAD_OK", line, UPLOAD_OK_TIMEOUT_SECONDS)) {
+        Log("ERROR: Pico did not confirm UPLOAD_OK (Timeout).");
+        return false;
     }
 
     Log("SUCCESS: File transfer complete. Total bytes sent: " + std::to_string(sent));
+    return true;
+}
+
+// UPLOAD2 (compressed when the Pico can) when the Pico has it, the stop-and-wait UPLOAD otherwise.
+bool UploadPayload(const std::string& filename, const std::vector<char>& payload)
+{
+    Upload2Result result = UploadPayload2(filename, payload, true);
+    if (result != Upload2Result::Unsupported) {
+        return result == Upload2Result::Ok;
+    }
+    Log("Pico has no UPLOAD2, falling back to UPLOAD.");
+    return UploadPayloadLegacy(filename, payload);
+}
+
+// rsync's weak checksum, as the Pico computes it for each block: the byte sum and
+// the position-weighted sum, 16 bits each. BuildSyncDelta rolls it a byte at a time.
+static void SyncWeakSums(const uint8_t* data, size_t len, uint32_t& a, uint32_t& b)
+{
+    a = b = 0;
+    for (size_t i = 0; i < len; ++i) {
+        a += data[i];
+        b += static_cast<uint32_t>(len - i) * data[i];
+    }
+}
+
+// Builds the delta that turns the Pico's copy into payload, from the copy's block
+// checksums. Only whole blocks (the first fullBlocks) can be reused. reusedBlocks
+// counts the blocks the Pico copies instead of receiving.
+static std::vector<char> BuildSyncDelta(const std::vector<char>& payload, size_t block, size_t fullBlocks,
+    const std::vector<uint32_t>& weak, const std::vector<uint32_t>& strong, size_t& reusedBlocks)
+{
+    std::unordered_multimap<uint32_t, uint32_t> byWeak;
+    for (uint32_t i = 0; i < fullBlocks && i < weak.size(); ++i) {
+        byWeak.emplace(weak[i], i);
+    }
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(payload.data());
+    const size_t size = payload.size();
+    std::vector<char> delta;
+    auto putRecord = [&delta](char type, uint32_t v1) {
+        delta.push_back(type);
+        for (int k = 0; k < 4; ++k) delta.push_back(static_cast<char>(v1 >> (8 * k)));
+    };
+    uint32_t copyFirst = 0, copyCount = 0; // The COPY record still growing
+    auto flushCopy = [&]() {
+        if (copyCount > 0) {
+            putRecord(SYNC_COPY, copyFirst);
+            for (int k = 0; k < 4; ++k) delta.push_back(static_cast<char>(copyCount >> (8 * k)));
+            copyCount = 0;
+        }
+    };
+    auto putLiteral = [&](size_t from, size_t to) {
+        if (to > from) {
+            flushCopy();
+            putRecord(SYNC_LITERAL, static_cast<uint32_t>(to - from));
+            delta.insert(delta.end(), payload.begin() + from, payload.begin() + to);
+        }
+    };
+
+    reusedBlocks = 0;
+    size_t pos = 0, literalFrom = 0;
+    uint32_t a = 0, b = 0;
+    bool rolled = false; // a and b hold the sums of [pos, pos + block)
+    while (!byWeak.empty() && pos + block <= size) {
+        if (!rolled) {
+            SyncWeakSums(data + pos, block, a, b);
+            rolled = true;
+        }
+        auto range = byWeak.equal_range((a & 0xFFFF) | (b << 16));
+        int64_t match = -1;
+        if (range.first != range.second) {
+            const uint32_t crc = Crc32Update(0, data + pos, block);
+            for (auto it = range.first; it != range.second; ++it) {
+                if (strong[it->second] == crc) {
+                    match = it->second;
+                    break;
+                }
+            }
+        }
+        if (match >= 0) {
+            putLiteral(literalFrom, pos);
+            if (copyCount == 0 || copyFirst + copyCount != match) {
+                flushCopy();
+                copyFirst = static_cast<uint32_t>(match);
+            }
+            ++copyCount;
+            ++reusedBlocks;
+            pos += block;
+            literalFrom = pos;
+            rolled = false;
+        }
+        else {
+            if (pos + block < size) {
+                a += data[pos + block] - data[pos];
+                b += a - static_cast<uint32_t>(block) * data[pos];
+            }
+            ++pos;
+        }
+    }
+    putLiteral(literalFrom, size);
+    flushCopy();
+    return delta;
+}
+
+// Asks for the size and CRC-32 of the Pico's copy of filename. False when the Pico
+// has no HASH command or did not answer; exists is false when it has no copy.
+static bool PicoFileHash(const std::string& filename, bool& exists, size_t& size, uint32_t& crc)
+{
+    {
+        std::lock_guard<std::mutex> msgLock(msgMutex);
+        serialMessages.clear();
+    }
+    const std::string command = "HASH " + filename + "\r\n";
+    SendData(command.c_str(), static_cast<DWORD>(command.size()));
+    std::string line;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(READY_TIMEOUT_SECONDS);
+    while (std::chrono::steady_clock::now() < deadline) {
+        if (!TakePicoLine(line)) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+        if (line.find("Unknown command") != std::string::npos) {
+            return false;
+        }
+        if (line.compare(0, 5, "HASH ") == 0) {
+            std::string crcHex;
+            exists = line != "HASH NONE" && static_cast<bool>(std::istringstream(line.substr(5)) >> size >> crcHex);
+            crc = exists ? static_cast<uint32_t>(strtoul(crcHex.c_str(), nullptr, 16)) : 0;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Sends the changes to the Pico's copy of filename: fetches its block checksums,
+// uploads the delta and has the Pico rebuild the file. False when any step fails.
+static bool SyncDelta(const std::string& filename, const std::vector<char>& payload, size_t oldSize, uint32_t newCrc)
+{
+    size_t block = SYNC_MIN_BLOCK;
+    while (block < SYNC_MAX_BLOCK && block * block < oldSize) {
+        block *= 2;
+    }
+    {
+        std::lock_guard<std::mutex> msgLock(msgMutex);
+        serialMessages.clear();
+    }
+    std::string command = "SYNC " + filename + " " + std::to_string(block) + "\r\n";
+    SendData(command.c_str(), static_cast<DWORD>(command.size()));
+
+    // SYNCSIG <count> <block>, a line per block, SYNCSIG_END
+    std::string line;
+    size_t count = 0;
+    if (!WaitForPicoLine("SYNCSIG ", line, READY_TIMEOUT_SECONDS) || !(std::istringstream(line.substr(8)) >> count >> block) || block == 0) {
+        Log("ERROR: Pico did not send block checksums.");
+        return false;
+    }
+    std::vector<uint32_t> weak, strong;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(ACK_TIMEOUT_SECONDS);
+    while (line != "SYNCSIG_END") {
+        if (std::chrono::steady_clock::now() > deadline) {
+            Log("ERROR: Block checksums timed out.");
+            return false;
+        }
+        if (!TakePicoLine(line)) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+        if (line.size() == 16 && line.find_first_not_of("0123456789abcdef") == std::string::npos) {
+            weak.push_back(static_cast<uint32_t>(strtoul(line.substr(0, 8).c_str(), nullptr, 16)));
+            strong.push_back(static_cast<uint32_t>(strtoul(line.substr(8).c_str(), nullptr, 16)));
+            deadline = std::chrono::steady_clock::now() + std::chrono::seconds(ACK_TIMEOUT_SECONDS);
+        }
+    }
+    if (weak.size() != count) {
+        Log("ERROR: Expected " + std::to_string(count) + " block checksums, got " + std::to_string(weak.size()) + ".");
+        return false;
+    }
+
+    size_t reused = 0;
+    std::vector<char> delta = BuildSyncDelta(payload, block, oldSize / block, weak, strong, reused);
+    Log("SYNC " + filename + ": " + std::to_string(reused) + " of " + std::to_string(count) + " blocks reused, delta " +
+        std::to_string(delta.size()) + " bytes for " + std::to_string(payload.size()) + " (" + std::to_string(count * 18) + " bytes of checksums)");
+    if (reused == 0) {
+        Log("Nothing to reuse, uploading the whole file.");
+        return UploadPayload(filename, payload);
+    }
+    if (UploadPayload2(filename + ".dlt", delta, true) != Upload2Result::Ok) {
+        return false;
+    }
+
+    char crcHex[9];
+    snprintf(crcHex, sizeof(crcHex), "%08x", newCrc);
+    command = "PATCH " + filename + " " + std::to_string(block) + " " + std::to_string(payload.size()) + " " + crcHex + "\r\n";
+    SendData(command.c_str(), static_cast<DWORD>(command.size()));
+    if (!WaitForPicoLine("PATCH_", line, UPLOAD_OK_TIMEOUT_SECONDS)) {
+        Log("ERROR: Pico did not confirm PATCH (Timeout).");
+        return false;
+    }
+    if (line.compare(0, 9, "PATCH_OK ") != 0) {
+        Log("ERROR: " + line);
+        return false;
+    }
+    Log("SUCCESS: " + filename + " synced.");
+    return true;
+}
+
+// Uploads payload as filename, sending as little as it can: nothing when the Pico's
+// copy already matches, a delta against an older copy, the whole file otherwise
+// (and whenever the Pico has no copy, no HASH/SYNC/PATCH, or the delta fails).
+bool SyncPayload(const std::string& filename, const std::vector<char>& payload)
+{
+    const uint32_t crc = Crc32Update(0, reinterpret_cast<const uint8_t*>(payload.data()), payload.size());
+    bool exists = false;
+    size_t oldSize = 0;
+    uint32_t oldCrc = 0;
+    if (!PicoFileHash(filename, exists, oldSize, oldCrc) || !exists || oldSize == 0) {
+        return UploadPayload(filename, payload);
+    }
+    if (oldSize == payload.size() && oldCrc == crc) {
+        Log("SKIPPED: " + filename + " is already on the Pico.");
+        return true;
+    }
+    if (SyncDelta(filename, payload, oldSize, crc)) {
+        return true;
+    }
+    Log("Delta sync failed, uploading the whole file.");
+    return UploadPayload(filename, payload);
+}
+
+void UploadFile(bool convertImages)
+{
+    // Tells the listener thread to STOP logging data until we return.
+    ProtocolScopeGuard guard;
+    OPENFILENAMEA ofn;
+    char szFile[MAX_PATH] = { 0 };
+    ZeroMemory(&ofn, sizeof(ofn));
+    ofn.lStructSize = sizeof(ofn);
+    ofn.lpstrFile = szFile;
+    ofn.nMaxFile = sizeof(szFile);
+    ofn.lpstrFilter = "All Files\0*.*\0Images\0*.png;*.bmp;*.jpg;*.jpeg;*.gif\0";
+    ofn.lpstrTitle = "Select File to Upload";
+    ofn.Flags = OFN_PATHMUSTEXIST | OFN_FILEMUSTEXIST;
+
+    if (!GetOpenFileNameA(&ofn)) {
+        Log("Upload canceled.");
+        return;
+    }
+
+    // The whole payload is prepared up front, so a converted image uploads the same way.
+    std::vector<char> payload;
+    std::string filename = std::filesystem::path(szFile).filename().string();
+    if (convertImages && IsConvertibleImage(szFile)) {
+        if (!ConvertImageTo565(szFile, payload)) {
+            Log("Upload aborted: image conversion failed.");
+            return;
+        }
+        filename = std::filesystem::path(szFile).stem().string() + ".565";
+        Log("Converted to " + filename + " (" + std::to_string(payload.size()) + " bytes)");
+    }
+    else {
+        std::ifstream file(szFile, std::ios::binary);
+        if (!file) {
+            Log("ERROR: Failed to open file.");
+            return;
+        }
+        payload.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+    SyncPayload(filename, payload);
+}
+
+// Downloads filename with CAT and checks it against expected.
+static bool LinkTestDownload(const std::string& filename, const std::vector<char>& expected, bool compress)
+{
+    {
+        std::lock_guard<std::mutex> msgLock(msgMutex);
+        serialMessages.clear();
+    }
+    const std::string command = "CAT " + filename + "\r\n";
+    SendData(command.c_str(), static_cast<DWORD>(command.size()));
+    std::string offer;
+    std::wstring savedPath;
+    if (!WaitForPicoLine("DLOFFER ", offer, READY_TIMEOUT_SECONDS) || !ReceiveDownload(offer, compress, savedPath)) {
+        return false;
+    }
+    std::ifstream file(savedPath, std::ios::binary);
+    std::vector<char> received((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (received != expected) {
+        Log("ERROR: " + filename + " came back different from the upload.");
+        return false;
+    }
+    return true;
+}
+
+// Moves two generated files, random bytes (linktest.bin) and log-like text
+// (linktest.txt), up with UPLOAD, UPLOAD2 and compressed UPLOAD2, and back down
+// with CAT raw and compressed, checking each download byte for byte. Logs the
+// effective throughput of each. Then syncs edited copies of linktest.txt, whose
+// logged delta should grow with the edit. The files are left on the Pico and in
+// the PicoLink folder.
+void RunLinkTest()
+{
+    ProtocolScopeGuard guard;
+    std::vector<char> random(LINK_TEST_BYTES), text;
+    uint32_t x = 2463534242u; // xorshift32: incompressible, reproducible
+    for (char& c : random) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        c = static_cast<char>(x);
+    }
+    for (unsigned i = 0; text.size() < LINK_TEST_BYTES; ++i) {
+        char line[64];
+        int n = snprintf(line, sizeof(line), "%08u sensor %u temp=%u.%u state=%s\n", i * 250, i % 4, 20 + i * 7 % 9, i % 10, i % 5 ? "OK" : "WARN");
+        text.insert(text.end(), line, line + n);
+    }
+    text.resize(LINK_TEST_BYTES);
+
+    const struct { const char* name; const std::vector<char>& data; } files[] = {
+        { "linktest.bin", random },
+        { "linktest.txt", text },
+    };
+    static const char* const runs[] = { "UPLOAD", "UPLOAD2", "UPLOAD2 LZ", "CAT", "CAT LZ" };
+    for (const auto& f : files) {
+        for (int run = 0; run < 5; ++run) {
+            auto start = std::chrono::steady_clock::now();
+            bool ok = run == 0 ? UploadPayloadLegacy(f.name, f.data)
+                    : run < 3 ? UploadPayload2(f.name, f.data, run == 2) == Upload2Result::Ok
+                    : LinkTestDownload(f.name, f.data, run == 4);
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            std::string name = std::string(runs[run]) + " " + f.name;
+            if (ok) {
+                Log("LINK TEST " + name + ": " + std::to_string(static_cast<int>(f.data.size() / 1024.0 / seconds)) + " KB/s");
+            }
+            else {
+                Log("LINK TEST " + name + ": failed");
+            }
+        }
+    }
+
+    // Each edit overwrites a run in the middle and inserts a line near the start,
+    // against the previous round's copy; the last round changes nothing and is skipped.
+    std::vector<char> edited = text;
+    const char inserted[] = "00000000 inserted line\n";
+    edited.insert(edited.begin() + 1000, inserted, inserted + sizeof(inserted) - 1);
+    for (size_t edit : { size_t(16), size_t(1024), size_t(16384), size_t(0) }) {
+        std::fill(edited.begin() + LINK_TEST_BYTES / 2, edited.begin() + LINK_TEST_BYTES / 2 + edit, '#');
+        bool ok = SyncPayload("linktest.txt", edited) && LinkTestDownload("linktest.txt", edited, true);
+        Log("LINK TEST SYNC linktest.txt, " + std::to_string(edit) + "-byte edit: " + (ok ? "ok" : "failed"));
+    }
 }
 
 // Helper: Retrieves the Documents path, creates the "PicoLink Files" subfolder, and returns the path.
@@ -557,107 +1386,208 @@ std::wstring GetPicoLinkFolder()
 }
 
 // ----------------------------------------------------
-// CRITICAL: File Download Protocol Handler (Fixed Path and Data Types)
+// File Download Protocol Handler
 // ----------------------------------------------------
-void HandleIncomingSend(const std::string& commandLine)
+// Receives the file a DLOFFER line announces into the PicoLink folder. Data goes to
+// "<file>.<crc>.part" first, so a failed download resumes from where it stopped the
+// next time the same file is offered, and the part file is renamed only once the
+// whole-file CRC matches. compress asks for compressed chunks.
+bool ReceiveDownload(const std::string& offerLine, bool compress, std::wstring& savedPath)
 {
-    // 1. Immediately SET the flag. This stops the listener thread from logging the file data.
-    protocolActive.store(true);
-    Log("Download initiated from Pico.");
-
-    // Use a scope guard to ensure the flag is cleared on exit
-    class ProtocolScopeGuard {
-    public:
-        ~ProtocolScopeGuard() {
-            protocolActive.store(false);
-            FlushSerialMessagesToLog();
-            Log("Download session concluded.");
-        }
-    } guard;
-
-    // --- Parse Command ---
-    std::stringstream ss(commandLine);
-    std::string command, filename_str;
-    // FIX: Use size_t for file size to match standard C++ practice and remove warning
-    size_t filesize_s = 0;
-
-    // Example commandLine: "SEND A.TXT 1\r\n"
-    if (!(ss >> command >> filename_str >> filesize_s) || command != "SEND") {
-        Log("ERROR: Invalid SEND command format received.");
-        return;
+    struct DownloadFlag {
+        DownloadFlag() { downloadActive.store(true); }
+        ~DownloadFlag() { downloadActive.store(false); }
+    } flag;
+    auto sendLine = [](const std::string& line) {
+        std::string out = line + "\r\n";
+        SendData(out.c_str(), static_cast<DWORD>(out.size()));
+    };
+
+    // --- Parse Offer ---
+    std::istringstream ss(offerLine);
+    std::string command, filename, crcHex;
+    size_t filesize = 0;
+    if (!(ss >> command >> filename >> filesize >> crcHex) || command != "DLOFFER") {
+        Log("ERROR: Invalid DLOFFER line received.");
+        sendLine("DLCANCEL");
+        return false;
     }
+    const uint32_t fileCrc = static_cast<uint32_t>(strtoul(crcHex.c_str(), nullptr, 16));
+    filename = std::filesystem::path(filename).filename().string();
 
-    // --- Open Output File ---
-    // CRITICAL FIX: Use the new GetPicoLinkFolder function
-    std::wstring pico_folder_w = GetPicoLinkFolder();
-    if (pico_folder_w.empty()) {
+    std::wstring folder = GetPicoLinkFolder();
+    if (folder.empty()) {
         Log("FATAL ERROR: Could not find or create PicoLink folder for saving.");
-        return;
+        sendLine("DLCANCEL");
+        return false;
+    }
+    savedPath = folder + L"\\" + std::wstring(filename.begin(), filename.end());
+    const std::wstring partPath = savedPath + L"." + std::wstring(crcHex.begin(), crcHex.end()) + L".part";
+
+    // --- Resume ---
+    std::error_code ec;
+    size_t offset = 0;
+    uint32_t crc = 0;
+    if (std::filesystem::exists(partPath, ec)) {
+        offset = static_cast<size_t>(std::filesystem::file_size(partPath, ec));
+        if (ec || offset > filesize) {
+            offset = 0;
+        }
+        std::ifstream part(partPath, std::ios::binary);
+        std::vector<char> buf(64 * 1024);
+        for (size_t left = offset; left > 0 && part; ) {
+            size_t n = std::min(left, buf.size());
+            part.read(buf.data(), static_cast<std::streamsize>(n));
+            crc = Crc32Update(crc, reinterpret_cast<const uint8_t*>(buf.data()), n);
+            left -= n;
+        }
+        if (!part) {
+            offset = 0;
+            crc = 0;
+        }
+    }
+    std::ofstream outfile(partPath, std::ios::binary | (offset ? std::ios::in | std::ios::out : std::ios::trunc | std::ios::out));
+    if (outfile.is_open()) {
+        outfile.seekp(static_cast<std::streamoff>(offset));
     }
-
-    std::wstring filename_w = std::wstring(filename_str.begin(), filename_str.end());
-    // Construct the full path: Documents\PicoLink Files\A.TXT
-    std::wstring full_path_w = pico_folder_w + L"\\" + filename_w;
-
-    std::ofstream outfile(full_path_w, std::ios::binary | std::ios::trunc);
     if (!outfile.is_open()) {
-        Log("FATAL ERROR: Failed to open file for writing: " + wstring_to_string(full_path_w));
-        return;
+        Log("FATAL ERROR: Failed to open file for writing: " + wstring_to_string(partPath));
+        sendLine("DLCANCEL");
+        return false;
     }
-
-    Log("Receiving file: " + filename_str + " (" + std::to_string(filesize_s) + " bytes) to: " + wstring_to_string(full_path_w));
-
-    // --- Receive Data Loop ---
-    // FIX: Use size_t for byte counter
-    size_t bytesReceived = 0;
-
-    // Safety timeout (e.g., 5 seconds for a small file)
-    auto startTime = std::chrono::high_resolution_clock::now();
-    const auto timeout = std::chrono::seconds(30);
-
-    while (bytesReceived < filesize_s) {
-        if (std::chrono::high_resolution_clock::now() - startTime > timeout) {
-            Log("TIMEOUT: Download timed out before receiving all expected bytes.");
-            break;
+    Log("Receiving file: " + filename + " (" + std::to_string(filesize) + " bytes) to: " + wstring_to_string(savedPath) +
+        (offset ? ", resuming at " + std::to_string(offset) : ""));
+    sendLine("DLGET " + std::to_string(offset) + " " + std::to_string(DL_CHUNK) + " " + std::to_string(DL_WINDOW) + (compress ? " lz" : ""));
+
+    // --- Receive Frames ---
+    typedef std::chrono::steady_clock Clock;
+    size_t expected = offset, acked = offset, nakSent = SIZE_MAX, badFrames = 0, linkBytes = 0;
+    std::vector<uint8_t> unpacked(DL_CHUNK);
+    auto lastData = Clock::now();
+    auto nak = [&]() {
+        if (nakSent == expected || expected == filesize) return; // Only the outcome is left
+        sendLine("DLNAK " + std::to_string(expected));
+        nakSent = expected;
+    };
+    std::string buf, endLine;
+    bool failed = false;
+    while (endLine.empty() && !failed) {
+        {
+            std::lock_guard<std::mutex> lock(msgMutex);
+            buf.append(serialMessages);
+            serialMessages.clear();
         }
+        size_t pos = 0;
+        while (pos < buf.size() && endLine.empty()) {
+            const uint8_t* p = reinterpret_cast<const uint8_t*>(buf.data()) + pos;
+            const size_t avail = buf.size() - pos;
+            if (p[0] != DL_MAGIC[0]) { // Part of a damaged frame: resynchronize
+                pos++;
+                continue;
+            }
+            if (avail < DL_HEADER_BYTES) break;
+            const uint32_t frameOffset = p[2] | (p[3] << 8) | (p[4] << 16) | (static_cast<uint32_t>(p[5]) << 24);
+            const uint16_t lengthField = p[6] | (p[7] << 8);
+            const bool isText = lengthField & DL_TEXT_FLAG, packed = lengthField & LZ_FRAME_FLAG;
+            const size_t len = lengthField & ~(DL_TEXT_FLAG | LZ_FRAME_FLAG);
+            if (p[1] != DL_MAGIC[1] || len > DL_CHUNK) {
+                pos++;
+                continue;
+            }
+            if (avail < DL_HEADER_BYTES + len + 4) break;
+            const uint8_t* c = p + DL_HEADER_BYTES + len;
+            const uint32_t frameCrc = c[0] | (c[1] << 8) | (c[2] << 16) | (static_cast<uint32_t>(c[3]) << 24);
+            if (Crc32Update(0, p + 2, DL_HEADER_BYTES - 2 + len) != frameCrc) {
+                badFrames++;
+                nak();
+                pos++;
+                continue;
+            }
+            const uint8_t* data = p + DL_HEADER_BYTES;
+            int dataLen = static_cast<int>(len);
+            if (!isText && frameOffset == expected && packed) {
+                dataLen = LzDecompress(data, len, unpacked.data(), unpacked.size());
+                data = unpacked.data();
+            }
+            if (isText) {
+                endLine.assign(reinterpret_cast<const char*>(data), len);
+            }
+            else if (dataLen < 0) {
+                badFrames++;
+                nak();
+            }
+            else if (frameOffset == expected) {
+                outfile.write(reinterpret_cast<const char*>(data), dataLen);
+                crc = Crc32Update(crc, data, dataLen);
+                expected += dataLen;
+                linkBytes += len;
+            }
+            else if (frameOffset > expected) { // One went missing
+                nak();
+            }
+            pos += DL_HEADER_BYTES + len + 4;
+            lastData = Clock::now();
+        }
+        buf.erase(0, pos);
 
-        // Yield to listener thread to ensure the buffer is fed
-        std::this_thread::sleep_for(std::chrono::milliseconds(5));
-
-        std::lock_guard<std::mutex> lock(msgMutex);
-
-        size_t available_data_in_buffer = serialMessages.length();
-        size_t remaining_file_size = filesize_s - bytesReceived;
-
-        size_t bytes_to_process = std::min(available_data_in_buffer, remaining_file_size);
-
-        if (bytes_to_process > 0) {
-            // Write the data chunk
-            outfile.write(serialMessages.data(), bytes_to_process);
-            bytesReceived += bytes_to_process;
-
-            // Remove processed data from the buffer
-            serialMessages.erase(0, bytes_to_process);
+        if (!outfile) {
+            Log("FATAL ERROR: Write to " + wstring_to_string(partPath) + " failed.");
+            sendLine("DLCANCEL");
+            failed = true;
+        }
+        else if (expected != acked) {
+            outfile.flush(); // ACKed bytes are on disk, so a resume can trust the part file
+            sendLine("DLACK " + std::to_string(expected));
+            acked = expected;
+        }
+        else if (endLine.empty()) {
+            if (Clock::now() - lastData > std::chrono::seconds(DL_TIMEOUT_SECONDS)) {
+                Log("TIMEOUT: No data from the Pico for " + std::to_string(DL_TIMEOUT_SECONDS) + " seconds.");
+                sendLine("DLCANCEL");
+                failed = true;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
         }
     }
-
     outfile.close();
-
-    // After receiving all expected bytes, consume the final END marker if present
     {
+        // Whatever follows the transfer is ordinary output again
         std::lock_guard<std::mutex> lock(msgMutex);
-        size_t end_pos = serialMessages.find("END\r\n");
-        if (end_pos != std::string::npos) {
-            serialMessages.erase(end_pos, 5); // 5 is for "END\r\n"
-        }
+        serialMessages.insert(0, buf);
     }
 
-    if (bytesReceived == filesize_s) {
-        Log("SUCCESS: File transfer complete. Bytes received: " + std::to_string(bytesReceived) + " to " + wstring_to_string(full_path_w));
+    // --- Verify ---
+    // All the data with the outcome frame lost still checks against the offer's CRC
+    if (endLine.compare(0, 6, "DLEND ") != 0 && (!endLine.empty() || expected != filesize)) {
+        if (!endLine.empty()) Log("ERROR: " + endLine);
+        Log("Download incomplete at " + std::to_string(expected) + " of " + std::to_string(filesize) + " bytes; it resumes next time.");
+        return false;
     }
-    else {
-        Log("ERROR: File transfer incomplete. Expected " + std::to_string(filesize_s) + " bytes, got " + std::to_string(bytesReceived) + " bytes.");
+    if (expected != filesize || crc != fileCrc) {
+        Log("ERROR: Downloaded file does not match the Pico's CRC. Discarding it.");
+        std::filesystem::remove(partPath, ec);
+        return false;
     }
+    std::filesystem::remove(savedPath, ec);
+    std::filesystem::rename(partPath, savedPath, ec);
+    if (ec) {
+        Log("ERROR: Could not rename " + wstring_to_string(partPath) + ": " + ec.message());
+        return false;
+    }
+    Log("SUCCESS: File transfer complete. Bytes received: " + std::to_string(expected - offset) + " to " + wstring_to_string(savedPath) +
+        (linkBytes != expected - offset ? ", " + std::to_string(linkBytes) + " over the link" : "") +
+        (badFrames ? ", " + std::to_string(badFrames) + " bad frames" : ""));
+    return true;
+}
+
+// Runs a download the Pico started (shell "send") on its own thread.
+void HandleDownloadOffer(const std::string& offerLine)
+{
+    ProtocolScopeGuard guard;
+    Log("Download initiated from Pico.");
+    std::wstring savedPath;
+    ReceiveDownload(offerLine, true, savedPath);
+    Log("Download session concluded.");
 }
 std::wstring FindPicoCOMPort()
 {
@@ -700,7 +1630,7 @@ std::wstring FindPicoCOMPort()
 }
 void PicoListenerThread()
 {
-    char buffer[512];
+    char buffer[4096]; // A whole download window per read when the Pico streams
     DWORD bytesRead;
     bool wasConnected = false;
     std::wstring currentPortName = L"";
@@ -765,12 +1695,11 @@ void PicoListenerThread()
                     std::string raw(buffer, bytesRead);
 
                     // --- SUPPRESS ACK/NACK RAW LOGGING ---
-                    bool shouldLogRaw = true;
+                    // Covers ACK, NACK and the UPLOAD2 replies (ACK2, NAK2), which may arrive several per read.
+                    bool shouldLogRaw = !downloadActive.load();
                     if (protocolActive.load()) {
-                        if (bytesRead == 5) {
-                            if (raw == "ACK\r\n" || raw == "NACK\r\n") {
-                                shouldLogRaw = false;
-                            }
+                        if (raw.compare(0, 3, "ACK") == 0 || raw.compare(0, 3, "NAK") == 0 || raw.compare(0, 4, "NACK") == 0) {
+                            shouldLogRaw = false;
                         }
                     }
 
@@ -800,14 +1729,16 @@ void PicoListenerThread()
         // --- Download Initiation Block ---
         {
             std::lock_guard<std::mutex> msgLock(msgMutex);
-            if (!protocolActive.load()) {
-                size_t send_pos = serialMessages.find("SEND ");
+            if (!protocolActive.load() && !transferBusy.load()) {
+                size_t send_pos = serialMessages.find("DLOFFER ");
                 size_t eol_pos = serialMessages.find('\n', send_pos);
                 if (send_pos != std::string::npos && eol_pos != std::string::npos) {
                     std::string command_line = serialMessages.substr(send_pos, eol_pos - send_pos + 1);
                     serialMessages.erase(send_pos, eol_pos - send_pos + 1);
                     Log("[PICO COMMAND] " + command_line);
-                    std::thread(HandleIncomingSend, command_line).detach();
+                    // Set before the thread starts, so the frames that follow are not flushed to the log
+                    protocolActive.store(true);
+                    std::thread(HandleDownloadOffer, command_line).detach();
                     protocolInitiatedThisCycle = true;
                 }
             }
@@ -817,10 +1748,25 @@ void PicoListenerThread()
             FlushSerialMessagesToLog();
         }
 
-        std::this_thread::sleep_for(std::chrono::milliseconds(20)); // Polling delay
+        // Polling delay. Short during a transfer: UPLOAD2 refills its window as ACKs arrive.
+        std::this_thread::sleep_for(std::chrono::milliseconds(protocolActive.load() ? 1 : 20));
     }
 }
 
+// Runs a button's transfer on its own thread, unless one is already running or the
+// Pico is sending a file: two transfers at once would interleave on the COM port.
+static void StartTransfer(std::function<void()> transfer)
+{
+    if (protocolActive.load() || transferBusy.exchange(true)) {
+        Log("Busy: wait for the current transfer to finish.");
+        return;
+    }
+    std::thread([transfer]() {
+        transfer();
+        transferBusy.store(false);
+        }).detach();
+}
+
 void CreateUI(HWND hWnd)
 {
     const int btnX = 20;
@@ -835,17 +1781,32 @@ void CreateUI(HWND hWnd)
         btnX, btnY, btnWidth, btnHeight,
         hWnd, (HMENU)IDC_UPLOAD, hInst, NULL);
 
+    // Link test: UPLOAD vs UPLOAD2 throughput
+    CreateWindowW(L"BUTTON", L"Link Speed Test",
+        WS_VISIBLE | WS_CHILD | BS_PUSHBUTTON,
+        btnX + btnWidth + 10, btnY, btnWidth, btnHeight,
+        hWnd, (HMENU)IDC_LINKTEST, hInst, NULL);
+
+    // Image conversion option, checked by default
+    const int chkY = btnY + btnHeight + 5;
+    const int chkHeight = 20;
+    hConvert = CreateWindowW(L"BUTTON", L"Convert images to .565",
+        WS_VISIBLE | WS_CHILD | BS_AUTOCHECKBOX,
+        btnX, chkY, btnWidth, chkHeight,
+        hWnd, (HMENU)IDC_CONVERT, hInst, NULL);
+    SendMessage(hConvert, BM_SETCHECK, BST_CHECKED, 0);
+
     // Debug window
     hDebug = CreateWindowExW(WS_EX_CLIENTEDGE, L"EDIT", L"",
         WS_CHILD | WS_VISIBLE | WS_VSCROLL | ES_MULTILINE | ES_AUTOVSCROLL | ES_READONLY,
-        btnX, btnY + btnHeight + 10, btnWidth, 130,
+        btnX, chkY + chkHeight + 10, btnWidth, 130,
         hWnd, (HMENU)IDC_DEBUG, hInst, NULL);
 
     // Initial resize call (will be handled better by WM_SIZE later)
     RECT rcClient;
     GetClientRect(hWnd, &rcClient);
     int dbgX = btnX;
-    int dbgY = btnY + btnHeight + 10;
+    int dbgY = chkY + chkHeight + 10;
     int dbgWidth = rcClient.right - dbgX - margin;
     int dbgHeight = rcClient.bottom - dbgY - margin;
     MoveWindow(hDebug, dbgX, dbgY, dbgWidth, dbgHeight, TRUE);
@@ -865,7 +1826,7 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
         int winHeight = HIWORD(lParam);
 
         const int dbgX = 20;    // same left margin as button
-        const int dbgY = 60;    // below the button
+        const int dbgY = 85;    // below the button and the convert checkbox
         const int dbgMargin = 20; // Define the constant for resizing margins
         const int dbgWidth = winWidth - dbgX - dbgMargin;
         const int dbgHeight = winHeight - dbgY - dbgMargin;
@@ -889,10 +1850,18 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
             break;
 
         case IDC_UPLOAD:
+        {
+            // Read the option here, on the UI thread, before handing off
+            bool convertImages = SendMessage(hConvert, BM_GETCHECK, 0, 0) == BST_CHECKED;
             // Run the upload in a separate thread to avoid freezing GUI
-            std::thread([]() {
-                UploadFile();
-                }).detach();
+            StartTransfer([convertImages]() {
+                UploadFile(convertImages);
+                });
+        }
+            break;
+
+        case IDC_LINKTEST:
+            StartTransfer(RunLinkTest);
             break;
         }
     }
@@ -2,6 +2,15 @@
 #include <Adafruit_ST7789.h>
 #include <SPI.h>
 #include <LittleFS.h>
+#include <glcdfont.c> // Classic 5x7 GFX font, rasterized directly by the cell renderer
+#include <atomic>
+#ifdef ARDUINO_ARCH_RP2040
+#include <hardware/dma.h>
+#include <hardware/spi.h>
+#endif
+// Builds the "bench" command: timings and self-checks of the subsystems. Off in
+// release builds, which then carry none of that code or its counters.
+// #define PICOS_BENCH
 // ----------------------------
 // TFT CONFIGURATION
 // ----------------------------
@@ -14,6 +23,7 @@
 #define LINE_HEIGHT 9
 #define MAX_LINES (SCREEN_HEIGHT / LINE_HEIGHT)
 Adafruit_ST7789 tft = Adafruit_ST7789(TFT_CS, TFT_DC, TFT_RST);
+#define TFT_SPI_HW spi0 // Hardware SPI block behind the default SPI object (pixel DMA target)
 const int COLS = SCREEN_WIDTH / CHAR_WIDTH;
 const int WRAP_COLS = COLS - 1; 
 // ----------------------------
@@ -24,6 +34,52 @@ const String READY_MSG = "READY\r\n\r\n";
 const String UPLOAD_OK_MSG = "UPLOAD_OK";
 const String FATAL_ERROR_MSG = "FATAL ERROR:";
 const size_t BLOCK_SIZE = 512;
+// UPLOAD2: framed blocks, several in flight. A frame is "U2", the block's sequence
+// number (u32 LE), its length (u16 LE, LZ_FRAME_FLAG set when compressed), the
+// data, then the CRC-32 (LE) of everything after the magic.
+const char UPLOAD2_MAGIC[2] = {'U', '2'};
+const size_t UPLOAD2_HEADER_BYTES = 8;
+const size_t UPLOAD2_MAX_BLOCK = 2048;
+const size_t UPLOAD2_MAX_WINDOW = 16;
+const size_t UPLOAD2_DEFAULT_BLOCK = 1024;
+const size_t UPLOAD2_DEFAULT_WINDOW = 8;
+// Downloads (send, CAT). The Pico offers the file with "DLOFFER <file> <size> <crc>",
+// the PC answers "DLGET <offset> <chunk> <window>", and the Pico streams frames from
+// that offset: the magic, the file offset (u32 LE), the length (u16 LE), the data,
+// then the CRC-32 (LE) of everything after the magic. The outcome, "DLEND <size>
+// <crc>" or "DLERR <reason>", comes as a frame too, flagged with DL_TEXT_FLAG, so
+// file data skipped while resynchronizing can never pass for it. "DLGET ... lz"
+// asks for compressed chunks; those that do not shrink still go raw.
+const uint8_t DL_MAGIC[2] = {0xA5, 'D'};
+const size_t DL_HEADER_BYTES = 8;
+const uint16_t DL_TEXT_FLAG = 0x4000; // In the length field
+const size_t DL_MAX_CHUNK = 2048;
+const size_t DL_MAX_WINDOW = 16;
+const unsigned long DL_OFFER_TIMEOUT_MS = 5000; // For the PC's DLGET
+const unsigned long DL_RESEND_MS = 500;         // Go back to the last ACK after this long without one
+const unsigned long DL_IDLE_TIMEOUT_MS = 10000; // Give up after this long without progress
+// Delta sync (HASH, SYNC, PATCH); the protocol is described at DELTA SYNC below.
+const size_t SYNC_MIN_BLOCK = 64;
+const size_t SYNC_MAX_BLOCK = 4096;
+const uint8_t SYNC_COPY = 'C';    // Delta record: blocks of the old copy
+const uint8_t SYNC_LITERAL = 'L'; // Delta record: new bytes
+// Upload write ring. Received data is staged in whole LittleFS blocks, so every
+// write is one aligned 4 KB block (no read-modify-write of a partial one) and a
+// write only runs while no serial data is waiting. A flash program or erase
+// stalls both cores (XIP is off and arduino-pico idles the other core), so a
+// writer on core 1 would not overlap with USB receive either; the overlap is the
+// PC sending the next blocks, ACKed before the write, into the USB buffers.
+#define UPLOAD_FLASH_BLOCK 4096
+#define UPLOAD_RING_BUFS 4
+struct UploadWriter {
+    File *file;
+    uint8_t *bufs;  // count x UPLOAD_FLASH_BLOCK, malloc'd
+    uint32_t count;
+    uint32_t head;  // Buffers filled
+    uint32_t tail;  // Buffers written
+    size_t fill;    // Bytes in the buffer being filled, bufs[head % count]
+    bool failed;
+};
 // ----------------------------
 // SERIAL UPLOAD IMPLEMENTATION
 // ----------------------------
@@ -45,8 +101,10 @@ size_t serialBlockRead(uint8_t* buffer, size_t count, unsigned long timeoutMs =
     unsigned long start = millis();
     
     while (bytesRead < count) {
-        if (Serial.available()) {
-            buffer[bytesRead++] = Serial.read();
+        int available = Serial.available();
+        if (available > 0) {
+            // Take whatever has arrived in one call rather than a byte at a time
+            bytesRead += Serial.readBytes(buffer + bytesRead, min((size_t)available, count - bytesRead));
             start = millis(); // Reset timeout on new data
         } else if (millis() - start > timeoutMs) {
             return bytesRead; // Timeout occurred
@@ -55,6 +113,118 @@ size_t serialBlockRead(uint8_t* buffer, size_t count, unsigned long timeoutMs =
     }
     return bytesRead;
 }
+// CRC-32 as in zlib and PNG (reflected, polynomial 0xEDB88320), table built by the compiler.
+struct Crc32Table {
+    uint32_t v[256];
+    constexpr Crc32Table() : v() {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            v[i] = c;
+        }
+    }
+};
+constexpr Crc32Table CRC32_TABLE = Crc32Table();
+// Start with crc = 0; feed the result back in to continue over more data.
+uint32_t crc32Update(uint32_t crc, const uint8_t *data, size_t len) {
+    crc = ~crc;
+    while (len--) crc = CRC32_TABLE.v[(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+// Block compression for UPLOAD2 and downloads, in the LZ4 block format (end-of-block
+// rules included, so any LZ4 block decoder takes it). Every block is compressed on
+// its own, so the decoder needs no window beyond the block it writes into, and a
+// resent or resumed block decodes the same as the first time.
+#define LZ_MIN_MATCH 4
+#define LZ_LAST_LITERALS 5 // LZ4: a block ends with at least this many literals
+#define LZ_MATCH_LIMIT 12  // LZ4: no match starts this close to the end
+#define LZ_HASH_BITS 10
+#define LZ_HASH_SIZE (1 << LZ_HASH_BITS)
+const uint16_t LZ_FRAME_FLAG = 0x8000; // In a frame's length field: the data is lzCompress()ed
+static_assert(UPLOAD2_MAX_BLOCK < 0xFFFF && DL_MAX_CHUNK < 0xFFFF, "lzCompress() blocks must stay below 64 KB");
+// Compresses len bytes (below 64 KB: 0xFFFF marks an empty table slot) into dst.
+// Returns the compressed size, or 0 when it would not fit in cap: send the block
+// raw then. table holds LZ_HASH_SIZE entries.
+size_t lzCompress(const uint8_t *src, size_t len, uint8_t *dst, size_t cap, uint16_t *table) {
+    memset(table, 0xFF, LZ_HASH_SIZE * sizeof(uint16_t));
+    size_t ip = 0, anchor = 0, op = 0;
+    auto putLength = [&](size_t n) { // The rest of a length whose token nibble is 15
+        for (; n >= 255; n -= 255) {
+            if (op >= cap) return false;
+            dst[op++] = 255;
+        }
+        if (op >= cap) return false;
+        dst[op++] = (uint8_t)n;
+        return true;
+    };
+    // The literals since anchor, then a match (none for the last sequence)
+    auto sequence = [&](size_t matchLen, size_t offset) {
+        const size_t lit = ip - anchor, token = op++;
+        if (token >= cap) return false;
+        dst[token] = (uint8_t)(min(lit, (size_t)15) << 4);
+        if (lit >= 15 && !putLength(lit - 15)) return false;
+        if (lit > cap - op) return false;
+        memcpy(dst + op, src + anchor, lit);
+        op += lit;
+        if (matchLen == 0) return true;
+        if (cap - op < 2) return false;
+        dst[op++] = (uint8_t)offset;
+        dst[op++] = (uint8_t)(offset >> 8);
+        const size_t m = matchLen - LZ_MIN_MATCH;
+        dst[token] |= (uint8_t)min(m, (size_t)15);
+        return m < 15 || putLength(m - 15);
+    };
+    while (ip + LZ_MATCH_LIMIT <= len) {
+        uint32_t v, r;
+        memcpy(&v, src + ip, 4);
+        const uint32_t h = (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+        const size_t ref = table[h];
+        table[h] = (uint16_t)ip;
+        if (ref != 0xFFFF && (memcpy(&r, src + ref, 4), r == v)) {
+            size_t m = LZ_MIN_MATCH;
+            while (ip + m < len - LZ_LAST_LITERALS && src[ref + m] == src[ip + m]) m++;
+            if (!sequence(m, ip - ref)) return 0;
+            ip += m;
+            anchor = ip;
+        } else {
+            ip++;
+        }
+    }
+    ip = len;
+    return sequence(0, 0) ? op : 0;
+}
+// Decompresses one lzCompress()ed block into dst. Returns its size, or -1 when the
+// data is malformed or would not fit in cap.
+int lzDecompress(const uint8_t *src, size_t len, uint8_t *dst, size_t cap) {
+    size_t ip = 0, op = 0;
+    auto getLength = [&](size_t &n) {
+        uint8_t b;
+        do {
+            if (ip >= len) return false;
+            b = src[ip++];
+            n += b;
+        } while (b == 255);
+        return true;
+    };
+    while (ip < len) {
+        const uint8_t token = src[ip++];
+        size_t lit = token >> 4, m = token & 15;
+        if (lit == 15 && !getLength(lit)) return -1;
+        if (lit > len - ip || lit > cap - op) return -1;
+        memcpy(dst + op, src + ip, lit);
+        ip += lit;
+        op += lit;
+        if (ip == len) break; // The last sequence has no match
+        if (len - ip < 2) return -1;
+        const size_t offset = src[ip] | (src[ip + 1] << 8);
+        ip += 2;
+        if (m == 15 && !getLength(m)) return -1;
+        m += LZ_MIN_MATCH;
+        if (offset == 0 || offset > op || m > cap - op) return -1;
+        for (; m > 0; --m, ++op) dst[op] = dst[op - offset]; // May overlap itself
+    }
+    return (int)op;
+}
 // ----------------------------
 // LED CONFIGURATION
 // ----------------------------
@@ -130,10 +300,7 @@ char cmdBuf[CMD_BUF];
 int cmdLen = 0;
 int cursorPos = 0;
 bool inputWrapped = false;
-int lastPreviewCols = 0;
-int lastCursorCol = -1;
-int lastCursorRowY = -1;
-int lastGlobalCursorPos = -1;
+int inputCursorRow = MAX_LINES; // First grid row the drawn cursor overlay touched (MAX_LINES = none)
 // ----------------------------
 // SHELL PROMPT
 // ----------------------------
@@ -142,15 +309,33 @@ inline int promptCols() { return PROMPT.length(); }
 // ----------------------------
 // SCROLLBACK DEFINITIONS (FIXED ORDER)
 // ----------------------------
-#define SCROLLBACK_SIZE 50 // MOVED UP
-//Holds the text and the color for each entry
-struct ScrollbackEntry {
-    String text;
-    uint16_t color; // Color for the message
+// Logical lines live in one fixed byte arena used as a ring; the oldest lines are
+// evicted when a new one needs the space. Each record is
+//   uint16 len, uint16 runCount, runCount x {uint16 count, uint16 color}, len chars
+// padded to 4 bytes. Lines are only wrapped to COLS when drawn; a visual row is
+// found by a binary search over the lines' first rows.
+#define SB_ARENA_KB 16 // The one knob: arena size, a power of two; line slots follow
+#define SB_ARENA_BYTES (SB_ARENA_KB * 1024)
+#define SB_MAX_LINES (SB_ARENA_KB * 32) // Power of two
+#define SB_MAX_LINE_CHARS (12 * COLS) // Longer lines are stored as several lines
+static_assert((SB_ARENA_KB & (SB_ARENA_KB - 1)) == 0, "SB_ARENA_KB must be a power of two");
+static_assert(SB_MAX_LINES * 12 < 65536, "Stored rows must fit the 16-bit sbLineRow");
+struct SbLineHeader {
+    uint16_t len;
+    uint16_t runCount;
+};
+struct SbRun {
+    uint16_t count; // Characters covered by this run
+    uint16_t color;
 };
-ScrollbackEntry scrollback[SCROLLBACK_SIZE]; // Array of ScrollbackEntry structs
-int scrollbackHead = 0;
-int scrollbackCount = 0;
+uint32_t sbArena[SB_ARENA_BYTES / 4];
+uint16_t sbLineOff[SB_MAX_LINES]; // Record offset in 4-byte words, per line slot
+uint16_t sbLineRow[SB_MAX_LINES]; // Absolute visual row of each line's first segment, mod 65536
+uint32_t sbFirstLine = 0; // Absolute line ids in the store: [sbFirstLine, sbNextLine)
+uint32_t sbNextLine = 0;
+uint32_t sbFirstRow = 0;  // Absolute visual rows in the store: [sbFirstRow, sbNextRow)
+uint32_t sbNextRow = 0;
+uint32_t sbTail = 0;      // Arena byte offset of the next record
 int terminalScrollOffset = 0;
 #define HISTORY_SIZE 64
 String history[HISTORY_SIZE];
@@ -187,29 +372,80 @@ const uint16_t RAINBOW_COLORS[] = {
     ST77XX_VIOLET        // 7. Violet (New Violet)
 };
 const int RAINBOW_COUNT = 7;
-// Maximum number of characters to store color data for per line (e.g., S> Pi = 3.14...)
-const int MAX_RAINBOW_CHARS = 30; 
-// Parallel array to store per-character colors for rainbow lines.
-uint16_t rainbowColors[SCROLLBACK_SIZE][MAX_RAINBOW_CHARS]; // SCROLLBACK_SIZE is now defined
 // Helper to cycle through the global RAINBOW_COLORS array.
 uint16_t getRainbowColor(int index) {
     // Uses your global RAINBOW_COLORS array and RAINBOW_COUNT constant 
     return RAINBOW_COLORS[index % RAINBOW_COUNT];
 }
-// Stores the rainbow data into the parallel array
-void storeRainbowData(int scrollbackIndex, const String &s) {
-    int charCount = s.length();
-    for (int i = 0; i < charCount && i < MAX_RAINBOW_CHARS; ++i) {
-        rainbowColors[scrollbackIndex][i] = getRainbowColor(i); 
+// ----------------------------
+// FIXED-POINT MATH
+// ----------------------------
+// Q16.16 fixed point for the graphics paths (cube, moon, mood light). The M0+
+// has no FPU, so float sin/cos/sqrt are soft-float library calls; here they are
+// tables generated by the compiler plus integer multiplies. Angles are binary,
+// 65536 units per turn, so they wrap for free in a uint16_t.
+typedef int32_t fix16;
+#define FIX_SHIFT 16
+#define FIX_ONE (1 << FIX_SHIFT)
+#define FIX_SIN_BITS 10 // log2 of the table steps per turn
+#define FIX_SIN_STEPS (1 << FIX_SIN_BITS)
+#define FIX_DEG(d) ((uint16_t)((d) * 65536.0 / 360.0 + 0.5)) // Binary angle of a constant in degrees
+struct FixVec3 {
+    fix16 x, y, z;
+};
+struct FixMat3 {
+    fix16 m[3][3];
+};
+// Quarter sine wave, sin(2 pi i / FIX_SIN_STEPS) for i in [0, FIX_SIN_STEPS / 4],
+// from a Taylor series the compiler evaluates in double precision.
+struct FixSinTable {
+    fix16 v[FIX_SIN_STEPS / 4 + 1];
+    constexpr FixSinTable() : v() {
+        for (int i = 0; i <= FIX_SIN_STEPS / 4; ++i) {
+            double x = i * (2 * 3.14159265358979323846 / FIX_SIN_STEPS), term = x, sum = x;
+            for (int n = 1; n < 10; ++n) {
+                term *= -x * x / ((2 * n) * (2 * n + 1));
+                sum += term;
+            }
+            v[i] = (fix16)(sum * FIX_ONE + 0.5);
+        }
     }
-}
+};
+constexpr FixSinTable FIX_SIN = FixSinTable();
+// Half widths of a disc of radius R per scanline offset dy: round(sqrt(R^2 - dy^2)),
+// i.e. the sqrt calls of a scanline circle fill, done once by the compiler.
+template <int R>
+struct FixDiscTable {
+    uint8_t half[R + 1];
+    constexpr FixDiscTable() : half() {
+        for (int dy = 0; dy <= R; ++dy) {
+            int n = R * R - dy * dy, root = 0;
+            while ((root + 1) * (root + 1) <= n) ++root;
+            half[dy] = root + (n - root * root > root ? 1 : 0); // sqrt >= root + 0.5 rounds up
+        }
+    }
+};
+#define MOON_RADIUS 60
+#define MOON_CX (SCREEN_WIDTH / 2)
+#define MOON_CY (SCREEN_HEIGHT / 2 - 20) // Room for the phase label underneath
+#define MOON_PHASES 30
+#define MOON_FRAME_MS 100                 // Auto-play: all phases in 3 s
+constexpr FixDiscTable<MOON_RADIUS> MOON_DISC = FixDiscTable<MOON_RADIUS>();
+// A run of one color on a moon scanline, x relative to the moon's center
+struct MoonSpan {
+    int x, w;
+    uint16_t color;
+};
+struct MoonApp {
+    int day;               // Phase to show
+    int shownDay;          // Phase on screen
+    bool playing;          // SELECT: step through the phases every MOON_FRAME_MS
+    unsigned long lastStep;
+};
+MoonApp moonApp;
 // ----------------------------
 // 3D CUBE DEFINITIONS
 // ----------------------------
-struct Point3D {
-    float x, y, z;
-};
-
 // FIX: Define the 2D Point struct with a constructor
 struct Point {
     int x, y;
@@ -218,17 +454,542 @@ struct Point {
     // Constructor with initial values
     Point(int _x, int _y) : x(_x), y(_y) {}
 };
+struct CubeApp {
+    uint16_t angleX, angleY, angleZ; // Binary angles
+    Point shown[8];                  // Last drawn projection, erased before the next one
+    bool haveShown;
+};
+CubeApp cubeApp;
+// ----------------------------
+// MOOD LIGHT EFFECTS
+// ----------------------------
+// The mood light is a set of procedural effects. Each one generates the frame a
+// scanline at a time into the DMA row buffer with table and integer math; the
+// frame goes to the panel as one full-screen window, band by band, so the next
+// band is generated while the previous one is on the wire.
+#define MOOD_FRAME_MS 33                     // 30 fps
+#define MOOD_STARS 150
+#define MOOD_FIRE_W (SCREEN_WIDTH / 2)       // Fire runs at half resolution, doubled on output
+#define MOOD_FIRE_H (SCREEN_HEIGHT / 2 + 2)  // Plus two seed rows below the screen
+struct MoodEffect {
+    const char *name;
+    bool (*start)();                     // Optional: tables and buffers; false if out of memory
+    bool (*frame)(unsigned long t);      // Per frame, t ms into the effect; false: frame unchanged
+    void (*line)(uint16_t *out, int y);  // One scanline of SCREEN_WIDTH pixels, y ascending
+};
+struct MoodStar {
+    uint16_t x;     // Quarter pixels
+    uint8_t y;
+    uint8_t speed;  // 1 (far) to 3 (near)
+};
+// Mood light: the start message stays on the terminal for a moment first.
+struct MoodApp {
+    const MoodEffect *effect;
+    unsigned long startAt;
+    uint32_t frames;                  // Frames sent, for the fps report
+    int hue;                          // solid, gradient, rainbow: hue of the first pixel
+    uint16_t palette[256];            // plasma, fire
+    uint8_t sine[256];                // plasma: 128 + 127 sin over 256 steps
+    uint8_t plasmaCol[SCREEN_WIDTH];  // plasma: per-frame column and diagonal terms
+    uint8_t plasmaDiag[SCREEN_WIDTH + SCREEN_HEIGHT - 1];
+    uint8_t plasmaPhase;
+    int plasmaShift;
+    uint8_t *fire;                    // fire: MOOD_FIRE_W x MOOD_FIRE_H heat, malloc'd while running
+    MoodStar stars[MOOD_STARS];       // stars: sorted by y
+    int starNext;                     // stars: first star not yet drawn this frame
+    uint32_t rng;
+};
+MoodApp moodApp;
 
 // ----------------------------
-// Rendering snapshots
+// Rendering snapshots (character-cell framebuffer)
+// ----------------------------
+// The terminal is a COLS x MAX_LINES grid of cells. termGrid holds what the
+// terminal wants on screen, termFrame the renderer's copy of it (see RENDER
+// CORE) and termShown what the panel currently shows. Flushing diffs termFrame
+// against termShown and only pushes the horizontal spans that changed.
+struct TermCell {
+    char ch;
+    uint16_t fg;
+    uint16_t bg;
+};
+const char TERM_CELL_UNKNOWN = 0; // termShown marker: panel content unknown, always repaint
+TermCell termGrid[MAX_LINES][COLS];
+TermCell termFrame[MAX_LINES][COLS];
+TermCell termShown[MAX_LINES][COLS];
+#ifdef PICOS_BENCH
+// Running totals of what the cell renderer pushed to the panel (see 'bench').
+struct TermRenderStats {
+    uint32_t pixels;
+    uint32_t windows;
+    uint32_t glyphs;
+};
+TermRenderStats termStats = {0, 0, 0};
+#endif
+// ----------------------------
+// ST7789 HARDWARE VERTICAL SCROLL
+// ----------------------------
+// The scrollback rows form the controller's vertical scroll area and the input
+// rows below it are the fixed bottom area. Pushing k lines then only moves the
+// scroll start by k rows and repaints the k rows that wrapped to the bottom.
+// Assumes setRotation(2) on the 240x240 panel: no MY flip and no row offset.
+#define ST7789_VSCRDEF 0x33
+#define ST7789_VSCRSADD 0x37
+#define ST7789_GRAM_LINES 320
+int vscrollRows = 0;  // Grid rows in the scroll area (0 = scrolling off)
+int vscrollFirst = 0; // GRAM band currently shown at the top of the scroll area
+int scrollbackRowsPushed = 0; // Rows added to the scrollback since the last draw
+// ----------------------------
+// RENDER CORE
+// ----------------------------
+// On the RP2040 the cell renderer runs on core 1. Core 0 composes termGrid and
+// posts the rows that changed, plus what to do with them, into a single-producer
+// single-consumer ring. Core 1 (loop1) owns the panel side: termFrame, termShown,
+// the scroll state, the glyph atlas and the DMA. Anything else that draws from
+// core 0 calls renderSync() first (resetHardwareScroll() does): core 1 only acts
+// on commands, so once the ring has drained the panel is core 0's until it posts
+// again. Without a second core the commands run as they are posted.
+#define RENDER_RING_SLOTS 32 // Power of two; a full redraw is about 30 commands
+enum RenderOp : uint8_t {
+    RENDER_ROW,        // Copy cells into termFrame[row]
+    RENDER_FLUSH,      // Diff and send rows [first, last)
+    RENDER_FLUSH_SPAN, // Diff and send cells [first, last) of row
+    RENDER_SCROLLBACK, // Scroll area of `first` rows with `arg` new rows, then send it
+    RENDER_INVALIDATE, // Forget what the panel shows in rows [first, last)
+#ifdef PICOS_BENCH
+    RENDER_CHECK,      // "bench render": sequence check only
+#endif
+};
+struct RenderCmd {
+    RenderOp op;
+    uint8_t row;
+    uint8_t first, last;
+    uint32_t arg;
+    TermCell cells[COLS]; // RENDER_ROW
+};
+struct RenderRing {
+    RenderCmd slots[RENDER_RING_SLOTS];
+    std::atomic<uint32_t> head; // Commands posted; written by core 0 only
+    std::atomic<uint32_t> tail; // Commands done; written by core 1 only
+};
+RenderRing renderRing;
+TermCell termPosted[MAX_LINES][COLS]; // Core 0's record of termFrame, so unchanged rows are not posted
+#ifdef PICOS_BENCH
+bool renderAsync = true;              // false: wait for every command, as if core 0 drew itself (bench)
+uint32_t renderCheckNext = 0;         // Core 1 side of "bench render"
+uint32_t renderCheckErrors = 0;
+#endif
+// ----------------------------
+// GLYPH ATLAS
+// ----------------------------
+// Pre-rasterized RGB565 tiles of the 6x9 cell font, one per (char, fg, bg) in use.
+// Direct-mapped; a miss simply re-rasterizes the tile from the GFX font table.
+#define GLYPH_CACHE_SLOTS 128
+struct GlyphTile {
+    char ch;
+    bool valid;
+    uint16_t fg;
+    uint16_t bg;
+    uint16_t px[CHAR_WIDTH * LINE_HEIGHT];
+};
+GlyphTile glyphCache[GLYPH_CACHE_SLOTS];
+// ----------------------------
+// DISPLAY DMA BUFFERS
+// ----------------------------
+// Two ping-pong pixel buffers, each big enough for a whole 240x9 text row: the
+// CPU composes into one while DMA clocks the other out to the panel.
+#define DISP_BUF_PIXELS (SCREEN_WIDTH * LINE_HEIGHT)
+uint16_t dispBuf[2][DISP_BUF_PIXELS];
+int dispBufNext = 0;         // Buffer the CPU may compose into next
+bool dispWindowOpen = false; // Inside startWrite() with an address window set
+// ----------------------------
+// BMP DECODER
+// ----------------------------
+// Rows are decoded in file order from multi-row block reads and handed to a
+// BmpSink. The image viewer's sink streams them into one panel window; bottom-up
+// files are sent with the panel's row addressing mirrored instead of seeking.
+#define BMP_BLOCK_BYTES 4096
+struct BmpInfo {
+    int32_t width;
+    int32_t height;        // Always positive; see topDown
+    bool topDown;
+    uint16_t depth;        // 1, 4, 8, 16, 24 or 32 bits per pixel
+    bool rgb555;           // 16-bit pixels are X1R5G5B5 rather than R5G6B5
+    uint32_t dataOffset;
+    uint32_t rowSize;      // Bytes per file row, including the 4-byte padding
+    uint16_t palette[256]; // RGB565, depth <= 8
+};
+// The decoder converts each row into buf and calls emit(sink, y, count) with y
+// counted from the top of the decoded region; emit may point buf elsewhere.
+struct BmpSink {
+    uint16_t *buf;
+    void (*emit)(BmpSink &sink, int y, int count);
+    void *ctx;
+};
+struct ImgStats {
+    uint32_t bytesRead;
+    uint32_t reads;
+    uint32_t seeks;
+};
+uint8_t bmpBlock[BMP_BLOCK_BYTES];
+ImgStats imgStats = {0, 0, 0}; // Flash traffic of the BMP and .565 decoders
+// ----------------------------
+// NATIVE RGB565 IMAGES (.565)
+// ----------------------------
+// PicoLink converts PNG/BMP into this format. Pixels are stored in the panel's
+// wire order, so rows go from flash to SPI without per-pixel work:
+//   0  "I565"   magic
+//   4  u16 LE   width
+//   6  u16 LE   height
+//   8  u8       flags, bit 0: rows are RLE packed
+//   9  7 bytes  reserved, 0
+// then height rows, top first. A plain row is width big-endian RGB565 pixels. A
+// packed row starts with a u16 LE byte count (bit 15 set: the row follows
+// unpacked), then packets: 0x80|(n-1) and one pixel for a run of n, or n-1 and
+// n literal pixels.
+#define IMG565_HEADER_BYTES 16
+#define IMG565_FLAG_RLE 0x01
+#define IMG565_ROW_RAW 0x8000
+#define IMG565_MAX_WIDTH (BMP_BLOCK_BYTES / 2) // A whole row must fit in bmpBlock
+struct Img565Info {
+    uint16_t width;
+    uint16_t height;
+    bool rle;
+};
+// Buffered sequential reads through bmpBlock, for walking packed rows.
+struct ImgReader {
+    File *file;
+    uint32_t pos; // Next unread byte in bmpBlock
+    uint32_t len; // Valid bytes in bmpBlock
+};
+// ----------------------------
+// IMAGE VIEWER
 // ----------------------------
-String prevVisibleLines[MAX_LINES];
-int prevVisibleCount = 0;
+// Images larger than the screen open scaled to fit. SELECT halves the scale step
+// down to 1:1 and then returns to fit; NEXT/PREV pan down/up, moving to the next/
+// previous column of the image at the bottom/top edge.
+// Scaling is a streaming box filter in Q16 fixed point: each screen pixel is the
+// average of the block of source pixels it covers, summed one decoded source row
+// at a time, so RAM use is the column sums plus one source row for any image size.
+// A vertical pan decodes only the strip coming into view, draws it into the GRAM
+// lines below (or above) the screen and then moves the hardware scroll start.
+#define VIEW_SRC_MAX_WIDTH 2048 // Widest source span one view may cover
+#define VIEW_PAN_ROWS 40        // Rows per pan step; at most the 80 off-screen GRAM lines
+#define VIEW_STEP_ONE 0x10000   // Q16 scale step of 1:1
+struct ImageView {
+    File *file;
+    const BmpInfo *bmp;       // Exactly one of bmp and native is set
+    const Img565Info *native;
+    int width, height;        // Source size
+    uint32_t fitStep;         // Q16 source pixels per screen pixel; the "fit" zoom
+    uint32_t step;            // Current zoom
+    int scaledW, scaledH;     // Image size at the current zoom
+    int viewW, viewH;         // Visible part, centered on screen when smaller
+    int panX, panY;           // Top-left of the visible part, in scaled pixels
+    int scrollLine;           // GRAM line shown at the top of the screen
+};
+// Box filter state while a strip is drawn: per screen column sums of the 5/6/5
+// bit channels over the source block of the scaled row being accumulated.
+struct ViewScaler {
+    ImageView *view;
+    int srcY0;                            // Source row of the decoded strip's y = 0
+    uint16_t colStart[SCREEN_WIDTH + 1];  // Source column bounds per screen column
+    uint32_t sumR[SCREEN_WIDTH];
+    uint32_t sumG[SCREEN_WIDTH];
+    uint32_t sumB[SCREEN_WIDTH];
+    int accRow;                           // Scaled row being summed, -1 if none
+    int accCount;                         // Source rows summed into it
+};
+uint16_t viewSrcRow[VIEW_SRC_MAX_WIDTH];
+ViewScaler viewScaler;
+struct ImageApp {
+    String path;
+    File file;
+    BmpInfo bmp;
+    Img565Info native;
+    ImageView view;
+    bool fits;  // Drawn 1:1, no zoom or pan
+    bool drawn;
+};
+ImageApp imageApp;
+// ----------------------------
+// SLIDESHOW
+// ----------------------------
+// While an image is on screen the next one is opened and its header read in an
+// idle pass, so a transition only streams rows through the scaling viewer (the
+// same path "pic" uses) straight to the panel. No frame is kept: a full-screen
+// one (115 KB) does not fit next to the terminal's buffers.
+#define SLIDE_PATTERN_LEN 32
+#define SLIDE_DEFAULT_SECONDS 5
+struct Slideshow {
+    char pattern[SLIDE_PATTERN_LEN + 1];
+    int count;                // Matching image files
+    int shown;                // Index on screen, -1 before the first
+    int next;                 // Index of the staged (or failed) image
+    File file;                // Image being staged
+    BmpInfo bmp;
+    Img565Info native;
+    ImageView view;           // Decode cursor of the next image
+    bool staged;              // The next image is open and its header read
+    bool failed;              // The next image could not be opened or decoded
+    bool pending;             // The image after the shown one is not opened yet
+    unsigned long intervalMs;
+    unsigned long shownAt;
+    // Transition latency, request to image on the panel
+    uint32_t warmCount, warmUs; // Image was already staged
+    uint32_t coldCount, coldUs; // Staging had to be finished first
+};
+Slideshow slideshow;
+// ----------------------------
+// MESH VIEWER
+// ----------------------------
+// "model <file.obj>" spins a triangle mesh (v and f records; polygons become
+// fans). Frames are composed band by band in the DMA row buffers and only the
+// union of this and the last frame's bounding box is sent, so nothing is erased
+// on screen first. Back faces are culled and the rest drawn far to near; the
+// order is kept across frames, so the insertion sort only fixes up small moves.
+// The mesh (about 35 KB) is taken from the heap while the viewer runs, and 7 KB
+// of float positions only while the file loads.
+#define MESH_MAX_VERTICES 600
+#define MESH_MAX_TRIANGLES 1200
+#define MESH_RADIUS 100   // Screen radius of the model's bounding sphere
+#define MESH_SUBPIXEL 4   // Fraction bits of screen coordinates
+#define MESH_LINE_LEN 128 // Longest OBJ line parsed; the rest is ignored
+struct MeshTri {
+    uint16_t v[3];
+    int16_t n[3]; // Unit normal, Q14
+};
+struct MeshBox {
+    int x0, y0, x1, y1; // Half-open; empty when x0 >= x1
+};
+struct Mesh {
+    int vertexCount;
+    int triCount;
+    FixVec3 vertices[MESH_MAX_VERTICES]; // Centered, scaled to MESH_RADIUS pixels
+    MeshTri tris[MESH_MAX_TRIANGLES];
+    // Per frame
+    int16_t sx[MESH_MAX_VERTICES];       // Screen position, MESH_SUBPIXEL fraction bits
+    int16_t sy[MESH_MAX_VERTICES];
+    int16_t vz[MESH_MAX_VERTICES];       // Depth in pixels, larger is nearer
+    int16_t key[MESH_MAX_TRIANGLES];     // Triangle depth: sum of its vertices' vz
+    uint16_t order[MESH_MAX_TRIANGLES];  // Triangles far to near
+    uint16_t color[MESH_MAX_TRIANGLES];  // Flat shade
+    uint8_t yMin[MESH_MAX_TRIANGLES];    // Screen rows touched; yMin > yMax when culled
+    uint8_t yMax[MESH_MAX_TRIANGLES];
+    MeshBox box;                         // What the last frame drew
+    bool wire;                           // Edges only instead of flat-shaded fill
+};
+struct ModelApp {
+    String path;
+    Mesh *mesh;
+    uint16_t angleX, angleY, angleZ;
+    int speed;                 // Spin speed steps, 0 to 4
+    unsigned long frameUs;     // Transform, raster and send time of the last frame
+    unsigned long lastReadout;
+};
+ModelApp modelApp;
+// ----------------------------
+// PAGER
+// ----------------------------
+// "more" keeps only the screen (the cell grid) and a fixed-size index in RAM.
+// The index holds the start offset of every stride-th page seen so far; when it
+// fills up, every other entry is dropped and the stride doubles, so any file
+// size fits and paging back never re-reads more than stride pages.
+#define PAGER_ROWS (MAX_LINES - 1) // The last row is the status bar
+#define PAGER_INDEX_SLOTS 256
+#define PAGER_BLOCK 256
+struct Pager {
+    File file;
+    uint32_t size;
+    uint32_t page;      // Current page number
+    uint32_t pageStart; // File offset of the current page
+    uint32_t nextStart; // File offset just past the current page
+    uint32_t index[PAGER_INDEX_SLOTS];
+    uint16_t indexCount;
+    uint16_t stride;    // Pages between index entries, a power of two
+};
+struct PagerApp {
+    Pager pg;
+    String path;
+};
+PagerApp pagerApp;
+// ----------------------------
+// CALCULATOR
+// ----------------------------
+// Expressions compile once into a small stack bytecode; compiled programs are
+// kept in an LRU cache keyed by the expression text, so repeated expressions
+// (history recall, calc -f) skip parsing entirely.
+#define CALC_MAX_CODE 96
+#define CALC_MAX_CONSTS 16
+#define CALC_MAX_STACK 16
+#define CALC_MAX_NEST 12     // Parentheses, function calls and ^ chains
+#define CALC_MAX_VARS 16     // Slot 0 is "ans"
+#define CALC_NAME_LEN 8
+#define CALC_CACHE_SIZE 8
+#define CALC_CACHE_TEXT 64   // Longer expressions are compiled but not cached
+enum CalcOpcode : uint8_t {
+    OPC_CONST, // + const index
+    OPC_VAR,   // + variable slot
+    OPC_CALL,  // + function index
+    OPC_NEG, OPC_ADD, OPC_SUB, OPC_MUL, OPC_DIV, OPC_MOD, OPC_POW
+};
+enum CalcStatus : uint8_t {
+    CALC_OK, CALC_ERR_SYNTAX, CALC_ERR_PAREN, CALC_ERR_CHAR, CALC_ERR_NAME,
+    CALC_ERR_COMPLEX, CALC_ERR_VARS, CALC_ERR_DIV_ZERO, CALC_ERR_DOMAIN
+};
+struct CalcProgram {
+    uint8_t code[CALC_MAX_CODE];
+    double consts[CALC_MAX_CONSTS]; // Interned: each distinct literal is stored once
+    uint8_t codeLen;
+    uint8_t constCount;
+    int8_t storeVar; // Slot assigned by "name = expr", or -1
+};
+struct CalcParser {
+    const char *p;
+    CalcProgram *prog;
+    uint8_t nest;
+    int8_t depth; // Stack depth after the code emitted so far
+    CalcStatus status;
+};
+struct CalcVar {
+    char name[CALC_NAME_LEN + 1];
+    double value;
+};
+struct CalcCacheEntry {
+    uint32_t hash;
+    uint32_t lastUse; // 0 = empty slot
+    char text[CALC_CACHE_TEXT];
+    CalcProgram prog;
+};
+CalcVar calcVars[CALC_MAX_VARS] = {{"ans", 0.0}};
+int calcVarCount = 1;
+CalcCacheEntry calcCache[CALC_CACHE_SIZE];
+uint32_t calcCacheClock = 0;
+// ----------------------------
+// APP SCHEDULER
+// ----------------------------
+// Full-screen apps do not loop on their own: loop() drives the active one
+// through its hooks, so serial commands, the timer and the LED keep running
+// while it is on screen. tick() reads input every pass; render() draws a frame
+// once frameMs has passed (0: every pass) and should fit in that budget. Either
+// may be null. An app ends by calling appQuit(); exit() restores the terminal.
+// While an app is active the terminal does not draw itself.
+struct App {
+    const char *name;
+    bool (*init)();                    // Takes the screen; false (with a message) if it cannot run
+    void (*tick)(unsigned long now);
+    void (*render)(unsigned long now);
+    void (*exit)();
+    unsigned long frameMs;
+};
+struct AppStats {
+    uint32_t frames;
+    uint32_t overruns;     // Frames that took longer than frameMs
+    unsigned long worstUs; // Slowest render
+};
+const App *activeApp = nullptr;
+bool appQuitting = false;
+unsigned long appNextFrame = 0;
+AppStats appStats;
+// ----------------------------
+// COMMAND REGISTRY TYPES
+// ----------------------------
+// CMD_OWNS_SCREEN: the handler started a full-screen app, whose exit hook
+// restores the terminal, so the dispatcher must not redraw it.
+enum CmdResult { CMD_DONE, CMD_OWNS_SCREEN };
+// A parsed command line. tokenizeInPlace() strips quotes/escapes inside the
+// line buffer itself and NUL-terminates each token there, so args[i] is a C
+// string pointing into that buffer: no String copies, no heap.
+#define MAX_ARGS 32
+struct TokenView {
+    uint16_t off; // Token start in the line buffer
+    uint16_t len; // Length after quote/escape removal
+};
+struct CmdArgs {
+    char *line;
+    TokenView tok[MAX_ARGS];
+    int count;
+    bool overflow; // The line had more than MAX_ARGS tokens
+    const char *operator[](int i) const { return line + tok[i].off; }
+};
+typedef CmdResult (*CommandHandler)(CmdArgs &args);
+struct CommandSpec {
+    const char *name;      // Lower case; tables are sorted by it
+    CommandHandler handler;
+    uint8_t minArgs;       // Arguments required after the command name
+    const char *usage;
+    const char *help;
+};
 // ----------------------------
 // Function prototypes
 // ----------------------------
+const CommandSpec *findCommand(const CommandSpec *table, size_t count, const char *name, size_t len);
+void pushCommandHelp();
+#ifdef PICOS_BENCH
+void benchDispatch();
+void benchTokenizer();
+void benchCalc();
+void benchPager(const String &path);
+void benchBmp(const String &path);
+void benchImg565(const String &path, const String &bmpPath);
+void benchFit(const String &path);
+void benchSlideshow(const char *pattern);
+void benchModel(const String &path);
+void benchFixed();
+void benchMoon();
+void benchMood();
+void benchFlash();
+void benchLz(const String &path);
+void benchApp();
+void benchRender();
+#endif
+bool pagerOpen(Pager &pg, const String &path);
+uint32_t pagerLayout(Pager &pg, uint32_t offset, bool draw);
+void pagerIndexPage(Pager &pg);
+void pagerShowPage(Pager &pg, uint32_t page, uint32_t offset, bool draw);
+bool pagerNext(Pager &pg, bool draw);
+bool pagerPrev(Pager &pg, bool draw);
+void pagerDrawStatus(const Pager &pg, const char *name);
+bool calcEmit(CalcParser &ps, uint8_t byte, int stackDelta);
+int calcInternConst(CalcProgram &prog, double v);
+void calcParseExpr(CalcParser &ps);
+void calcParseUnary(CalcParser &ps);
+CalcStatus calcCompile(const char *text, CalcProgram &prog);
+CalcStatus calcExecute(const CalcProgram &prog, double &result);
+const CalcProgram *calcLookup(const char *expr, CalcStatus &status);
+CalcStatus calcEvaluate(const char *expr, double &result);
+const char *calcStatusText(CalcStatus status);
+inline bool termCellEquals(const TermCell &a, const TermCell &b);
+inline bool termRowEquals(const TermCell *a, const TermCell *b);
+inline const SbLineHeader *sbHeader(uint32_t slot);
+inline const SbRun *sbRuns(const SbLineHeader *h);
+inline const char *sbChars(const SbLineHeader *h);
+int sbBuildRuns(const char *s, int len, uint16_t color, SbRun *out);
 void pushScrollback(const String &s, uint16_t color = ST77XX_WHITE); // FIXED prototype
+void pushScrollbackChars(const char *s, int n, uint16_t color);
 void invalidateTerminalCache();
+void resetHardwareScroll();
+void termInvalidateRows(int first, int last);
+void termFlushRows(int first, int last);
+void termFlushRowRange(int row, int col0, int col1);
+void termPostRows(int first, int last);
+void termSendRows(int first, int last);
+void termSendSpan(int row, int col0, int col1);
+void termForgetRows(int first, int last);
+void termPresentScrollback(int rows, int pushed);
+RenderCmd &renderBegin();
+void renderEnd();
+void renderDrain();
+void renderSync();
+void renderExecute(const RenderCmd &cmd);
+int termPutText(int row, int col, const char *text, int len, uint16_t fg, uint16_t bg = ST77XX_BLACK);
+void termClearRow(int row, uint16_t bg = ST77XX_BLACK);
+void termSetCell(int row, int col, char c, uint16_t fg, uint16_t bg);
+uint16_t *dispRowBuffer();
+void dispBeginWindow(int x, int y, int w, int h);
+void dispSubmit(const uint16_t *buf, uint32_t count);
+void dispFill(int x, int y, int w, int h, uint16_t color);
+void dispEndWindow();
 void pushSystemMessage(const String &s);
 void drawFullTerminal();
 void drawInputArea();
@@ -242,13 +1003,15 @@ void loadHistoryCommand(int index);
 void historyRecallDown();
 void historyRecallUp();
 void addHistory(const String &line);
-void executeCommandLine(const String &raw);
+void executeCommandLine(char *line);
 String trimStr(const String &s);
-String evalCalc(const String &expr);
-void tokenizeLine(const String &line, String tokens[], int &count, int maxTokens);
+String calcFormat(double v);
+void calcRunFile(const String &path, const char *expr);
+int tokenizeInPlace(char *line, CmdArgs &args);
+String joinArgs(const CmdArgs &args, int first);
 bool fsBegin();
 String listFiles();
-String readFile(const String &path);
+void catToScrollback(const String &path);
 bool writeFile(const String &path, const String &data, bool append); 
 bool removeFile(const String &path);
 void kbPrev(); 
@@ -257,25 +1020,133 @@ void kbConfirm();
 void handleFKeyAction(int fKeyNumber);
 void handleFKeyInput(char inputChar);
 void drawCursorAndPreview(); 
-void calculateFullWrapSegments(const String &input, String outLines[], int &count, int maxOut, bool startsAsContinuation);
+void drawInputFrom(int pos);
 const char* kbGetModeName();
 void drawMultiColorString(const String &text, int lineNum, int x_start);
-void executeCat(String filename);
+void executeDownload(String filename);
+void executeUpload2(String filename, size_t fileSize, size_t blockSize, size_t window, bool lz);
+bool uploadWriterBegin(UploadWriter &w, File &file);
+uint8_t *uploadWriterSpace(UploadWriter &w, size_t &len);
+void uploadWriterCommit(UploadWriter &w, size_t len);
+bool uploadWriterPut(UploadWriter &w, const uint8_t *data, size_t len);
+bool uploadWriterStep(UploadWriter &w);
+bool uploadWriterFinish(UploadWriter &w);
+void uploadWriterEnd(UploadWriter &w);
+bool upload2ReadHeader(uint8_t *header);
+uint32_t syncWeakSum(const uint8_t *data, size_t len);
+void executeHash(String filename);
+void executeSyncSignatures(String filename, size_t block);
+void executePatch(String filename, size_t block, size_t newSize, uint32_t newCrc);
 void drawRotatingCube(Point* projected_points, uint16_t color);
-void runCubeAnimation();
-void mood();
-void runMoonPhase();
+bool appStart(const App &app);
+void appQuit();
+bool appPressed(int button, unsigned long now);
+void appService(unsigned long now);
+void serviceTimers(unsigned long now);
+bool cubeInit();
+void cubeTick(unsigned long now);
+void cubeRender(unsigned long now);
+void cubeExit();
+bool moodInit();
+void moodTick(unsigned long now);
+void moodRender(unsigned long now);
+void moodExit();
+uint32_t moodRandom();
+void moodFillLine(uint16_t *out, uint16_t color);
+bool moodSolidFrame(unsigned long t);
+void moodSolidLine(uint16_t *out, int y);
+bool moodGradientFrame(unsigned long t);
+void moodGradientLine(uint16_t *out, int y);
+bool moodRainbowFrame(unsigned long t);
+void moodRainbowLine(uint16_t *out, int y);
+bool moodPlasmaStart();
+bool moodPlasmaFrame(unsigned long t);
+void moodPlasmaLine(uint16_t *out, int y);
+bool moodFireStart();
+bool moodFireFrame(unsigned long t);
+void moodFireLine(uint16_t *out, int y);
+bool moodStarsStart();
+bool moodStarsFrame(unsigned long t);
+void moodStarsLine(uint16_t *out, int y);
+const MoodEffect *moodFindEffect(const char *name);
+bool moodEffectStart();
+void moodEffectStop();
+bool moodDrawFrame(unsigned long t);
+bool moonInit();
+void moonTick(unsigned long now);
+void moonRender(unsigned long now);
+void moonExit();
+bool pagerInit();
+void pagerTick(unsigned long now);
+void pagerExit();
 void drawMoon(int day, int totalDays);
+int moonTerminator(int day, int totalDays);
+int moonLitSpans(int dy, int terminator, MoonSpan *out);
+int moonDeltaSpans(int dy, int from, int to, MoonSpan *out);
+void drawMoonDelta(int fromDay, int toDay, int totalDays);
+void drawMoonLabel(int day);
 void drawStars(); // Add this prototype
-void displayImage(const String& filename);
-uint16_t read16(File &f);
-uint32_t read32(File &f);
-Point3D rotateX(Point3D p, float angle);
-Point3D rotateY(Point3D p, float angle);
-Point3D rotateZ(Point3D p, float angle);
-Point project(Point3D p);
-
-uint16_t hsvToRgb565(int hue, uint8_t sat, uint8_t val);
+bool imageInit();
+void imageTick(unsigned long now);
+void imageExit();
+inline uint16_t le16(const uint8_t *p);
+inline uint32_t le32(const uint8_t *p);
+const char *bmpReadHeader(File &f, BmpInfo &bi);
+void bmpConvertRow(const BmpInfo &bi, const uint8_t *src, int first, int count, uint16_t *dst);
+bool bmpDecode(File &f, const BmpInfo &bi, int x0, int w, int y0, int h, BmpSink &sink);
+void bmpPanelEmit(BmpSink &sink, int y, int count);
+bool bmpDrawToPanel(File &f, const BmpInfo &bi, int x0, int w, int y0, int h, int sx, int sy);
+void dispSetRowFlip(bool flip);
+const char *img565ReadHeader(File &f, Img565Info &ii);
+bool imgReaderNeed(ImgReader &rd, uint32_t n);
+bool img565UnpackRow(const uint8_t *src, uint32_t len, uint8_t *dst, int width);
+bool img565NextRow(ImgReader &rd, const Img565Info &ii, uint8_t *dst);
+bool img565SkipRow(ImgReader &rd);
+bool img565DrawToPanel(File &f, const Img565Info &ii, int x0, int w, int y0, int h, int sx, int sy);
+void dispSubmitBytes(const uint8_t *buf, uint32_t bytes);
+bool img565Decode(File &f, const Img565Info &ii, int x0, int w, int y0, int h, BmpSink &sink);
+void viewOpen(ImageView &v, File &f, const BmpInfo *bmp, const Img565Info *native);
+void viewSetStep(ImageView &v, uint32_t step, int centerX, int centerY);
+int viewScaledRowOf(uint32_t step, int srcRow);
+void viewFlushRow(ViewScaler &sc);
+void viewScaleEmit(BmpSink &sink, int y, int count);
+bool viewDrawStrip(ImageView &v, int row0, int rows);
+bool viewRedraw(ImageView &v);
+bool viewPan(ImageView &v, bool down);
+void viewZoom(ImageView &v);
+void hwScrollSetLine(int line);
+bool globMatch(const char *pat, const char *str);
+int slideFind(const char *pattern, int index, String &path);
+bool slideStage(Slideshow &ss, int index);
+bool slideStep(Slideshow &ss);
+bool slideDraw(Slideshow &ss);
+bool slidePresent(Slideshow &ss);
+bool slideAdvance(Slideshow &ss, int dir);
+bool slideBegin(Slideshow &ss, const char *pattern);
+void slideEnd(Slideshow &ss);
+bool slideInit();
+void slideTick(unsigned long now);
+void slideRender(unsigned long now);
+void slideExit();
+const char *meshLoadObj(Mesh &m, File &f);
+const char *meshParseObj(Mesh &m, File &f, float (*pos)[3]);
+void meshTransform(Mesh &m, const FixMat3 &rot);
+void meshSpan(uint16_t *row, int bx0, int bw, int xa, int xb, uint16_t color);
+void meshRasterBand(const Mesh &m, uint16_t *buf, int bx0, int bw, int y0, int rows);
+uint32_t meshDrawFrame(Mesh &m, const FixMat3 &rot);
+bool modelInit();
+void modelTick(unsigned long now);
+void modelRender(unsigned long now);
+void modelExit();
+Point project(const FixVec3 &p);
+fix16 fixMul(fix16 a, fix16 b);
+fix16 fixSinStep(int step);
+fix16 fixSin(uint16_t angle);
+fix16 fixCos(uint16_t angle);
+FixMat3 fixRotationXYZ(uint16_t ax, uint16_t ay, uint16_t az);
+FixVec3 fixTransform(const FixMat3 &m, const FixVec3 &v);
+
+constexpr uint16_t hsvToRgb565(int hue, uint8_t sat, uint8_t val);
 
 void wdt_disable_platform() {
     // This is the correct function call for most RP2040 cores 
@@ -288,28 +1159,14 @@ void wdt_enable_platform() {
 }
 
 void invalidateTerminalCache() {
-    prevVisibleCount = 0;
-}
-// Helper function to read a 16-bit value from a file (BMP uses little-endian)
-uint16_t read16(File &f) {
-  uint16_t result;
-  uint8_t buffer[2];
-  if (f.read(buffer, 2) == 2) {
-    result = buffer[0] | (buffer[1] << 8);
-    return result;
-  }
-  return 0; // Error case
-}
-
-// Helper function to read a 32-bit value from a file (BMP uses little-endian)
-uint32_t read32(File &f) {
-  uint32_t result;
-  uint8_t buffer[4];
-  if (f.read(buffer, 4) == 4) {
-    result = buffer[0] | (buffer[1] << 8) | (buffer[2] << 16) | (buffer[3] << 24);
-    return result;
-  }
-  return 0; // Error case
+    termInvalidateRows(0, MAX_LINES);
+}
+// Little-endian field readers for file headers (BMP, image containers)
+inline uint16_t le16(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+inline uint32_t le32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
 }
 void drawStars() {
     const int numStars = 150;
@@ -322,8 +1179,8 @@ void drawStars() {
     }
 }
 
-uint16_t hsvToRgb565(int hue, uint8_t sat, uint8_t val) {
-    uint8_t r, g, b;
+constexpr uint16_t hsvToRgb565(int hue, uint8_t sat, uint8_t val) {
+    uint8_t r = 0, g = 0, b = 0;
     hue = hue % 360; 
     
     if (val == 0) {
@@ -348,34 +1205,70 @@ uint16_t hsvToRgb565(int hue, uint8_t sat, uint8_t val) {
     // Convert 8-bit R,G,B to 16-bit RGB565
     return ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3);
 }
-
-// *** 3D CUBE IMPLEMENTATION ***
-
-Point3D rotateX(Point3D p, float angle) {
-    float rad = angle * PI / 180.0;
-    float cosA = cos(rad);
-    float sinA = sin(rad);
-    return {p.x, p.y * cosA - p.z * sinA, p.y * sinA + p.z * cosA};
+// Every whole hue at full saturation and value: the mood light's palette.
+struct HueTable {
+    uint16_t v[360];
+    constexpr HueTable() : v() {
+        for (int hue = 0; hue < 360; ++hue) v[hue] = hsvToRgb565(hue, 255, 255);
+    }
+};
+constexpr HueTable HUE_PALETTE = HueTable();
+// ----------------------------
+// Fixed-point math
+// ----------------------------
+inline fix16 fixMul(fix16 a, fix16 b) {
+    return (fix16)(((int64_t)a * b) >> FIX_SHIFT);
 }
-
-Point3D rotateY(Point3D p, float angle) {
-    float rad = angle * PI / 180.0;
-    float cosA = cos(rad);
-    float sinA = sin(rad);
-    return {p.x * cosA + p.z * sinA, p.y, -p.x * sinA + p.z * cosA};
+// sin at a whole table step, unfolded from the quarter wave.
+inline fix16 fixSinStep(int step) {
+    const int quarter = FIX_SIN_STEPS / 4;
+    step &= FIX_SIN_STEPS - 1;
+    int i = step % quarter;
+    switch (step / quarter) {
+        case 0: return FIX_SIN.v[i];
+        case 1: return FIX_SIN.v[quarter - i];
+        case 2: return -FIX_SIN.v[i];
+        default: return -FIX_SIN.v[quarter - i];
+    }
 }
-
-Point3D rotateZ(Point3D p, float angle) {
-    float rad = angle * PI / 180.0;
-    float cosA = cos(rad);
-    float sinA = sin(rad);
-    return {p.x * cosA - p.y * sinA, p.x * sinA + p.y * cosA, p.z};
+// Rounded linear interpolation between steps.
+fix16 fixSin(uint16_t angle) {
+    const int fracBits = 16 - FIX_SIN_BITS;
+    int step = angle >> fracBits;
+    int frac = angle & ((1 << fracBits) - 1);
+    fix16 a = fixSinStep(step);
+    fix16 b = fixSinStep(step + 1);
+    return a + (((b - a) * frac + (1 << (fracBits - 1))) >> fracBits);
+}
+fix16 fixCos(uint16_t angle) {
+    return fixSin(angle + 16384);
+}
+// Rz * Ry * Rx: about x first, then y, then z; composed once per frame so each
+// vertex costs nine multiplies.
+FixMat3 fixRotationXYZ(uint16_t ax, uint16_t ay, uint16_t az) {
+    fix16 sx = fixSin(ax), cx = fixCos(ax);
+    fix16 sy = fixSin(ay), cy = fixCos(ay);
+    fix16 sz = fixSin(az), cz = fixCos(az);
+    fix16 sysx = fixMul(sy, sx), sycx = fixMul(sy, cx);
+    FixMat3 r = {{
+        {fixMul(cz, cy), fixMul(cz, sysx) - fixMul(sz, cx), fixMul(cz, sycx) + fixMul(sz, sx)},
+        {fixMul(sz, cy), fixMul(sz, sysx) + fixMul(cz, cx), fixMul(sz, sycx) - fixMul(cz, sx)},
+        {-sy, fixMul(cy, sx), fixMul(cy, cx)},
+    }};
+    return r;
 }
+FixVec3 fixTransform(const FixMat3 &m, const FixVec3 &v) {
+    return {fixMul(m.m[0][0], v.x) + fixMul(m.m[0][1], v.y) + fixMul(m.m[0][2], v.z),
+            fixMul(m.m[1][0], v.x) + fixMul(m.m[1][1], v.y) + fixMul(m.m[1][2], v.z),
+            fixMul(m.m[2][0], v.x) + fixMul(m.m[2][1], v.y) + fixMul(m.m[2][2], v.z)};
+}
+
+// *** 3D CUBE IMPLEMENTATION ***
 
 // --- 3D to 2D Projection ---
-Point project(Point3D p) {
+Point project(const FixVec3 &p) {
     // Simple orthographic projection
-    return Point((int)(p.x + SCREEN_WIDTH / 2), (int)(p.y + SCREEN_HEIGHT / 2));
+    return Point((p.x >> FIX_SHIFT) + SCREEN_WIDTH / 2, (p.y >> FIX_SHIFT) + SCREEN_HEIGHT / 2);
 }
 
 // --- Drawing the Cube ---
@@ -393,1334 +1286,2475 @@ void drawRotatingCube(Point* projected_points, uint16_t color) {
         tft.drawLine(p1.x, p1.y, p2.x, p2.y, color);
     }
 }
-void runCubeAnimation() {
+bool cubeInit() {
+    resetHardwareScroll();
     tft.fillScreen(ST77XX_BLACK);
-    
-    // Define the 8 vertices of the cube
-    Point3D vertices[8];
-    float size = 50.0; // Use float to avoid conversion warnings
-    vertices[0] = {-size, -size, -size};
-    vertices[1] = { size, -size, -size};
-    vertices[2] = { size,  size, -size};
-    vertices[3] = {-size,  size, -size};
-    vertices[4] = {-size, -size,  size};
-    vertices[5] = { size, -size,  size};
-    vertices[6] = { size,  size,  size};
-    vertices[7] = {-size,  size,  size};
-
-    float angleX = 0, angleY = 0, angleZ = 0;
-
+    cubeApp.angleX = cubeApp.angleY = cubeApp.angleZ = 0;
+    cubeApp.haveShown = false;
     pushSystemMessage("Starting 3D animation...");
-    delay(1000); 
-
-    tft.fillScreen(ST77XX_BLACK);
-
-    while (true) {
-        Point projected_points[8];
-
-        // --- ERASE OLD CUBE ---
-        for(int i=0; i<8; ++i) {
-            Point3D p = vertices[i];
-            p = rotateX(p, angleX);
-            p = rotateY(p, angleY);
-            p = rotateZ(p, angleZ);
-            projected_points[i] = project(p);
-        }
-        drawRotatingCube(projected_points, ST77XX_BLACK);
-
-        // --- UPDATE ANGLES ---
-        angleX += 1.0;
-        angleY += 1.5;
-        angleZ += 2.0;
-
-        // --- DRAW NEW CUBE ---
-        for(int i=0; i<8; ++i) {
-            Point3D p = vertices[i];
-            p = rotateX(p, angleX);
-            p = rotateY(p, angleY);
-            p = rotateZ(p, angleZ);
-            projected_points[i] = project(p);
-        }
-        drawRotatingCube(projected_points, ST77XX_GREEN);
-        
-        // --- CHECK FOR EXIT ---
-        if (digitalRead(buttonPins[IDX_BACK]) == HIGH) {
-            pushSystemMessage("Exiting 3D animation...");
-            break;
-        }
-
-        delay(15); // Animation speed
+    return true;
+}
+void cubeTick(unsigned long now) {
+    if (appPressed(IDX_BACK, now)) {
+        pushSystemMessage("Exiting 3D animation...");
+        appQuit();
     }
-    
-    // --- RESTORE TERMINAL ---
-    
+}
+void cubeRender(unsigned long now) {
+    // Define the 8 vertices of the cube
+    const fix16 size = 50 * FIX_ONE;
+    const FixVec3 vertices[8] = {
+        {-size, -size, -size}, { size, -size, -size}, { size,  size, -size}, {-size,  size, -size},
+        {-size, -size,  size}, { size, -size,  size}, { size,  size,  size}, {-size,  size,  size},
+    };
+    CubeApp &c = cubeApp;
+
+    // One rotation matrix per frame; each vertex is transformed once.
+    FixMat3 rotation = fixRotationXYZ(c.angleX, c.angleY, c.angleZ);
+    Point projected_points[8];
+    for (int i = 0; i < 8; ++i) projected_points[i] = project(fixTransform(rotation, vertices[i]));
+
+    // --- ERASE OLD CUBE, DRAW NEW ONE ---
+    if (c.haveShown) drawRotatingCube(c.shown, ST77XX_BLACK);
+    drawRotatingCube(projected_points, ST77XX_GREEN);
+    memcpy(c.shown, projected_points, sizeof(c.shown));
+    c.haveShown = true;
+
+    // --- UPDATE ANGLES ---
+    c.angleX += FIX_DEG(1.0);
+    c.angleY += FIX_DEG(1.5);
+    c.angleZ += FIX_DEG(2.0);
+}
+void cubeExit() {
     tft.fillScreen(ST77XX_BLACK);
     invalidateTerminalCache();
     drawFullTerminal();
 }
-void mood() {
-    tft.fillScreen(ST77XX_BLACK);
-    pushSystemMessage("Starting mood light!");
-    drawFullTerminal();
-    delay(1500); 
-    
-    float currentHue = 0.0; // Use a float for the hue
-    int lastHueInt = -1;
-
-    // This loop runs indefinitely until the BACK button is pressed.
-    while (true) {
-        // Check for the exit condition first.
-        if (digitalRead(buttonPins[IDX_BACK]) == HIGH) {
-            pushSystemMessage("Exiting mood light...");
-            break; // Exit the infinite loop.
-        }
-
-        // Increment the hue by a small fractional amount for a smooth transition.
-        currentHue += 0.5; 
-        if (currentHue >= 360.0) {
-            currentHue -= 360.0; // Wrap the hue value back to 0.
+constexpr App CUBE_APP = {"cube", cubeInit, cubeTick, cubeRender, cubeExit, 15};
+// ----------------------------
+// Mood light effects
+// ----------------------------
+// xorshift32: the effects need a few random numbers per pixel row, random() is too slow.
+uint32_t moodRandom() {
+    uint32_t x = moodApp.rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return moodApp.rng = x;
+}
+void moodFillLine(uint16_t *out, uint16_t color) {
+    for (int x = 0; x < SCREEN_WIDTH; ++x) out[x] = color;
+}
+// solid: the whole screen in one hue, around the wheel every 3.6 s.
+bool moodSolidFrame(unsigned long t) {
+    int hue = (t / 10) % 360;
+    if (hue == moodApp.hue) return false; // Same color as on screen
+    moodApp.hue = hue;
+    return true;
+}
+void moodSolidLine(uint16_t *out, int y) {
+    moodFillLine(out, HUE_PALETTE.v[moodApp.hue]);
+}
+// gradient: a quarter of the hue wheel top to bottom, drifting slowly.
+bool moodGradientFrame(unsigned long t) {
+    moodApp.hue = (t / 40) % 360;
+    return true;
+}
+void moodGradientLine(uint16_t *out, int y) {
+    moodFillLine(out, HUE_PALETTE.v[(moodApp.hue + y * 90 / SCREEN_HEIGHT) % 360]);
+}
+// rainbow: diagonal hue bands scrolling up and to the left.
+bool moodRainbowFrame(unsigned long t) {
+    moodApp.hue = (t / 4) % 360;
+    return true;
+}
+void moodRainbowLine(uint16_t *out, int y) {
+    int hue = (moodApp.hue + y) % 360;
+    for (int x = 0; x < SCREEN_WIDTH; ++x) {
+        out[x] = HUE_PALETTE.v[hue];
+        if (++hue == 360) hue = 0;
+    }
+}
+// plasma: three sine waves (columns, rows, diagonals) summed into a palette
+// index. The column and diagonal terms are tabled once per frame, so a pixel is
+// two loads, two adds and a palette lookup.
+bool moodPlasmaStart() {
+    MoodApp &m = moodApp;
+    for (int i = 0; i < 256; ++i) {
+        m.sine[i] = 128 + ((fixSin(i << 8) * 127) >> FIX_SHIFT);
+        m.palette[i] = HUE_PALETTE.v[i * 360 / 256];
+    }
+    return true;
+}
+bool moodPlasmaFrame(unsigned long t) {
+    MoodApp &m = moodApp;
+    uint8_t colPhase = t / 12, diagPhase = t / 23;
+    for (int x = 0; x < SCREEN_WIDTH; ++x) m.plasmaCol[x] = m.sine[(uint8_t)(x * 2 + colPhase)];
+    for (int i = 0; i < SCREEN_WIDTH + SCREEN_HEIGHT - 1; ++i) m.plasmaDiag[i] = m.sine[(uint8_t)(i + diagPhase)];
+    m.plasmaPhase = t / 17;
+    m.plasmaShift = (t / 8) & 255; // Palette cycling
+    return true;
+}
+void moodPlasmaLine(uint16_t *out, int y) {
+    const MoodApp &m = moodApp;
+    const int bias = m.sine[(uint8_t)(y * 3 + m.plasmaPhase)] + (m.plasmaShift << 2);
+    const uint8_t *diag = m.plasmaDiag + y;
+    for (int x = 0; x < SCREEN_WIDTH; ++x) {
+        out[x] = m.palette[(uint8_t)((m.plasmaCol[x] + diag[x] + bias) >> 2)];
+    }
+}
+// fire: heat spreads up from two random seed rows, averaging the three cells
+// below and the one under those and cooling a little per row. Each heat row is
+// updated as its first scanline is generated; the rows below still hold the
+// previous frame, which is what moves the flames up.
+bool moodFireStart() {
+    MoodApp &m = moodApp;
+    m.fire = (uint8_t *)malloc(MOOD_FIRE_W * MOOD_FIRE_H);
+    if (!m.fire) return false;
+    memset(m.fire, 0, MOOD_FIRE_W * MOOD_FIRE_H);
+    // Black, red, yellow, white
+    for (int i = 0; i < 256; ++i) {
+        int r = min(i * 3, 255), g = constrain(i * 3 - 255, 0, 255), b = constrain(i * 3 - 510, 0, 255);
+        m.palette[i] = ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3);
+    }
+    return true;
+}
+bool moodFireFrame(unsigned long t) {
+    uint8_t *seed = moodApp.fire + (MOOD_FIRE_H - 2) * MOOD_FIRE_W;
+    for (int x = 0; x < 2 * MOOD_FIRE_W; ++x) {
+        uint32_t r = moodRandom() & 255;
+        seed[x] = r > 128 ? 255 : 0;
+    }
+    return true;
+}
+void moodFireLine(uint16_t *out, int y) {
+    uint8_t *row = moodApp.fire + (y >> 1) * MOOD_FIRE_W;
+    if ((y & 1) == 0) {
+        const uint8_t *below = row + MOOD_FIRE_W, *below2 = below + MOOD_FIRE_W;
+        uint32_t bits = 0;
+        for (int x = 0; x < MOOD_FIRE_W; ++x) {
+            if ((x & 15) == 0) bits = moodRandom(); // Two bits of cooling per cell
+            int left = below[x > 0 ? x - 1 : x], right = below[x < MOOD_FIRE_W - 1 ? x + 1 : x];
+            int heat = (left + below[x] + right + below2[x]) >> 2, cooling = bits & 3;
+            bits >>= 2;
+            row[x] = heat > cooling ? heat - cooling : 0;
         }
-
-        // Convert the float hue to an integer for comparison and color calculation.
-        int currentHueInt = (int)currentHue;
-
-        // Only redraw the screen if the integer part of the hue has changed.
-        // This is an optimization to avoid unnecessary screen fills.
-        if (currentHueInt != lastHueInt) {
-            uint16_t color = hsvToRgb565(currentHueInt, 255, 255);
-            tft.fillScreen(color);
-            lastHueInt = currentHueInt;
+    }
+    for (int x = 0; x < MOOD_FIRE_W; ++x) out[2 * x] = out[2 * x + 1] = moodApp.palette[row[x]];
+}
+// stars: the drawStars() sky in three parallax layers drifting left.
+bool moodStarsStart() {
+    MoodApp &m = moodApp;
+    for (int i = 0; i < MOOD_STARS; ++i) {
+        MoodStar star = {(uint16_t)random(SCREEN_WIDTH * 4), (uint8_t)random(SCREEN_HEIGHT), (uint8_t)(1 + random(3))};
+        int j = i;
+        for (; j > 0 && m.stars[j - 1].y > star.y; --j) m.stars[j] = m.stars[j - 1];
+        m.stars[j] = star;
+    }
+    return true;
+}
+bool moodStarsFrame(unsigned long t) {
+    MoodApp &m = moodApp;
+    for (int i = 0; i < MOOD_STARS; ++i) {
+        MoodStar &star = m.stars[i];
+        int step = 2 * star.speed * star.speed; // 0.5, 2 and 4.5 pixels per frame
+        star.x = star.x >= step ? star.x - step : star.x + SCREEN_WIDTH * 4 - step;
+    }
+    m.starNext = 0;
+    return true;
+}
+void moodStarsLine(uint16_t *out, int y) {
+    MoodApp &m = moodApp;
+    memset(out, 0, SCREEN_WIDTH * sizeof(uint16_t)); // ST77XX_BLACK
+    for (; m.starNext < MOOD_STARS && m.stars[m.starNext].y <= y; ++m.starNext) {
+        const MoodStar &star = m.stars[m.starNext];
+        int x = star.x >> 2;
+        if (star.speed == 1) out[x] = 0x8410; // Grey
+        else if (star.speed == 2) out[x] = ST77XX_YELLOW;
+        else {
+            out[x] = ST77XX_WHITE;
+            if (x + 1 < SCREEN_WIDTH) out[x + 1] = ST77XX_WHITE; // Near stars streak
         }
-        
-        delay(5); // A small delay to control the speed of the cycle.
     }
+}
+constexpr MoodEffect MOOD_EFFECTS[] = {
+    {"solid",    nullptr,         moodSolidFrame,    moodSolidLine},
+    {"gradient", nullptr,         moodGradientFrame, moodGradientLine},
+    {"rainbow",  nullptr,         moodRainbowFrame,  moodRainbowLine},
+    {"plasma",   moodPlasmaStart, moodPlasmaFrame,   moodPlasmaLine},
+    {"fire",     moodFireStart,   moodFireFrame,     moodFireLine},
+    {"stars",    moodStarsStart,  moodStarsFrame,    moodStarsLine},
+};
+constexpr size_t MOOD_EFFECT_COUNT = sizeof(MOOD_EFFECTS) / sizeof(MOOD_EFFECTS[0]);
 
+const MoodEffect *moodFindEffect(const char *name) {
+    for (size_t i = 0; i < MOOD_EFFECT_COUNT; ++i) {
+        if (strcasecmp(name, MOOD_EFFECTS[i].name) == 0) return &MOOD_EFFECTS[i];
+    }
+    return nullptr;
+}
+// Resets the shared state and runs the effect's start hook.
+bool moodEffectStart() {
+    MoodApp &m = moodApp;
+    m.frames = 0;
+    m.hue = -1;
+    m.fire = nullptr;
+    m.rng = 0x9E3779B9u ^ micros();
+    return !m.effect->start || m.effect->start();
+}
+void moodEffectStop() {
+    free(moodApp.fire);
+    moodApp.fire = nullptr;
+}
+// Generates and sends one frame. The last band is still in flight on return.
+bool moodDrawFrame(unsigned long t) {
+    MoodApp &m = moodApp;
+    if (!m.effect->frame(t)) return false;
+    const int bandRows = DISP_BUF_PIXELS / SCREEN_WIDTH;
+    dispBeginWindow(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
+    for (int y = 0; y < SCREEN_HEIGHT; y += bandRows) {
+        int rows = min(bandRows, SCREEN_HEIGHT - y);
+        uint16_t *buf = dispRowBuffer();
+        for (int r = 0; r < rows; ++r) m.effect->line(buf + r * SCREEN_WIDTH, y + r);
+        dispSubmit(buf, rows * SCREEN_WIDTH);
+    }
+    m.frames++;
+    return true;
+}
+bool moodInit() {
+    if (!moodEffectStart()) {
+        pushSystemMessage("Error: Not enough RAM for " + String(moodApp.effect->name) + ".");
+        return false;
+    }
+    resetHardwareScroll();
+    tft.fillScreen(ST77XX_BLACK);
+    pushSystemMessage("Starting mood light: " + String(moodApp.effect->name) + "!");
+    drawFullTerminal();
+    moodApp.startAt = millis() + 1500;
+    return true;
+}
+void moodTick(unsigned long now) {
+    if (appPressed(IDX_BACK, now)) {
+        pushSystemMessage("Exiting mood light...");
+        appQuit();
+    }
+}
+void moodRender(unsigned long now) {
+    if ((long)(now - moodApp.startAt) < 0) return;
+    moodDrawFrame(now - moodApp.startAt);
+}
+void moodExit() {
     // Restore the terminal interface.
+    dispEndWindow();
+    moodEffectStop();
+    unsigned long ms = millis() - moodApp.startAt;
+    if ((long)ms > 0 && moodApp.frames) {
+        uint32_t tenths = (uint64_t)moodApp.frames * 10000 / ms;
+        pushSystemMessage("Mood: " + String(tenths / 10) + "." + String(tenths % 10) + " fps, worst frame " +
+                          String(appStats.worstUs / 1000) + " ms, " + String(appStats.overruns) + " late");
+    }
     tft.fillScreen(ST77XX_BLACK);
     invalidateTerminalCache(); // Clear the visual cache
     drawFullTerminal();        // Force a full redraw of the terminal
 }
+constexpr App MOOD_APP = {"mood", moodInit, moodTick, moodRender, moodExit, MOOD_FRAME_MS};
 
+// Shadow center relative to the moon's: sweeps 4r across the moon over the phases.
+int moonTerminator(int day, int totalDays) {
+    return -(2 * MOON_RADIUS) + day * 4 * MOON_RADIUS / (totalDays - 1);
+}
+// Lit part of scanline dy: the disc minus the shadow, a disc of the same radius
+// (so the same half width) centered on the terminator. Returns the span count.
+int moonLitSpans(int dy, int terminator, MoonSpan *out) {
+    const int h = MOON_DISC.half[abs(dy)];
+    int start = max(-h, terminator - h), end = min(h, terminator + h);
+    int n = 0;
+    if (start >= end) start = end = h; // No overlap: the whole slice is lit
+    if (-h < start) out[n++] = {-h, start + h, ST77XX_WHITE};
+    if (end < h) out[n++] = {end, h - end, ST77XX_WHITE};
+    return n;
+}
+// Pixels of scanline dy that change when the terminator moves: the old shadow
+// minus the new one turns white, the new minus the old black. Up to 4 spans.
+int moonDeltaSpans(int dy, int from, int to, MoonSpan *out) {
+    const int h = MOON_DISC.half[abs(dy)];
+    int n = 0;
+    auto add = [&](int start, int end, uint16_t color) {
+        start = max(start, -h);
+        end = min(end, h);
+        if (start < end) out[n++] = {start, end - start, color};
+    };
+    // A \ B = [A.start, min(A.end, B.start)) + [max(A.start, B.end), A.end)
+    add(from - h, min(from + h, to - h), ST77XX_WHITE);
+    add(max(from - h, to + h), from + h, ST77XX_WHITE);
+    add(to - h, min(to + h, from - h), ST77XX_BLACK);
+    add(max(to - h, from + h), to + h, ST77XX_BLACK);
+    return n;
+}
+// Full redraw, for entering the viewer: clears the moon box and paints every lit span.
 void drawMoon(int day, int totalDays) {
-    int cx = SCREEN_WIDTH / 2;
-    int cy = SCREEN_HEIGHT / 2 - 20; // Move moon up to make space for text
-    int r = 60;
-
-    // Clear the drawing area to erase the previous frame.
-    tft.fillRect(cx - r - 1, cy - r - 1, 2 * r + 2, 2 * r + 2, ST77XX_BLACK);
-
-    // Calculate phase and shadow position.
-    float phase = day / (float)(totalDays - 1);
-    int terminator_x = cx - (2 * r) + (int)(phase * 4.0 * r);
-
-    // --- Build the moon scanline by scanline with corrected logic ---
-    for (int y = cy - r; y <= cy + r; y++) {
-        int dy = y - cy;
-
-        // Calculate the boundaries of the full moon shape for this line.
-        int half_width_moon = round(sqrt(r * r - dy * dy));
-        int moon_x1 = cx - half_width_moon;
-        int moon_x2 = cx + half_width_moon;
-
-        // Calculate the boundaries of the shadow shape for this line.
-        int half_width_shadow = 0;
-        if (abs(dy) < r) {
-             half_width_shadow = round(sqrt(r * r - dy * dy));
-        }
-        int shadow_x1 = terminator_x - half_width_shadow;
-        int shadow_x2 = terminator_x + half_width_shadow;
-        
-        // Find the actual start and end of the shadow's intersection with the moon.
-        int intersection_start = max(moon_x1, shadow_x1);
-        int intersection_end   = min(moon_x2, shadow_x2);
-
-        // --- NEW, ROBUST LOGIC ---
-        // First, check if there is any real overlap on this line.
-        if (intersection_start >= intersection_end) {
-            // NO OVERLAP: The shadow is not on the moon here. Draw the full moon slice.
-            tft.drawFastHLine(moon_x1, y, moon_x2 - moon_x1, ST77XX_WHITE);
-        } else {
-            // OVERLAP EXISTS: "Punch out" the shadow by drawing the lit parts around it.
-            // 1. Draw the lit part to the LEFT of the shadow intersection.
-            if (moon_x1 < intersection_start) {
-                tft.drawFastHLine(moon_x1, y, intersection_start - moon_x1, ST77XX_WHITE);
-            }
-            // 2. Draw the lit part to the RIGHT of the shadow intersection.
-            if (intersection_end < moon_x2) {
-                tft.drawFastHLine(intersection_end, y, moon_x2 - intersection_end, ST77XX_WHITE);
-            }
-        }
+    const int r = MOON_RADIUS;
+    tft.fillRect(MOON_CX - r - 1, MOON_CY - r - 1, 2 * r + 2, 2 * r + 2, ST77XX_BLACK);
+    int terminator = moonTerminator(day, totalDays);
+    MoonSpan spans[2];
+    for (int dy = -r; dy <= r; dy++) {
+        int n = moonLitSpans(dy, terminator, spans);
+        for (int i = 0; i < n; ++i) tft.drawFastHLine(MOON_CX + spans[i].x, MOON_CY + dy, spans[i].w, spans[i].color);
     }
-
-    // --- Draw the day number underneath ---
+    drawMoonLabel(day);
+}
+// Steps from one phase to another by repainting only where lit and shadow swap;
+// adjacent phases touch a sliver along each limb of the shadow.
+void drawMoonDelta(int fromDay, int toDay, int totalDays) {
+    int from = moonTerminator(fromDay, totalDays), to = moonTerminator(toDay, totalDays);
+    MoonSpan spans[4];
+    for (int dy = -MOON_RADIUS; dy <= MOON_RADIUS; dy++) {
+        int n = moonDeltaSpans(dy, from, to, spans);
+        for (int i = 0; i < n; ++i) tft.drawFastHLine(MOON_CX + spans[i].x, MOON_CY + dy, spans[i].w, spans[i].color);
+    }
+    drawMoonLabel(toDay);
+}
+// The text is printed over its own black background; only the parts of the old
+// label sticking out past the new one are cleared.
+void drawMoonLabel(int day) {
+    static int shownX = 0, shownW = 0;
     tft.setTextSize(2);
     tft.setTextColor(ST77XX_WHITE, ST77XX_BLACK);
     String dayText = "Phase: " + String(day + 1);
-    
+
     int16_t x1, y1;
     uint16_t w, h;
     tft.getTextBounds(dayText, 0, 0, &x1, &y1, &w, &h);
     int text_x = (SCREEN_WIDTH - w) / 2;
-    int text_y = cy + r + 10;
-
-    // THE FIX: Clear only a small, centered box for the text, not the full width.
-    int clear_width = 120; // A fixed width that's large enough for "Day 30"
-    int clear_x = (SCREEN_WIDTH - clear_width) / 2;
-    tft.fillRect(clear_x, text_y, clear_width, h + 5, ST77XX_BLACK);
-    
+    int text_y = MOON_CY + MOON_RADIUS + 10;
     tft.setCursor(text_x, text_y);
     tft.print(dayText);
+    if (shownX < text_x) tft.fillRect(shownX, text_y, text_x - shownX, h, ST77XX_BLACK);
+    if (shownX + shownW > text_x + w) tft.fillRect(text_x + w, text_y, shownX + shownW - text_x - w, h, ST77XX_BLACK);
+    shownX = text_x;
+    shownW = w;
 
     tft.setTextSize(1);
 }
-/**
- * @brief Enters a dedicated loop to display and control the moon phase viewer.
- * Exits when the BACK button is pressed.
- */
-void runMoonPhase() {
-    int currentDay = 0; // Start at Day 0 (New Moon)
-    const int totalDays = 30;
-
+// Moon phase viewer: PREV/NEXT step a phase, SELECT toggles auto-play, BACK exits.
+bool moonInit() {
+    moonApp.day = moonApp.shownDay = 0; // Start at Day 0 (New Moon)
+    moonApp.playing = false;
+    resetHardwareScroll();
     tft.fillScreen(ST77XX_BLACK);
     drawStars(); // Draw the starfield background once
-    drawMoon(currentDay, totalDays);
-
-    while (true) {
-        unsigned long now = millis();
-        bool dayChanged = false;
-
-        // Check for LEFT button (IDX_PREV)
-        if (digitalRead(buttonPins[IDX_PREV]) == HIGH && (now - lastPressTime[IDX_PREV] > pressCooldown)) {
-            lastPressTime[IDX_PREV] = now;
-            currentDay--;
-            if (currentDay < 0) {
-                currentDay = totalDays - 1; // Wrap around
-            }
-            dayChanged = true;
-        }
-
-        // Check for RIGHT button (IDX_NEXT)
-        if (digitalRead(buttonPins[IDX_NEXT]) == HIGH && (now - lastPressTime[IDX_NEXT] > pressCooldown)) {
-            lastPressTime[IDX_NEXT] = now;
-            currentDay++;
-            if (currentDay >= totalDays) {
-                currentDay = 0; // Wrap around
-            }
-            dayChanged = true;
-        }
-
-        // Check for BACK button to exit
-        if (digitalRead(buttonPins[IDX_BACK]) == HIGH && (now - lastPressTime[IDX_BACK] > pressCooldown)) {
-            lastPressTime[IDX_BACK] = now;
-            break; // Exit the loop
-        }
-
-        if (dayChanged) {
-            drawMoon(currentDay, totalDays);
-        }
-
-        yield(); // Allow other processes to run
+    drawMoon(moonApp.day, MOON_PHASES);
+    return true;
+}
+void moonTick(unsigned long now) {
+    MoonApp &m = moonApp;
+    if (appPressed(IDX_PREV, now)) m.day = (m.day + MOON_PHASES - 1) % MOON_PHASES; // Wrap around
+    if (appPressed(IDX_NEXT, now)) m.day = (m.day + 1) % MOON_PHASES;
+    if (appPressed(IDX_SELECT, now)) {
+        m.playing = !m.playing;
+        m.lastStep = now;
     }
-
+    if (m.playing && now - m.lastStep >= MOON_FRAME_MS) {
+        m.lastStep += MOON_FRAME_MS;
+        m.day = (m.day + 1) % MOON_PHASES;
+    }
+    if (appPressed(IDX_BACK, now)) appQuit();
+}
+void moonRender(unsigned long now) {
+    if (moonApp.day == moonApp.shownDay) return;
+    drawMoonDelta(moonApp.shownDay, moonApp.day, MOON_PHASES);
+    moonApp.shownDay = moonApp.day;
+}
+void moonExit() {
     // Restore terminal interface upon exit
     tft.fillScreen(ST77XX_BLACK);
     invalidateTerminalCache();
     drawFullTerminal();
 }
-void displayImage(const String& filename) {
-    File bmpFile;
-    int bmpWidth, bmpHeight;             // Full W+H of BMP in pixels
-    uint8_t bmpDepth;                    // Bit depth (supports 24)
-    uint32_t bmpImageoffset;             // Start of image data in file
-    // Buffer needs to hold up to SCREEN_WIDTH pixels (3 bytes each for 24-bit)
-    uint8_t rowBuffer[SCREEN_WIDTH * 3];
-    // Screen buffer holds one row in 16-bit format
-    uint16_t screenBuffer[SCREEN_WIDTH];
-
-    bmpFile = LittleFS.open(filename, "r");
-    if (!bmpFile) {
-        pushSystemMessage("Error opening file: " + filename);
-        drawFullTerminal();
-        clearCurrentCommand();
-        return;
+constexpr App MOON_APP = {"moon", moonInit, moonTick, moonRender, moonExit, 0};
+// ----------------------------
+// Pager
+// ----------------------------
+bool pagerOpen(Pager &pg, const String &path) {
+    pg.file = LittleFS.open(path, "r");
+    if (!pg.file) return false;
+    pg.size = pg.file.size();
+    pg.indexCount = 0;
+    pg.stride = 1;
+    pagerShowPage(pg, 0, 0, false);
+    return true;
+}
+// Lays out one page from offset: PAGER_ROWS rows, wrapped at COLS, tabs to 4.
+// Composes it into the grid when draw is set; returns the next page's offset.
+uint32_t pagerLayout(Pager &pg, uint32_t offset, bool draw) {
+    uint8_t block[PAGER_BLOCK];
+    int n = 0, i = 0;
+    int row = 0, col = 0;
+    uint32_t pos = offset;
+    if (draw) {
+        for (int r = 0; r < PAGER_ROWS; ++r) termClearRow(r);
     }
-
-    // --- BMP Header Parsing (mostly unchanged) ---
-    if (read16(bmpFile) != 0x4D42) { /* ... error handling ... */ return; }
-    read32(bmpFile); // filesize
-    read32(bmpFile); // reserved
-    bmpImageoffset = read32(bmpFile); // pixel data offset
-    read32(bmpFile); // DIB header size
-    bmpWidth = read32(bmpFile);
-    bmpHeight = read32(bmpFile);
-    if (read16(bmpFile) != 1) { /* ... error handling ... */ return; } // planes
-    bmpDepth = read16(bmpFile); // bits per pixel
-    if ((bmpDepth != 24) || (read32(bmpFile) != 0)) { /* ... error handling ... */ return; } // uncompressed
-
-    // BMP rows padded to 4-byte boundary
-    uint32_t rowSize = (bmpWidth * 3 + 3) & ~3;
-
-    // --- Clipping & Centering Calculations ---
-    int drawWidth = min(bmpWidth, SCREEN_WIDTH);
-    int drawHeight = min(bmpHeight, SCREEN_HEIGHT);
-
-    // Calculate starting X pixel offset within the BMP data
-    int bmpXOffset = 0;
-    if (bmpWidth > SCREEN_WIDTH) {
-        bmpXOffset = (bmpWidth - SCREEN_WIDTH) / 2;
+    pg.file.seek(offset);
+    while (row < PAGER_ROWS) {
+        if (i == n) {
+            n = pg.file.read(block, sizeof(block));
+            i = 0;
+            if (n <= 0) break;
+        }
+        char c = (char)block[i];
+        if (col == COLS) { // Full row: wrap, swallowing a newline that ends it exactly
+            row++;
+            col = 0;
+            if (c == '\n') { i++; pos++; }
+            continue;
+        }
+        i++;
+        pos++;
+        if (c == '\n') { row++; col = 0; continue; }
+        if (c == '\r') continue;
+        if (c == '\t') { col = min((col / 4 + 1) * 4, COLS); continue; }
+        if ((uint8_t)c < 32 || (uint8_t)c > 126) c = '.';
+        if (draw) termSetCell(row, col, c, ST77XX_WHITE, ST77XX_BLACK);
+        col++;
     }
-    // Calculate starting Y row within the BMP data (remember BMP is bottom-up)
-    int bmpYStartRow = 0;
-    if (bmpHeight > SCREEN_HEIGHT) {
-        bmpYStartRow = (bmpHeight - SCREEN_HEIGHT) / 2;
+    return pos;
+}
+// Pages are reached one step at a time from page 0, so entries stay contiguous.
+void pagerIndexPage(Pager &pg) {
+    if (pg.page % pg.stride || pg.page / pg.stride != pg.indexCount) return;
+    if (pg.indexCount == PAGER_INDEX_SLOTS) {
+        for (int i = 0; i < PAGER_INDEX_SLOTS / 2; ++i) pg.index[i] = pg.index[2 * i];
+        pg.indexCount = PAGER_INDEX_SLOTS / 2;
+        pg.stride *= 2;
+        if (pg.page % pg.stride) return;
     }
-    // Calculate the ending Y row within the BMP data
-    int bmpYEndRow = bmpYStartRow + drawHeight;
-
-    // Calculate where to start drawing on the screen (centering the *clipped* image)
-    int screenXStart = (SCREEN_WIDTH - drawWidth) / 2;
-    int screenYStart = (SCREEN_HEIGHT - drawHeight) / 2;
-
-
-    // --- Drawing Logic ---
-    tft.fillScreen(ST77XX_BLACK); // Clear screen
-
-    // Loop through the visible rows of the BMP (bottom-up)
-    for (int bmpRow = bmpYStartRow; bmpRow < bmpYEndRow; bmpRow++) {
-        // Calculate the file offset for the start of the desired *section* of the BMP row
-        uint32_t filePos = bmpImageoffset + (bmpHeight - 1 - bmpRow) * rowSize + bmpXOffset * 3;
-        bmpFile.seek(filePos);
-
-        // Read only the necessary pixel data for the visible width
-        if (bmpFile.read(rowBuffer, drawWidth * 3) != drawWidth * 3) {
-             pushSystemMessage("Error: File read failed.");
-             break; // Exit drawing loop
-        }
-
-        // Convert 24-bit BGR to 16-bit RGB565 for the screen buffer
-        int bufIdx = 0;
-        for (int col = 0; col < drawWidth; col++) {
-            uint8_t b = rowBuffer[bufIdx++];
-            uint8_t g = rowBuffer[bufIdx++];
-            uint8_t r = rowBuffer[bufIdx++];
-            screenBuffer[col] = tft.color565(r, g, b);
-        }
-
-        // Calculate the screen Y coordinate for this row
-        // (bmpRow - bmpYStartRow) gives the row index within the clipped area (0 to drawHeight-1)
-        int screenY = screenYStart + (bmpRow - bmpYStartRow);
-
-        // Draw the row buffer to the screen at the calculated position
-        tft.drawRGBBitmap(screenXStart, screenY, screenBuffer, drawWidth, 1);
-        yield(); // Allow background tasks
-    }
-
-    bmpFile.close();
-
-    // === Wait for BACK button press (unchanged) ===
-    pushSystemMessage("Press BACK to exit image viewer...");
-    // --- FIXED Wait for BACK Button Press ---
-    unsigned long timeButtonLastChecked = millis(); // Use a separate timer for polling
-    bool backButtonPressed = false;
-
-    while (!backButtonPressed) {
-        // Check button state periodically
-        if (millis() - timeButtonLastChecked > 50) { // Check every 50ms (adjust if needed)
-            if (digitalRead(buttonPins[IDX_BACK]) == HIGH) {
-                // Button is pressed, now wait for release (simple debounce)
-                delay(pressCooldown); // Wait for debounce period
-                // Optional: Check if still pressed after delay to confirm,
-                // but for exiting, just detecting the initial press is usually fine.
-                backButtonPressed = true; // Set flag to exit loop
-            }
-            timeButtonLastChecked = millis(); // Reset polling timer
-        }
-        yield(); // IMPORTANT: Keep yielding in the wait loop
+    pg.index[pg.indexCount++] = pg.pageStart;
+}
+void pagerShowPage(Pager &pg, uint32_t page, uint32_t offset, bool draw) {
+    pg.page = page;
+    pg.pageStart = offset;
+    pg.nextStart = pagerLayout(pg, offset, draw);
+    pagerIndexPage(pg);
+}
+bool pagerNext(Pager &pg, bool draw) {
+    if (pg.nextStart >= pg.size) return false;
+    pagerShowPage(pg, pg.page + 1, pg.nextStart, draw);
+    return true;
+}
+// Seeks to the nearest indexed page at or before the target and lays out forward from there.
+bool pagerPrev(Pager &pg, bool draw) {
+    if (pg.page == 0) return false;
+    uint32_t target = pg.page - 1;
+    uint32_t entry = min(target / pg.stride, (uint32_t)pg.indexCount - 1);
+    uint32_t offset = pg.index[entry];
+    for (uint32_t p = entry * pg.stride; p < target; ++p) offset = pagerLayout(pg, offset, false);
+    pagerShowPage(pg, target, offset, draw);
+    return true;
+}
+void pagerDrawStatus(const Pager &pg, const char *name) {
+    char buf[COLS + 1];
+    uint32_t pct = pg.size ? (uint32_t)((uint64_t)pg.nextStart * 100 / pg.size) : 100;
+    int len = snprintf(buf, sizeof(buf), " %s  p%lu  %lu%%%s", name, (unsigned long)pg.page + 1,
+                       (unsigned long)pct, pg.nextStart >= pg.size ? " (END)" : "");
+    termClearRow(PAGER_ROWS, ST77XX_GREEN);
+    termPutText(PAGER_ROWS, 0, buf, min(len, COLS), ST77XX_BLACK, ST77XX_GREEN);
+}
+// Full-screen pager: PREV/NEXT page, SELECT back to the top, BACK exits.
+// Only the visible page is ever read, so large files open immediately.
+bool pagerInit() {
+    Pager &pg = pagerApp.pg;
+    if (!pagerOpen(pg, pagerApp.path)) {
+        pushSystemMessage("Error: Could not open file.");
+        return false;
     }
-
-    // === Restore Terminal (unchanged) ===
-    tft.fillScreen(ST77XX_BLACK);
-    invalidateTerminalCache();
-    drawFullTerminal();
-    clearCurrentCommand();
+    resetHardwareScroll();
+    pagerShowPage(pg, 0, 0, true);
+    pagerDrawStatus(pg, pagerApp.path.c_str());
+    termFlushRows(0, MAX_LINES);
+    return true;
 }
-// ----------------------------
-// Calculates the wrapped segments of the ENTIRE command buffer content.
-// ----------------------------
-void calculateFullWrapSegments(const String &input, String outLines[], int &count, int maxOut, bool startsAsContinuation) {
-    count = 0;
-    int pos = 0;
-    int inputLength = input.length();
-    
-    if (inputLength == 0) {
-        if (count < maxOut) outLines[count++] = "";
-        return;
+void pagerTick(unsigned long now) {
+    Pager &pg = pagerApp.pg;
+    bool changed = false;
+    if (appPressed(IDX_PREV, now)) changed = pagerPrev(pg, true);
+    if (appPressed(IDX_NEXT, now)) changed = pagerNext(pg, true);
+    if (appPressed(IDX_SELECT, now) && pg.page != 0) {
+        pagerShowPage(pg, 0, 0, true);
+        changed = true;
     }
+    if (appPressed(IDX_BACK, now)) appQuit();
 
-    // --- 1. Handle the FIRST line ---
-    int firstLineCapacity = startsAsContinuation ? WRAP_COLS : (WRAP_COLS - promptCols());
-    if (count < maxOut) {
-        int len = min(inputLength, firstLineCapacity);
-        outLines[count++] = input.substring(pos, pos + len);
-        pos += len;
-    } else {
-        return;
-    }
-    
-    // --- 2. Handle subsequent lines (always Full WRAP_COLS capacity) ---
-    while (pos < inputLength && count < maxOut) {
-        int rem = inputLength - pos;
-        int len = min(rem, WRAP_COLS); 
-        outLines[count++] = input.substring(pos, pos + len);
-        pos += len;
+    if (changed) {
+        pagerDrawStatus(pg, pagerApp.path.c_str());
+        termFlushRows(0, MAX_LINES);
     }
 }
+void pagerExit() {
+    pagerApp.pg.file.close();
+    drawFullTerminal(); // Repaints the terminal over the page through the cell diff
+}
+constexpr App PAGER_APP = {"more", pagerInit, pagerTick, nullptr, pagerExit, 0};
 // ----------------------------
-// Scrollback / push helpers
+// BMP decoding
 // ----------------------------
-void pushScrollback(const String &text, uint16_t color) { 
-    int current = 0;
-    int next = -1;
-    const int SCROLLBACK_LINE_WIDTH = COLS; // 40 characters wide
-    
-    // Loop to find all explicit newline characters ('\n')
-    do {
-        next = text.indexOf('\n', current);
-        String line;
-        
-        if (next == -1) {
-            line = text.substring(current);
-        } else {
-            line = text.substring(current, next);
+// Parses the file and info headers (BITMAPINFOHEADER or later) and the palette.
+// Returns nullptr on success, otherwise a short reason.
+const char *bmpReadHeader(File &f, BmpInfo &bi) {
+    uint8_t h[66]; // File header + 40-byte info header + BI_BITFIELDS masks
+    f.seek(0);
+    int got = f.read(h, sizeof(h));
+    imgStats.reads++;
+    imgStats.bytesRead += max(got, 0);
+    if (got < 54 || le16(h) != 0x4D42) return "Not a BMP file";
+
+    uint32_t dibSize = le32(h + 14);
+    int32_t height = (int32_t)le32(h + 22);
+    uint32_t compression = le32(h + 30);
+    uint32_t colors = le32(h + 46);
+    bi.dataOffset = le32(h + 10);
+    bi.width = (int32_t)le32(h + 18);
+    bi.topDown = height < 0;
+    bi.height = height < 0 ? -height : height;
+    bi.depth = le16(h + 28);
+    bi.rgb555 = (bi.depth == 16);
+    if (dibSize < 40 || le16(h + 26) != 1) return "Unsupported BMP header";
+    if (bi.width <= 0 || bi.height == 0 || bi.width > 8192 || bi.height > 8192) return "Bad BMP size";
+
+    if (compression == 3 && (bi.depth == 16 || bi.depth == 32)) { // BI_BITFIELDS
+        if (got < 66) return "Bad BMP header";
+        uint32_t redMask = le32(h + 54);
+        if (bi.depth == 16 && redMask == 0xF800) bi.rgb555 = false;
+        else if (bi.depth == 16 && redMask == 0x7C00) bi.rgb555 = true;
+        else if (bi.depth != 32 || redMask != 0x00FF0000) return "Unsupported BMP bit masks";
+    } else if (compression != 0) {
+        return "Compressed BMP not supported";
+    }
+    if (bi.depth != 1 && bi.depth != 4 && bi.depth != 8 && bi.depth != 16 && bi.depth != 24 && bi.depth != 32) {
+        return "Unsupported BMP depth";
+    }
+    bi.rowSize = ((uint32_t)bi.width * bi.depth + 31) / 32 * 4;
+
+    if (bi.depth <= 8) {
+        uint32_t count = colors ? min(colors, (uint32_t)(1u << bi.depth)) : (1u << bi.depth);
+        memset(bi.palette, 0, sizeof(bi.palette));
+        f.seek(14 + dibSize);
+        got = f.read(bmpBlock, count * 4);
+        imgStats.seeks++;
+        imgStats.reads++;
+        imgStats.bytesRead += max(got, 0);
+        if (got != (int)(count * 4)) return "Bad BMP palette";
+        for (uint32_t i = 0; i < count; ++i) { // BGRX entries
+            const uint8_t *e = bmpBlock + i * 4;
+            bi.palette[i] = ((e[2] & 0xF8) << 8) | ((e[1] & 0xFC) << 3) | (e[0] >> 3);
         }
-        
-        current = next + 1; // Advance for the next iteration
-        
-        // --- Line Segment Insertion Logic (Handles character-wrapping) ---
-        if (line.length() > 0) {
-            int linePos = 0;
-            while (linePos < line.length()) {
-                // Calculate the segment length (max of 40 characters or the remaining length)
-                int segmentLength = min((int)line.length() - linePos, SCROLLBACK_LINE_WIDTH);
-                
-                String segment = line.substring(linePos, linePos + segmentLength);
-                linePos += segmentLength;
-
-                // Insert the segment into the scrollback buffer
-                int idx;
-                if (scrollbackCount < SCROLLBACK_SIZE) {
-                    idx = (scrollbackHead + scrollbackCount) % SCROLLBACK_SIZE;
-                    scrollbackCount++;
-                } else {
-                    idx = scrollbackHead;
-                    scrollbackHead = (scrollbackHead + 1) % SCROLLBACK_SIZE;
-                }
-
-                // --- NEW LED BLINK TRIGGER ---
-                ledBlinkEndTime = millis() + LED_BLINK_DURATION_MS;
-                digitalWrite(STATUS_LED_PIN, HIGH); // Turn LED ON
-                // -----------------------------    
-
-                scrollback[idx].text = segment;
-                scrollback[idx].color = color;
-                terminalScrollOffset = 0;
+    }
+    return nullptr;
+}
+// Converts count pixels, starting at pixel first of the row at src, to RGB565.
+// The RP2040's M0+ has no SIMD, so the 24/32-bit paths do two pixels per
+// iteration with shifts and masks; palettized rows are a lookup per pixel.
+void bmpConvertRow(const BmpInfo &bi, const uint8_t *src, int first, int count, uint16_t *dst) {
+    switch (bi.depth) {
+        case 24:
+        case 32: {
+            const int step = bi.depth / 8;
+            const uint8_t *p = src + first * step;
+            int i = 0;
+            for (; i + 1 < count; i += 2, p += 2 * step) { // BGR(X) byte order
+                dst[i] = ((p[2] & 0xF8) << 8) | ((p[1] & 0xFC) << 3) | (p[0] >> 3);
+                dst[i + 1] = ((p[step + 2] & 0xF8) << 8) | ((p[step + 1] & 0xFC) << 3) | (p[step] >> 3);
             }
-        } else if (line.length() == 0 && next != -1) {
-            // Handle explicit empty line (two consecutive \n)
-            int idx;
-            if (scrollbackCount < SCROLLBACK_SIZE) {
-                idx = (scrollbackHead + scrollbackCount) % SCROLLBACK_SIZE;
-                scrollbackCount++;
-            } else {
-                idx = scrollbackHead;
-                scrollbackHead = (scrollbackHead + 1) % SCROLLBACK_SIZE;
+            if (i < count) dst[i] = ((p[2] & 0xF8) << 8) | ((p[1] & 0xFC) << 3) | (p[0] >> 3);
+            break;
+        }
+        case 16: {
+            const uint8_t *p = src + first * 2;
+            for (int i = 0; i < count; ++i, p += 2) {
+                uint16_t v = p[0] | (p[1] << 8);
+                // 555: shift red and green up one bit, copy green's top bit into its new low bit
+                dst[i] = bi.rgb555 ? (((v & 0x7FE0) << 1) | ((v >> 4) & 0x20) | (v & 0x1F)) : v;
             }
-            scrollback[idx].text = "";
-            scrollback[idx].color = color;
-            terminalScrollOffset = 0;
+            break;
         }
-
-        if (next == -1) break; 
-        
-    } while (true);
-    
-    // As before, redraw is handled by the caller (e.g., executeCommandLine)
-}
-// ----------------------------
-// System messages: GREEN SYS LABEL
-// ----------------------------
-void pushSystemMessage(const String &s) {
-    pushScrollback(SYS_PROMPT + s, ST77XX_GREEN);  // <-- CRITICAL: Set color to GREEN
-}
-// ----------------------------
-// Draw only the scrollback area (top region) with bottom-up newest placement.
-// ----------------------------
-void drawScrollbackArea(int availableOutputRows) {
-    if (availableOutputRows <= 0) {
-        // Clear all previous lines
-        for (int r = 0; r < prevVisibleCount; ++r) {
-            if (prevVisibleLines[r] != "") {
-                tft.fillRect(0, r * LINE_HEIGHT, SCREEN_WIDTH, LINE_HEIGHT, ST77XX_BLACK);
-                prevVisibleLines[r] = "";
+        case 8: {
+            const uint8_t *p = src + first;
+            for (int i = 0; i < count; ++i) dst[i] = bi.palette[p[i]];
+            break;
+        }
+        default: { // 4 and 1 bits per pixel, most significant bits first
+            const int perByte = 8 / bi.depth;
+            const uint8_t mask = (1 << bi.depth) - 1;
+            for (int i = 0; i < count; ++i) {
+                int px = first + i;
+                int shift = 8 - bi.depth * (px % perByte + 1);
+                dst[i] = bi.palette[(src[px / perByte] >> shift) & mask];
             }
         }
-        prevVisibleCount = 0;
-        return;
     }
-
-    int newestGlobal = scrollbackCount - 1 - terminalScrollOffset;
-    if (newestGlobal < 0) newestGlobal = 0;
-    
-    for (int slot = 0; slot < availableOutputRows; ++slot) {
-        int visualRow = (availableOutputRows - 1) - slot;
-        int globalIndex = newestGlobal - slot;
-        
-        String toDraw = "";
-        uint16_t color = ST77XX_WHITE; // Default fallback
-
-        if (globalIndex >= 0 && scrollbackCount > 0) {
-            int idx = (scrollbackHead + globalIndex) % SCROLLBACK_SIZE;
-            
-            toDraw = scrollback[idx].text;
-            color = scrollback[idx].color; 
-        }
-
-        // Optimization Check: Only redraw the row if the content has changed
-        if (visualRow >= prevVisibleCount || prevVisibleLines[visualRow] != toDraw) {
-            int y = visualRow * LINE_HEIGHT;
-            
-            // 1. Clear the line before drawing
-            tft.fillRect(0, y, SCREEN_WIDTH, LINE_HEIGHT, ST77XX_BLACK);
-            
-            // 2. CHECK FOR RAINBOW SIGNAL (ST77XX_BLACK) - Unchanged
-            if (color == ST77XX_BLACK && toDraw.length() > 0) {
-                // ... (Rainbow logic, untouched)
-                int idx = (scrollbackHead + globalIndex) % SCROLLBACK_SIZE;
-                int x = 0;
-                
-                for (int i = 0; i < toDraw.length() && i < MAX_RAINBOW_CHARS; ++i) {
-                    uint16_t charColor = rainbowColors[idx][i];
-                    
-                    // Override the SYS_PROMPT part to be solid GREEN 
-                    if (i < SYS_PROMPT.length()) {
-                        charColor = ST77XX_GREEN;
-                    }
-                    
-                    tft.setCursor(x, y);
-                    tft.setTextColor(charColor, ST77XX_BLACK);
-                    tft.print(toDraw.charAt(i));
-                    
-                    x += CHAR_WIDTH;
-                }
-                prevVisibleLines[visualRow] = toDraw; // Update cache
-                
-            } else if (toDraw.length() > 0) {
-                // 3. Draw standard single-color text using the color from the struct
-                tft.setCursor(0, y);
-                
-                // --- Split-Color Logic for PROMPT and System Messages ---
-                if (toDraw.startsWith(PROMPT)) {
-                    tft.setTextColor(ST77XX_CYAN, ST77XX_BLACK);
-                    tft.print(PROMPT);
-                    tft.setTextColor(ST77XX_WHITE, ST77XX_BLACK);
-                    tft.print(toDraw.substring(PROMPT.length()));
-                } 
-                // SCENARIO A: First line of a system message (starts with "S>")
-                else if (toDraw.startsWith(SYS_PROMPT) && color == ST77XX_GREEN) { 
-                    tft.setTextColor(ST77XX_GREEN, ST77XX_BLACK); // S> in Green
-                    tft.print(SYS_PROMPT);
-                    tft.setTextColor(ST77XX_WHITE, ST77XX_BLACK); // Rest in White
-                    tft.print(toDraw.substring(SYS_PROMPT.length()));
-                }
-                // SCENARIO B: Subsequent wrapped lines of a system message (NO "S>")
-                else if (color == ST77XX_GREEN) {
-                    // FIX: Draw the entire continuation line in White.
-                    tft.setTextColor(ST77XX_WHITE, ST77XX_BLACK); 
-                    tft.print(toDraw);
-                }
-                // END FIX
-                else {
-                    // Default fallback: Use the color stored in the struct for all other lines
-                    tft.setTextColor(color, ST77XX_BLACK);
-                    tft.print(toDraw);
-                }
-                // --- End Single-Color Logic ---
-
-                prevVisibleLines[visualRow] = toDraw; // Update cache
-            } else {
-                // Clear cache for empty lines
-                prevVisibleLines[visualRow] = "";
+}
+// Decodes image rows [y0, y0 + h) and columns [x0, x0 + w) (top-down coordinates),
+// visiting rows in file order: one seek, then block reads of as many whole rows as
+// fit in bmpBlock. Rows wider than the block are read per row, visible bytes only,
+// in block-sized chunks when the visible span is wider still.
+bool bmpDecode(File &f, const BmpInfo &bi, int x0, int w, int y0, int h, BmpSink &sink) {
+    const uint32_t firstFileRow = bi.topDown ? y0 : bi.height - y0 - h;
+    const int rowsPerBlock = BMP_BLOCK_BYTES / bi.rowSize;
+
+    if (rowsPerBlock > 0) {
+        f.seek(bi.dataOffset + firstFileRow * bi.rowSize);
+        imgStats.seeks++;
+        for (int done = 0; done < h;) {
+            int rows = min(rowsPerBlock, h - done);
+            int want = rows * bi.rowSize;
+            int got = f.read(bmpBlock, want);
+            imgStats.reads++;
+            imgStats.bytesRead += max(got, 0);
+            if (got != want) return false;
+            for (int r = 0; r < rows; ++r, ++done) {
+                bmpConvertRow(bi, bmpBlock + r * bi.rowSize, x0, w, sink.buf);
+                sink.emit(sink, bi.topDown ? done : h - 1 - done, w);
             }
+            yield();
         }
+        return true;
     }
 
-    // Clear any old scrollback lines that are no longer visible
-    for (int r = availableOutputRows; r < prevVisibleCount; ++r) {
-        tft.fillRect(0, r * LINE_HEIGHT, SCREEN_WIDTH, LINE_HEIGHT, ST77XX_BLACK);
-        prevVisibleLines[r] = "";
+    // One byte of slack: a sub-byte chunk may start and end inside a byte.
+    const int chunkPixels = (BMP_BLOCK_BYTES - 1) * 8 / bi.depth;
+    for (int done = 0; done < h; ++done) {
+        for (int first = 0; first < w; first += chunkPixels) {
+            const int count = min(chunkPixels, w - first);
+            const uint32_t spanStart = (uint32_t)(x0 + first) * bi.depth / 8;
+            const uint32_t spanBytes = ((uint32_t)(x0 + first + count) * bi.depth + 7) / 8 - spanStart;
+            f.seek(bi.dataOffset + (firstFileRow + done) * bi.rowSize + spanStart);
+            int got = f.read(bmpBlock, spanBytes);
+            imgStats.seeks++;
+            imgStats.reads++;
+            imgStats.bytesRead += max(got, 0);
+            if (got != (int)spanBytes) return false;
+            bmpConvertRow(bi, bmpBlock, x0 + first - spanStart * 8 / bi.depth, count, sink.buf + first);
+        }
+        sink.emit(sink, bi.topDown ? done : h - 1 - done, w);
+        yield();
     }
-    prevVisibleCount = availableOutputRows;
+    return true;
 }
-// ----------------------------
-// DRAWFULLTERMINAL- Draws everything once (scrollback + input lines).
-// ----------------------------
-void drawFullTerminal() {
-    // 1. Calculate all visual line segments from the entire command buffer.
-    String input = String(cmdBuf).substring(0, cmdLen); 
-    const int MAX_CHUNKS = 16;
-    String fwdSegments[MAX_CHUNKS];
-    int fwdCount = 0;
-    calculateFullWrapSegments(input, fwdSegments, fwdCount, MAX_CHUNKS, false);
-    
-    if (fwdCount == 0) fwdCount = 1;
-
-    // Determine how many lines the input will occupy.
-    const int INPUT_LINES_TO_DRAW = min(fwdCount, MAX_LINES);
-    // 2. Determine screen layout, shrinking the history area to make room for the input.
-    int availableOutputRows = MAX_LINES - INPUT_LINES_TO_DRAW; 
-    
-    // Redraw the history/scrollback area in its new, possibly smaller, space.
-    drawScrollbackArea(availableOutputRows);
-
-    // *** MODIFICATION ***
-    // Redraw the input area using the new function
-    drawInputArea();
-
-    drawCursorAndPreview();
-
+// Rows already arrive in window order (see bmpDrawToPanel), so y is not needed.
+void bmpPanelEmit(BmpSink &sink, int y, int count) {
+    dispSubmit(sink.buf, count);
+    sink.buf = dispRowBuffer(); // The other half of the ping-pong pair
+}
+// Streams a decoded region into one address window at (sx, sy). Bottom-up files
+// arrive bottom row first, so the window's row order is mirrored to match.
+bool bmpDrawToPanel(File &f, const BmpInfo &bi, int x0, int w, int y0, int h, int sx, int sy) {
+    const bool flip = !bi.topDown;
+    if (flip) dispSetRowFlip(true);
+    dispBeginWindow(sx, flip ? ST7789_GRAM_LINES - sy - h : sy, w, h);
+    BmpSink sink = {dispRowBuffer(), bmpPanelEmit, nullptr};
+    bool ok = bmpDecode(f, bi, x0, w, y0, h, sink);
+    dispEndWindow();
+    if (flip) dispSetRowFlip(false);
+    return ok;
 }
 // ----------------------------
-// drawInputArea() - Draws ONLY the command input area (no scrollback, no cursor)
+// Native .565 decoding
 // ----------------------------
-void drawInputArea() {
-    // 1. Calculate all visual line segments from the entire command buffer.
-    String input = String(cmdBuf).substring(0, cmdLen); 
-    const int MAX_CHUNKS = 16;
-    String fwdSegments[MAX_CHUNKS];
-    int fwdCount = 0;
-    calculateFullWrapSegments(input, fwdSegments, fwdCount, MAX_CHUNKS, false);
-    
-    if (fwdCount == 0) fwdCount = 1; // Always at least one line
-
-    // Determine how many lines the input will occupy.
-    const int INPUT_LINES_TO_DRAW = min(fwdCount, MAX_LINES);
-    // 2. Determine screen layout
-    int availableOutputRows = MAX_LINES - INPUT_LINES_TO_DRAW; 
-    
-    // 3. Clear the entire input area before redrawing.
-    int yStart = availableOutputRows * LINE_HEIGHT;
-    if (yStart < SCREEN_HEIGHT) {
-        tft.fillRect(0, yStart, SCREEN_WIDTH, SCREEN_HEIGHT - yStart, ST77XX_BLACK);
-    }
-
-    // 4. Loop to draw all *visible* segments of the command.
-    for (int i = 0; i < INPUT_LINES_TO_DRAW; ++i) {
-        int segmentIndex = fwdCount - INPUT_LINES_TO_DRAW + i; 
-        if (segmentIndex >= 0 && segmentIndex < fwdCount) {
-            int y = (availableOutputRows + i) * LINE_HEIGHT;
-            int xOffset = 0;
-            
-            if (segmentIndex == 0) {
-                tft.fillRect(0, y, promptCols() * CHAR_WIDTH, LINE_HEIGHT, ST77XX_BLACK);
-                tft.setCursor(0, y);
-                tft.setTextColor(ST77XX_CYAN, ST77XX_BLACK);
-                tft.print(PROMPT);
-                xOffset = promptCols() * CHAR_WIDTH;
-            }
-            
-            tft.setCursor(xOffset, y); 
-            tft.setTextColor(ST77XX_WHITE, ST77XX_BLACK);
-            tft.print(fwdSegments[segmentIndex]);
-
-            int textWidth = xOffset + fwdSegments[segmentIndex].length() * CHAR_WIDTH;
-            tft.fillRect(textWidth, y, SCREEN_WIDTH - textWidth, LINE_HEIGHT, ST77XX_BLACK);
+// Returns nullptr on success, otherwise a short reason.
+const char *img565ReadHeader(File &f, Img565Info &ii) {
+    uint8_t h[IMG565_HEADER_BYTES];
+    f.seek(0);
+    int got = f.read(h, sizeof(h));
+    imgStats.reads++;
+    imgStats.bytesRead += max(got, 0);
+    if (got != IMG565_HEADER_BYTES || memcmp(h, "I565", 4) != 0) return "Not a .565 file";
+    ii.width = le16(h + 4);
+    ii.height = le16(h + 6);
+    ii.rle = h[8] & IMG565_FLAG_RLE;
+    if (ii.width == 0 || ii.height == 0) return "Bad image size";
+    if (ii.width > IMG565_MAX_WIDTH) return "Image too wide";
+    if (!ii.rle && f.size() < IMG565_HEADER_BYTES + (uint32_t)ii.width * ii.height * 2) return "File truncated";
+    return nullptr;
+}
+// Makes at least n bytes available at bmpBlock + rd.pos, keeping the unread tail.
+bool imgReaderNeed(ImgReader &rd, uint32_t n) {
+    if (rd.len - rd.pos >= n) return true;
+    uint32_t left = rd.len - rd.pos;
+    memmove(bmpBlock, bmpBlock + rd.pos, left);
+    int got = rd.file->read(bmpBlock + left, BMP_BLOCK_BYTES - left);
+    imgStats.reads++;
+    imgStats.bytesRead += max(got, 0);
+    rd.pos = 0;
+    rd.len = left + max(got, 0);
+    return rd.len >= n;
+}
+// Unpacks one RLE row into dst, still in wire order. False unless the packets
+// add up to exactly width pixels.
+bool img565UnpackRow(const uint8_t *src, uint32_t len, uint8_t *dst, int width) {
+    const uint8_t *end = src + len;
+    uint16_t *out = (uint16_t *)dst;
+    int px = 0;
+    while (src < end) {
+        uint8_t ctl = *src++;
+        int n = (ctl & 0x7F) + 1;
+        if (px + n > width) return false;
+        if (ctl & 0x80) {
+            if (end - src < 2) return false;
+            uint16_t wire;
+            memcpy(&wire, src, 2); // Copied as bytes, so no swap either way
+            src += 2;
+            for (int i = 0; i < n; ++i) out[px + i] = wire;
+        } else {
+            if (end - src < 2 * n) return false;
+            memcpy(out + px, src, 2 * n);
+            src += 2 * n;
         }
+        px += n;
     }
+    return px == width;
 }
-// ----------------------------
-// drawCursorAndPreview()  Draws just the cursor and keyboard preview (Interaction point)
-// ----------------------------
-void drawCursorAndPreview() {
-    
-    // --- FORMAT CONFIRMATION DRAWING LOGIC ---
-    if (fkeyState == F_AWAIT_FORMAT_CONFIRM) {
-        const int PROMPT_LEN = 7;
-        const int CURSOR_COL = PROMPT_LEN;
-        int y_pos = (MAX_LINES - 1) * LINE_HEIGHT;
-        int drawX = CURSOR_COL * CHAR_WIDTH;
-        int drawY = y_pos;
-        int padX = drawX - 1;
-        int padY = drawY - 1;
-        int padW = CHAR_WIDTH + 1;
-        int padH = LINE_HEIGHT + 1;
-        
-        char displayChar = ' ';
-        uint16_t fg_color = ST77XX_WHITE;
-        uint16_t bg_color = ST77XX_BLACK;
-        
-        if (formatIndex == 0) { // User selected 'Y'
-            displayChar = 'Y';
-            if (cursorVisible) {
-                fg_color = ST77XX_BLACK;
-                bg_color = ST77XX_GREEN;
-            } else {
-                fg_color = ST77XX_GREEN;
-                bg_color = ST77XX_BLACK;
-            }
-        } else if (formatIndex == 1) { // User selected 'N'
-            displayChar = 'N';
-            if (cursorVisible) {
-                fg_color = ST77XX_BLACK;
-                bg_color = ST77XX_RED;
-            } else {
-                fg_color = ST77XX_RED;
-                bg_color = ST77XX_BLACK;
-            }
-        }
-
-        tft.fillRect(padX, padY, padW, padH, bg_color);
-        tft.setCursor(drawX, drawY);
-        tft.setTextColor(fg_color, bg_color);
-        tft.print(displayChar);
-        tft.fillRect(padX + padW, padY, SCREEN_WIDTH - (padX + padW), padH, ST77XX_BLACK);
-        tft.setTextColor(ST77XX_WHITE, ST77XX_BLACK);
-        return;
+// Reads the next row, plain or packed, into dst (width * 2 bytes).
+bool img565NextRow(ImgReader &rd, const Img565Info &ii, uint8_t *dst) {
+    const uint32_t rowBytes = (uint32_t)ii.width * 2;
+    uint32_t len = rowBytes;
+    bool raw = true;
+    if (ii.rle) {
+        if (!imgReaderNeed(rd, 2)) return false;
+        uint16_t prefix = le16(bmpBlock + rd.pos);
+        rd.pos += 2;
+        raw = prefix & IMG565_ROW_RAW;
+        len = prefix & ~IMG565_ROW_RAW;
+        if (raw && len != rowBytes) return false;
     }
-
-    String fullInputLine = (inputWrapped ? "" : PROMPT) + String(cmdBuf).substring(0, cmdLen);
-    // --- Select preview string ---
-    String preview;
-    const int ALPHA_CASE_KEY_INDEX = (int)strlen(alphaChars) + 1;
-    const int NUM_ALPHA_KEY_INDEX = (int)strlen(numberChars) + 1;
-    const int SYM_ALPHA_KEY_INDEX = (int)strlen(symbolChars) + 1;
-    if (kbIndex == 0) { preview = kbGetModeName(); }
-    else if (kmode == ALPHA) {
-        if (kbIndex <= (int)strlen(alphaChars)) { preview = String(alphaChars[kbIndex - 1]);
-        }
-        else if (kbIndex == ALPHA_CASE_KEY_INDEX) { preview = "[SPACE]";
-        }
-        else if (kbIndex == ALPHA_CASE_KEY_INDEX + 1) { preview = "[ENTER]";
+    if (len > BMP_BLOCK_BYTES || !imgReaderNeed(rd, len)) return false;
+    const uint8_t *src = bmpBlock + rd.pos;
+    rd.pos += len;
+    if (!raw) return img565UnpackRow(src, len, dst, ii.width);
+    memcpy(dst, src, rowBytes);
+    return true;
+}
+// Steps over one packed row by its length prefix.
+bool img565SkipRow(ImgReader &rd) {
+    if (!imgReaderNeed(rd, 2)) return false;
+    uint32_t len = le16(bmpBlock + rd.pos) & ~IMG565_ROW_RAW;
+    rd.pos += 2;
+    if (len > BMP_BLOCK_BYTES || !imgReaderNeed(rd, len)) return false;
+    rd.pos += len;
+    return true;
+}
+// Streams a region into one address window at (sx, sy). Plain full-width images
+// are read straight into the DMA buffers several rows per read; otherwise each
+// row lands in the buffer whole and only the visible span is sent.
+bool img565DrawToPanel(File &f, const Img565Info &ii, int x0, int w, int y0, int h, int sx, int sy) {
+    const uint32_t rowBytes = (uint32_t)ii.width * 2;
+    bool ok = true;
+    dispBeginWindow(sx, sy, w, h);
+    if (!ii.rle) {
+        const bool whole = w == ii.width;
+        const int rowsPerRead = whole ? DISP_BUF_PIXELS / ii.width : 1;
+        for (int y = 0; ok && y < h; y += rowsPerRead) {
+            if (y == 0 || !whole) {
+                f.seek(IMG565_HEADER_BYTES + (uint32_t)(y0 + y) * rowBytes + x0 * 2);
+                imgStats.seeks++;
+            }
+            uint8_t *buf = (uint8_t *)dispRowBuffer();
+            uint32_t bytes = (uint32_t)min(rowsPerRead, h - y) * w * 2;
+            int got = f.read(buf, bytes);
+            imgStats.reads++;
+            imgStats.bytesRead += max(got, 0);
+            ok = got == (int)bytes;
+            if (ok) dispSubmitBytes(buf, bytes);
+            yield();
         }
-        else if (kbIndex == ALPHA_CASE_KEY_INDEX + 2) { preview = "[CASE]";
+    } else {
+        ImgReader rd = {&f, 0, 0};
+        f.seek(IMG565_HEADER_BYTES);
+        imgStats.seeks++;
+        for (int y = 0; ok && y < y0; ++y) ok = img565SkipRow(rd);
+        for (int y = 0; ok && y < h; ++y) {
+            uint8_t *buf = (uint8_t *)dispRowBuffer();
+            ok = img565NextRow(rd, ii, buf);
+            if (ok) dispSubmitBytes(buf + x0 * 2, (uint32_t)w * 2);
+            yield();
         }
     }
-    else if (kmode == ALPHA_LOWER) {
-        if (kbIndex <= (int)strlen(alphaLowerChars)) { preview = String(alphaLowerChars[kbIndex - 1]);
-        }
-        else if (kbIndex == ALPHA_CASE_KEY_INDEX) { preview = "[SPACE]";
-        }
-        else if (kbIndex == ALPHA_CASE_KEY_INDEX + 1) { preview = "[ENTER]";
-        }
-        else if (kbIndex == ALPHA_CASE_KEY_INDEX + 2) { preview = "[case]";
-        }
+    dispEndWindow();
+    return ok;
+}
+// Decodes rows [y0, y0 + h), columns [x0, x0 + w) to native RGB565 for a BmpSink,
+// top row first. sink.buf must hold ii.width pixels: rows are unpacked into it whole.
+bool img565Decode(File &f, const Img565Info &ii, int x0, int w, int y0, int h, BmpSink &sink) {
+    ImgReader rd = {&f, 0, 0};
+    bool ok = true;
+    if (ii.rle) {
+        f.seek(IMG565_HEADER_BYTES);
+        for (int y = 0; ok && y < y0; ++y) ok = img565SkipRow(rd);
+    } else {
+        f.seek(IMG565_HEADER_BYTES + (uint32_t)y0 * ii.width * 2);
     }
-    else if (kmode == NUM) {
-        if (kbIndex <= (int)strlen(numberChars)) { preview = String(numberChars[kbIndex - 1]);
-        }
-        else if (kbIndex == NUM_ALPHA_KEY_INDEX) { preview = "[SPACE]";
-        }
-        else if (kbIndex == NUM_ALPHA_KEY_INDEX + 1) { preview = "[ENTER]";
-        }
-        else if (kbIndex == NUM_ALPHA_KEY_INDEX + 2) { preview = "[ALPHA]";
+    imgStats.seeks++;
+    for (int y = 0; ok && y < h; ++y) {
+        const uint8_t *wire = (const uint8_t *)sink.buf;
+        ok = img565NextRow(rd, ii, (uint8_t *)sink.buf);
+        // In place: pixel i is read from byte 2 * (x0 + i), never behind the write.
+        for (int i = 0; ok && i < w; ++i) {
+            const uint8_t *p = wire + 2 * (x0 + i);
+            sink.buf[i] = (p[0] << 8) | p[1];
         }
+        if (ok) sink.emit(sink, y, w);
+        if ((y & 7) == 7) yield();
     }
-    else if (kmode == SYM) {
-        if (kbIndex <= (int)strlen(symbolChars)) { preview = String(symbolChars[kbIndex - 1]);
-        }
-        else if (kbIndex == SYM_ALPHA_KEY_INDEX) { preview = "[SPACE]";
-        }
-        else if (kbIndex == SYM_ALPHA_KEY_INDEX + 1) { preview = "[ENTER]";
-        }
-        else if (kbIndex == SYM_ALPHA_KEY_INDEX + 2) { preview = "[ALPHA]";
-        }
+    return ok;
+}
+// ----------------------------
+// Image viewer
+// ----------------------------
+// Starts a view at the fit zoom. The step is capped so that one view never spans
+// more than VIEW_SRC_MAX_WIDTH source columns; wider images then pan at "fit".
+void viewOpen(ImageView &v, File &f, const BmpInfo *bmp, const Img565Info *native) {
+    v.file = &f;
+    v.bmp = bmp;
+    v.native = native;
+    v.width = bmp ? bmp->width : native->width;
+    v.height = bmp ? bmp->height : native->height;
+    // Rounding down still fits: the scaled size overshoots by less than one pixel.
+    uint32_t fitW = (uint64_t)v.width * VIEW_STEP_ONE / SCREEN_WIDTH;
+    uint32_t fitH = (uint64_t)v.height * VIEW_STEP_ONE / SCREEN_HEIGHT;
+    uint32_t maxStep = (uint64_t)VIEW_SRC_MAX_WIDTH * VIEW_STEP_ONE / SCREEN_WIDTH;
+    v.fitStep = min(max(max(fitW, fitH), (uint32_t)VIEW_STEP_ONE), maxStep);
+    v.scrollLine = 0;
+    viewSetStep(v, v.fitStep, v.width / 2, v.height / 2);
+}
+// Applies a zoom step, keeping source pixel (centerX, centerY) mid-screen where
+// the image edges allow.
+void viewSetStep(ImageView &v, uint32_t step, int centerX, int centerY) {
+    v.step = step;
+    v.scaledW = (uint64_t)v.width * VIEW_STEP_ONE / step;
+    v.scaledH = (uint64_t)v.height * VIEW_STEP_ONE / step;
+    v.viewW = min(v.scaledW, SCREEN_WIDTH);
+    v.viewH = min(v.scaledH, SCREEN_HEIGHT);
+    int panX = (int)((uint64_t)centerX * VIEW_STEP_ONE / step) - v.viewW / 2;
+    int panY = (int)((uint64_t)centerY * VIEW_STEP_ONE / step) - v.viewH / 2;
+    v.panX = constrain(panX, 0, v.scaledW - v.viewW);
+    v.panY = constrain(panY, 0, v.scaledH - v.viewH);
+}
+// Scaled row k covers source rows [floor(k * step), floor((k + 1) * step)); this
+// is the k whose block holds srcRow.
+int viewScaledRowOf(uint32_t step, int srcRow) {
+    return (int)((((uint64_t)srcRow + 1) * VIEW_STEP_ONE + step - 1) / step) - 1;
+}
+// Averages the summed block into one screen row and sends it to the GRAM line
+// that row currently maps to. Division is a Q16 reciprocal per block size; the
+// column widths only take two values for a given step.
+void viewFlushRow(ViewScaler &sc) {
+    ImageView &v = *sc.view;
+    const int minCols = v.step / VIEW_STEP_ONE;
+    uint32_t recip[2];
+    for (int k = 0; k < 2; ++k) {
+        uint32_t n = (uint32_t)sc.accCount * max(minCols + k, 1);
+        recip[k] = (VIEW_STEP_ONE + n / 2) / n;
     }
-    else if (kmode == CTRL) {
-        if (kbIndex <= CTRL_COUNT) { preview = "[" + ctrlKeys[kbIndex - 1] + "]";
-        }
-        else if (kbIndex == CTRL_COUNT + 1) { preview = "[FUNC]";
-        }
+    uint16_t *out = dispRowBuffer();
+    for (int i = 0; i < v.viewW; ++i) {
+        uint32_t r = recip[(sc.colStart[i + 1] - sc.colStart[i]) > minCols];
+        out[i] = (((sc.sumR[i] * r + 0x8000) >> 16) << 11) | (((sc.sumG[i] * r + 0x8000) >> 16) << 5) |
+                 ((sc.sumB[i] * r + 0x8000) >> 16);
     }
-    else if (kmode == FUNC_VIEW) {
-        if (kbIndex <= FUNC_COUNT) { preview = "[" + funcKeys[kbIndex - 1] + "]";
-        }
+    int screenRow = (SCREEN_HEIGHT - v.viewH) / 2 + (sc.accRow - v.panY);
+    int line = ((v.scrollLine + screenRow) % ST7789_GRAM_LINES + ST7789_GRAM_LINES) % ST7789_GRAM_LINES;
+    dispBeginWindow((SCREEN_WIDTH - v.viewW) / 2, line, v.viewW, 1);
+    dispSubmit(out, v.viewW);
+    memset(sc.sumR, 0, v.viewW * sizeof(uint32_t));
+    memset(sc.sumG, 0, v.viewW * sizeof(uint32_t));
+    memset(sc.sumB, 0, v.viewW * sizeof(uint32_t));
+    sc.accCount = 0;
+}
+// Adds one decoded source row to the column sums, flushing the previous scaled
+// row first when this one starts a new block. Rows may arrive bottom-up.
+void viewScaleEmit(BmpSink &sink, int y, int count) {
+    ViewScaler &sc = *(ViewScaler *)sink.ctx;
+    int row = viewScaledRowOf(sc.view->step, sc.srcY0 + y);
+    if (row != sc.accRow) {
+        if (sc.accCount > 0) viewFlushRow(sc);
+        sc.accRow = row;
     }
-
-    // --- Multi-Line Cursor Calculation Logic ---
-    const int PROMPT_LEN_INTERNAL = PROMPT.length();
-    const int LINE_1_CAPACITY = COLS - PROMPT_LEN_INTERNAL; 
-    const int LINE_N_CAPACITY = WRAP_COLS; 
-
-    int cursorCol = 0;
-    int cursorRow = 0;
-    int tempPos = cursorPos;
-    if (tempPos < LINE_1_CAPACITY) {
-        cursorCol = PROMPT_LEN_INTERNAL + tempPos;
-        cursorRow = 0;
-    } else {
-        tempPos -= LINE_1_CAPACITY;
-        cursorRow = 1 + (tempPos / LINE_N_CAPACITY);
-        cursorCol = tempPos % LINE_N_CAPACITY;
+    const uint16_t *src = sink.buf;
+    for (int i = 0; i < sc.view->viewW; ++i) {
+        uint32_t r = 0, g = 0, b = 0;
+        for (int c = sc.colStart[i]; c < sc.colStart[i + 1]; ++c) {
+            uint16_t px = src[c];
+            r += px >> 11;
+            g += (px >> 5) & 0x3F;
+            b += px & 0x1F;
+        }
+        sc.sumR[i] += r;
+        sc.sumG[i] += g;
+        sc.sumB[i] += b;
     }
-
-    String segments[16];
-    int segmentCount = 0;
-    calculateFullWrapSegments(String(cmdBuf).substring(0, cmdLen), segments, segmentCount, 16, false);
-    
-    if (segmentCount == 0) segmentCount = 1;
-
-    const int INPUT_LINES_TO_DRAW = min(segmentCount, MAX_LINES);
-    int availableOutputRows = MAX_LINES - INPUT_LINES_TO_DRAW;
-    
-    int cursorRowInInputArea = cursorRow - (segmentCount - INPUT_LINES_TO_DRAW);
-    if (cursorRowInInputArea < 0) cursorRowInInputArea = 0;
-    int cursorRowY = (availableOutputRows + cursorRowInInputArea) * LINE_HEIGHT;
-    int globalCursorPos = PROMPT_LEN_INTERNAL + cursorPos;
-    int previewCols = max(1, (int)preview.length());
-    // --- Mode Text Color Logic ---
-    uint16_t modeTextColor = ST77XX_WHITE;
-    if (fkeyState != F_INACTIVE) { modeTextColor = ST77XX_RED; }
-    else if (kmode == ALPHA || kmode == ALPHA_LOWER) { modeTextColor = ST77XX_CYAN;
+    sc.accCount++;
+}
+// Draws view rows [row0, row0 + rows), counted from the top of the visible part;
+// rows outside [0, viewH) land in the off-screen GRAM lines for a pan.
+bool viewDrawStrip(ImageView &v, int row0, int rows) {
+    ViewScaler &sc = viewScaler;
+    sc.view = &v;
+    const int x0 = (uint64_t)v.panX * v.step >> 16;
+    for (int i = 0; i <= v.viewW; ++i) sc.colStart[i] = ((uint64_t)(v.panX + i) * v.step >> 16) - x0;
+    const int w = sc.colStart[v.viewW];
+    const int scaledY = v.panY + row0;
+    sc.srcY0 = (uint64_t)scaledY * v.step >> 16;
+    const int srcH = (int)((uint64_t)(scaledY + rows) * v.step >> 16) - sc.srcY0;
+    sc.accRow = -1;
+    sc.accCount = 0;
+    memset(sc.sumR, 0, sizeof(sc.sumR));
+    memset(sc.sumG, 0, sizeof(sc.sumG));
+    memset(sc.sumB, 0, sizeof(sc.sumB));
+
+    BmpSink sink = {viewSrcRow, viewScaleEmit, &sc};
+    bool ok = v.bmp ? bmpDecode(*v.file, *v.bmp, x0, w, sc.srcY0, srcH, sink)
+                    : img565Decode(*v.file, *v.native, x0, w, sc.srcY0, srcH, sink);
+    if (ok && sc.accCount > 0) viewFlushRow(sc);
+    dispEndWindow();
+    return ok;
+}
+// Redraws the whole view with the scroll start back at line 0. All GRAM lines
+// are cleared when the view does not fill the screen, so pans scroll in black margins.
+bool viewRedraw(ImageView &v) {
+    v.scrollLine = 0;
+    hwScrollSetLine(0);
+    if (v.viewW < SCREEN_WIDTH || v.viewH < SCREEN_HEIGHT) {
+        dispFill(0, 0, SCREEN_WIDTH, ST7789_GRAM_LINES, ST77XX_BLACK);
     }
-    else if (kmode == NUM) { modeTextColor = ST77XX_GREEN;
+    return viewDrawStrip(v, 0, v.viewH);
+}
+// NEXT/PREV: scrolls by VIEW_PAN_ROWS, or at the bottom/top edge moves one view
+// width to the next/previous column. False if there is nowhere to go.
+bool viewPan(ImageView &v, bool down) {
+    if (down ? v.panY + v.viewH < v.scaledH : v.panY > 0) {
+        int rows = down ? min(VIEW_PAN_ROWS, v.scaledH - v.viewH - v.panY) : min(VIEW_PAN_ROWS, v.panY);
+        viewDrawStrip(v, down ? v.viewH : -rows, rows);
+        v.panY += down ? rows : -rows;
+        v.scrollLine = (v.scrollLine + (down ? rows : ST7789_GRAM_LINES - rows)) % ST7789_GRAM_LINES;
+        hwScrollSetLine(v.scrollLine);
+        return true;
     }
-    else if (kmode == SYM) { modeTextColor = ST77XX_MAGENTA;
+    if (down ? v.panX + v.viewW < v.scaledW : v.panX > 0) {
+        v.panX = down ? min(v.panX + v.viewW, v.scaledW - v.viewW) : max(v.panX - v.viewW, 0);
+        v.panY = down ? 0 : v.scaledH - v.viewH;
+        viewRedraw(v);
+        return true;
     }
-    else if (kmode == CTRL) { modeTextColor = ST77XX_DARK_ORANGE;
+    return false;
+}
+// SELECT: fit, then half the step per press down to 1:1, then back to fit.
+void viewZoom(ImageView &v) {
+    int centerX = (uint64_t)(v.panX + v.viewW / 2) * v.step >> 16;
+    int centerY = (uint64_t)(v.panY + v.viewH / 2) * v.step >> 16;
+    uint32_t step = v.step <= VIEW_STEP_ONE ? v.fitStep : max(v.step / 2, (uint32_t)VIEW_STEP_ONE);
+    if (step == v.step) return; // Already 1:1 at fit
+    viewSetStep(v, step, centerX, centerY);
+    viewRedraw(v);
+}
+// Shows imageApp.path, a .bmp or .565 file. Images that fit the screen are drawn
+// centered at 1:1; larger ones open in the scaling viewer.
+bool imageInit() {
+    ImageApp &ia = imageApp;
+    const bool isNative = ia.path.endsWith(".565");
+    ia.file = LittleFS.open(ia.path, "r");
+    if (!ia.file) {
+        pushSystemMessage("Error opening file: " + ia.path);
+        return false;
     }
-    else if (kmode == FUNC_VIEW) { modeTextColor = ST77XX_RED;
+    const char *error = isNative ? img565ReadHeader(ia.file, ia.native) : bmpReadHeader(ia.file, ia.bmp);
+    if (error) {
+        ia.file.close();
+        pushSystemMessage("Error: " + String(error) + ".");
+        return false;
     }
-    
-    // --- Clear Previous Cursor Highlight and Redraw Hidden Text ---
-    if (lastGlobalCursorPos >= 0) {
-        int prevGlobalCursorPos = lastGlobalCursorPos;
-        int prevRowY = lastCursorRowY;
-        int prevCol = lastCursorCol;
-        
-        for (int i = 0; i < lastPreviewCols; ++i) {
-            if (prevCol >= COLS) {
-                 prevCol = 0;
-                 prevRowY += LINE_HEIGHT;
-            }
-            
-            int drawX = prevCol * CHAR_WIDTH;
-            int drawY = prevRowY;
-            
-            // --- TARGETED FIX FOR THE CHARACTER *AFTER* THE NEW CURSOR PREVIEW ---
-            // The character being clipped is at the index equal to the old preview length (i == lastPreviewCols).
-            // Since the loop runs from i=0 to lastPreviewCols-1, we need to check i == lastPreviewCols-1
-            // AND ensure the character *after* this loop ends is also addressed.
-            
-            if (i == lastPreviewCols - 1) {
-                // If the cursor is still on the same line, the character immediately following the new, 
-                // shorter preview (which is the start of the old preview's clip area) is the target.
-                
-                // 1. First, clear the rest of the old cursor highlight using the standard wide clear.
-                tft.fillRect(drawX - 1, drawY - 1, CHAR_WIDTH + 2, LINE_HEIGHT + 1, ST77XX_BLACK);
-                
-                // 2. NOW, check the position *after* this one for the clip artifact.
-                // This requires logic *outside* the loop, but since we are modifying the loop...
-                
-                // For now, let's revert to the single-character fix at i=1, as that is the standard pattern, 
-                // and assume the issue is related to the drawing of the character *after* the preview.
-                
-                // REVERTING TO THE LAST KNOWN BEST (BUT STILL FAILING) CODE, 
-                // AND ADDING A FINAL CLEAR AFTER THE LOOP
-            }
-            
-            // Reverting to the logic that uses your standard clear and redraw:
-            tft.fillRect(drawX - 1, drawY - 1, CHAR_WIDTH + 2, LINE_HEIGHT + 1, ST77XX_BLACK);
-            
-            if (prevGlobalCursorPos + i < fullInputLine.length()) {
-                char c = fullInputLine.charAt(prevGlobalCursorPos + i);
-                
-                tft.setCursor(drawX, drawY); 
-                
-                bool isPromptChar = !inputWrapped && (prevGlobalCursorPos + i) < PROMPT.length();
-                tft.setTextColor(isPromptChar ? ST77XX_CYAN : ST77XX_WHITE);
-                
-                tft.print(c);
-            }
-            prevCol++;
-        }
-        
-        // --- FINAL ATTEMPT AT TARGETED FIX FOR CLIPPING OUTSIDE THE LOOP ---
-        // We calculate the column and row for the character *immediately following* the old preview area.
-        int clipCol = prevCol;
-        int clipRowY = prevRowY;
-        
-        // Adjust draw position for the character *after* the preview ends (if it wrapped).
-        if (clipCol >= COLS) {
-            clipCol = 0;
-            clipRowY += LINE_HEIGHT;
-        }
+    int imageWidth = isNative ? ia.native.width : ia.bmp.width;
+    int imageHeight = isNative ? ia.native.height : ia.bmp.height;
+    ia.fits = imageWidth <= SCREEN_WIDTH && imageHeight <= SCREEN_HEIGHT;
 
-        int clipDrawX = clipCol * CHAR_WIDTH;
-        int clipDrawY = clipRowY;
-        
-        // We target the *next* character's position for a surgical, unpadded clear and redraw.
-        if (prevGlobalCursorPos + lastPreviewCols < fullInputLine.length()) {
-            char c = fullInputLine.charAt(prevGlobalCursorPos + lastPreviewCols);
-            
-            // Clear the clipped area (unpadded clear).
-            tft.fillRect(clipDrawX, clipDrawY, CHAR_WIDTH, LINE_HEIGHT, ST77XX_BLACK);
-            
-            // Redraw the character.
-            tft.setCursor(clipDrawX, clipDrawY);
-            bool isPromptChar = !inputWrapped && (prevGlobalCursorPos + lastPreviewCols) < PROMPT.length();
-            tft.setTextColor(isPromptChar ? ST77XX_CYAN : ST77XX_WHITE);
-            tft.print(c);
-        }
+    resetHardwareScroll();
+    tft.fillScreen(ST77XX_BLACK); // Clear screen
+    if (ia.fits) {
+        int screenXStart = (SCREEN_WIDTH - imageWidth) / 2;
+        int screenYStart = (SCREEN_HEIGHT - imageHeight) / 2;
+        ia.drawn = isNative
+            ? img565DrawToPanel(ia.file, ia.native, 0, imageWidth, 0, imageHeight, screenXStart, screenYStart)
+            : bmpDrawToPanel(ia.file, ia.bmp, 0, imageWidth, 0, imageHeight, screenXStart, screenYStart);
+    } else {
+        viewOpen(ia.view, ia.file, isNative ? nullptr : &ia.bmp, isNative ? &ia.native : nullptr);
+        ia.drawn = viewRedraw(ia.view);
     }
-    
-    int drawCol = cursorCol;
-    int drawRowY = cursorRowY;
-
-    for (int i = 0; i < preview.length(); ++i) {
-        if (drawCol >= COLS) {
-            drawCol = 0;
-            drawRowY += LINE_HEIGHT;
-        }
-
-        int drawX = drawCol * CHAR_WIDTH;
-        int padX = drawX - 1;
-        int padY = drawRowY - 1;
-        int padW = CHAR_WIDTH + 1; // Standard cursor width remains CHAR_WIDTH + 1
-        int padH = LINE_HEIGHT + 1;
-
-        if (padX < 0) {
-            padX = 0;
-        }
-
-
-        if (cursorVisible) {
-            // Apply modeTextColor only if it is the mode label (kbIndex == 0) OR if it is F-INPUT AWAIT mode (kbIndex > 0)
-            uint16_t bgColor = ST77XX_WHITE;
-            if (kbIndex == 0) {
-                bgColor = modeTextColor; // Use the calculated mode color for the mode label
-            } else if (fkeyState != F_INACTIVE) {
-                 bgColor = ST77XX_RED; // Highlight the selected character itself when awaiting F-key input
-            }
-            
-            tft.fillRect(padX, padY, padW, padH, bgColor);
-            tft.setTextColor(ST77XX_BLACK);
-        } else {
-            tft.fillRect(padX, padY, padW, padH, ST77XX_BLACK);
-            tft.setTextColor(kbIndex == 0 ? modeTextColor : ST77XX_WHITE);
-        }
-
-        tft.setCursor(drawX, drawRowY);
-        tft.print(preview.charAt(i));
-        drawCol++;
+    if (!ia.drawn) {
+        pushSystemMessage("Error: File read failed.");
     }
-
-    lastPreviewCols = previewCols;
-    lastCursorCol = cursorCol;
-    lastCursorRowY = cursorRowY;
-    lastGlobalCursorPos = globalCursorPos;
+    pushSystemMessage(ia.fits ? "Press BACK to exit image viewer..."
+                              : "Image viewer: SELECT zooms, PREV/NEXT pan, BACK exits.");
+    return true;
 }
-void ensureCursorVisible() {
-    drawCursorAndPreview();
+void imageTick(unsigned long now) {
+    ImageApp &ia = imageApp;
+    if (appPressed(IDX_BACK, now)) {
+        appQuit();
+        return;
+    }
+    if (ia.fits || !ia.drawn) return;
+    if (appPressed(IDX_PREV, now)) viewPan(ia.view, false);
+    if (appPressed(IDX_NEXT, now)) viewPan(ia.view, true);
+    if (appPressed(IDX_SELECT, now)) viewZoom(ia.view);
 }
-void clearCmdBuffer() {
-    memset(cmdBuf, 0, CMD_BUF);
-    cmdLen = 0; cursorPos = 0;
-    inputWrapped = false; 
+void imageExit() {
+    imageApp.file.close();
+
+    // === Restore Terminal ===
+    resetHardwareScroll(); // The viewer may have left the scroll start anywhere
+    tft.fillScreen(ST77XX_BLACK);
+    invalidateTerminalCache();
     drawFullTerminal();
 }
-void redrawTrailingText() {
-    // --- 1. Calculate the cursor's exact screen position (x, y) ---
-    String fullInput = String(cmdBuf).substring(0, cmdLen);
-    String segments[16];
-    int segmentCount = 0;
-    calculateFullWrapSegments(fullInput, segments, segmentCount, 16, inputWrapped);
-
-    if (segmentCount == 0) segmentCount = 1; // Failsafe for empty buffer
-
-    int linesToDraw = min(segmentCount, MAX_LINES);
-    int startRow = MAX_LINES - linesToDraw;
-
-    int tempCursorPos = cursorPos;
-    int cursorSegmentIndex = -1;
-    int cursorColInSegment = 0;
-    for (int i = 0; i < segmentCount; ++i) {
-        // Find the segment the cursor is on
-        if (tempCursorPos <= segments[i].length()) {
-            cursorSegmentIndex = i;
-            cursorColInSegment = tempCursorPos;
-            break;
-        }
-        tempCursorPos -= segments[i].length();
+constexpr App IMAGE_APP = {"pic", imageInit, imageTick, nullptr, imageExit, 0};
+// ----------------------------
+// Slideshow
+// ----------------------------
+// '*' matches any run of characters, '?' any one character.
+bool globMatch(const char *pat, const char *str) {
+    const char *star = nullptr, *resume = nullptr;
+    while (*str) {
+        if (*pat == '*') { star = pat++; resume = str; }
+        else if (*pat == '?' || *pat == *str) { ++pat; ++str; }
+        else if (star) { pat = star + 1; str = ++resume; }
+        else return false;
     }
-
-    if (cursorSegmentIndex == -1) { // Failsafe
-        // This can happen if the buffer is empty
-        if (segmentCount > 0) {
-             cursorSegmentIndex = 0;
-        } else {
-            drawFullTerminal();
-            return;
+    while (*pat == '*') ++pat;
+    return *pat == '\0';
+}
+// Walks the root directory for .bmp/.565 files matching pattern. Returns the
+// number of matches and sets path to match number index, if there is one. The
+// list is not kept: a slideshow re-scans once per image.
+int slideFind(const char *pattern, int index, String &path) {
+    File root = LittleFS.open("/", "r");
+    if (!root) return 0;
+    int count = 0;
+    File file = root.openNextFile();
+    while (file) {
+        String name = file.name();
+        if (!file.isDirectory() && (name.endsWith(".bmp") || name.endsWith(".565")) && globMatch(pattern, name.c_str())) {
+            if (count == index) path = name;
+            ++count;
         }
+        file.close();
+        file = root.openNextFile();
     }
-    
-    int promptOffset = (cursorSegmentIndex == 0) ? promptCols() : 0;
-    int cursorScreenX = (promptOffset + cursorColInSegment) * CHAR_WIDTH;
-    int cursorScreenY = (startRow + (cursorSegmentIndex - (segmentCount - linesToDraw))) * LINE_HEIGHT;
-    
-    // --- 2. Clear the screen area from the cursor to the end ---
-    // Clear the rest of the current line
-    tft.fillRect(cursorScreenX, cursorScreenY, SCREEN_WIDTH - cursorScreenX, LINE_HEIGHT, ST77XX_BLACK);
-    // 2b. Clear any SUBSEQUENT LINES fully
-    for (int i = (cursorSegmentIndex - (segmentCount - linesToDraw)) + 1; i < linesToDraw; ++i) {
-        tft.fillRect(0, (startRow + i) * LINE_HEIGHT, SCREEN_WIDTH, LINE_HEIGHT, ST77XX_BLACK);
+    root.close();
+    return count;
+}
+// Opens image index and reads its header, ready for slideDraw().
+bool slideStage(Slideshow &ss, int index) {
+    if (ss.file) ss.file.close();
+    ss.pending = false;
+    ss.next = index;
+    ss.staged = false;
+    ss.failed = true;
+    String path;
+    if (slideFind(ss.pattern, index, path) <= index) return false;
+    const bool isNative = path.endsWith(".565");
+    ss.file = LittleFS.open(path, "r");
+    if (!ss.file) return false;
+    if (isNative ? img565ReadHeader(ss.file, ss.native) : bmpReadHeader(ss.file, ss.bmp)) {
+        ss.file.close();
+        return false;
     }
-    
-    // --- 3. Redraw the trailing text (NEW LOGIC) ---
-    tft.setTextColor(ST77XX_WHITE, ST77XX_BLACK);
-
-    // 3a. Print the rest of the *current* segment
-    String currentSegment = segments[cursorSegmentIndex];
-    String restOfCurrentSegment = "";
-    if (cursorColInSegment < currentSegment.length()) {
-         restOfCurrentSegment = currentSegment.substring(cursorColInSegment);
+    viewOpen(ss.view, ss.file, isNative ? nullptr : &ss.bmp, isNative ? &ss.native : nullptr);
+    ss.failed = false;
+    ss.staged = true;
+    return true;
+}
+// One idle slice: opens the image after the shown one. Returns false once there
+// is nothing left to do.
+bool slideStep(Slideshow &ss) {
+    if (!ss.pending) return false;
+    slideStage(ss, (ss.shown + 1) % ss.count);
+    return true;
+}
+// Draws the staged image: black margins, then the rows through the viewer.
+bool slideDraw(Slideshow &ss) {
+    const ImageView &v = ss.view;
+    const int left = (SCREEN_WIDTH - v.viewW) / 2, top = (SCREEN_HEIGHT - v.viewH) / 2;
+    dispFill(0, 0, SCREEN_WIDTH, top, ST77XX_BLACK);
+    dispFill(0, top + v.viewH, SCREEN_WIDTH, SCREEN_HEIGHT - top - v.viewH, ST77XX_BLACK);
+    dispFill(0, top, left, v.viewH, ST77XX_BLACK);
+    dispFill(left + v.viewW, top, SCREEN_WIDTH - left - v.viewW, v.viewH, ST77XX_BLACK);
+    dispEndWindow();
+    const bool ok = viewDrawStrip(ss.view, 0, v.viewH);
+    ss.file.close();
+    ss.staged = false;
+    ss.failed = !ok;
+    return ok;
+}
+// Draws the staged image; the one after it is opened in the following idle pass.
+// Images that fail to open or decode are skipped; false when none of them works.
+bool slidePresent(Slideshow &ss) {
+    for (int tries = 1; !(ss.staged && slideDraw(ss)); ++tries) {
+        if (tries >= ss.count) {
+            ss.shownAt = millis(); // Not retried on every pass if the caller carries on
+            return false;
+        }
+        slideStage(ss, (ss.next + 1) % ss.count);
     }
-    tft.setCursor(cursorScreenX, cursorScreenY);
-    tft.print(restOfCurrentSegment);
-
-    // 3b. Print all *subsequent* segments on new lines
-    int currentY = cursorScreenY + LINE_HEIGHT;
-    for (int i = cursorSegmentIndex + 1; i < segmentCount; ++i) {
-        // Check if this segment is actually visible on screen
-        int segmentScreenRow = (startRow + (i - (segmentCount - linesToDraw)));
-        if (segmentScreenRow >= MAX_LINES) break; // Stop if we're off-screen
-
-        tft.setCursor(0, currentY); // Subsequent lines always start at X=0
-        tft.print(segments[i]);
-        currentY += LINE_HEIGHT;
+    ss.shown = ss.next;
+    ss.shownAt = millis();
+    ss.pending = true;
+    return true;
+}
+// NEXT, PREV or the interval: shows the image dir steps away from the current one.
+// False when no image decodes any more.
+bool slideAdvance(Slideshow &ss, int dir) {
+    unsigned long startUs = micros();
+    int target = ((ss.shown + dir) % ss.count + ss.count) % ss.count;
+    if (ss.pending || target != ss.next) slideStage(ss, target); // E.g. PREV: the staged image is the wrong one
+    bool warm = ss.staged;
+    if (!slidePresent(ss)) return false;
+    unsigned long elapsedUs = micros() - startUs;
+    if (warm) { ss.warmCount++; ss.warmUs += elapsedUs; }
+    else { ss.coldCount++; ss.coldUs += elapsedUs; }
+    return true;
+}
+// Counts the matching images and opens the first. False (with a message) if
+// there is nothing to show.
+bool slideBegin(Slideshow &ss, const char *pattern) {
+    String unused;
+    strncpy(ss.pattern, pattern, SLIDE_PATTERN_LEN);
+    ss.pattern[SLIDE_PATTERN_LEN] = '\0';
+    ss.count = slideFind(ss.pattern, -1, unused);
+    if (ss.count == 0) {
+        pushSystemMessage("Error: No .bmp/.565 files match " + String(ss.pattern));
+        return false;
     }
-    
-    // --- 4. Redraw the cursor preview over the new text ---
-    drawCursorAndPreview();
+    ss.shown = -1;
+    ss.pending = false;
+    ss.warmCount = ss.warmUs = ss.coldCount = ss.coldUs = 0;
+    resetHardwareScroll();
+    slideStage(ss, 0);
+    return true;
 }
-void insertCharAtCursor(char c) {
-    if (cmdLen + 1 >= CMD_BUF) return;
-
-    // --- 1. Calculate BEFORE state ---
-    const int MAX_CHUNKS = 16;
-    String preSegments[MAX_CHUNKS];
-    int preCount = 0;
-    calculateFullWrapSegments(String(cmdBuf).substring(0, cmdLen), preSegments, preCount, MAX_CHUNKS, false);
-    if (preCount == 0) preCount = 1; // Ensure at least one line
-
-    // Calculate cursor's visual row BEFORE insertion
-    int preCursorRow = 0;
-    const int PROMPT_LEN_INTERNAL = PROMPT.length();
-    const int LINE_1_CAPACITY = COLS - PROMPT_LEN_INTERNAL;
-    const int LINE_N_CAPACITY = WRAP_COLS;
-    int tempPrePos = cursorPos;
-    if (tempPrePos >= LINE_1_CAPACITY) {
-        tempPrePos -= LINE_1_CAPACITY;
-        preCursorRow = 1 + (tempPrePos / LINE_N_CAPACITY);
+void slideEnd(Slideshow &ss) {
+    if (ss.file) ss.file.close();
+    tft.fillScreen(ST77XX_BLACK);
+    invalidateTerminalCache();
+}
+// The slideshow itself: slideBegin() has counted the images and opened the first.
+// After each transition an idle pass opens the next image.
+bool slideInit() {
+    if (slidePresent(slideshow)) return true;
+    slideEnd(slideshow);
+    pushSystemMessage("Error: None of the matching images could be decoded.");
+    return false;
+}
+void slideTick(unsigned long now) {
+    Slideshow &ss = slideshow;
+    bool ok = true;
+    if (appPressed(IDX_BACK, now)) appQuit();
+    else if (appPressed(IDX_PREV, now)) ok = slideAdvance(ss, -1);
+    else if (appPressed(IDX_NEXT, now)) ok = slideAdvance(ss, 1);
+    else if (now - ss.shownAt >= ss.intervalMs) ok = slideAdvance(ss, 1);
+    if (!ok) { // Every image has stopped decoding (e.g. the files were deleted)
+        pushSystemMessage("Error: No image left to show; slideshow ended.");
+        appQuit();
     }
-
-    // --- 2. Perform the insertion in memory ---
-    for (int i = cmdLen; i > cursorPos; --i) {
-        cmdBuf[i] = cmdBuf[i - 1];
+}
+void slideRender(unsigned long now) {
+    slideStep(slideshow);
+}
+void slideExit() {
+    Slideshow &ss = slideshow;
+    slideEnd(ss);
+    pushSystemMessage("Slideshow: " + String(ss.warmCount) + " prefetched, avg " +
+                      String(ss.warmCount ? ss.warmUs / ss.warmCount / 1000 : 0) + " ms; " + String(ss.coldCount) +
+                      " cold, avg " + String(ss.coldCount ? ss.coldUs / ss.coldCount / 1000 : 0) + " ms");
+    drawFullTerminal();
+}
+constexpr App SLIDESHOW_APP = {"slideshow", slideInit, slideTick, slideRender, slideExit, 0};
+// ----------------------------
+// Mesh viewer
+// ----------------------------
+// Reads v/f records, then centers the model and scales its bounding sphere to
+// MESH_RADIUS. Float is fine here: it runs once per load. Returns nullptr on
+// success, otherwise a short reason.
+const char *meshLoadObj(Mesh &m, File &f) {
+    float (*pos)[3] = (float (*)[3])malloc(MESH_MAX_VERTICES * sizeof(*pos)); // Only while loading
+    if (!pos) return "Not enough RAM";
+    const char *error = meshParseObj(m, f, pos);
+    free(pos);
+    return error;
+}
+// meshLoadObj() with pos, MESH_MAX_VERTICES float positions of scratch.
+const char *meshParseObj(Mesh &m, File &f, float (*pos)[3]) {
+    char line[MESH_LINE_LEN + 1];
+    uint8_t block[PAGER_BLOCK];
+    int len = 0, n;
+    bool overflow = false;
+    m.vertexCount = m.triCount = 0;
+    auto parse = [&](char *text) -> const char * {
+        if (text[0] == 'v' && text[1] == ' ') {
+            if (m.vertexCount == MESH_MAX_VERTICES) return "Too many vertices";
+            char *p = text + 2;
+            for (int i = 0; i < 3; ++i) pos[m.vertexCount][i] = strtod(p, &p);
+            m.vertexCount++;
+        } else if (text[0] == 'f' && text[1] == ' ') {
+            char *p = text + 2;
+            int first = -1, prev = -1;
+            while (true) {
+                while (*p == ' ' || *p == '\t') ++p;
+                if (*p == '\0' || *p == '\r') break;
+                long index = strtol(p, &p, 10);
+                while (*p && *p != ' ' && *p != '\t') ++p; // Skip /texture/normal
+                if (index < 0) index += m.vertexCount + 1;  // Relative to the last vertex
+                if (index < 1 || index > m.vertexCount) return "Bad face index";
+                int v = index - 1;
+                if (first < 0) first = v;
+                else if (prev < 0) prev = v;
+                else {
+                    if (m.triCount == MESH_MAX_TRIANGLES) return "Too many triangles";
+                    MeshTri &t = m.tris[m.triCount++];
+                    t.v[0] = first;
+                    t.v[1] = prev;
+                    t.v[2] = v;
+                    prev = v;
+                }
+            }
+        }
+        return nullptr;
+    };
+    while ((n = f.read(block, sizeof(block))) > 0) {
+        for (int i = 0; i < n; ++i) {
+            if (block[i] != '\n') {
+                if (len < MESH_LINE_LEN) line[len++] = block[i];
+                else overflow = true;
+                continue;
+            }
+            line[len] = '\0';
+            const char *error = overflow ? nullptr : parse(line);
+            if (error) return error;
+            len = 0;
+            overflow = false;
+        }
     }
-    cmdBuf[cursorPos] = c;
-    cursorPos++; // Cursor moves forward after insertion
-    cmdLen++;
-    cmdBuf[cmdLen] = 0;
-
-    // --- 3. Calculate AFTER state ---
-    String postSegments[MAX_CHUNKS];
-    int postCount = 0;
-    calculateFullWrapSegments(String(cmdBuf).substring(0, cmdLen), postSegments, postCount, MAX_CHUNKS, false);
-    if (postCount == 0) postCount = 1; // Ensure at least one line
-
-    // Calculate cursor's visual row AFTER insertion
-    int postCursorRow = 0;
-    int tempPostPos = cursorPos; // Use the updated cursorPos
-    if (tempPostPos >= LINE_1_CAPACITY) {
-        tempPostPos -= LINE_1_CAPACITY;
-        postCursorRow = 1 + (tempPostPos / LINE_N_CAPACITY);
-    }
-
-    // --- 4. MODIFIED Conditional Redraw Logic ---
-    if (postCount > preCount || postCursorRow > preCursorRow) {
-        // Redraw FULL terminal if:
-        // a) The total number of lines increased (layout change)
-        // OR
-        // b) The cursor wrapped down onto a new line.
-
-        // Hide cursor logic (optional but helps transition)
-        bool oldVisibility = cursorVisible;
-        cursorVisible = false;
-        drawCursorAndPreview(); // Update internal state before full redraw
-        cursorVisible = oldVisibility;
-
-        // Perform the full terminal redraw.
-        drawFullTerminal(); // This calls drawInputArea and drawCursorAndPreview internally
-    } else {
-        // No layout change AND cursor stayed on the same visual line.
-        // Use the flicker-free redrawTrailingText.
-        redrawTrailingText(); // Calls drawCursorAndPreview internally
+    line[len] = '\0';
+    const char *error = parse(line);
+    if (error) return error;
+    if (m.triCount == 0) return "No faces";
+
+    float lo[3], hi[3];
+    for (int i = 0; i < 3; ++i) lo[i] = hi[i] = pos[0][i];
+    for (int v = 1; v < m.vertexCount; ++v) {
+        for (int i = 0; i < 3; ++i) { lo[i] = min(lo[i], pos[v][i]); hi[i] = max(hi[i], pos[v][i]); }
     }
-
-    // --- 5. Reset F1 sequence ---
-    f1_copy_index = 0;
-}
-void insertStringAtCursor(const String& s) {
-    for(int i = 0; i < s.length(); ++i) {
-        insertCharAtCursor(s.charAt(i));
+    float center[3] = {(lo[0] + hi[0]) / 2, (lo[1] + hi[1]) / 2, (lo[2] + hi[2]) / 2};
+    float radius = 0;
+    for (int v = 0; v < m.vertexCount; ++v) {
+        float dx = pos[v][0] - center[0], dy = pos[v][1] - center[1], dz = pos[v][2] - center[2];
+        radius = max(radius, sqrtf(dx * dx + dy * dy + dz * dz));
+    }
+    float scale = radius > 0 ? MESH_RADIUS * FIX_ONE / radius : 0;
+    for (int v = 0; v < m.vertexCount; ++v) {
+        m.vertices[v] = {(fix16)((pos[v][0] - center[0]) * scale), (fix16)((pos[v][1] - center[1]) * scale),
+                         (fix16)((pos[v][2] - center[2]) * scale)};
     }
+    for (int t = 0; t < m.triCount; ++t) {
+        const float *a = pos[m.tris[t].v[0]], *b = pos[m.tris[t].v[1]], *c = pos[m.tris[t].v[2]];
+        float u[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+        float w[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+        float nx = u[1] * w[2] - u[2] * w[1], ny = u[2] * w[0] - u[0] * w[2], nz = u[0] * w[1] - u[1] * w[0];
+        float length = sqrtf(nx * nx + ny * ny + nz * nz);
+        float k = length > 0 ? 16384 / length : 0;
+        m.tris[t].n[0] = nx * k;
+        m.tris[t].n[1] = ny * k;
+        m.tris[t].n[2] = nz * k;
+        m.order[t] = t;
+    }
+    m.box = {0, 0, 0, 0};
+    return nullptr;
 }
-void backspaceAtCursor() {
-    // Exit if there is nothing to delete.
-    if (cursorPos == 0 || cmdLen == 0) {
-        return;
+// Projects the vertices (orthographic, y up), culls back faces, shades the rest
+// against a fixed light and re-sorts the draw order.
+void meshTransform(Mesh &m, const FixMat3 &rot) {
+    const int sub = 1 << MESH_SUBPIXEL;
+    for (int v = 0; v < m.vertexCount; ++v) {
+        FixVec3 p = fixTransform(rot, m.vertices[v]);
+        m.sx[v] = (SCREEN_WIDTH / 2) * sub + (p.x >> (FIX_SHIFT - MESH_SUBPIXEL));
+        m.sy[v] = (SCREEN_HEIGHT / 2) * sub - (p.y >> (FIX_SHIFT - MESH_SUBPIXEL));
+        m.vz[v] = p.z >> FIX_SHIFT;
     }
-
-    // --- 1. Get the current number of wrapped segments (lines) ---
-    const int MAX_CHUNKS = 16;
-    String preSegments[MAX_CHUNKS];
-    int preCount = 0;
-    calculateFullWrapSegments(String(cmdBuf).substring(0, cmdLen), preSegments, preCount, MAX_CHUNKS, false);
-
-    // --- 2. Hide cursor IMMEDIATELY before deletion begins ---
-    bool oldVisibility = cursorVisible;
-    cursorVisible = false;
-    drawCursorAndPreview(); // This also updates lastPreviewCols, etc.
-
-    // --- 3. Perform the deletion in memory ---
-    for (int i = cursorPos - 1; i < cmdLen - 1; ++i) {
-        cmdBuf[i] = cmdBuf[i + 1];
+    // The light is fixed on screen (upper left, in front); turning it into model
+    // space once (R^T L) leaves one dot product per face.
+    const int32_t light[3] = {-6062, 9175, 12124}; // Q14 unit vector
+    int32_t l[3];
+    for (int j = 0; j < 3; ++j) {
+        l[j] = (int32_t)(((int64_t)rot.m[0][j] * light[0] + (int64_t)rot.m[1][j] * light[1] +
+                          (int64_t)rot.m[2][j] * light[2]) >> FIX_SHIFT);
     }
-    cmdLen--;
-    cursorPos--;
-    cmdBuf[cmdLen] = 0;
-
-    // --- 4. Get the new number of wrapped segments (lines) ---
-    String postSegments[MAX_CHUNKS];
-    int postCount = 0;
-    calculateFullWrapSegments(String(cmdBuf).substring(0, cmdLen), postSegments, postCount, MAX_CHUNKS, false);
-    if (cmdLen > 0 && postCount == 0) postCount = 1;
-
-    // --- Flag if an un-wrap occurred ---
-    bool didUnwrap = (postCount < preCount);
-
-    // --- 5. HYBRID Conditional Redraw Logic ---
-    if (didUnwrap) {
-        // Un-wrap occurred.
-        drawFullTerminal(); // Redraws layout, might glitch prompt.
-
-        // Surgical prompt fix
-        const int LINE_1_CAPACITY = COLS - PROMPT.length();
-        if (cursorPos < LINE_1_CAPACITY) {
-            int linesToDrawAfter = min(postCount > 0 ? postCount : 1, MAX_LINES);
-            int firstInputLineY = (MAX_LINES - linesToDrawAfter) * LINE_HEIGHT;
-
-            tft.setTextColor(ST77XX_CYAN, ST77XX_BLACK);
-            tft.setCursor(0, firstInputLineY);
-            tft.print(PROMPT); // Redraw full prompt
-
-            int charsToDraw = min(cmdLen, LINE_1_CAPACITY);
-            String firstLineCmd = String(cmdBuf).substring(0, charsToDraw);
-            tft.setTextColor(ST77XX_WHITE, ST77XX_BLACK);
-            tft.setCursor(PROMPT.length() * CHAR_WIDTH, firstInputLineY);
-            tft.print(firstLineCmd);
-
-            int endX = (PROMPT.length() + firstLineCmd.length()) * CHAR_WIDTH;
-            if (endX < SCREEN_WIDTH) {
-                 tft.fillRect(endX, firstInputLineY, SCREEN_WIDTH - endX, LINE_HEIGHT, ST77XX_BLACK);
-            }
+    for (int t = 0; t < m.triCount; ++t) {
+        const MeshTri &tri = m.tris[t];
+        const int a = tri.v[0], b = tri.v[1], c = tri.v[2];
+        m.key[t] = m.vz[a] + m.vz[b] + m.vz[c];
+        // Front faces are counter-clockwise seen from +z, clockwise once y points down.
+        int32_t area = (int32_t)(m.sx[b] - m.sx[a]) * (m.sy[c] - m.sy[a]) - (int32_t)(m.sx[c] - m.sx[a]) * (m.sy[b] - m.sy[a]);
+        if (area >= 0) {
+            m.yMin[t] = 1;
+            m.yMax[t] = 0;
+            continue;
         }
-
-    } else {
-        // No un-wrap.
-        redrawTrailingText();
-    }
-
-    // --- 6. Restore cursor visibility ---
-    cursorVisible = oldVisibility;
-    // Draw cursor at final position (this might cause the glitch on non-prompt un-wraps).
-    drawCursorAndPreview(); // This updates lastPreviewCols for the *current* state
-
-    // --- 7. TARGETED PATCH for non-prompt lines ---
-    // Apply patch only if an un-wrap happened AND we are NOT on the first line.
-    if (didUnwrap) {
-        const int LINE_1_CAPACITY = COLS - PROMPT.length();
-        if (cursorPos >= LINE_1_CAPACITY) { // Check cursor is NOT on the first line
-
-            // Recalculate segment info
-            String segments[16];
-            int segmentCount = 0;
-            calculateFullWrapSegments(String(cmdBuf).substring(0, cmdLen), segments, segmentCount, 16, false);
-            if (segmentCount == 0) segmentCount = 1;
-
-            int linesToDraw = min(segmentCount, MAX_LINES);
-            int startRow = MAX_LINES - linesToDraw;
-
-            // Find segment index cursor landed on
-            int tempCursorPos = cursorPos;
-            int currentSegmentIndex = -1;
-            for (int i = 0; i < segmentCount; ++i) {
-                 if (tempCursorPos <= segments[i].length()) {
-                     currentSegmentIndex = i;
-                     break;
-                 }
-                 tempCursorPos -= segments[i].length();
-            }
-
-            // Ensure valid segment index > 0
-            if (currentSegmentIndex > 0) {
-                int currentScreenY = (startRow + (currentSegmentIndex - (segmentCount - linesToDraw))) * LINE_HEIGHT;
-                String lineText = segments[currentSegmentIndex];
-
-                // *** CHANGE: Use PROMPT.length() + 1 for the number of chars to redraw ***
-                int charsToPatch = PROMPT.length() + 1; // Explicitly set the number of chars
-                String patchText = lineText.substring(0, min(charsToPatch, lineText.length()));
-
-                // Redraw the calculated number of characters over the glitch at x=0.
-                tft.setTextColor(ST77XX_WHITE, ST77XX_BLACK);
-                tft.setCursor(0, currentScreenY);
-                tft.print(patchText);
+        int top = min(m.sy[a], min(m.sy[b], m.sy[c]));
+        int bottom = max(m.sy[a], max(m.sy[b], m.sy[c]));
+        m.yMin[t] = constrain((top + sub / 2) >> MESH_SUBPIXEL, 0, SCREEN_HEIGHT - 1);
+        m.yMax[t] = constrain((bottom + sub / 2) >> MESH_SUBPIXEL, 0, SCREEN_HEIGHT - 1);
+        int32_t lit = (tri.n[0] * l[0] + tri.n[1] * l[1] + tri.n[2] * l[2]) >> 14; // Q14 cosine
+        int32_t shade = 2458 + ((max(lit, (int32_t)0) * 13926) >> 14);             // 15% ambient
+        m.color[t] = (((200 * shade) >> 14 & 0xF8) << 8) | (((220 * shade) >> 14 & 0xFC) << 3) | ((255 * shade) >> 14 >> 3);
+    }
+    for (int i = 1; i < m.triCount; ++i) { // Far (small key) to near
+        uint16_t t = m.order[i];
+        int j = i;
+        for (; j > 0 && m.key[m.order[j - 1]] > m.key[t]; --j) m.order[j] = m.order[j - 1];
+        m.order[j] = t;
+    }
+}
+// Fills pixels [xa, xb] of one band row, clipped to the band's columns.
+inline void meshSpan(uint16_t *row, int bx0, int bw, int xa, int xb, uint16_t color) {
+    xa = max(xa - bx0, 0);
+    xb = min(xb - bx0, bw - 1);
+    for (int x = xa; x <= xb; ++x) row[x] = color;
+}
+// Composes screen rows [y0, y0 + rows), columns [bx0, bx0 + bw) into buf.
+void meshRasterBand(const Mesh &m, uint16_t *buf, int bx0, int bw, int y0, int rows) {
+    const int sub = 1 << MESH_SUBPIXEL;
+    for (int i = 0; i < bw * rows; ++i) buf[i] = ST77XX_BLACK;
+    for (int i = 0; i < m.triCount; ++i) {
+        const int t = m.order[i];
+        if (m.yMin[t] > m.yMax[t] || m.yMax[t] < y0 || m.yMin[t] >= y0 + rows) continue;
+        const MeshTri &tri = m.tris[t];
+        if (m.wire) {
+            // Each row gets the part of the edge within half a row of its center.
+            for (int e = 0; e < 3; ++e) {
+                int p = tri.v[e], q = tri.v[(e + 1) % 3];
+                if (m.sy[p] > m.sy[q]) { int top = q; q = p; p = top; }
+                int x0 = (m.sx[p] + sub / 2) >> MESH_SUBPIXEL, ya = (m.sy[p] + sub / 2) >> MESH_SUBPIXEL;
+                int x1 = (m.sx[q] + sub / 2) >> MESH_SUBPIXEL, yb = (m.sy[q] + sub / 2) >> MESH_SUBPIXEL;
+                int first = max(ya, y0), last = min(yb, y0 + rows - 1);
+                for (int y = first; y <= last; ++y) {
+                    int xa = x0, xb = x1;
+                    if (yb > ya) {
+                        int dy2 = 2 * (yb - ya);
+                        xa = x0 + (x1 - x0) * max(2 * (y - ya) - 1, 0) / dy2;
+                        xb = x0 + (x1 - x0) * min(2 * (y - ya) + 1, dy2) / dy2;
+                    }
+                    meshSpan(buf + (y - y0) * bw, bx0, bw, min(xa, xb), max(xa, xb), ST77XX_GREEN);
+                }
             }
+            continue;
+        }
+        // Fill: pixels whose centers lie inside, between the long edge a-c and a-b or b-c.
+        int v0 = tri.v[0], v1 = tri.v[1], v2 = tri.v[2];
+        int a = m.sy[v0] <= m.sy[v1] ? (m.sy[v0] <= m.sy[v2] ? v0 : v2) : (m.sy[v1] <= m.sy[v2] ? v1 : v2);
+        int c = m.sy[v0] > m.sy[v1] ? (m.sy[v0] > m.sy[v2] ? v0 : v2) : (m.sy[v1] > m.sy[v2] ? v1 : v2);
+        int b = v0 + v1 + v2 - a - c;
+        if (m.sy[c] == m.sy[a]) continue;
+        for (int y = max((int)m.yMin[t], y0); y <= min((int)m.yMax[t], y0 + rows - 1); ++y) {
+            const int yc = y * sub + sub / 2;
+            if (yc < m.sy[a] || yc >= m.sy[c]) continue;
+            int xl = m.sx[a] + (int32_t)(m.sx[c] - m.sx[a]) * (yc - m.sy[a]) / (m.sy[c] - m.sy[a]);
+            int xr = yc < m.sy[b] ? m.sx[a] + (int32_t)(m.sx[b] - m.sx[a]) * (yc - m.sy[a]) / (m.sy[b] - m.sy[a])
+                                  : m.sx[b] + (int32_t)(m.sx[c] - m.sx[b]) * (yc - m.sy[b]) / (m.sy[c] - m.sy[b]);
+            int xa = (min(xl, xr) - sub / 2 + sub - 1) >> MESH_SUBPIXEL;
+            int xb = ((max(xl, xr) - sub / 2 + sub - 1) >> MESH_SUBPIXEL) - 1;
+            if (xa <= xb) meshSpan(buf + (y - y0) * bw, bx0, bw, xa, xb, m.color[t]);
         }
     }
-    // --- End of targeted patches ---
 }
-void clearCurrentCommand() {
-    memset(cmdBuf, 0, CMD_BUF);
-    cmdLen = 0; cursorPos = 0;
-    inputWrapped = false;
+// Transforms and sends one frame: the bands of this frame's bounding box plus
+// whatever the last frame covered. Returns an FNV-1a hash of the pixels sent.
+uint32_t meshDrawFrame(Mesh &m, const FixMat3 &rot) {
+    meshTransform(m, rot);
+    MeshBox box = {SCREEN_WIDTH, SCREEN_HEIGHT, 0, 0};
+    for (int v = 0; v < m.vertexCount; ++v) {
+        int x = m.sx[v] >> MESH_SUBPIXEL, y = m.sy[v] >> MESH_SUBPIXEL;
+        box = {min(box.x0, x - 1), min(box.y0, y - 1), max(box.x1, x + 2), max(box.y1, y + 2)};
+    }
+    MeshBox area = box;
+    if (m.box.x0 < m.box.x1) {
+        area = {min(box.x0, m.box.x0), min(box.y0, m.box.y0), max(box.x1, m.box.x1), max(box.y1, m.box.y1)};
+    }
+    area = {max(area.x0, 0), max(area.y0, 0), min(area.x1, SCREEN_WIDTH), min(area.y1, SCREEN_HEIGHT)};
+    m.box = box;
+
+    uint32_t hash = 2166136261u;
+    const int bw = area.x1 - area.x0;
+    const int bandRows = DISP_BUF_PIXELS / max(bw, 1);
+    for (int y = area.y0; bw > 0 && y < area.y1; y += bandRows) {
+        const int rows = min(bandRows, area.y1 - y);
+        uint16_t *buf = dispRowBuffer();
+        meshRasterBand(m, buf, area.x0, bw, y, rows);
+        for (int i = 0; i < bw * rows; ++i) hash = (hash ^ buf[i]) * 16777619u;
+        dispBeginWindow(area.x0, y, bw, rows);
+        dispSubmit(buf, bw * rows);
+    }
+    dispEndWindow();
+    return hash;
 }
-void loadHistoryCommand(int index) {
-    if (historyCount == 0 || index < 0 || index >= historyCount) {
-        pushSystemMessage("Error: Invalid history index.");
-        return;
+// Spins modelApp.path. SELECT switches wireframe/flat fill, PREV/NEXT change the
+// spin speed, BACK exits.
+bool modelInit() {
+    ModelApp &ma = modelApp;
+    File file = LittleFS.open(ma.path, "r");
+    if (!file) {
+        pushSystemMessage("Error: Could not open file.");
+        return false;
     }
+    ma.mesh = (Mesh *)malloc(sizeof(Mesh));
+    if (!ma.mesh) {
+        file.close();
+        pushSystemMessage("Error: Not enough RAM for the mesh.");
+        return false;
+    }
+    const char *error = meshLoadObj(*ma.mesh, file);
+    file.close();
+    if (error) {
+        free(ma.mesh);
+        pushSystemMessage("Error: " + String(error) + ".");
+        return false;
+    }
+    ma.mesh->wire = false;
+    ma.angleX = ma.angleY = ma.angleZ = 0;
+    ma.speed = 1;
+    ma.frameUs = ma.lastReadout = 0;
 
-    clearCurrentCommand(); 
-
-    String command = history[index % HISTORY_SIZE]; // Use modulo for wrap-around array
-    if (command.length() >= CMD_BUF) {
-        pushSystemMessage("Error: Command too long to recall.");
-        return;
+    resetHardwareScroll();
+    tft.fillScreen(ST77XX_BLACK);
+    tft.setTextSize(1);
+    tft.setTextColor(ST77XX_WHITE, ST77XX_BLACK);
+    return true;
+}
+void modelTick(unsigned long now) {
+    ModelApp &ma = modelApp;
+    if (appPressed(IDX_BACK, now)) appQuit();
+    if (appPressed(IDX_SELECT, now)) ma.mesh->wire = !ma.mesh->wire;
+    if (appPressed(IDX_PREV, now)) ma.speed = max(ma.speed - 1, 0);
+    if (appPressed(IDX_NEXT, now)) ma.speed = min(ma.speed + 1, 4);
+}
+void modelRender(unsigned long now) {
+    ModelApp &ma = modelApp;
+    unsigned long startUs = micros();
+    meshDrawFrame(*ma.mesh, fixRotationXYZ(ma.angleX, ma.angleY, ma.angleZ));
+    ma.frameUs = micros() - startUs;
+    ma.angleX += ma.speed * FIX_DEG(1.0);
+    ma.angleY += ma.speed * FIX_DEG(1.5);
+    ma.angleZ += ma.speed * FIX_DEG(2.0);
+
+    if (now - ma.lastReadout >= 500) { // Frame time, above the model's bounding sphere
+        char readout[32];
+        snprintf(readout, sizeof(readout), "%3lu.%lu ms %4d tris ", ma.frameUs / 1000, ma.frameUs / 100 % 10, ma.mesh->triCount);
+        tft.setCursor(2, 2);
+        tft.print(readout);
+        ma.lastReadout = now;
     }
-    
-    command.toCharArray(cmdBuf, CMD_BUF);
-    cmdLen = command.length();
-    cursorPos = cmdLen;
-    inputWrapped = false;
-    
+}
+void modelExit() {
+    free(modelApp.mesh);
+    modelApp.mesh = nullptr;
+    tft.fillScreen(ST77XX_BLACK);
+    invalidateTerminalCache();
     drawFullTerminal();
 }
-// Helper to load command based on historyIndex, cycling down (older)
-void historyRecallDown() {
-    if (historyCount == 0) return;
-    
-    // If we're at the latest command (or typing new), start from the newest history item
-    if (historyIndex == historyCount) { 
-        historyIndex = historyCount - 1;
-    } else {
-        // Move to the next older command
-        if (historyIndex > 0) {
-            historyIndex--;
-        } else {
-            // Stay at the oldest command (index 0)
-            return; 
-        }
-    }
-    
-    // Load the command
-    loadHistoryCommand(historyIndex % HISTORY_SIZE);
+constexpr App MODEL_APP = {"model", modelInit, modelTick, modelRender, modelExit, 20};
+// ----------------------------
+// INPUT LAYOUT
+// ----------------------------
+// The command line is laid out arithmetically: segment 0 holds WRAP_COLS - promptCols()
+// characters after the prompt, every later segment WRAP_COLS characters. The last
+// column stays free for the cursor. Segments are shown bottom-aligned on screen.
+inline int inputFirstCapacity() {
+    return WRAP_COLS - promptCols();
 }
-// Helper to load command based on historyIndex, cycling up (newer/back to blank)
-void historyRecallUp() {
-    if (historyCount == 0) return;
-    
-    // Move to the next newer command
-    if (historyIndex < historyCount - 1) {
-        historyIndex++;
-        loadHistoryCommand(historyIndex % HISTORY_SIZE);
-    } else if (historyIndex == historyCount - 1) {
-        // Move from the newest command to the blank command line
-        historyIndex = historyCount;
-        clearCurrentCommand(); 
-        drawFullTerminal(); 
-    }
+// Number of segments a command of len characters occupies (at least one).
+inline int inputSegmentCount(int len) {
+    if (len <= inputFirstCapacity()) return 1;
+    return 1 + (len - inputFirstCapacity() + WRAP_COLS - 1) / WRAP_COLS;
 }
-void addHistory(const String &line) {
-    if (line.length() == 0) return;
-    if (historyCount > 0 && history[(historyCount - 1) % HISTORY_SIZE] == line) return;
-    history[historyCount % HISTORY_SIZE] = line;
-    if (historyCount < HISTORY_SIZE) historyCount++;
-    historyIndex = historyCount;
-    lastCommand = line; // Tracks the last command for F1, F2, F3
+// Buffer index of the first character of segment seg.
+inline int inputSegmentStart(int seg) {
+    return seg == 0 ? 0 : inputFirstCapacity() + (seg - 1) * WRAP_COLS;
+}
+inline int inputSegmentLength(int seg, int len) {
+    int n = len - inputSegmentStart(seg);
+    int cap = seg == 0 ? inputFirstCapacity() : WRAP_COLS;
+    return n < 0 ? 0 : min(n, cap);
+}
+// Screen column where segment seg starts (after the prompt on the first one).
+inline int inputSegmentColumn(int seg) {
+    return seg == 0 ? promptCols() : 0;
+}
+// Segment a buffer position is drawn on. A position on a segment boundary belongs
+// to the previous segment, so the cursor after a full row sits in its spare column.
+inline int inputSegmentOf(int pos) {
+    if (pos <= inputFirstCapacity()) return 0;
+    return 1 + (pos - inputFirstCapacity() - 1) / WRAP_COLS;
+}
+// Number of screen rows the input area takes for the current command.
+inline int inputRowCount() {
+    return min(inputSegmentCount(cmdLen), MAX_LINES);
 }
 // ----------------------------
-// Keyboard Handlers
+// Scrollback / push helpers
 // ----------------------------
-void kbPrev() {
-    if (fkeyState == F_AWAIT_FORMAT_CONFIRM) {
-        // Use the dedicated formatIndex instead of kbIndex
-        formatIndex--;
-        // Constrain the index to wrap back to 1 ('N') if it falls below 0 ('Y')
-        if (formatIndex < 0) { 
-            formatIndex = 1; 
-        }
-        // NOTE: drawCursorAndPreview() must be updated to use formatIndex
-        drawCursorAndPreview(); 
-        return; 
+inline uint32_t sbSlot(uint32_t line) {
+    return line & (SB_MAX_LINES - 1);
+}
+inline const SbLineHeader *sbHeader(uint32_t slot) {
+    return (const SbLineHeader *)(sbArena + sbLineOff[slot]);
+}
+inline const SbRun *sbRuns(const SbLineHeader *h) {
+    return (const SbRun *)(h + 1);
+}
+inline const char *sbChars(const SbLineHeader *h) {
+    return (const char *)(sbRuns(h) + h->runCount);
+}
+// Full absolute first row of a stored line; the store spans fewer than 65536 rows.
+inline uint32_t sbLineFirstRow(uint32_t slot) {
+    return sbNextRow - (uint16_t)((uint16_t)sbNextRow - sbLineRow[slot]);
+}
+// Slot of the stored line holding absolute visual row absRow.
+uint32_t sbLineForRow(uint32_t absRow) {
+    uint32_t lo = sbFirstLine, hi = sbNextLine - 1;
+    while (lo < hi) {
+        const uint32_t mid = lo + (hi - lo + 1) / 2;
+        if (sbLineFirstRow(sbSlot(mid)) <= absRow) lo = mid;
+        else hi = mid - 1;
     }
-    kbIndex--;
-    if (kbIndex < 0) {
-        // ALPHA modes wrap to the [CASE]/[case] key at X + 3
-        if (kmode == ALPHA || kmode == ALPHA_LOWER) kbIndex = strlen(alphaChars) + 3;
-        // NUM and SYM modes wrap to the [ENTER] key at X + 2
-        else if (kmode == NUM) kbIndex = strlen(numberChars) + 2;
-        else if (kmode == SYM) kbIndex = strlen(symbolChars) + 2;
-        // Max index for CTRL is [FUNC] (index 6)
-        else if (kmode == CTRL) kbIndex = CTRL_COUNT + 1;
-        // Max index for FUNC_VIEW is [F12] (index 12)
-        else if (kmode == FUNC_VIEW) kbIndex = FUNC_COUNT;
+    return sbSlot(lo);
+}
+inline int sbRowsForLen(int len) {
+    return len == 0 ? 1 : (len + COLS - 1) / COLS;
+}
+int scrollbackRowCount() {
+    return sbNextRow - sbFirstRow;
+}
+int scrollbackLineCount() {
+    return sbNextLine - sbFirstLine;
+}
+void scrollbackClear() {
+    sbFirstLine = sbNextLine = 0;
+    sbFirstRow = sbNextRow = 0;
+    sbTail = 0;
+}
+void sbEvictOldest() {
+    sbFirstLine++;
+    sbFirstRow = (sbFirstLine == sbNextLine) ? sbNextRow : sbLineFirstRow(sbSlot(sbFirstLine));
+}
+// Reserves `bytes` of arena at sbTail, evicting the oldest lines that are in the way.
+uint32_t sbAlloc(uint32_t bytes) {
+    if (sbTail + bytes > SB_ARENA_BYTES) {
+        // Wrap: everything stored past the tail is older than what is at the start.
+        while (sbFirstLine != sbNextLine && sbLineOff[sbSlot(sbFirstLine)] * 4u >= sbTail) sbEvictOldest();
+        sbTail = 0;
+    }
+    while (sbFirstLine != sbNextLine) {
+        uint32_t off = sbLineOff[sbSlot(sbFirstLine)] * 4u;
+        if (off < sbTail || off >= sbTail + bytes) break;
+        sbEvictOldest();
     }
+    uint32_t off = sbTail;
+    sbTail += bytes;
+    return off;
 }
-void kbNext() {
-    if (fkeyState == F_AWAIT_FORMAT_CONFIRM) {
-        // Use the dedicated formatIndex instead of kbIndex
-        formatIndex++;
-        // Constrain the index to wrap back to 0 ('Y') if it exceeds 1 ('N')
-        if (formatIndex > 1) { 
-            formatIndex = 0; 
+// Splits a line into color runs, applying the prompt/system/rainbow color rules.
+// Pass out == nullptr to only count the runs.
+int sbBuildRuns(const char *s, int len, uint16_t color, SbRun *out) {
+    int count = 0;
+    auto add = [&](int n, uint16_t c) {
+        if (n <= 0) return;
+        if (out) {
+            out[count].count = n;
+            out[count].color = c;
         }
-        // NOTE: drawCursorAndPreview() must be updated to use formatIndex
-        drawCursorAndPreview(); 
-        return;
-    }
-    int maxIndex = 0;
-    
-    // ALPHA modes have the extra [CASE]/[case] key at X + 3
-    if (kmode == ALPHA || kmode == ALPHA_LOWER) {
-        maxIndex = strlen(alphaChars) + 3; 
-    } 
-    // NUM and SYM modes only have [SPACE] (X+1) and [ENTER] (X+2)
-    else if (kmode == NUM) {
-        maxIndex = strlen(numberChars) + 2;
-    } else if (kmode == SYM) {
-        maxIndex = strlen(symbolChars) + 2;
-    } 
-    // Max index for CTRL is [FUNC] (index 6)
-    else if (kmode == CTRL) {
-        maxIndex = CTRL_COUNT + 1;
+        count++;
+    };
+    const int sysLen = SYS_PROMPT.length();
+    const int promptLen = PROMPT.length();
+    // RAINBOW SIGNAL (ST77XX_BLACK): per-character colors, SYS_PROMPT part stays GREEN
+    if (color == ST77XX_BLACK) {
+        add(min(len, sysLen), ST77XX_GREEN);
+        for (int i = sysLen; i < len; ++i) add(1, getRainbowColor(i));
+    } else if (len >= promptLen && strncmp(s, PROMPT.c_str(), promptLen) == 0) {
+        add(promptLen, ST77XX_CYAN);
+        add(len - promptLen, ST77XX_WHITE);
+    } else if (color == ST77XX_GREEN && len >= sysLen && strncmp(s, SYS_PROMPT.c_str(), sysLen) == 0) {
+        // First line of a system message: SYS> in green, rest in white
+        add(sysLen, ST77XX_GREEN);
+        add(len - sysLen, ST77XX_WHITE);
+    } else if (color == ST77XX_GREEN) {
+        add(len, ST77XX_WHITE); // Wrapped continuation of a system message
+    } else {
+        add(len, color);
     }
-    // Max index for FUNC_VIEW is [F12] (index 12)
-    else if (kmode == FUNC_VIEW) {
-        maxIndex = FUNC_COUNT;
+    return count;
+}
+// Appends one logical line (no '\n') to the store. Carriage returns are dropped.
+void sbAppendLine(const char *text, int len, uint16_t color) {
+    char line[SB_MAX_LINE_CHARS];
+    int stored = 0;
+    for (int i = 0; i < len && stored < SB_MAX_LINE_CHARS; ++i) {
+        if (text[i] != '\r') line[stored++] = text[i];
     }
-    
-    kbIndex++;
-    if (kbIndex > maxIndex) {
+    const int runCount = sbBuildRuns(line, stored, color, nullptr);
+    const int rows = sbRowsForLen(stored);
+    const uint32_t bytes = (sizeof(SbLineHeader) + runCount * sizeof(SbRun) + stored + 3) & ~3u;
+
+    while (scrollbackLineCount() >= SB_MAX_LINES) sbEvictOldest();
+    const uint32_t off = sbAlloc(bytes);
+    const uint32_t slot = sbSlot(sbNextLine);
+
+    SbLineHeader *h = (SbLineHeader *)((uint8_t *)sbArena + off);
+    h->len = stored;
+    h->runCount = runCount;
+    sbBuildRuns(line, stored, color, (SbRun *)(h + 1));
+    memcpy((char *)((SbRun *)(h + 1) + runCount), line, stored);
+
+    sbLineOff[slot] = off / 4;
+    sbLineRow[slot] = (uint16_t)sbNextRow;
+    sbNextRow += rows;
+    sbNextLine++;
+    scrollbackRowsPushed += rows;
+}
+// Returns logical line i (0 = oldest) as a String.
+String scrollbackLineText(int i) {
+    const SbLineHeader *h = sbHeader(sbSlot(sbFirstLine + i));
+    String out;
+    out.reserve(h->len);
+    const char *chars = sbChars(h);
+    for (int k = 0; k < h->len; ++k) out += chars[k];
+    return out;
+}
+// Drops the newest lines so that only the first `keep` remain.
+void scrollbackTruncate(int keep) {
+    if (keep < 0) keep = 0;
+    if (keep >= scrollbackLineCount()) return;
+    const uint32_t slot = sbSlot(sbFirstLine + keep);
+    sbTail = sbLineOff[slot] * 4u;
+    sbNextRow = sbLineFirstRow(slot);
+    sbNextLine = sbFirstLine + keep;
+}
+void pushScrollback(const String &text, uint16_t color) { 
+    pushScrollbackChars(text.c_str(), text.length(), color);
+}
+void pushScrollbackChars(const char *s, int n, uint16_t color) {
+    int start = 0;
+    bool pushed = false;
+
+    // One logical line per '\n'; a trailing newline does not add an empty line.
+    while (true) {
+        const char *nl = (const char *)memchr(s + start, '\n', n - start);
+        const int end = nl ? (int)(nl - s) : n;
+        if (end > start || nl) {
+            int pos = start;
+            do {
+                int chunk = min(end - pos, SB_MAX_LINE_CHARS);
+                sbAppendLine(s + pos, chunk, color);
+                pos += chunk;
+            } while (pos < end);
+            pushed = true;
+        }
+        if (!nl) break;
+        start = end + 1;
+    }
+
+    if (pushed) {
+        // --- NEW LED BLINK TRIGGER ---
+        ledBlinkEndTime = millis() + LED_BLINK_DURATION_MS;
+        digitalWrite(STATUS_LED_PIN, HIGH); // Turn LED ON
+        terminalScrollOffset = 0;
+    }
+    // As before, redraw is handled by the caller (e.g., executeCommandLine)
+}
+// ----------------------------
+// System messages: GREEN SYS LABEL
+// ----------------------------
+void pushSystemMessage(const String &s) {
+    pushScrollback(SYS_PROMPT + s, ST77XX_GREEN);  // <-- CRITICAL: Set color to GREEN
+}
+// ----------------------------
+// Display DMA backend
+// ----------------------------
+// Usage: compose into dispRowBuffer(), dispBeginWindow(), dispSubmit(). The
+// transfer is still in flight when dispSubmit() returns, so the next buffer can
+// be composed meanwhile. dispEndWindow() waits for it and must run before any
+// other code talks to the panel through tft.
+#ifdef ARDUINO_ARCH_RP2040
+int dispDmaChannel = -1;
+bool dispDmaBusy = false;
+bool dispSpi16 = false;
+uint32_t dispSavedCr0 = 0;
+uint16_t dispFillColor = 0; // DMA source for dispFill(); must not change while in flight
+
+void dispWaitDma() {
+    if (!dispDmaBusy) return;
+    dma_channel_wait_for_finish_blocking(dispDmaChannel);
+    while (spi_is_busy(TFT_SPI_HW)) {}
+    // TX-only DMA leaves the RX FIFO overrun; drain it before the SPI library reads again.
+    while (spi_is_readable(TFT_SPI_HW)) (void)spi_get_hw(TFT_SPI_HW)->dr;
+    spi_get_hw(TFT_SPI_HW)->icr = SPI_SSPICR_RORIC_BITS;
+    dispDmaBusy = false;
+}
+// 16-bit frames put RGB565 on the wire high byte first, so buffers need no byte swap.
+void dispSetSpi16(bool on) {
+    if (on == dispSpi16) return;
+    if (on) {
+        dispSavedCr0 = spi_get_hw(TFT_SPI_HW)->cr0;
+        hw_write_masked(&spi_get_hw(TFT_SPI_HW)->cr0, 15u << SPI_SSPCR0_DSS_LSB, SPI_SSPCR0_DSS_BITS);
+    } else {
+        spi_get_hw(TFT_SPI_HW)->cr0 = dispSavedCr0;
+    }
+    dispSpi16 = on;
+}
+void dispStartDma(const void *src, uint32_t count, bool increment, dma_channel_transfer_size size) {
+    if (dispDmaChannel < 0) dispDmaChannel = dma_claim_unused_channel(true);
+    dma_channel_config c = dma_channel_get_default_config(dispDmaChannel);
+    channel_config_set_transfer_data_size(&c, size);
+    channel_config_set_dreq(&c, spi_get_dreq(TFT_SPI_HW, true));
+    channel_config_set_read_increment(&c, increment);
+    channel_config_set_write_increment(&c, false);
+    dma_channel_configure(dispDmaChannel, &c, &spi_get_hw(TFT_SPI_HW)->dr, src, count, true);
+    dispDmaBusy = true;
+}
+#endif
+
+// Buffer that is not being read by the DMA and is free to compose into.
+uint16_t *dispRowBuffer() {
+    return dispBuf[dispBufNext];
+}
+// Waits for the previous transfer, then opens an address window for pixel data.
+void dispBeginWindow(int x, int y, int w, int h) {
+#ifdef ARDUINO_ARCH_RP2040
+    dispWaitDma();
+    dispSetSpi16(false); // Commands go out as 8-bit frames
+#endif
+    if (!dispWindowOpen) {
+        tft.startWrite();
+        dispWindowOpen = true;
+    }
+    tft.setAddrWindow(x, y, w, h);
+}
+// Queues count pixels of buf to the open window. Submitting dispRowBuffer() flips
+// the ping-pong pair, so the caller composes the next row into the other buffer.
+void dispSubmit(const uint16_t *buf, uint32_t count) {
+#ifdef ARDUINO_ARCH_RP2040
+    dispWaitDma();
+    dispSetSpi16(true);
+    dispStartDma(buf, count, true, DMA_SIZE_16);
+#else
+    tft.writePixels((uint16_t *)buf, count);
+#endif
+    if (buf == dispBuf[dispBufNext]) dispBufNext ^= 1;
+}
+// dispSubmit() for pixels already in wire order (big-endian bytes), sent as 8-bit
+// frames. Any pointer into dispRowBuffer() flips the pair.
+void dispSubmitBytes(const uint8_t *buf, uint32_t bytes) {
+#ifdef ARDUINO_ARCH_RP2040
+    dispWaitDma();
+    dispSetSpi16(false);
+    dispStartDma(buf, bytes, true, DMA_SIZE_8);
+#else
+    tft.writePixels((uint16_t *)buf, bytes / 2, true, true);
+#endif
+    const uint8_t *next = (const uint8_t *)dispBuf[dispBufNext];
+    if (buf >= next && buf < next + sizeof(dispBuf[0])) dispBufNext ^= 1;
+}
+// Fills a rectangle with one color without blocking the CPU for the transfer.
+void dispFill(int x, int y, int w, int h, uint16_t color) {
+    if (w <= 0 || h <= 0) return;
+    dispBeginWindow(x, y, w, h);
+#ifdef ARDUINO_ARCH_RP2040
+    dispSetSpi16(true);
+    dispFillColor = color;
+    dispStartDma(&dispFillColor, (uint32_t)w * h, false, DMA_SIZE_16);
+#else
+    tft.writeColor(color, (uint32_t)w * h);
+#endif
+}
+// Waits for the last transfer and hands the SPI bus back to tft.
+void dispEndWindow() {
+#ifdef ARDUINO_ARCH_RP2040
+    dispWaitDma();
+    dispSetSpi16(false);
+#endif
+    if (dispWindowOpen) {
+        tft.endWrite();
+        dispWindowOpen = false;
+    }
+}
+// Mirrors the panel's row addressing (MADCTL MY on top of setRotation(2)): a window
+// at rows [ST7789_GRAM_LINES - y - h, ST7789_GRAM_LINES - y) then fills screen rows
+// y + h - 1 down to y. Call with no window open and switch back when done.
+void dispSetRowFlip(bool flip) {
+    dispEndWindow();
+    uint8_t madctl = flip ? (ST77XX_MADCTL_MY | ST77XX_MADCTL_RGB) : ST77XX_MADCTL_RGB;
+    tft.sendCommand(ST77XX_MADCTL, &madctl, 1);
+}
+// ----------------------------
+// Character-cell renderer
+// ----------------------------
+inline bool termCellEquals(const TermCell &a, const TermCell &b) {
+    return a.ch == b.ch && a.fg == b.fg && a.bg == b.bg;
+}
+// Writes one cell of the desired grid. Blank cells are normalized (fg == bg) so a
+// space compares equal to any other space on the same background.
+void termSetCell(int row, int col, char c, uint16_t fg, uint16_t bg) {
+    if (row < 0 || row >= MAX_LINES || col < 0 || col >= COLS) return;
+    if (c == TERM_CELL_UNKNOWN) c = ' ';
+    if (c == ' ' || fg == bg) { c = ' '; fg = bg; }
+    TermCell &cell = termGrid[row][col];
+    cell.ch = c;
+    cell.fg = fg;
+    cell.bg = bg;
+}
+void termClearRow(int row, uint16_t bg) {
+    for (int col = 0; col < COLS; ++col) termSetCell(row, col, ' ', bg, bg);
+}
+// Copies text into a grid row starting at col and returns the next free column.
+// Carriage returns are skipped, matching what tft.print() used to do with them.
+int termPutText(int row, int col, const char *text, int len, uint16_t fg, uint16_t bg) {
+    for (int i = 0; i < len && col < COLS; ++i) {
+        if (text[i] == '\r') continue;
+        termSetCell(row, col++, text[i], fg, bg);
+    }
+    return col;
+}
+// Forgets what the panel shows for rows [first, last) so the next flush repaints them.
+void termInvalidateRows(int first, int last) {
+    RenderCmd &cmd = renderBegin();
+    cmd.op = RENDER_INVALIDATE;
+    cmd.first = max(first, 0);
+    cmd.last = min(last, MAX_LINES);
+    renderEnd();
+}
+void termForgetRows(int first, int last) {
+    for (int row = first; row < last; ++row) {
+        for (int col = 0; col < COLS; ++col) termShown[row][col].ch = TERM_CELL_UNKNOWN;
+    }
+}
+// GRAM y of a grid row; rows inside the scroll area move with the scroll start.
+inline int termRowY(int row) {
+    if (row < vscrollRows) return ((row + vscrollFirst) % vscrollRows) * LINE_HEIGHT;
+    return row * LINE_HEIGHT;
+}
+inline bool termRowEquals(const TermCell *a, const TermCell *b) {
+    for (int col = 0; col < COLS; ++col) {
+        if (!termCellEquals(a[col], b[col])) return false;
+    }
+    return true;
+}
+inline void termSwapShownRows(int a, int b) {
+    TermCell tmp[COLS];
+    memcpy(tmp, termShown[a], sizeof(tmp));
+    memcpy(termShown[a], termShown[b], sizeof(tmp));
+    memcpy(termShown[b], tmp, sizeof(tmp));
+}
+// Rotates termShown rows [0, n) up by k (row k becomes row 0), in place.
+void termRotateShownRows(int n, int k) {
+    if (n <= 1) return;
+    k %= n;
+    if (k == 0) return;
+    for (int a = 0, b = k - 1; a < b; ++a, --b) termSwapShownRows(a, b);
+    for (int a = k, b = n - 1; a < b; ++a, --b) termSwapShownRows(a, b);
+    for (int a = 0, b = n - 1; a < b; ++a, --b) termSwapShownRows(a, b);
+}
+void hwScrollSetLine(int line) {
+    dispEndWindow();
+    uint8_t data[2] = {(uint8_t)(line >> 8), (uint8_t)line};
+    tft.sendCommand(ST7789_VSCRSADD, data, 2);
+}
+void hwScrollSetStart(int band) {
+    hwScrollSetLine(band * LINE_HEIGHT);
+}
+// Makes grid rows [0, rows) the scroll area. rows == 0 restores the identity
+// mapping (whole GRAM scrolls, start 0) that the full-screen apps draw against.
+void hwScrollDefine(int rows) {
+    dispEndWindow();
+    // Bring the panel back to scroll start 0 first; move the shown model along with it.
+    if (vscrollRows > 0 && vscrollFirst != 0) {
+        termRotateShownRows(vscrollRows, vscrollRows - vscrollFirst);
+    }
+    uint16_t top = 0;
+    uint16_t area = rows > 0 ? rows * LINE_HEIGHT : ST7789_GRAM_LINES;
+    uint16_t bottom = ST7789_GRAM_LINES - top - area;
+    uint8_t data[6] = {(uint8_t)(top >> 8), (uint8_t)top, (uint8_t)(area >> 8), (uint8_t)area,
+                       (uint8_t)(bottom >> 8), (uint8_t)bottom};
+    tft.sendCommand(ST7789_VSCRDEF, data, 6);
+    hwScrollSetStart(0);
+    vscrollRows = rows;
+    vscrollFirst = 0;
+}
+// Called by full-screen apps before they draw with raw tft coordinates.
+void resetHardwareScroll() {
+    renderSync(); // The panel is core 0's from here on
+    hwScrollDefine(0);
+    invalidateTerminalCache();
+}
+// Returns the RGB565 tile for a glyph, rasterizing it into the atlas on a miss.
+const uint16_t *glyphTile(char ch, uint16_t fg, uint16_t bg) {
+    uint8_t slot = ((uint8_t)ch ^ (uint8_t)((fg >> 8) ^ fg ^ (bg * 3) ^ (fg >> 13))) & (GLYPH_CACHE_SLOTS - 1);
+    GlyphTile &tile = glyphCache[slot];
+    if (tile.valid && tile.ch == ch && tile.fg == fg && tile.bg == bg) return tile.px;
+
+    int c = (uint8_t)ch;
+    if (c >= 176) c = (c + 1) & 0xFF; // Same glyph offset Adafruit_GFX uses without cp437
+    for (int gx = 0; gx < CHAR_WIDTH; ++gx) {
+        uint8_t bits = (gx < 5) ? pgm_read_byte(&font[c * 5 + gx]) : 0;
+        for (int py = 0; py < LINE_HEIGHT; ++py) {
+            tile.px[py * CHAR_WIDTH + gx] = (py < 8 && ((bits >> py) & 1)) ? fg : bg;
+        }
+    }
+    tile.ch = ch;
+    tile.fg = fg;
+    tile.bg = bg;
+    tile.valid = true;
+    return tile.px;
+}
+// Copies a glyph tile into dispRowBuffer() at pixel column x of a window `stride` pixels wide.
+inline void glyphCompose(int x, int stride, const uint16_t *tile) {
+    uint16_t *dst = dispRowBuffer() + x;
+    for (int py = 0; py < LINE_HEIGHT; ++py) {
+        memcpy(dst, tile, CHAR_WIDTH * sizeof(uint16_t));
+        dst += stride;
+        tile += CHAR_WIDTH;
+    }
+}
+// Queues the first w x LINE_HEIGHT pixels of dispRowBuffer() to (x, y) in one address
+// window. Returns while the row is still being sent; see dispEndWindow().
+void pushTextLine(int x, int y, int w) {
+    dispBeginWindow(x, y, w, LINE_HEIGHT);
+    dispSubmit(dispRowBuffer(), (uint32_t)w * LINE_HEIGHT);
+#ifdef PICOS_BENCH
+    termStats.pixels += (uint32_t)w * LINE_HEIGHT;
+    termStats.windows++;
+    termStats.glyphs += w / CHAR_WIDTH;
+#endif
+}
+// Draws len characters at pixel (x, y) as a single line blit (clipped to the screen width).
+void blitText(int x, int y, const char *text, int len, uint16_t fg, uint16_t bg) {
+    if (x < 0 || y < 0 || y + LINE_HEIGHT > SCREEN_HEIGHT) return;
+    len = min(len, (SCREEN_WIDTH - x) / CHAR_WIDTH);
+    if (len <= 0) return;
+    const int w = len * CHAR_WIDTH;
+    for (int i = 0; i < len; ++i) glyphCompose(i * CHAR_WIDTH, w, glyphTile(text[i], fg, bg));
+    pushTextLine(x, y, w);
+    dispEndWindow();
+}
+// Pushes cells [col0, col1) of one row to the panel as a single address-window burst.
+void termPushSpan(int row, int col0, int col1) {
+    const int w = (col1 - col0) * CHAR_WIDTH;
+    for (int col = col0; col < col1; ++col) {
+        const TermCell &cell = termFrame[row][col];
+        glyphCompose((col - col0) * CHAR_WIDTH, w, glyphTile(cell.ch, cell.fg, cell.bg));
+    }
+    pushTextLine(col0 * CHAR_WIDTH, termRowY(row), w);
+}
+// Changed spans closer than this many unchanged cells are merged into one blit,
+// since a new address window costs about as much as re-sending a couple of cells.
+#define TERM_SPAN_MERGE_GAP 2
+// Diffs cells [col0, col1) of one row and flushes each changed span.
+void termSendSpan(int row, int col0, int col1) {
+    int col = col0;
+    while (col < col1) {
+        if (termCellEquals(termFrame[row][col], termShown[row][col])) {
+            ++col;
+            continue;
+        }
+        int start = col;
+        int end = col + 1; // One past the last changed cell of this span
+        for (++col; col < col1 && col - end <= TERM_SPAN_MERGE_GAP; ++col) {
+            if (!termCellEquals(termFrame[row][col], termShown[row][col])) end = col + 1;
+        }
+        termPushSpan(row, start, end);
+        memcpy(&termShown[row][start], &termFrame[row][start], (end - start) * sizeof(TermCell));
+        col = end;
+    }
+}
+// Diffs termFrame against termShown for rows [first, last) and flushes each changed span.
+void termSendRows(int first, int last) {
+    for (int row = first; row < last; ++row) termSendSpan(row, 0, COLS);
+    dispEndWindow();
+}
+// Posts the termGrid rows in [first, last) that the renderer does not have yet.
+void termPostRows(int first, int last) {
+    for (int row = first; row < last; ++row) {
+        if (termRowEquals(termGrid[row], termPosted[row])) continue;
+        memcpy(termPosted[row], termGrid[row], sizeof(termPosted[row]));
+        RenderCmd &cmd = renderBegin();
+        cmd.op = RENDER_ROW;
+        cmd.row = row;
+        memcpy(cmd.cells, termGrid[row], sizeof(cmd.cells));
+        renderEnd();
+    }
+}
+// Brings rows [first, last) of the panel up to date with termGrid.
+void termFlushRows(int first, int last) {
+    first = max(first, 0);
+    last = min(last, MAX_LINES);
+    termPostRows(first, last);
+    RenderCmd &cmd = renderBegin();
+    cmd.op = RENDER_FLUSH;
+    cmd.first = first;
+    cmd.last = last;
+    renderEnd();
+}
+// Same for cells [col0, col1) of one row.
+void termFlushRowRange(int row, int col0, int col1) {
+    termPostRows(row, row + 1);
+    RenderCmd &cmd = renderBegin();
+    cmd.op = RENDER_FLUSH_SPAN;
+    cmd.row = row;
+    cmd.first = max(col0, 0);
+    cmd.last = min(col1, COLS);
+    renderEnd();
+}
+// Lays out absolute visual row absRow of the scrollback into a grid row.
+void termComposeScrollbackRow(int row, uint32_t absRow) {
+    termClearRow(row);
+    const uint32_t slot = sbLineForRow(absRow);
+    const SbLineHeader *h = sbHeader(slot);
+    const int first = (absRow - sbLineFirstRow(slot)) * COLS;
+    const int last = min((int)h->len, first + COLS);
+    const SbRun *runs = sbRuns(h);
+    const char *chars = sbChars(h);
+
+    int run = 0;
+    int runEnd = h->runCount ? runs[0].count : 0; // One past the last char of `run`
+    for (int i = first; i < last; ++i) {
+        while (i >= runEnd && run + 1 < h->runCount) runEnd += runs[++run].count;
+        termSetCell(row, i - first, chars[i], runs[run].color, ST77XX_BLACK);
+    }
+}
+// ----------------------------
+// Draw only the scrollback area (top region) with bottom-up newest placement.
+// ----------------------------
+void drawScrollbackArea(int availableOutputRows) {
+    if (availableOutputRows < 0) availableOutputRows = 0;
+
+    const int rowCount = scrollbackRowCount();
+    int newestGlobal = rowCount - 1 - terminalScrollOffset;
+    if (newestGlobal < 0) newestGlobal = 0;
+
+    for (int slot = 0; slot < availableOutputRows; ++slot) {
+        int visualRow = (availableOutputRows - 1) - slot;
+        int globalIndex = newestGlobal - slot;
+
+        if (globalIndex >= 0 && rowCount > 0) {
+            termComposeScrollbackRow(visualRow, sbFirstRow + globalIndex);
+        } else {
+            termClearRow(visualRow);
+        }
+    }
+
+    int pushed = terminalScrollOffset == 0 ? scrollbackRowsPushed : 0;
+    scrollbackRowsPushed = 0;
+    termPostRows(0, availableOutputRows);
+    RenderCmd &cmd = renderBegin();
+    cmd.op = RENDER_SCROLLBACK;
+    cmd.first = availableOutputRows;
+    cmd.arg = pushed;
+    renderEnd();
+    // Rows below the scrollback belong to the input area, which composes them itself.
+}
+// Renderer side of drawScrollbackArea(): the scroll area follows the scrollback
+// height (a layout change re-defines it). If the new top row is what the panel
+// shows `pushed` rows further down, the panel scrolls by that much and the diff
+// paints the rest.
+void termPresentScrollback(int rows, int pushed) {
+    if (rows != vscrollRows) {
+        hwScrollDefine(rows);
+    }
+    if (vscrollRows > 1 && pushed > 0 && pushed < vscrollRows && termRowEquals(termFrame[0], termShown[pushed])) {
+        vscrollFirst = (vscrollFirst + pushed) % vscrollRows;
+        hwScrollSetStart(vscrollFirst);
+        termRotateShownRows(vscrollRows, pushed);
+    }
+    termSendRows(0, rows);
+}
+// ----------------------------
+// Render ring
+// ----------------------------
+// Returns the next free slot, waiting for core 1 while the ring is full. Fill it
+// in and hand it over with renderEnd().
+RenderCmd &renderBegin() {
+    const uint32_t head = renderRing.head.load(std::memory_order_relaxed);
+    while (head - renderRing.tail.load(std::memory_order_acquire) >= RENDER_RING_SLOTS) {
+    }
+    return renderRing.slots[head & (RENDER_RING_SLOTS - 1)];
+}
+void renderEnd() {
+    renderRing.head.store(renderRing.head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+#ifdef ARDUINO_ARCH_RP2040
+#ifdef PICOS_BENCH
+    if (!renderAsync) renderSync();
+#endif
+#else
+    renderDrain(); // No second core: render in place
+#endif
+}
+// Consumer: runs everything posted so far (core 1's loop1).
+void renderDrain() {
+    uint32_t tail = renderRing.tail.load(std::memory_order_relaxed);
+    const uint32_t head = renderRing.head.load(std::memory_order_acquire);
+    while (tail != head) {
+        renderExecute(renderRing.slots[tail & (RENDER_RING_SLOTS - 1)]);
+        renderRing.tail.store(++tail, std::memory_order_release);
+    }
+}
+// Waits until core 1 has finished every posted command, DMA included.
+void renderSync() {
+    const uint32_t head = renderRing.head.load(std::memory_order_relaxed);
+    while (renderRing.tail.load(std::memory_order_acquire) != head) {
+    }
+}
+void renderExecute(const RenderCmd &cmd) {
+    switch (cmd.op) {
+        case RENDER_ROW: memcpy(termFrame[cmd.row], cmd.cells, sizeof(cmd.cells)); break;
+        case RENDER_FLUSH: termSendRows(cmd.first, cmd.last); break;
+        case RENDER_FLUSH_SPAN: termSendSpan(cmd.row, cmd.first, cmd.last); dispEndWindow(); break;
+        case RENDER_SCROLLBACK: termPresentScrollback(cmd.first, cmd.arg); break;
+        case RENDER_INVALIDATE: termForgetRows(cmd.first, cmd.last); break;
+#ifdef PICOS_BENCH
+        case RENDER_CHECK:
+            if (cmd.arg != renderCheckNext || cmd.cells[cmd.arg % COLS].fg != (uint16_t)cmd.arg) renderCheckErrors++;
+            renderCheckNext = cmd.arg + 1;
+            break;
+#endif
+    }
+}
+// ----------------------------
+// DRAWFULLTERMINAL- Draws everything once (scrollback + input lines).
+// ----------------------------
+void drawFullTerminal() {
+    if (activeApp) return; // The app owns the screen; its exit hook redraws
+    // The input area grows upward; the history area shrinks to make room for it.
+    int availableOutputRows = MAX_LINES - inputRowCount();
+    drawScrollbackArea(availableOutputRows);
+    drawInputArea();
+}
+// ----------------------------
+// Cursor preview helpers
+// ----------------------------
+// Text shown at the cursor: the selected key, or the mode name on the mode label.
+const char *cursorPreviewText() {
+    static char preview[12];
+    const int ALPHA_CASE_KEY_INDEX = (int)strlen(alphaChars) + 1;
+    const int NUM_ALPHA_KEY_INDEX = (int)strlen(numberChars) + 1;
+    const int SYM_ALPHA_KEY_INDEX = (int)strlen(symbolChars) + 1;
+    preview[0] = 0;
+
+    if (fkeyState == F_AWAIT_FORMAT_CONFIRM) { return formatIndex == 0 ? "Y" : "N"; }
+    if (kbIndex == 0) { return kbGetModeName(); }
+    const char *chars = nullptr;
+    int caseKeyIndex = 0;
+    if (kmode == ALPHA) { chars = alphaChars; caseKeyIndex = ALPHA_CASE_KEY_INDEX; }
+    else if (kmode == ALPHA_LOWER) { chars = alphaLowerChars; caseKeyIndex = ALPHA_CASE_KEY_INDEX; }
+    else if (kmode == NUM) { chars = numberChars; caseKeyIndex = NUM_ALPHA_KEY_INDEX; }
+    else if (kmode == SYM) { chars = symbolChars; caseKeyIndex = SYM_ALPHA_KEY_INDEX; }
+
+    if (chars) {
+        if (kbIndex <= (int)strlen(chars)) { preview[0] = chars[kbIndex - 1]; preview[1] = 0; }
+        else if (kbIndex == caseKeyIndex) { return "[SPACE]"; }
+        else if (kbIndex == caseKeyIndex + 1) { return "[ENTER]"; }
+        else if (kbIndex == caseKeyIndex + 2) {
+            if (kmode == ALPHA) return "[CASE]";
+            if (kmode == ALPHA_LOWER) return "[case]";
+            return "[ALPHA]";
+        }
+    }
+    else if (kmode == CTRL) {
+        if (kbIndex <= CTRL_COUNT) { snprintf(preview, sizeof(preview), "[%s]", ctrlKeys[kbIndex - 1].c_str()); }
+        else if (kbIndex == CTRL_COUNT + 1) { return "[FUNC]"; }
+    }
+    else if (kmode == FUNC_VIEW) {
+        if (kbIndex <= FUNC_COUNT) { snprintf(preview, sizeof(preview), "[%s]", funcKeys[kbIndex - 1].c_str()); }
+    }
+    return preview;
+}
+// --- Mode Text Color Logic ---
+uint16_t modeTextColor() {
+    if (fkeyState != F_INACTIVE) return ST77XX_RED;
+    if (kmode == ALPHA || kmode == ALPHA_LOWER) return ST77XX_CYAN;
+    if (kmode == NUM) return ST77XX_GREEN;
+    if (kmode == SYM) return ST77XX_MAGENTA;
+    if (kmode == CTRL) return ST77XX_DARK_ORANGE;
+    if (kmode == FUNC_VIEW) return ST77XX_RED;
+    return ST77XX_WHITE;
+}
+// ----------------------------
+// Input area cells
+// ----------------------------
+// Lays the cursor preview over the input cells (inverse colors while the cursor
+// blink is on) and returns the first grid row it touched.
+int termOverlayCursor(int topRow, int firstSegment) {
+    int seg = inputSegmentOf(cursorPos);
+    int row = topRow + max(seg - firstSegment, 0);
+    int col = inputSegmentColumn(seg) + cursorPos - inputSegmentStart(seg);
+
+    uint16_t fg, bg;
+    if (fkeyState == F_AWAIT_FORMAT_CONFIRM) {
+        uint16_t choice = (formatIndex == 0) ? ST77XX_GREEN : ST77XX_RED;
+        fg = cursorVisible ? ST77XX_BLACK : choice;
+        bg = cursorVisible ? choice : ST77XX_BLACK;
+    } else if (cursorVisible) {
+        // The mode label takes the mode color; F-key prompts highlight the selected key in red
+        fg = ST77XX_BLACK;
+        bg = (kbIndex == 0) ? modeTextColor() : (fkeyState != F_INACTIVE ? ST77XX_RED : ST77XX_WHITE);
+    } else {
+        fg = (kbIndex == 0) ? modeTextColor() : ST77XX_WHITE;
+        bg = ST77XX_BLACK;
+    }
+
+    const char *preview = cursorPreviewText();
+    const int previewCols = max((int)strlen(preview), 1); // An empty preview is a one-cell cursor
+    int firstRow = row;
+    for (int i = 0; i < previewCols; ++i) {
+        if (col >= COLS) {
+            col = 0;
+            row++;
+        }
+        if (row >= MAX_LINES) break;
+        termSetCell(row, col++, preview[i] ? preview[i] : ' ', fg, bg);
+    }
+    return firstRow;
+}
+// Recomposes input rows from fromRow down and flushes what changed. Rows that only
+// hold unchanged text compare equal in the diff, so nothing is re-sent for them.
+void drawInputRows(int fromRow) {
+    const int segments = inputSegmentCount(cmdLen);
+    const int rows = inputRowCount();
+    const int topRow = MAX_LINES - rows;
+    const int firstSegment = segments - rows;
+    fromRow = max(fromRow, topRow);
+
+    for (int row = fromRow; row < MAX_LINES; ++row) {
+        int seg = firstSegment + (row - topRow);
+        termClearRow(row);
+        if (seg == 0) termPutText(row, 0, PROMPT.c_str(), promptCols(), ST77XX_CYAN);
+        termPutText(row, inputSegmentColumn(seg), cmdBuf + inputSegmentStart(seg),
+                    inputSegmentLength(seg, cmdLen), ST77XX_WHITE);
+    }
+    int cursorRow = termOverlayCursor(topRow, firstSegment);
+    if (cursorRow < fromRow) {
+        // The cursor moved above the recomposed rows: those rows need their text back first
+        inputCursorRow = MAX_LINES;
+        drawInputRows(cursorRow);
+        return;
+    }
+    inputCursorRow = cursorRow;
+    termFlushRows(fromRow, MAX_LINES);
+}
+// ----------------------------
+// drawInputArea() - Draws ONLY the command input area (no scrollback)
+// ----------------------------
+void drawInputArea() {
+    drawInputRows(0);
+}
+// Redraws the input area from buffer position pos onward, plus the rows the
+// previous cursor covered. Typing at the end of a long command touches one row.
+void drawInputFrom(int pos) {
+    const int rows = inputRowCount();
+    const int topRow = MAX_LINES - rows;
+    const int firstSegment = inputSegmentCount(cmdLen) - rows;
+    int row = topRow + max(inputSegmentOf(max(pos, 0)) - firstSegment, 0);
+    drawInputRows(min(row, inputCursorRow));
+}
+// ----------------------------
+// drawCursorAndPreview()  Draws just the cursor and keyboard preview (Interaction point)
+// ----------------------------
+void drawCursorAndPreview() {
+    if (activeApp) return;
+    drawInputFrom(cursorPos);
+}
+void ensureCursorVisible() {
+    drawCursorAndPreview();
+}
+void clearCmdBuffer() {
+    memset(cmdBuf, 0, CMD_BUF);
+    cmdLen = 0; cursorPos = 0;
+    inputWrapped = false; 
+    drawFullTerminal();
+}
+void insertCharAtCursor(char c) {
+    if (cmdLen + 1 >= CMD_BUF) return;
+    const int preCount = inputSegmentCount(cmdLen);
+
+    memmove(cmdBuf + cursorPos + 1, cmdBuf + cursorPos, cmdLen - cursorPos);
+    cmdBuf[cursorPos] = c;
+    cursorPos++; // Cursor moves forward after insertion
+    cmdLen++;
+    cmdBuf[cmdLen] = 0;
+
+    // A new input row shifts the history area up; otherwise only the tail changes.
+    if (inputSegmentCount(cmdLen) != preCount) drawFullTerminal();
+    else drawInputFrom(cursorPos - 1);
+
+    // --- Reset F1 sequence ---
+    f1_copy_index = 0;
+}
+void insertStringAtCursor(const String& s) {
+    for(int i = 0; i < s.length(); ++i) {
+        insertCharAtCursor(s.charAt(i));
+    }
+}
+void backspaceAtCursor() {
+    // Exit if there is nothing to delete.
+    if (cursorPos == 0 || cmdLen == 0) {
+        return;
+    }
+    const int preCount = inputSegmentCount(cmdLen);
+
+    memmove(cmdBuf + cursorPos - 1, cmdBuf + cursorPos, cmdLen - cursorPos);
+    cmdLen--;
+    cursorPos--;
+    cmdBuf[cmdLen] = 0;
+
+    // An un-wrap gives a row back to the history area; otherwise only the tail changes.
+    if (inputSegmentCount(cmdLen) != preCount) drawFullTerminal();
+    else drawInputFrom(cursorPos);
+}
+void clearCurrentCommand() {
+    memset(cmdBuf, 0, CMD_BUF);
+    cmdLen = 0; cursorPos = 0;
+    inputWrapped = false;
+}
+void loadHistoryCommand(int index) {
+    if (historyCount == 0 || index < 0 || index >= historyCount) {
+        pushSystemMessage("Error: Invalid history index.");
+        return;
+    }
+
+    clearCurrentCommand(); 
+
+    String command = history[index % HISTORY_SIZE]; // Use modulo for wrap-around array
+    if (command.length() >= CMD_BUF) {
+        pushSystemMessage("Error: Command too long to recall.");
+        return;
+    }
+    
+    command.toCharArray(cmdBuf, CMD_BUF);
+    cmdLen = command.length();
+    cursorPos = cmdLen;
+    inputWrapped = false;
+    
+    drawFullTerminal();
+}
+// Helper to load command based on historyIndex, cycling down (older)
+void historyRecallDown() {
+    if (historyCount == 0) return;
+    
+    // If we're at the latest command (or typing new), start from the newest history item
+    if (historyIndex == historyCount) { 
+        historyIndex = historyCount - 1;
+    } else {
+        // Move to the next older command
+        if (historyIndex > 0) {
+            historyIndex--;
+        } else {
+            // Stay at the oldest command (index 0)
+            return; 
+        }
+    }
+    
+    // Load the command
+    loadHistoryCommand(historyIndex % HISTORY_SIZE);
+}
+// Helper to load command based on historyIndex, cycling up (newer/back to blank)
+void historyRecallUp() {
+    if (historyCount == 0) return;
+    
+    // Move to the next newer command
+    if (historyIndex < historyCount - 1) {
+        historyIndex++;
+        loadHistoryCommand(historyIndex % HISTORY_SIZE);
+    } else if (historyIndex == historyCount - 1) {
+        // Move from the newest command to the blank command line
+        historyIndex = historyCount;
+        clearCurrentCommand(); 
+        drawFullTerminal(); 
+    }
+}
+void addHistory(const String &line) {
+    if (line.length() == 0) return;
+    if (historyCount > 0 && history[(historyCount - 1) % HISTORY_SIZE] == line) return;
+    history[historyCount % HISTORY_SIZE] = line;
+    if (historyCount < HISTORY_SIZE) historyCount++;
+    historyIndex = historyCount;
+    lastCommand = line; // Tracks the last command for F1, F2, F3
+}
+// ----------------------------
+// Keyboard Handlers
+// ----------------------------
+void kbPrev() {
+    if (fkeyState == F_AWAIT_FORMAT_CONFIRM) {
+        // Use the dedicated formatIndex instead of kbIndex
+        formatIndex--;
+        // Constrain the index to wrap back to 1 ('N') if it falls below 0 ('Y')
+        if (formatIndex < 0) { 
+            formatIndex = 1; 
+        }
+        // NOTE: drawCursorAndPreview() must be updated to use formatIndex
+        drawCursorAndPreview(); 
+        return; 
+    }
+    kbIndex--;
+    if (kbIndex < 0) {
+        // ALPHA modes wrap to the [CASE]/[case] key at X + 3
+        if (kmode == ALPHA || kmode == ALPHA_LOWER) kbIndex = strlen(alphaChars) + 3;
+        // NUM and SYM modes wrap to the [ENTER] key at X + 2
+        else if (kmode == NUM) kbIndex = strlen(numberChars) + 2;
+        else if (kmode == SYM) kbIndex = strlen(symbolChars) + 2;
+        // Max index for CTRL is [FUNC] (index 6)
+        else if (kmode == CTRL) kbIndex = CTRL_COUNT + 1;
+        // Max index for FUNC_VIEW is [F12] (index 12)
+        else if (kmode == FUNC_VIEW) kbIndex = FUNC_COUNT;
+    }
+}
+void kbNext() {
+    if (fkeyState == F_AWAIT_FORMAT_CONFIRM) {
+        // Use the dedicated formatIndex instead of kbIndex
+        formatIndex++;
+        // Constrain the index to wrap back to 0 ('Y') if it exceeds 1 ('N')
+        if (formatIndex > 1) { 
+            formatIndex = 0; 
+        }
+        // NOTE: drawCursorAndPreview() must be updated to use formatIndex
+        drawCursorAndPreview(); 
+        return;
+    }
+    int maxIndex = 0;
+    
+    // ALPHA modes have the extra [CASE]/[case] key at X + 3
+    if (kmode == ALPHA || kmode == ALPHA_LOWER) {
+        maxIndex = strlen(alphaChars) + 3; 
+    } 
+    // NUM and SYM modes only have [SPACE] (X+1) and [ENTER] (X+2)
+    else if (kmode == NUM) {
+        maxIndex = strlen(numberChars) + 2;
+    } else if (kmode == SYM) {
+        maxIndex = strlen(symbolChars) + 2;
+    } 
+    // Max index for CTRL is [FUNC] (index 6)
+    else if (kmode == CTRL) {
+        maxIndex = CTRL_COUNT + 1;
+    }
+    // Max index for FUNC_VIEW is [F12] (index 12)
+    else if (kmode == FUNC_VIEW) {
+        maxIndex = FUNC_COUNT;
+    }
+    
+    kbIndex++;
+    if (kbIndex > maxIndex) {
         kbIndex = 0;
     }
     drawCursorAndPreview();
@@ -1800,20 +3834,8 @@ void kbConfirm() {
         inputWrapped = false; 
         historyIndex = historyCount; 
 
-        // 4a. SWAP ORDER: CLEAR ARTIFACTS FIRST 
-        // ** EXPANDED ARTIFACT FIX to full line **
-        const int y_pos_start = (MAX_LINES - 1) * LINE_HEIGHT; 
-        const int start_y = y_pos_start - 1;
-        const int y_height = LINE_HEIGHT + 1; 
-        
-        // Wipe the entire last line of the screen to remove Y/N remnants
-        tft.fillRect(0, start_y, SCREEN_WIDTH, y_height, ST77XX_BLACK); 
-        
-        // 4b. Redraw the full terminal (Draws the clean PICOS> prompt)
+        // 4a. Redraw the full terminal (the Y/N cell is replaced by the [ALPHA] cursor)
         drawFullTerminal(); 
-
-        // 4c. Redraw the new [ALPHA] mode label and cursor.
-        drawCursorAndPreview(); 
         
         // 5. ENSURE the function exits and does not fall through.
         return;
@@ -2000,15 +4022,14 @@ void kbConfirm() {
             String currentInput = String(cmdBuf).substring(0, cmdLen);
             String fullCommand = "";
             
-            int i = scrollbackCount - 1;
+            int i = scrollbackLineCount() - 1;
             if (inputWrapped) { 
                 while (i >= 0) {
-                    int idx = (scrollbackHead + i) % SCROLLBACK_SIZE;
-                    String line = scrollback[idx].text;
+                    String line = scrollbackLineText(i);
                     
                     if (line.startsWith(PROMPT)) {
                         fullCommand = line.substring(PROMPT.length()) + fullCommand;
-                        scrollbackCount = i;
+                        scrollbackTruncate(i);
                         break;
                     } 
                     else if (!line.startsWith(SYS_PROMPT)) { 
@@ -2036,19 +4057,19 @@ void kbConfirm() {
             
             // Proceed with scrollback and execution ONLY for non-empty commands
             
-            const int MAX_CHUNKS = 16;
-            String fwdFinal[MAX_CHUNKS];
-            int fwdCountFinal = 0;
-            calculateFullWrapSegments(fullCommand, fwdFinal, fwdCountFinal, MAX_CHUNKS, false);
-            if (fwdCountFinal > 0) {
-                 pushScrollback(PROMPT + fwdFinal[0]);
-            }
-            for (int j = 1; j < fwdCountFinal; j++) {
-                pushScrollback(fwdFinal[j]);
+            // Echo the command with the same row breaks the input area used
+            const int echoLen = fullCommand.length();
+            for (int seg = 0; seg < inputSegmentCount(echoLen); seg++) {
+                int start = inputSegmentStart(seg);
+                String part = fullCommand.substring(start, start + inputSegmentLength(seg, echoLen));
+                pushScrollback(seg == 0 ? PROMPT + part : part);
             }
             
             addHistory(fullCommand);
-            executeCommandLine(fullCommand);
+            // Handlers may edit cmdBuf (bench input), so the tokens live in their own buffer
+            static char execLine[CMD_BUF];
+            fullCommand.toCharArray(execLine, sizeof(execLine));
+            executeCommandLine(execLine);
 
             clearCmdBuffer(); 
             return;
@@ -2235,467 +4256,1603 @@ void handleFKeyInput(char inputChar) {
         }
         fkeyState = F_INACTIVE;
     }
-    
-    // Final state cleanup and redraw
-    kmode = ALPHA;
-    kbIndex = 0;
-    drawFullTerminal(); 
+    
+    // Final state cleanup and redraw
+    kmode = ALPHA;
+    kbIndex = 0;
+    drawFullTerminal(); 
+}
+// ----------------------------
+// Command parsing & execution helpers
+// ----------------------------
+String trimStr(const String &s) {
+    int i = 0;
+    while (i < s.length() && isspace(s[i])) i++;
+    int j = s.length() - 1; while (j >= 0 && isspace(s[j])) j--;
+    if (j < i) return "";
+    return s.substring(i, j + 1);
+}
+// ----------------------------
+// Calculator
+// ----------------------------
+struct CalcFunction {
+    const char *name;
+    double (*fn)(double);
+};
+const CalcFunction CALC_FUNCTIONS[] = {
+    {"abs", [](double v) { return fabs(v); }},
+    {"acos", acos}, {"asin", asin}, {"atan", atan},
+    {"ceil", ceil}, {"cos", cos}, {"exp", exp}, {"floor", floor},
+    {"ln", log}, {"log", log10},
+    {"round", [](double v) { return v < 0 ? ceil(v - 0.5) : floor(v + 0.5); }},
+    {"sin", sin}, {"sqrt", sqrt}, {"tan", tan},
+};
+const int CALC_FUNCTION_COUNT = sizeof(CALC_FUNCTIONS) / sizeof(CALC_FUNCTIONS[0]);
+
+bool calcNameIs(const char *name, size_t len, const char *word) {
+    return strlen(word) == len && strncmp(name, word, len) == 0;
+}
+int calcFindFunction(const char *name, size_t len) {
+    for (int i = 0; i < CALC_FUNCTION_COUNT; ++i) {
+        if (calcNameIs(name, len, CALC_FUNCTIONS[i].name)) return i;
+    }
+    return -1;
+}
+int calcFindVar(const char *name, size_t len) {
+    for (int i = 0; i < calcVarCount; ++i) {
+        if (calcNameIs(name, len, calcVars[i].name)) return i;
+    }
+    return -1;
+}
+// Returns the slot for name, creating it (value 0) if needed; -1 if the table is full.
+int calcVarSlot(const char *name, size_t len) {
+    int slot = calcFindVar(name, len);
+    if (slot >= 0 || calcVarCount >= CALC_MAX_VARS) return slot;
+    memcpy(calcVars[calcVarCount].name, name, len);
+    calcVars[calcVarCount].name[len] = '\0';
+    calcVars[calcVarCount].value = 0.0;
+    return calcVarCount++;
+}
+bool calcEmit(CalcParser &ps, uint8_t byte, int stackDelta) {
+    if (ps.status != CALC_OK) return false;
+    ps.depth += stackDelta;
+    if (ps.prog->codeLen >= CALC_MAX_CODE || ps.depth > CALC_MAX_STACK) {
+        ps.status = CALC_ERR_COMPLEX;
+        return false;
+    }
+    ps.prog->code[ps.prog->codeLen++] = byte;
+    return true;
+}
+int calcInternConst(CalcProgram &prog, double v) {
+    for (int i = 0; i < prog.constCount; ++i) {
+        if (prog.consts[i] == v) return i;
+    }
+    if (prog.constCount >= CALC_MAX_CONSTS) return -1;
+    prog.consts[prog.constCount] = v;
+    return prog.constCount++;
+}
+void calcEmitConst(CalcParser &ps, double v) {
+    int k = calcInternConst(*ps.prog, v);
+    if (k < 0) { ps.status = CALC_ERR_COMPLEX; return; }
+    if (calcEmit(ps, OPC_CONST, 1)) calcEmit(ps, k, 0);
+}
+// Parses "expr)" after an opening parenthesis has been consumed.
+void calcParseGroup(CalcParser &ps) {
+    if (++ps.nest > CALC_MAX_NEST) { ps.status = CALC_ERR_COMPLEX; return; }
+    calcParseExpr(ps);
+    ps.nest--;
+    if (ps.status != CALC_OK) return;
+    if (*ps.p != ')') { ps.status = CALC_ERR_PAREN; return; }
+    ps.p++;
+}
+void calcParsePrimary(CalcParser &ps) {
+    char c = *ps.p;
+    if (isdigit((unsigned char)c) || c == '.') {
+        char *end;
+        double v = strtod(ps.p, &end);
+        if (end == ps.p) { ps.status = CALC_ERR_SYNTAX; return; }
+        ps.p = end;
+        calcEmitConst(ps, v);
+    } else if (isalpha((unsigned char)c)) {
+        const char *name = ps.p;
+        while (isalnum((unsigned char)*ps.p) || *ps.p == '_') ps.p++;
+        size_t len = ps.p - name;
+        if (*ps.p == '(') {
+            int fn = calcFindFunction(name, len);
+            if (fn < 0) { ps.status = CALC_ERR_NAME; return; }
+            ps.p++;
+            calcParseGroup(ps);
+            if (calcEmit(ps, OPC_CALL, 0)) calcEmit(ps, fn, 0);
+        } else if (calcNameIs(name, len, "pi")) {
+            calcEmitConst(ps, PI);
+        } else if (calcNameIs(name, len, "e")) {
+            calcEmitConst(ps, 2.718281828459045);
+        } else {
+            int slot = calcFindVar(name, len);
+            if (slot < 0) { ps.status = CALC_ERR_NAME; return; }
+            if (calcEmit(ps, OPC_VAR, 1)) calcEmit(ps, slot, 0);
+        }
+    } else if (c == '(') {
+        ps.p++;
+        calcParseGroup(ps);
+    } else {
+        ps.status = (c == ')') ? CALC_ERR_PAREN : c ? CALC_ERR_CHAR : CALC_ERR_SYNTAX;
+    }
+}
+// power := primary ['^' unary], right-associative, so 2^-1 and 2^3^2 work
+void calcParsePower(CalcParser &ps) {
+    calcParsePrimary(ps);
+    if (ps.status != CALC_OK || *ps.p != '^') return;
+    ps.p++;
+    if (++ps.nest > CALC_MAX_NEST) { ps.status = CALC_ERR_COMPLEX; return; }
+    calcParseUnary(ps);
+    ps.nest--;
+    calcEmit(ps, OPC_POW, -1);
+}
+// unary := {'+'|'-'} power; binds looser than ^, so -2^2 is -4
+void calcParseUnary(CalcParser &ps) {
+    bool negate = false;
+    while (*ps.p == '-' || *ps.p == '+') {
+        if (*ps.p == '-') negate = !negate;
+        ps.p++;
+    }
+    calcParsePower(ps);
+    if (negate) calcEmit(ps, OPC_NEG, 0);
 }
-// ----------------------------
-// Command parsing & execution helpers
-// ----------------------------
-String trimStr(const String &s) {
-    int i = 0;
-    while (i < s.length() && isspace(s[i])) i++;
-    int j = s.length() - 1; while (j >= 0 && isspace(s[j])) j--;
-    if (j < i) return "";
-    return s.substring(i, j + 1);
+// term := unary {('*'|'/'|'%') unary}, left-associative, so 7%4%2 is (7%4)%2 = 1
+void calcParseTerm(CalcParser &ps) {
+    calcParseUnary(ps);
+    while (ps.status == CALC_OK && (*ps.p == '*' || *ps.p == '/' || *ps.p == '%')) {
+        char op = *ps.p++;
+        calcParseUnary(ps);
+        calcEmit(ps, op == '*' ? OPC_MUL : op == '/' ? OPC_DIV : OPC_MOD, -1);
+    }
 }
-// basic arithmetic calculator
-// arithmetic calculator with ALL fixed-size stacks/queues
-// arithmetic calculator with fixed stacks, char op stack, char operator in Tok
-String evalCalc(const String &expr) {
-    String s = expr;
-    String t = "";
-    // Remove spaces
-    for (unsigned int i = 0; i < s.length(); ++i) if (s[i] != ' ') t += s[i];
-    s = t;
-
-    // --- Fixed-size structures ---
-    const int MAX_TOKENS_OUT = 32;
-    const int MAX_OPS_STACK = 16;
-    const int MAX_EVAL_STACK = 16;
-
-    // *** Modified Tok struct ***
-    struct Tok {
-        String v; // Only used for numbers ('n') now
-        char type; // 'n' or 'o'
-        char op_char; // Stores the operator directly if type is 'o'
-    };
-
-    Tok out[MAX_TOKENS_OUT]; int out_sz = 0;
-    char op[MAX_OPS_STACK]; int op_sz = 0; // Operator stack remains char
-    double st[MAX_EVAL_STACK]; int st_sz = 0;
-
-    // --- Helper lambdas ---
-    auto push_out = [&](Tok tk) {
-        if (out_sz >= MAX_TOKENS_OUT) return false;
-        out[out_sz++] = tk;
-        return true;
-    };
-    auto push_op = [&](char o) {
-        if (op_sz >= MAX_OPS_STACK) return false;
-        op[op_sz++] = o;
-        return true;
-    };
-    auto pop_op = [&]()->char {
-        if (op_sz == 0) return '\0';
-        return op[--op_sz];
-    };
+// expr := term {('+'|'-') term}, left-associative
+void calcParseExpr(CalcParser &ps) {
+    calcParseTerm(ps);
+    while (ps.status == CALC_OK && (*ps.p == '+' || *ps.p == '-')) {
+        char op = *ps.p++;
+        calcParseTerm(ps);
+        calcEmit(ps, op == '+' ? OPC_ADD : OPC_SUB, -1);
+    }
+}
+// text must contain no whitespace (see calcLookup). "name = expr" also stores the result.
+CalcStatus calcCompile(const char *text, CalcProgram &prog) {
+    prog.codeLen = 0;
+    prog.constCount = 0;
+    prog.storeVar = -1;
+
+    const char *target = nullptr;
+    size_t targetLen = 0;
+    if (isalpha((unsigned char)*text)) {
+        const char *q = text;
+        while (isalnum((unsigned char)*q) || *q == '_') q++;
+        if (*q == '=') {
+            target = text;
+            targetLen = q - text;
+            text = q + 1;
+        }
+    }
 
-    auto isOp = [&](char c){ return c=='+'||c=='-'||c=='*'||c=='/'; };
-    auto prec = [&](char c)->int { if (c=='+'||c=='-') return 1; if (c=='*'||c=='/') return 2; return 0; };
-
-    // --- Shunting-Yard Algorithm ---
-    for (unsigned int i = 0; i < s.length();) {
-        char c = s[i];
-        if ((c >= '0' && c <= '9') || c=='.') { // Number
-            String num="";
-            while (i<s.length() && ((s[i]>='0'&&s[i]<='9') || s[i]=='.')) { num+=s[i]; i++; }
-            // Store number in v, type 'n', op_char irrelevant
-            Tok num_token = {num, 'n', '\0'};
-            if (!push_out(num_token)) return "ERR: Expression Too Complex (Output)";
-        } else if (isOp(c)) { // Operator
-            char opch = c;
-            while (op_sz > 0 && op[op_sz-1] != '(' && prec(op[op_sz-1]) >= prec(opch)) {
-                 char popped_op_char = pop_op();
-                 if (popped_op_char == '\0') return "ERR: Syntax (Pop Op)";
-                 // *** Store operator char in op_char, type 'o', v irrelevant ***
-                 Tok operator_token = {"", 'o', popped_op_char};
-                 if (!push_out(operator_token)) return "ERR: Expression Too Complex (Output)";
-            }
-            if (!push_op(opch)) return "ERR: Expression Too Complex (Operator Stack)";
-            i++;
-        } else if (c=='(') { // Left parenthesis
-            if (!push_op('(')) return "ERR: Expression Too Complex (Operator Stack)";
-            i++;
-        } else if (c==')') { // Right parenthesis
-            bool found=false;
-            while (op_sz > 0) {
-                char top_char = pop_op();
-                if (top_char == '\0') return "ERR: Syntax (Pop Op)";
-                if (top_char == '(') { found=true; break; }
-                 // *** Store operator char in op_char, type 'o', v irrelevant ***
-                 Tok operator_token = {"", 'o', top_char};
-                if (!push_out(operator_token)) return "ERR: Expression Too Complex (Output)";
-            }
-            if (!found) return "ERR: Mismatched Parentheses";
-            i++;
-        } else { // Invalid character
-             return "ERR: Invalid Character";
-        }
-    }
-
-    while (op_sz > 0) { // Pop remaining operators
-        char top_char = pop_op();
-        if (top_char == '\0') return "ERR: Syntax (Pop Op)";
-        if (top_char == '(' || top_char == ')') return "ERR: Mismatched Parentheses";
-         // *** Store operator char in op_char, type 'o', v irrelevant ***
-         Tok operator_token = {"", 'o', top_char};
-        if (!push_out(operator_token)) return "ERR: Expression Too Complex (Output)";
-    }
-
-    // --- RPN Evaluation ---
-    st_sz = 0;
-    for (int i = 0; i < out_sz; ++i) {
-        Tok &tk = out[i];
-        if (tk.type=='n') { // Number
-            if (st_sz >= MAX_EVAL_STACK) return "ERR: Evaluation Stack Overflow";
-            st[st_sz] = atof(tk.v.c_str()); // Get number from v
-            st_sz++;
-        } else if (tk.type=='o') { // Operator
-            if (st_sz < 2) return "ERR: Syntax (Eval Stack Underflow)";
-            st_sz--; double b = st[st_sz];
-            st_sz--; double a = st[st_sz];
-
-            // *** Get operator directly from op_char ***
-            char opch = tk.op_char;
-            double res = 0;
-            if (opch=='+') res = a + b;
-            else if (opch=='-') res = a - b;
-            else if (opch=='*') res = a * b;
-            else if (opch=='/') {
-                if (b == 0.0) return "INF";
-                res = a / b;
-            } else {
-                 // Check if op_char is somehow null/invalid
-                 if (opch == '\0') return "ERR: Internal Null Operator";
-                 else return "ERR: Unknown Operator"; // Should not happen
+    CalcParser ps = {text, &prog, 0, 0, CALC_OK};
+    calcParseExpr(ps);
+    if (ps.status == CALC_OK && *ps.p) ps.status = (*ps.p == ')') ? CALC_ERR_PAREN : CALC_ERR_SYNTAX;
+    if (ps.status != CALC_OK) return ps.status;
+
+    if (target) {
+        if (targetLen > CALC_NAME_LEN || calcNameIs(target, targetLen, "ans") || calcNameIs(target, targetLen, "pi") ||
+            calcNameIs(target, targetLen, "e") || calcFindFunction(target, targetLen) >= 0) return CALC_ERR_NAME;
+        int slot = calcVarSlot(target, targetLen);
+        if (slot < 0) return CALC_ERR_VARS;
+        prog.storeVar = slot;
+    }
+    return CALC_OK;
+}
+// Runs a compiled program; on success also updates "ans" and any assigned variable.
+CalcStatus calcExecute(const CalcProgram &prog, double &result) {
+    double st[CALC_MAX_STACK]; // Depth was bounded at compile time
+    int sp = 0;
+    for (int pc = 0; pc < prog.codeLen;) {
+        uint8_t op = prog.code[pc++];
+        switch (op) {
+            case OPC_CONST: st[sp++] = prog.consts[prog.code[pc++]]; break;
+            case OPC_VAR:   st[sp++] = calcVars[prog.code[pc++]].value; break;
+            case OPC_CALL:  st[sp - 1] = CALC_FUNCTIONS[prog.code[pc++]].fn(st[sp - 1]); break;
+            case OPC_NEG:   st[sp - 1] = -st[sp - 1]; break;
+            default: {
+                double b = st[--sp];
+                double &a = st[sp - 1];
+                if (op == OPC_ADD) a += b;
+                else if (op == OPC_SUB) a -= b;
+                else if (op == OPC_MUL) a *= b;
+                else if (op == OPC_POW) a = pow(a, b);
+                else if (b == 0.0) return CALC_ERR_DIV_ZERO;
+                else if (op == OPC_DIV) a /= b;
+                else a = fmod(a, b);
             }
-            st[st_sz] = res;
-            st_sz++;
         }
     }
+    result = st[0];
+    if (!isfinite(result)) return CALC_ERR_DOMAIN;
+    if (prog.storeVar >= 0) calcVars[prog.storeVar].value = result;
+    calcVars[0].value = result;
+    return CALC_OK;
+}
+// Finds or compiles the program for expr. The pointer stays valid until the next lookup.
+const CalcProgram *calcLookup(const char *expr, CalcStatus &status) {
+    static char key[CMD_BUF];
+    static CalcProgram uncached;
+    size_t len = 0;
+    uint32_t hash = 2166136261u; // FNV-1a over the text without whitespace
+    for (; *expr && len < sizeof(key) - 1; ++expr) {
+        if (isspace((unsigned char)*expr)) continue;
+        key[len++] = *expr;
+        hash = (hash ^ (uint8_t)*expr) * 16777619u;
+    }
+    key[len] = '\0';
 
-    // --- Final Result ---
-    if (st_sz != 1) return "ERR: Syntax (Final Eval Stack)";
-
-    // Format result
+    if (len >= CALC_CACHE_TEXT) {
+        status = calcCompile(key, uncached);
+        return status == CALC_OK ? &uncached : nullptr;
+    }
+    CalcCacheEntry *victim = &calcCache[0];
+    for (int i = 0; i < CALC_CACHE_SIZE; ++i) {
+        CalcCacheEntry &e = calcCache[i];
+        if (e.lastUse && e.hash == hash && strcmp(e.text, key) == 0) {
+            e.lastUse = ++calcCacheClock;
+            status = CALC_OK;
+            return &e.prog;
+        }
+        if (e.lastUse < victim->lastUse) victim = &e;
+    }
+    status = calcCompile(key, victim->prog);
+    if (status != CALC_OK) {
+        victim->lastUse = 0;
+        return nullptr;
+    }
+    victim->hash = hash;
+    victim->lastUse = ++calcCacheClock;
+    memcpy(victim->text, key, len + 1);
+    return &victim->prog;
+}
+CalcStatus calcEvaluate(const char *expr, double &result) {
+    CalcStatus status;
+    const CalcProgram *prog = calcLookup(expr, status);
+    return prog ? calcExecute(*prog, result) : status;
+}
+const char *calcStatusText(CalcStatus status) {
+    switch (status) {
+        case CALC_OK:           return "OK";
+        case CALC_ERR_SYNTAX:   return "Syntax";
+        case CALC_ERR_PAREN:    return "Mismatched Parentheses";
+        case CALC_ERR_CHAR:     return "Invalid Character";
+        case CALC_ERR_NAME:     return "Unknown Name";
+        case CALC_ERR_COMPLEX:  return "Expression Too Complex";
+        case CALC_ERR_VARS:     return "Too Many Variables";
+        case CALC_ERR_DIV_ZERO: return "Division by zero";
+        default:                return "Math Domain";
+    }
+}
+// Six decimals with trailing zeros (and a bare point) removed.
+String calcFormat(double v) {
     char buf[64];
-    dtostrf(st[0], 0, 6, buf);
+    dtostrf(v, 0, 6, buf);
     String outstr = String(buf);
     while (outstr.length()>1 && outstr.indexOf('.')>=0 && (outstr.endsWith("0") || outstr.endsWith("."))) {
         if (outstr.endsWith("0")) outstr.remove(outstr.length()-1);
         else if (outstr.endsWith(".")) { outstr.remove(outstr.length()-1); break; }
     }
-
     return outstr;
 }
-void tokenizeLine(const String &line, String tokens[], int &count, int maxTokens) {
-    count = 0;
-    int current = 0;
-    bool inQuote = false;
-    
-    for (int i = 0; i < line.length() && count < maxTokens; ++i) {
-        char c = line[i];
-        
-        if (c == '"') {
-            inQuote = !inQuote;
-        } else if (isspace(c) && !inQuote) {
-            if (current > 0) {
-                tokens[count++] = line.substring(i - current, i);
-                current = 0;
-            }
+// Streams path and evaluates expr once per numeric line, with x set to the line's value.
+void calcRunFile(const String &path, const char *expr) {
+    if (!fsReady) { pushSystemMessage("Error: LittleFS not available."); return; }
+    File file = LittleFS.open(path, "r");
+    if (!file) { pushSystemMessage("Error: File not found: " + path); return; }
+
+    int x = calcVarSlot("x", 1);
+    CalcStatus status;
+    const CalcProgram *prog = x < 0 ? nullptr : calcLookup(expr, status);
+    if (!prog) {
+        file.close();
+        pushSystemMessage("Error: Invalid expression or " + String(calcStatusText(x < 0 ? CALC_ERR_VARS : status)) + ".");
+        return;
+    }
+
+    uint8_t chunk[128];
+    char line[48];
+    int lineLen = 0;
+    bool overlong = false;
+    uint32_t evaluated = 0, skipped = 0;
+    auto finishLine = [&]() {
+        line[lineLen] = '\0';
+        char *end;
+        double in = strtod(line, &end);
+        while (isspace((unsigned char)*end)) end++;
+        if (overlong || end == line || *end) {
+            if (lineLen > 0 || overlong) skipped++;
         } else {
-            if (current == 0 && count < maxTokens) {
-                // Start of a new token
-                int start = i;
-                while (i < line.length() && (inQuote || !isspace(line[i]))) {
-                    if (line[i] == '"') inQuote = !inQuote;
-                    i++;
-                }
-                tokens[count++] = line.substring(start, i);
-                i--; // Back up one to re-check the space/next char
-                current = 0; // Reset current, token is saved
-            }
+            double out;
+            calcVars[x].value = in;
+            CalcStatus st = calcExecute(*prog, out);
+            pushScrollback(String(line) + " -> " + (st == CALC_OK ? calcFormat(out) : String(calcStatusText(st))));
+            evaluated++;
+        }
+        lineLen = 0;
+        overlong = false;
+    };
+    while (file.available()) {
+        int n = file.read(chunk, sizeof(chunk));
+        if (n <= 0) break;
+        for (int i = 0; i < n; ++i) {
+            char c = (char)chunk[i];
+            if (c == '\n') finishLine();
+            else if (c == '\r') continue;
+            else if (lineLen < (int)sizeof(line) - 1) line[lineLen++] = c;
+            else overlong = true;
         }
     }
+    if (lineLen > 0 || overlong) finishLine();
+    file.close();
+    pushSystemMessage("calc: " + String(evaluated) + " lines, " + String(skipped) + " skipped");
+}
+// Splits line into whitespace-separated tokens, in place. "double quotes" group
+// words (also mid-token), a backslash takes the next character literally.
+// Unescaped text is compacted towards the token start; the write position never
+// passes the read position, so the line can be rewritten while it is scanned.
+int tokenizeInPlace(char *line, CmdArgs &args) {
+    args.line = line;
+    args.count = 0;
+    args.overflow = false;
+    char *r = line;
+    char *w = line;
+    while (true) {
+        while (*r && isspace((unsigned char)*r)) r++;
+        if (!*r) break;
+        if (args.count == MAX_ARGS) { args.overflow = true; break; }
+
+        char *start = w;
+        bool inQuote = false;
+        while (*r && (inQuote || !isspace((unsigned char)*r))) {
+            char c = *r++;
+            if (c == '"') { inQuote = !inQuote; continue; }
+            if (c == '\\' && *r) c = *r++;
+            *w++ = c;
+        }
+        if (*r) r++; // Consume the delimiter before it can be overwritten by the terminator
+        *w++ = '\0';
 
-    if (current > 0 && count < maxTokens) {
-        tokens[count++] = line.substring(line.length() - current);
+        TokenView &t = args.tok[args.count++];
+        t.off = (uint16_t)(start - line);
+        t.len = (uint16_t)(w - 1 - start);
     }
-    
-    // Final post-processing to strip surrounding quotes if present
-    for (int i = 0; i < count; ++i) {
-        if (tokens[i].startsWith("\"") && tokens[i].endsWith("\"") && tokens[i].length() >= 2) {
-            tokens[i] = tokens[i].substring(1, tokens[i].length() - 1);
+    return args.count;
+}
+// Tokens first..count-1 rejoined with single spaces (for free-form arguments).
+String joinArgs(const CmdArgs &args, int first) {
+    String out;
+    for (int i = first; i < args.count; ++i) {
+        if (i > first) out += ' ';
+        out += args[i];
+    }
+    return out;
+}
+// ----------------------------
+// Command handlers
+// ----------------------------
+// Each handler gets the tokenized line (args[0] is the command).
+// Argument counts below the table's minArgs never reach the handler.
+CmdResult cmdHelp(CmdArgs &args) {
+    pushSystemMessage("Available commands:");
+    pushCommandHelp();
+    return CMD_DONE;
+}
+CmdResult cmdFkey(CmdArgs &args) {
+    pushScrollback("--- F-Key functionality: ---");
+    pushScrollback("F1: Print last command, char by char.");
+    pushScrollback("F2: Copy last cmd up to char.");
+    pushScrollback("F3: Repeat last cmd.");
+    pushScrollback("F4: Delete current cmd up to char.");
+    pushScrollback("F5: Recall last cmd. F6: Insert ^Z.");
+    pushScrollback("F7: Show history.");
+    pushScrollback("F8: Cycle back history.");  
+    pushScrollback("F9: Recall by history index.");
+    return CMD_DONE;
+}
+CmdResult cmdClear(CmdArgs &args) {
+    scrollbackClear();
+    return CMD_DONE;
+}
+CmdResult cmdCube(CmdArgs &args) {
+    return appStart(CUBE_APP) ? CMD_OWNS_SCREEN : CMD_DONE;
+}
+CmdResult cmdMood(CmdArgs &args) {
+    const MoodEffect *effect = moodFindEffect(args.count > 1 ? args[1] : "solid");
+    if (!effect) {
+        String names;
+        for (size_t i = 0; i < MOOD_EFFECT_COUNT; ++i) names += String(" ") + MOOD_EFFECTS[i].name;
+        pushSystemMessage("Error: Effects:" + names + ".");
+        return CMD_DONE;
+    }
+    moodApp.effect = effect;
+    return appStart(MOOD_APP) ? CMD_OWNS_SCREEN : CMD_DONE;
+}
+CmdResult cmdMoon(CmdArgs &args) {
+    return appStart(MOON_APP) ? CMD_OWNS_SCREEN : CMD_DONE;
+}
+CmdResult cmdVer(CmdArgs &args) {
+    pushSystemMessage(deviceVersion);
+    return CMD_DONE;
+}
+CmdResult cmdEcho(CmdArgs &args) {
+    String output = "";
+    String filePath = "";
+    bool appendMode = false;
+    bool redirection = false;
+
+    for (int i = 1; i < args.count; ++i) {
+        if (strcmp(args[i], ">") == 0 || strcmp(args[i], ">>") == 0) {
+            redirection = true;
+            appendMode = (args.tok[i].len == 2);
+            if (i + 1 < args.count) filePath = args[i + 1];
+            else { pushSystemMessage("Error: Missing filename write!"); return CMD_DONE; }
+            break;
+        }
+        if (output.length() > 0) output += " ";
+        output += args[i];
+    }
+
+    if (redirection) {
+        if (filePath.length() == 0) pushSystemMessage("Error: Missing filename for write!");
+        else if (writeFile(filePath, output, appendMode))
+            pushSystemMessage("Echo " + String(appendMode ? ">> " : "> ") + filePath + ": Success!");
+        else pushSystemMessage("Error: Failed to write to " + filePath);
+    } else {
+        pushSystemMessage(output);
+    }
+    return CMD_DONE;
+}
+CmdResult cmdTime(CmdArgs &args) {
+    unsigned long uptime = (millis() - startMillis) / 1000;
+    unsigned long seconds = uptime % 60;
+    unsigned long minutes = (uptime / 60) % 60;
+    unsigned long hours = (uptime / 3600);
+    char buf[32];
+    sprintf(buf, "Uptime: %lu:%02lu:%02lu", hours, minutes, seconds);
+    pushSystemMessage(String(buf));
+    return CMD_DONE;
+}
+CmdResult cmdCalc(CmdArgs &args) {
+    if (strcmp(args[1], "-f") == 0) {
+        if (args.count < 4) pushSystemMessage("Usage: calc -f <file> <expr of x>");
+        else calcRunFile(args[2], joinArgs(args, 3).c_str());
+        return CMD_DONE;
+    }
+    String expr = joinArgs(args, 1); // The user's input expression like "1+1"
+    double value;
+    CalcStatus status = calcEvaluate(expr.c_str(), value);
+    if (status == CALC_ERR_DIV_ZERO)
+        pushSystemMessage("Error: Division by zero.");
+    else if (status != CALC_OK)
+        pushSystemMessage("Error: Invalid expression or " + String(calcStatusText(status)) + ".");
+    else
+        pushScrollback(expr + " = " + calcFormat(value)); // Include the original expression
+    return CMD_DONE;
+}
+CmdResult cmdTimer(CmdArgs &args) {
+    // Attempt to convert the argument to an integer
+    long minutes = atol(args[1]); // Use long for safety
+
+    if (minutes <= 0) {
+        pushSystemMessage("Error: Minutes must be a positive number.");
+    } else if (timerEndTime > 0) {
+         pushSystemMessage("Error: Another timer is already running.");
+    } else {
+        // Calculate end time in milliseconds
+        // Use UL suffix for unsigned long constants to prevent overflow
+        timerEndTime = millis() + (unsigned long)minutes * 60000UL;
+        pushSystemMessage("Timer: " + String(minutes) + " min(s), Blink = 10s");
+    }
+    return CMD_DONE;
+}
+CmdResult cmdPic(CmdArgs &args) {
+    if (!fsReady) {
+        pushSystemMessage("Error: LittleFS not available.");
+    } else {
+        String filename = args[1];
+        if (!filename.endsWith(".bmp") && !filename.endsWith(".565")) { // Basic check
+            pushSystemMessage("Error: Only .bmp and .565 files supported.");
+        } else if (!LittleFS.exists(filename)) {
+            pushSystemMessage("Error: File not found: " + filename);
+        } else {
+            imageApp.path = filename;
+            if (appStart(IMAGE_APP)) return CMD_OWNS_SCREEN; // The viewer's exit restores the terminal
         }
     }
+    return CMD_DONE;
+}
+CmdResult cmdLs(CmdArgs &args) {
+    pushScrollback(listFiles());
+    return CMD_DONE;
+}
+CmdResult cmdCat(CmdArgs &args) {
+    catToScrollback(args[1]);
+    return CMD_DONE;
+}
+CmdResult cmdModel(CmdArgs &args) {
+    if (!fsReady) pushSystemMessage("Error: LittleFS not available.");
+    else if (!LittleFS.exists(args[1])) pushSystemMessage("Error: File not found: " + String(args[1]));
+    else {
+        modelApp.path = args[1];
+        if (appStart(MODEL_APP)) return CMD_OWNS_SCREEN;
+    }
+    return CMD_DONE;
+}
+CmdResult cmdMore(CmdArgs &args) {
+    if (!fsReady) pushSystemMessage("Error: LittleFS not available.");
+    else if (!LittleFS.exists(args[1])) pushSystemMessage("Error: File not found: " + String(args[1]));
+    else {
+        pagerApp.path = args[1];
+        if (appStart(PAGER_APP)) return CMD_OWNS_SCREEN;
+    }
+    return CMD_DONE;
+}
+CmdResult cmdRm(CmdArgs &args) {
+    if (removeFile(args[1]))
+        pushSystemMessage("Deleted " + String(args[1]) + ".");
+    else pushSystemMessage("Error: File not found or couldn't be deleted.");
+    return CMD_DONE;
 }
-void executeCommandLine(const String &raw) {
-    String line = trimStr(raw);
-    if (line.length() == 0) {
+CmdResult cmdFormat(CmdArgs &args) {
+    if (!fsReady) {
+        pushSystemMessage("Error: LittleFS not available. Terminating...");
+    } else if (fkeyState != F_INACTIVE) {
+        pushSystemMessage("Error: Already in special input mode.");
+    } else {
+        // --- ENTER CONFIRMATION MODE ---
+        pushSystemMessage("WARNING: Select Y/N to confirm FORMAT!");
+        
+        fkeyState = F_AWAIT_FORMAT_CONFIRM; 
+        kbIndex = 0; // Start selection on 'Y' (kbIndex 0 = Y, 0 = N)
+        // No need to change kmode, as kbConfirm/draw functions will ignore it.
+        
+        // Draw the new confirmation prompt immediately.
         drawFullTerminal(); 
-        clearCurrentCommand();
-        return;         
     }
+    return CMD_DONE;
+}
+CmdResult cmdDf(CmdArgs &args) {
+    if (!fsReady) { // Check if LittleFS is mounted 
+        pushSystemMessage("Error: LittleFS not available.");
+    } else {
+        #ifdef ESP32 // ESP32 uses totalBytes()/usedBytes() directly
+            size_t totalBytes = LittleFS.totalBytes();
+            size_t usedBytes = LittleFS.usedBytes();
+        #else // RP2040 uses FSInfo struct
+            FSInfo fs_info;
+            if (!LittleFS.info(fs_info)) {
+                 pushSystemMessage("Error: Could not get FS info.");
+                 return CMD_DONE; // Exit early on error
+            }
+            size_t totalBytes = fs_info.totalBytes;
+            size_t usedBytes = fs_info.usedBytes;
+        #endif
 
-    // Add command to history
-    addHistory(line); 
+        size_t freeBytes = totalBytes - usedBytes;
 
-    const int MAX_TOKENS = 8;
-    String tokens[MAX_TOKENS];
-    int count = 0;
-    tokenizeLine(line, tokens, count, MAX_TOKENS);
-    
-    if (count == 0) return;
-    
-    String cmd = tokens[0];
-    cmd.toLowerCase(); 
-    
-    if (cmd == "help") {
-        pushSystemMessage("Available commands:");
-        pushScrollback("help         - Show this message.");
-        pushScrollback("clear        - Clear terminal history.");
-        pushScrollback("calc <expr>  - Evaluate simple math.");
-        pushScrollback("pi           - Display Rainbow Pi"); 
-        pushScrollback("timer <min>  - Start timer (minutes).");
-        pushScrollback("ls           - List files on LittleFS.");
-        pushScrollback("cat <file>   - Display file content.");
-        pushScrollback("echo <text> >/>> <file> - Write file.");
-        pushScrollback("rm <file>    - Delete a file.");
-        pushScrollback("send <file>  - Send file to PC via USB.");
-        pushScrollback("format       - Format LT-FS partition.");
-        pushScrollback("df           - Disk usage information.");        
-        pushScrollback("ver          - Display version info.");
-        pushScrollback("time         - Show uptime since boot.");
-        pushScrollback("fkey         - Show F-key functions.");
-        pushScrollback("pic <f.bmp>  - Display BMP picture.");
-        pushScrollback("cube         - 3D CUBE, back to exit.");
-        pushScrollback("mood         - Cycle through RGB colors.");
-        pushScrollback("moon         - Moon phases.");
-    } else if (cmd == "fkey") {
-        pushScrollback("--- F-Key functionality: ---");
-        pushScrollback("F1: Print last command, char by char.");
-        pushScrollback("F2: Copy last cmd up to char.");
-        pushScrollback("F3: Repeat last cmd.");
-        pushScrollback("F4: Delete current cmd up to char.");
-        pushScrollback("F5: Recall last cmd. F6: Insert ^Z.");
-        pushScrollback("F7: Show history.");
-        pushScrollback("F8: Cycle back history.");  
-        pushScrollback("F9: Recall by history index.");      
-
-    } else if (cmd == "clear") {
-        scrollbackCount = 0; 
-        scrollbackHead = 0;
-    } else if (cmd == "cube") {
-        runCubeAnimation();
-        return;
-    } else if (cmd == "mood") {
-        mood();
-        return;
-    } else if (cmd == "moon") { 
-        runMoonPhase();
-        return;
-    } else if (cmd == "ver") {
-        pushSystemMessage(deviceVersion);
-
-    } else if (cmd == "echo") {
-        String output = "";
-        String filePath = "";
-        bool appendMode = false;
-        bool redirection = false;
-
-        for (int i = 1; i < count; ++i) {
-            if (tokens[i] == ">" || tokens[i] == ">>") {
-                redirection = true;
-                appendMode = (tokens[i] == ">>");
-                if (i + 1 < count) filePath = tokens[i + 1];
-                else { pushSystemMessage("Error: Missing filename write!"); return; }
-                break;
-            }
-            if (output.length() > 0) output += " ";
-            output += tokens[i];
+        // Format nicely in KB
+        String totalStr = String(totalBytes / 1024) + "KB";
+        String usedStr = String(usedBytes / 1024) + "KB";
+        String freeStr = String(freeBytes / 1024) + "KB";
+
+        // Add spaces for basic alignment (adjust spacing as needed)
+        String header = "Filesystem   Size   Used  Available";
+        String data   = "/           " + totalStr + "  " + usedStr + "   " + freeStr;
+
+        pushScrollback(header);
+        pushScrollback(data);
+    }
+    return CMD_DONE;
+}
+CmdResult cmdPi(CmdArgs &args) {
+    String piValue = String(PI_VALUE, 18);
+    String piString = "Pi = " + piValue;
+    String fullString = SYS_PROMPT + piString;
+    pushScrollback(fullString, ST77XX_BLACK);
+    // The rainbow row is painted by the cell renderer in drawFullTerminal() below.
+    return CMD_DONE;
+}
+#ifdef PICOS_BENCH
+void benchGlyph() {
+    // Glyph throughput: per-glyph GFX print versus atlas line blits, same 10 rows of text.
+    const int rows = 10;
+    const char *sample = "The quick brown fox jumps over the lazy!";
+    resetHardwareScroll(); // The print path below draws at raw panel rows
+    unsigned long startUs = micros();
+    for (int r = 0; r < rows; ++r) {
+        for (int c = 0; c < COLS; ++c) {
+            tft.setCursor(c * CHAR_WIDTH, r * LINE_HEIGHT);
+            tft.setTextColor(RAINBOW_COLORS[(r + c) % RAINBOW_COUNT], ST77XX_BLACK);
+            tft.print(sample[c]);
         }
+    }
+    unsigned long printUs = micros() - startUs;
+    startUs = micros();
+    for (int r = 0; r < rows; ++r) {
+        blitText(0, r * LINE_HEIGHT, sample, COLS, RAINBOW_COLORS[r % RAINBOW_COUNT], ST77XX_BLACK);
+    }
+    unsigned long blitUs = micros() - startUs;
+    uint32_t glyphs = (uint32_t)rows * COLS;
+    tft.fillScreen(ST77XX_BLACK);
+    invalidateTerminalCache();
+    pushSystemMessage("Glyphs/s: print " + String((uint32_t)(glyphs * 1000000ULL / max(printUs, 1UL))) +
+                      ", blit " + String((uint32_t)(glyphs * 1000000ULL / max(blitUs, 1UL))));
+}
+void benchScrollback() {
+    // Scrollback store: push rate and heap use over many more lines than it holds.
+    const uint32_t lines = 20000;
+    const char *sample = "SYS> scrollback bench line with some text";
+    uint32_t heapBefore = rp2040.getFreeHeap();
+    unsigned long startUs = micros();
+    for (uint32_t i = 0; i < lines; ++i) sbAppendLine(sample, 10 + (i % 30), ST77XX_GREEN);
+    unsigned long elapsedUs = micros() - startUs;
+    int32_t heapDelta = (int32_t)heapBefore - (int32_t)rp2040.getFreeHeap();
+    pushSystemMessage("SB: " + String((uint32_t)(lines * 1000000ULL / max(elapsedUs, 1UL))) +
+                      " lines/s, heap +" + String(heapDelta) + " B, holds " +
+                      String(scrollbackLineCount()) + " lines");
+}
+void benchInput() {
+    // Per-keystroke cost of typing into an empty versus an almost full command line.
+    const int keys = 40;
+    clearCurrentCommand();
+    unsigned long startUs = micros();
+    for (int i = 0; i < keys; ++i) insertCharAtCursor('a' + i % 26);
+    unsigned long firstUs = micros() - startUs;
+    while (cmdLen < CMD_BUF - 1 - keys) insertCharAtCursor('a' + cmdLen % 26);
+    startUs = micros();
+    for (int i = 0; i < keys; ++i) insertCharAtCursor('a' + i % 26);
+    unsigned long lastUs = micros() - startUs;
+    clearCurrentCommand();
+    pushSystemMessage("Input: " + String(firstUs / keys) + " us/key at start, " +
+                      String(lastUs / keys) + " us/key at " + String(CMD_BUF - 1) + " chars");
+}
+void benchTerminal() {
+    // Measures the cell renderer: pixels and address windows per push + redraw cycle.
+    const int cycles = 20;
+    renderSync(); // termStats belongs to the renderer
+    TermRenderStats before = termStats;
+    unsigned long startUs = micros();
+    for (int i = 0; i < cycles; ++i) {
+        pushScrollback("bench line " + String(i));
+        drawFullTerminal();
+    }
+    renderSync();
+    unsigned long elapsedUs = micros() - startUs;
+    uint32_t pixels = termStats.pixels - before.pixels;
+    uint32_t windows = termStats.windows - before.windows;
+    pushSystemMessage("Term: " + String(pixels / cycles) + " px, " + String(windows / cycles) +
+                      " windows, " + String(elapsedUs / cycles) + " us per line");
+}
+CmdResult cmdBench(CmdArgs &args) {
+    String mode = args.count > 1 ? args[1] : "";
+    if (mode == "glyph") benchGlyph();
+    else if (mode == "sb") benchScrollback();
+    else if (mode == "input") benchInput();
+    else if (mode == "cmd") benchDispatch();
+    else if (mode == "tok") benchTokenizer();
+    else if (mode == "calc") benchCalc();
+    else if (mode == "bmp") {
+        if (args.count < 3) pushSystemMessage("Usage: bench bmp <file.bmp>");
+        else benchBmp(args[2]);
+    }
+    else if (mode == "fix") benchFixed();
+    else if (mode == "moon") benchMoon();
+    else if (mode == "app") benchApp();
+    else if (mode == "render") benchRender();
+    else if (mode == "mood") benchMood();
+    else if (mode == "flash") benchFlash();
+    else if (mode == "lz") benchLz(args.count > 2 ? args[2] : "");
+    else if (mode == "model") {
+        if (args.count < 3) pushSystemMessage("Usage: bench model <file.obj>");
+        else benchModel(args[2]);
+    }
+    else if (mode == "show") benchSlideshow(args.count > 2 ? args[2] : "*");
+    else if (mode == "fit") {
+        if (args.count < 3) pushSystemMessage("Usage: bench fit <file.bmp|file.565>");
+        else benchFit(args[2]);
+    }
+    else if (mode == "565") {
+        if (args.count < 3) pushSystemMessage("Usage: bench 565 <file.565> [<file.bmp>]");
+        else benchImg565(args[2], args.count > 3 ? args[3] : "");
+    }
+    else if (mode == "more") {
+        if (args.count < 3) pushSystemMessage("Usage: bench more <file>");
+        else benchPager(args[2]);
+    }
+    else benchTerminal();
+    return CMD_DONE;
+}
+#endif
+CmdResult cmdSlideshow(CmdArgs &args) {
+    if (!fsReady) {
+        pushSystemMessage("Error: LittleFS not available.");
+        return CMD_DONE;
+    }
+    const char *pattern = args.count > 1 ? args[1] : "*";
+    int seconds = args.count > 2 ? atoi(args[2]) : SLIDE_DEFAULT_SECONDS;
+    if (seconds <= 0) seconds = SLIDE_DEFAULT_SECONDS;
+    if (!slideBegin(slideshow, pattern)) return CMD_DONE;
+    slideshow.intervalMs = seconds * 1000UL;
+    return appStart(SLIDESHOW_APP) ? CMD_OWNS_SCREEN : CMD_DONE;
+}
+CmdResult cmdSend(CmdArgs &args) {
+    String filename = args[1];
+    if (!LittleFS.exists(filename)) {
+        pushSystemMessage("Error: File not found: " + filename);
+    } else {
+        executeDownload(filename);
+    }
+    return CMD_DONE;
+}
+// ----------------------------
+// Serial command handlers (host protocol)
+// ----------------------------
+// These keep their own argument checks: the error lines are part of the wire protocol.
+CmdResult serialUpload(CmdArgs &args) {
+    if (args.count >= 3) {
+        String filename = args[1];
+        size_t fileSize = (size_t)strtoul(args[2], nullptr, 10);
+        
+        // Clear any residual serial data before entering blocking routine
+        while (Serial.available()) Serial.read(); 
 
-        if (redirection) {
-            if (filePath.length() == 0) pushSystemMessage("Error: Missing filename for write!");
-            else if (writeFile(filePath, output, appendMode))
-                pushSystemMessage("Echo " + String(appendMode ? ">> " : "> ") + filePath + ": Success!");
-            else pushSystemMessage("Error: Failed to write to " + filePath);
-        } else {
-            pushSystemMessage(output);
+        // CRITICAL: Call the flow-controlled, blocking upload function
+        executeUpload(filename, fileSize);
+        
+    } else {
+        pushSystemMessage("Error: UPLOAD command malformed (needs file & size).");
+        Serial.println("FATAL ERROR: UPLOAD syntax error."); 
+    }
+    return CMD_DONE;
+}
+// UPLOAD2 <file> <size> [<block> <window> [lz]]: the windowed, CRC-checked upload.
+CmdResult serialUpload2(CmdArgs &args) {
+    if (args.count >= 3) {
+        String filename = args[1];
+        size_t fileSize = (size_t)strtoul(args[2], nullptr, 10);
+        size_t blockSize = args.count > 3 ? (size_t)strtoul(args[3], nullptr, 10) : UPLOAD2_DEFAULT_BLOCK;
+        size_t window = args.count > 4 ? (size_t)strtoul(args[4], nullptr, 10) : UPLOAD2_DEFAULT_WINDOW;
+        bool lz = args.count > 5 && strcmp(args[5], "lz") == 0;
+        while (Serial.available()) Serial.read();
+        executeUpload2(filename, fileSize, blockSize, window, lz);
+    } else {
+        pushSystemMessage("Error: UPLOAD2 command malformed (needs file & size).");
+        Serial.println("FATAL ERROR: UPLOAD2 syntax error.");
+    }
+    return CMD_DONE;
+}
+// HASH <file>: size and CRC-32 of the Pico's copy, so the PC can skip an unchanged file.
+CmdResult serialHash(CmdArgs &args) {
+    if (args.count >= 2) {
+        executeHash(args[1]);
+    } else {
+        pushSystemMessage("Error: HASH command requires a filename.");
+        Serial.println("ERROR: HASH requires filename.");
+    }
+    return CMD_DONE;
+}
+// PATCH <file> <block> <size> <crc>: rebuild a file from the delta in <file>.dlt.
+CmdResult serialPatch(CmdArgs &args) {
+    if (args.count >= 5) {
+        executePatch(args[1], (size_t)strtoul(args[2], nullptr, 10), (size_t)strtoul(args[3], nullptr, 10),
+                     (uint32_t)strtoul(args[4], nullptr, 16));
+    } else {
+        pushSystemMessage("Error: PATCH command malformed.");
+        Serial.println("PATCH_FAIL Syntax error.");
+    }
+    return CMD_DONE;
+}
+// SYNC <file> <block>: block checksums of the Pico's copy, for the PC to build a delta.
+CmdResult serialSync(CmdArgs &args) {
+    if (args.count >= 3) {
+        executeSyncSignatures(args[1], (size_t)strtoul(args[2], nullptr, 10));
+    } else {
+        pushSystemMessage("Error: SYNC command malformed (needs file & block size).");
+        Serial.println("FATAL ERROR: SYNC syntax error.");
+    }
+    return CMD_DONE;
+}
+CmdResult serialCat(CmdArgs &args) {
+    if (args.count >= 2) {
+        executeDownload(args[1]);
+    } else {
+        pushSystemMessage("Error: CAT command requires a filename.");
+        Serial.println("ERROR: CAT requires filename.");
+    }
+    return CMD_DONE;
+}
+// ----------------------------
+// Command tables
+// ----------------------------
+// Both tables MUST stay sorted by name (checked below): lookup is a binary search.
+// Adding a command is one row here plus its handler; help is generated from the rows.
+constexpr CommandSpec COMMANDS[] = {
+#ifdef PICOS_BENCH
+    {"bench",  cmdBench,  0, "bench [<what>] [file]", "glyph sb input cmd tok calc more bmp 565 fit show fix model moon app render mood flash lz."},
+#endif
+    {"calc",   cmdCalc,   1, "calc [-f <file>] <expr>", "Math, vars, ans."},
+    {"cat",    cmdCat,    1, "cat <file>",   "Display file content."},
+    {"clear",  cmdClear,  0, "clear",        "Clear terminal history."},
+    {"cube",   cmdCube,   0, "cube",         "3D CUBE, back to exit."},
+    {"df",     cmdDf,     0, "df",           "Disk usage information."},
+    {"echo",   cmdEcho,   0, "echo <text> >/>> <file>", "Write file."},
+    {"fkey",   cmdFkey,   0, "fkey",         "Show F-key functions."},
+    {"format", cmdFormat, 0, "format",       "Format LT-FS partition."},
+    {"help",   cmdHelp,   0, "help",         "Show this message."},
+    {"ls",     cmdLs,     0, "ls",           "List files on LittleFS."},
+    {"model",  cmdModel,  1, "model <f.obj>", "Spin a 3D mesh, SELECT fill."},
+    {"mood",   cmdMood,   0, "mood [effect]", "solid gradient rainbow plasma fire stars."},
+    {"moon",   cmdMoon,   0, "moon",         "Moon phases."},
+    {"more",   cmdMore,   1, "more <file>",  "Page through a file."},
+    {"pi",     cmdPi,     0, "pi",           "Display Rainbow Pi"},
+    {"pic",    cmdPic,    1, "pic <f.bmp|f.565>", "Display BMP/565 picture."},
+    {"rm",     cmdRm,     1, "rm <file>",    "Delete a file."},
+    {"send",   cmdSend,   1, "send <file>",  "Send file to PC via USB."},
+    {"slideshow", cmdSlideshow, 0, "slideshow [pat] [sec]", "Cycle images, PREV/NEXT skip."},
+    {"time",   cmdTime,   0, "time",         "Show uptime since boot."},
+    {"timer",  cmdTimer,  1, "timer <min>",  "Start timer (minutes)."},
+    {"ver",    cmdVer,    0, "ver",          "Display version info."},
+};
+constexpr size_t COMMAND_COUNT = sizeof(COMMANDS) / sizeof(COMMANDS[0]);
+// Commands sent by the PC application over USB serial (matched case-insensitively).
+constexpr CommandSpec SERIAL_COMMANDS[] = {
+    {"cat",    serialCat,    0, "CAT <file>",           "Stream a file to the PC."},
+    {"hash",   serialHash,   0, "HASH <file>",          "Size and CRC-32 of a file."},
+    {"patch",  serialPatch,  0, "PATCH <file> <block> <size> <crc>", "Rebuild a file from <file>.dlt."},
+    {"sync",   serialSync,   0, "SYNC <file> <block>",  "Block checksums of a file, for a delta."},
+    {"upload", serialUpload, 0, "UPLOAD <file> <size>", "Receive a file from the PC."},
+    {"upload2", serialUpload2, 0, "UPLOAD2 <file> <size> [<block> <window> [lz]]", "Receive a file, windowed with CRC."},
+};
+constexpr size_t SERIAL_COMMAND_COUNT = sizeof(SERIAL_COMMANDS) / sizeof(SERIAL_COMMANDS[0]);
+
+constexpr bool commandNameLess(const char *a, const char *b) {
+    while (*a && *a == *b) { ++a; ++b; }
+    return (unsigned char)*a < (unsigned char)*b;
+}
+constexpr bool commandTableSorted(const CommandSpec *table, size_t count) {
+    for (size_t i = 1; i < count; ++i) {
+        if (!commandNameLess(table[i - 1].name, table[i].name)) return false;
+    }
+    return true;
+}
+static_assert(commandTableSorted(COMMANDS, COMMAND_COUNT), "COMMANDS must be sorted by name");
+static_assert(commandTableSorted(SERIAL_COMMANDS, SERIAL_COMMAND_COUNT), "SERIAL_COMMANDS must be sorted by name");
+// Longest "help" line, "<usage padded to HELP_USAGE_WIDTH> - <help>", so none is cut.
+#define HELP_USAGE_WIDTH 12
+constexpr size_t commandTextLength(const char *s) {
+    size_t n = 0;
+    while (s[n]) ++n;
+    return n;
+}
+constexpr size_t commandHelpWidth(const CommandSpec *table, size_t count) {
+    size_t width = 0;
+    for (size_t i = 0; i < count; ++i) {
+        size_t usage = commandTextLength(table[i].usage);
+        size_t line = (usage > HELP_USAGE_WIDTH ? usage : HELP_USAGE_WIDTH) + 3 + commandTextLength(table[i].help);
+        if (line > width) width = line;
+    }
+    return width;
+}
+constexpr size_t HELP_LINE_MAX = commandHelpWidth(COMMANDS, COMMAND_COUNT);
+
+// Compares the first len chars of name, case-insensitively, with a lower-case table name.
+int commandNameCompare(const char *name, size_t len, const char *entry) {
+    for (size_t i = 0; i < len; ++i, ++entry) {
+        int a = tolower((unsigned char)name[i]);
+        int b = (unsigned char)*entry;
+        if (a != b) return a - b;
+    }
+    return *entry ? -1 : 0;
+}
+// Binary search of a sorted command table. name need not be NUL-terminated or lower case.
+const CommandSpec *findCommand(const CommandSpec *table, size_t count, const char *name, size_t len) {
+    size_t lo = 0, hi = count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        int cmp = commandNameCompare(name, len, table[mid].name);
+        if (cmp == 0) return &table[mid];
+        if (cmp < 0) hi = mid;
+        else lo = mid + 1;
+    }
+    return nullptr;
+}
+// One "usage - help" line per command, usage padded to the classic 13-column layout.
+void pushCommandHelp() {
+    char buf[HELP_LINE_MAX + 1];
+    for (size_t i = 0; i < COMMAND_COUNT; ++i) {
+        snprintf(buf, sizeof(buf), "%-*s - %s", HELP_USAGE_WIDTH, COMMANDS[i].usage, COMMANDS[i].help);
+        pushScrollback(buf);
+    }
+}
+#ifdef PICOS_BENCH
+// tokenizeInPlace against fixed lines with their expected tokens ('|'-separated),
+// then the time per call on a typical line.
+void benchTokenizer() {
+    static const char *const CASES[][2] = {
+        {"ls", "ls"},
+        {"  echo   hi  ", "echo|hi"},
+        {"\t cat\t/dir/f.bmp\t", "cat|/dir/f.bmp"},
+        {"echo \"a b\" > f.txt", "echo|a b|>|f.txt"},
+        {"echo pre\"mid dle\"post", "echo|premid dlepost"},
+        {"echo a\\ b \\\"q\\\"", "echo|a b|\"q\""},
+        {"echo \"\" x", "echo||x"},
+        {"echo \"unclosed quote", "echo|unclosed quote"},
+        {"calc x+y*3", "calc|x+y*3"},
+    };
+    const int caseCount = sizeof(CASES) / sizeof(CASES[0]);
+    CmdArgs args;
+    char line[CMD_BUF];
+    int passed = 0;
+    for (int n = 0; n < caseCount; ++n) {
+        strcpy(line, CASES[n][0]);
+        tokenizeInPlace(line, args);
+        String joined;
+        for (int i = 0; i < args.count; ++i) joined += (i ? "|" : "") + String(args[i]);
+        if (joined == CASES[n][1]) passed++;
+        else pushSystemMessage("Tok: \"" + String(CASES[n][0]) + "\" gave " + joined);
+    }
+    const int runs = 1000;
+    const char *typical = "echo \"hello world\" >> /logs/out.txt";
+    unsigned long startUs = micros();
+    for (int n = 0; n < runs; ++n) {
+        strcpy(line, typical);
+        tokenizeInPlace(line, args);
+    }
+    unsigned long elapsedUs = micros() - startUs;
+    pushSystemMessage("Tok: " + String(passed) + "/" + String(caseCount) + " cases pass, " +
+                      String(elapsedUs * 1000 / runs) + " ns per line");
+}
+// calc against a table of expressions and their expected calcFormat() output (nullptr:
+// must fail to compile), then evaluations per second for compile + run and cached runs.
+void benchCalc() {
+    static const char *const CASES[][2] = {
+        {"1+2*3", "7"},
+        {"(4+5)*(6-7)/2", "-4.5"},
+        {"12.5*3-7/2+100", "134"},
+        {"((1+2)*(3+4))/(5-2)", "7"},
+        {"-2^2", "-4"},
+        {"2^3^2", "512"},
+        {"2^-1", "0.5"},
+        {"7%4%2", "1"},
+        {"1/3", "0.333333"},
+        {"sqrt(16)+abs(-3)", "7"},
+        {"floor(2.7)+ceil(2.1)+round(2.5)", "8"},
+        {"1+", nullptr},
+        {"(1", nullptr},
+    };
+    const int caseCount = sizeof(CASES) / sizeof(CASES[0]);
+    const int rounds = 40;
+    static CalcProgram scratch;
+    int passed = 0;
+    double v = 0;
+    for (int i = 0; i < caseCount; ++i) {
+        const bool ok = calcEvaluate(CASES[i][0], v) == CALC_OK;
+        if (CASES[i][1] ? ok && calcFormat(v) == CASES[i][1] : !ok) passed++;
+        else pushSystemMessage("Calc: " + String(CASES[i][0]) + " gave " + (ok ? calcFormat(v) : String("an error")));
+    }
+
+    unsigned long startUs = micros();
+    for (int r = 0; r < rounds; ++r)
+        for (int i = 0; i < caseCount; ++i)
+            if (calcCompile(CASES[i][0], scratch) == CALC_OK) calcExecute(scratch, v);
+    unsigned long compileUs = micros() - startUs;
+
+    startUs = micros();
+    for (int r = 0; r < rounds; ++r)
+        for (int i = 0; i < caseCount; ++i) calcEvaluate(CASES[i][0], v);
+    unsigned long cachedUs = micros() - startUs;
+
+    uint32_t evals = (uint32_t)rounds * caseCount;
+    pushSystemMessage("Calc: " + String(passed) + "/" + String(caseCount) + " cases pass");
+    pushSystemMessage("Calc ev/s: compile " + String((uint32_t)(evals * 1000000ULL / max(compileUs, 1UL))) +
+                      ", cached " + String((uint32_t)(evals * 1000000ULL / max(cachedUs, 1UL))));
+}
+// Pages through a file without drawing: open time, per-page cost both ways,
+// and the lowest free heap seen, which stays put whatever the file size.
+void benchPager(const String &path) {
+    static Pager pg;
+    uint32_t heapBefore = rp2040.getFreeHeap();
+    uint32_t heapMin = heapBefore;
+    unsigned long startUs = micros();
+    if (!pagerOpen(pg, path)) { pushSystemMessage("Error: Could not open file."); return; }
+    unsigned long openUs = micros() - startUs;
+
+    startUs = micros();
+    while (pagerNext(pg, false)) heapMin = min(heapMin, (uint32_t)rp2040.getFreeHeap());
+    unsigned long forwardUs = micros() - startUs;
+    uint32_t pages = pg.page + 1;
+    startUs = micros();
+    while (pagerPrev(pg, false)) heapMin = min(heapMin, (uint32_t)rp2040.getFreeHeap());
+    unsigned long backUs = micros() - startUs;
+    pg.file.close();
+
+    uint32_t steps = max(pages - 1, (uint32_t)1);
+    pushSystemMessage("More: " + String(pages) + " pages, " + String(pg.size) + " B, open " + String(openUs) + " us");
+    pushSystemMessage("More: fwd " + String(forwardUs / steps) + " us/pg, back " + String(backUs / steps) +
+                      " us/pg, heap -" + String(heapBefore - heapMin) + " B");
+}
+// Time to a full image for a BMP: decode only (rows dropped), then decode and
+// stream to the panel, with the flash reads and seeks the decoder made.
+void benchBmp(const String &path) {
+    static BmpInfo bmp;
+    File file = LittleFS.open(path, "r");
+    if (!file) { pushSystemMessage("Error: Could not open file."); return; }
+    const char *error = bmpReadHeader(file, bmp);
+    if (error) { file.close(); pushSystemMessage("Error: " + String(error) + "."); return; }
+    int w = min((int)bmp.width, SCREEN_WIDTH);
+    int h = min((int)bmp.height, SCREEN_HEIGHT);
+    int x0 = (bmp.width - w) / 2;
+    int y0 = (bmp.height - h) / 2;
+
+    static uint16_t row[SCREEN_WIDTH];
+    BmpSink drop = {row, [](BmpSink &, int, int) {}, nullptr};
+    imgStats = {0, 0, 0};
+    unsigned long startUs = micros();
+    bool ok = bmpDecode(file, bmp, x0, w, y0, h, drop);
+    unsigned long decodeUs = micros() - startUs;
+    ImgStats decodeStats = imgStats;
+
+    resetHardwareScroll();
+    startUs = micros();
+    ok = ok && bmpDrawToPanel(file, bmp, x0, w, y0, h, (SCREEN_WIDTH - w) / 2, (SCREEN_HEIGHT - h) / 2);
+    unsigned long panelUs = micros() - startUs;
+    file.close();
+    tft.fillScreen(ST77XX_BLACK);
+    invalidateTerminalCache();
+
+    if (!ok) pushSystemMessage("Error: File read failed.");
+    pushSystemMessage("BMP " + String(w) + "x" + String(h) + "x" + String(bmp.depth) + ": decode " +
+                      String(decodeUs / 1000) + " ms, full " + String(panelUs / 1000) + " ms");
+    pushSystemMessage("BMP: " + String(decodeStats.bytesRead) + " B in " + String(decodeStats.reads) +
+                      " reads, " + String(decodeStats.seeks) + " seeks");
+}
+// Time to scale a whole image to fit the screen, with its flash traffic and the
+// viewer's RAM: fixed buffers whatever the image size, and no heap.
+void benchFit(const String &path) {
+    static BmpInfo bmp;
+    static ImageView view;
+    Img565Info native;
+    const bool isNative = path.endsWith(".565");
+    File file = LittleFS.open(path, "r");
+    if (!file) { pushSystemMessage("Error: Could not open file."); return; }
+    const char *error = isNative ? img565ReadHeader(file, native) : bmpReadHeader(file, bmp);
+    if (error) { file.close(); pushSystemMessage("Error: " + String(error) + "."); return; }
+
+    uint32_t heapBefore = rp2040.getFreeHeap();
+    resetHardwareScroll();
+    viewOpen(view, file, isNative ? nullptr : &bmp, isNative ? &native : nullptr);
+    imgStats = {0, 0, 0};
+    unsigned long startUs = micros();
+    bool ok = viewRedraw(view);
+    unsigned long fitUs = micros() - startUs;
+    uint32_t heapAfter = rp2040.getFreeHeap();
+    file.close();
+    resetHardwareScroll();
+    tft.fillScreen(ST77XX_BLACK);
+
+    uint32_t workingSet = sizeof(viewScaler) + sizeof(viewSrcRow) + sizeof(bmpBlock) + sizeof(dispBuf);
+    if (!ok) pushSystemMessage("Error: File read failed.");
+    pushSystemMessage("Fit " + String(view.width) + "x" + String(view.height) + " -> " + String(view.viewW) + "x" +
+                      String(view.viewH) + ": " + String(fitUs / 1000) + " ms");
+    pushSystemMessage("Fit: " + String(imgStats.bytesRead) + " B in " + String(imgStats.reads) + " reads, " +
+                      String(imgStats.seeks) + " seeks");
+    pushSystemMessage("Fit: RAM " + String(workingSet) + " B static, heap " +
+                      String((int32_t)(heapBefore - heapAfter)) + " B");
+}
+// Transition latency with and without prefetch over the first few matching
+// images: cold is opening the file plus drawing it, prefetched the drawing alone.
+void benchSlideshow(const char *pattern) {
+    Slideshow &ss = slideshow; // Not running while the shell takes commands
+    if (!slideBegin(ss, pattern)) return;
+    const int images = min(ss.count, 8);
+    uint32_t openUs = 0, presentUs = 0;
+    for (int i = 0; i < images; ++i) {
+        unsigned long startUs = micros();
+        slideStage(ss, i);
+        openUs += micros() - startUs;
+        startUs = micros();
+        slidePresent(ss);
+        presentUs += micros() - startUs;
+    }
+    slideEnd(ss);
+    pushSystemMessage("Show: " + String(images) + " images, cold " + String((openUs + presentUs) / images / 1000) +
+                      " ms, prefetched " + String(presentUs / images / 1000) + " ms per transition");
+}
+// Accuracy of the fixed-point tables against libm and of the cube against known
+// corners, then CPU cycles per frame of the cube and moon math (the moon's old
+// sqrt path against its table) and per mood color.
+void benchFixed() {
+    const double turn = 2 * PI_VALUE / 65536;
+    int32_t sinErr = 0;
+    for (uint32_t a = 0; a < 65536; a += 7) {
+        sinErr = max(sinErr, abs(fixSin(a) - (fix16)lround(sin(a * turn) * FIX_ONE)));
+        sinErr = max(sinErr, abs(fixCos(a) - (fix16)lround(cos(a * turn) * FIX_ONE)));
+    }
+    int discErr = 0, hueErr = 0;
+    for (int dy = 0; dy <= MOON_RADIUS; ++dy) {
+        discErr += MOON_DISC.half[dy] != (int)round(sqrt(MOON_RADIUS * MOON_RADIUS - dy * dy));
+    }
+    for (int hue = 0; hue < 360; ++hue) hueErr += HUE_PALETTE.v[hue] != hsvToRgb565(hue, 255, 255);
+    pushSystemMessage("Fix: sin/cos max err " + String(sinErr) + " LSB, disc " + String(discErr) +
+                      " bad, hues " + String(hueErr) + " bad");
+
+    // Screen corners of the cube at a few frames of its animation, from double
+    // precision trig rounded to the pixel; the shift in project() truncates, so
+    // one pixel of slack.
+    static const struct {
+        uint16_t frame;
+        uint8_t xy[8][2];
+    } POSES[] = {
+        {0, {{70, 70}, {170, 70}, {170, 170}, {70, 170}, {70, 70}, {170, 70}, {170, 170}, {70, 170}}},
+        {45, {{120, 36}, {120, 74}, {49, 139}, {49, 101}, {191, 101}, {191, 139}, {120, 204}, {120, 166}}},
+        {120, {{154, 43}, {204, 129}, {161, 154}, {111, 68}, {79, 86}, {129, 172}, {86, 197}, {36, 111}}},
+        {240, {{161, 86}, {111, 172}, {154, 197}, {204, 111}, {86, 43}, {36, 129}, {79, 154}, {129, 68}}},
+    };
+    const fix16 size = 50 * FIX_ONE;
+    const FixVec3 fixCube[8] = {
+        {-size, -size, -size}, { size, -size, -size}, { size,  size, -size}, {-size,  size, -size},
+        {-size, -size,  size}, { size, -size,  size}, { size,  size,  size}, {-size,  size,  size},
+    };
+    const int poseCount = sizeof(POSES) / sizeof(POSES[0]);
+    int cubeErr = 0;
+    for (const auto &pose : POSES) {
+        uint16_t f = pose.frame;
+        FixMat3 m = fixRotationXYZ(f * FIX_DEG(1.0), f * FIX_DEG(1.5), f * FIX_DEG(2.0));
+        for (int i = 0; i < 8; ++i) {
+            Point p = project(fixTransform(m, fixCube[i]));
+            cubeErr += abs(p.x - pose.xy[i][0]) > 1 || abs(p.y - pose.xy[i][1]) > 1;
         }
+    }
+    pushSystemMessage("Fix: cube " + String(cubeErr) + "/" + String(8 * poseCount) + " corners off");
+
+    const int frames = 50;
+    volatile uint32_t sink = 0;
+    uint32_t start = rp2040.getCycleCount();
+    for (int f = 0; f < frames; ++f) {
+        FixMat3 m = fixRotationXYZ(f * FIX_DEG(1.0), f * FIX_DEG(1.5), f * FIX_DEG(2.0));
+        for (int i = 0; i < 8; ++i) sink += project(fixTransform(m, fixCube[i])).x;
+    }
+    uint32_t cubeFixed = (rp2040.getCycleCount() - start) / frames;
 
-    } else if (cmd == "time") {
-        unsigned long uptime = (millis() - startMillis) / 1000;
-        unsigned long seconds = uptime % 60;
-        unsigned long minutes = (uptime / 60) % 60;
-        unsigned long hours = (uptime / 3600);
-        char buf[32];
-        sprintf(buf, "Uptime: %lu:%02lu:%02lu", hours, minutes, seconds);
-        pushSystemMessage(String(buf));
+    start = rp2040.getCycleCount();
+    for (int f = 0; f < frames; ++f) {
+        for (int dy = -MOON_RADIUS; dy <= MOON_RADIUS; ++dy) { // Two sqrt per scanline, as drawMoon did
+            sink += (int)round(sqrt(MOON_RADIUS * MOON_RADIUS - dy * dy)) + (int)round(sqrt(MOON_RADIUS * MOON_RADIUS - dy * dy + f));
+        }
+    }
+    uint32_t moonFloat = (rp2040.getCycleCount() - start) / frames;
+    start = rp2040.getCycleCount();
+    for (int f = 0; f < frames; ++f) {
+        for (int dy = -MOON_RADIUS; dy <= MOON_RADIUS; ++dy) sink += MOON_DISC.half[abs(dy)];
+    }
+    uint32_t moonFixed = (rp2040.getCycleCount() - start) / frames;
+
+    start = rp2040.getCycleCount();
+    for (int hue = 0; hue < 360; ++hue) sink += hsvToRgb565(hue + sink % 2, 255, 255);
+    uint32_t hueCalc = (rp2040.getCycleCount() - start) / 360;
+    start = rp2040.getCycleCount();
+    for (int hue = 0; hue < 360; ++hue) sink += HUE_PALETTE.v[(hue + sink % 2) % 360];
+    uint32_t hueTable = (rp2040.getCycleCount() - start) / 360;
+
+    pushSystemMessage("Fix: cube " + String(cubeFixed) + " cyc/frame, moon " + String(moonFloat) + " -> " +
+                      String(moonFixed));
+    pushSystemMessage("Fix: hue " + String(hueCalc) + " -> " + String(hueTable) + " cyc/color");
+}
+// Render ring under load: core 0 posts numbered commands as fast as it can while
+// core 1 checks that each arrives once, in order and intact. Then a full terminal
+// redraw is timed with core 0 waiting for the renderer (the old single-core
+// behaviour) and with it running on core 1: the first figure is how long loop(),
+// and with it serial and input, is held up.
+void benchRender() {
+#ifdef ARDUINO_ARCH_RP2040
+    const uint32_t count = 100000;
+    renderSync();
+    renderCheckNext = renderCheckErrors = 0;
+    unsigned long startUs = micros();
+    for (uint32_t seq = 0; seq < count; ++seq) {
+        RenderCmd &cmd = renderBegin();
+        cmd.op = RENDER_CHECK;
+        cmd.arg = seq;
+        cmd.cells[seq % COLS].fg = seq;
+        renderEnd();
+    }
+    renderSync();
+    unsigned long ringUs = micros() - startUs;
+    pushSystemMessage("Render: " + String(renderCheckNext) + "/" + String(count) + " commands, " + String(renderCheckErrors) +
+                      " out of order or torn, " + String((uint32_t)(ringUs * 1000ULL / count)) + " ns each");
+
+    unsigned long blockedUs[2], doneUs[2];
+    for (int async = 0; async < 2; ++async) {
+        renderAsync = async;
+        invalidateTerminalCache();
+        startUs = micros();
+        drawFullTerminal();
+        blockedUs[async] = micros() - startUs;
+        renderSync();
+        doneUs[async] = micros() - startUs;
+    }
+    renderAsync = true;
+    pushSystemMessage("Render: full redraw holds loop() " + String(blockedUs[0]) + " us -> " + String(blockedUs[1]) +
+                      " us, panel done after " + String(doneUs[0]) + " / " + String(doneUs[1]) + " us");
+#else
+    pushSystemMessage("Render: needs the RP2040's second core.");
+#endif
+}
+// Runs the cube through loop() for 3 s, exactly as the device does, and reports
+// how often serial and the timers got serviced meanwhile: every loop() pass
+// polls the serial port, so the worst gap between passes is the longest a host
+// command (e.g. a PicoLink UPLOAD) waits. BACK ends it early.
+void benchApp() {
+    if (!appStart(CUBE_APP)) return;
+    const unsigned long startMs = millis();
+    unsigned long lastUs = micros(), worstGapUs = 0;
+    uint32_t passes = 0;
+    while (activeApp && millis() - startMs < 3000) {
+        loop();
+        unsigned long nowUs = micros();
+        worstGapUs = max(worstGapUs, nowUs - lastUs);
+        lastUs = nowUs;
+        ++passes;
+    }
+    if (activeApp) {
+        appQuit();
+        appService(millis());
+    }
+    pushSystemMessage("App: " + String(passes) + " loop passes, " + String(appStats.frames) + " frames (" +
+                      String(appStats.overruns) + " over budget, worst " + String(appStats.worstUs) + " us)");
+    pushSystemMessage("App: serial/timers serviced every pass, worst gap " + String(worstGapUs) + " us");
+}
+// Moon delta rendering against full redraws. Every phase-to-phase step is
+// replayed off screen and compared pixel for pixel with a full redraw of the
+// target phase, one box row at a time (rows do not depend on each other); then
+// both paths are timed on the panel.
+void benchMoon() {
+    const int r = MOON_RADIUS, side = 2 * r + 2;
+    uint8_t full[2 * MOON_RADIUS + 2], delta[2 * MOON_RADIUS + 2];
+    auto paintRow = [&](uint8_t *row, int dy, int day) {
+        memset(row, 0, side);
+        MoonSpan spans[2];
+        int n = moonLitSpans(dy, moonTerminator(day, MOON_PHASES), spans);
+        for (int i = 0; i < n; ++i) memset(&row[spans[i].x + r + 1], 1, spans[i].w);
+    };
+    uint32_t mismatches = 0, deltaPixels = 0, fullPixels = 0;
+    for (int from = 0; from < MOON_PHASES; ++from) {
+        for (int to = 0; to < MOON_PHASES; ++to) {
+            bool differs = false;
+            for (int dy = -r; dy <= r; ++dy) {
+                paintRow(delta, dy, from);
+                MoonSpan spans[4];
+                int n = moonDeltaSpans(dy, moonTerminator(from, MOON_PHASES), moonTerminator(to, MOON_PHASES), spans);
+                for (int i = 0; i < n; ++i) {
+                    memset(&delta[spans[i].x + r + 1], spans[i].color == ST77XX_WHITE, spans[i].w);
+                    if (to == (from + 1) % MOON_PHASES) deltaPixels += spans[i].w;
+                }
+                paintRow(full, dy, to);
+                differs |= memcmp(full, delta, side) != 0;
+            }
+            mismatches += differs;
+        }
+        for (int dy = -r; dy <= r; ++dy) {
+            paintRow(full, dy, from);
+            for (int x = 0; x < side; ++x) fullPixels += full[x];
+        }
+    }
+    fullPixels += MOON_PHASES * side * side; // The box clear
 
-    } else if (cmd == "calc") {
-        if (count < 2) {
-            pushSystemMessage("Usage: calc <expression>");
-        } else {
-            String expr = raw.substring(cmd.length());
-            expr.trim(); // expr now holds the user's input expression like "1+1"
-            String result = evalCalc(expr);
-            if (result.startsWith("ERR"))
-                pushSystemMessage("Error: Invalid expression or " + result.substring(4) + ".");
-            else if (result.startsWith("INF"))
-                pushSystemMessage("Error: Division by zero.");
-            else
-                // pushScrollback("= " + result); // Old line
-                pushScrollback(expr + " = " + result); // New line: Include the original expression
-        }
-    } else if (cmd == "timer") {
-        if (count < 2) {
-            pushSystemMessage("Usage: timer <minutes>");
-        } else {
-            // Attempt to convert the argument to an integer
-            long minutes = tokens[1].toInt(); // Use long for safety
+    resetHardwareScroll();
+    tft.fillScreen(ST77XX_BLACK);
+    unsigned long start = micros();
+    for (int day = 0; day < MOON_PHASES; ++day) drawMoon(day, MOON_PHASES);
+    unsigned long fullUs = (micros() - start) / MOON_PHASES;
+    start = micros();
+    for (int day = 0; day < MOON_PHASES; ++day) drawMoonDelta(day, (day + 1) % MOON_PHASES, MOON_PHASES);
+    unsigned long deltaUs = (micros() - start) / MOON_PHASES;
+    tft.fillScreen(ST77XX_BLACK);
+    invalidateTerminalCache();
 
-            if (minutes <= 0) {
-                pushSystemMessage("Error: Minutes must be a positive number.");
-            } else if (timerEndTime > 0) {
-                 pushSystemMessage("Error: Another timer is already running.");
-            } else {
-                // Calculate end time in milliseconds
-                // Use UL suffix for unsigned long constants to prevent overflow
-                timerEndTime = millis() + (unsigned long)minutes * 60000UL;
-                pushSystemMessage("Timer: " + String(minutes) + " min(s), Blink = 10s");
+    pushSystemMessage("Moon: " + String(mismatches) + "/" + String(MOON_PHASES * MOON_PHASES) + " steps differ from full redraw");
+    pushSystemMessage("Moon: step " + String(fullUs) + " -> " + String(deltaUs) + " us, px " + String(fullPixels / MOON_PHASES) +
+                      " -> " + String(deltaPixels / MOON_PHASES));
+}
+// Per effect: scanline generation alone, then whole frames streamed to the panel
+// (generation overlapped with DMA). Both must stay under MOOD_FRAME_MS.
+void benchMood() {
+    const int frames = 30;
+    String report[MOOD_EFFECT_COUNT];
+    resetHardwareScroll();
+    for (size_t i = 0; i < MOOD_EFFECT_COUNT; ++i) {
+        const MoodEffect &effect = MOOD_EFFECTS[i];
+        moodApp.effect = &effect;
+        if (!moodEffectStart()) { report[i] = String(effect.name) + ": not enough RAM"; continue; }
+        uint16_t *line = dispRowBuffer();
+        unsigned long start = micros();
+        for (int f = 0; f < frames; ++f) {
+            effect.frame(f * MOOD_FRAME_MS);
+            for (int y = 0; y < SCREEN_HEIGHT; ++y) effect.line(line, y);
+        }
+        unsigned long genUs = (micros() - start) / frames;
+        moodApp.hue = -1;
+        start = micros();
+        for (int f = 0; f < frames; ++f) moodDrawFrame((frames + f) * MOOD_FRAME_MS);
+        dispEndWindow();
+        unsigned long frameUs = (micros() - start) / frames;
+        moodEffectStop();
+        report[i] = String(effect.name) + ": gen " + String(genUs) + " us, frame " + String(frameUs) + " us (" +
+                    String(1000000UL / max(frameUs, 1UL)) + " fps)";
+    }
+    tft.fillScreen(ST77XX_BLACK);
+    invalidateTerminalCache();
+    for (size_t i = 0; i < MOOD_EFFECT_COUNT; ++i) pushSystemMessage("Mood " + report[i]);
+}
+// LittleFS write speed: 512-byte writes as uploads used to make them, against the
+// upload write ring's aligned 4 KB blocks. The scratch file is removed afterwards.
+void benchFlash() {
+    if (!fsReady) { pushSystemMessage("Error: LittleFS not available."); return; }
+    const size_t total = 128 * 1024;
+    static uint8_t chunk[BLOCK_SIZE];
+    for (size_t i = 0; i < BLOCK_SIZE; ++i) chunk[i] = i * 31 + 7;
+    unsigned long us[2] = {0, 0};
+    for (int mode = 0; mode < 2; ++mode) {
+        File file = LittleFS.open("bench.tmp", "w");
+        if (!file) { pushSystemMessage("Error: Could not open bench.tmp."); return; }
+        UploadWriter writer;
+        if (mode == 1 && !uploadWriterBegin(writer, file)) {
+            file.close();
+            LittleFS.remove("bench.tmp");
+            pushSystemMessage("Error: Not enough RAM.");
+            return;
+        }
+        unsigned long start = micros();
+        for (size_t done = 0; done < total; done += BLOCK_SIZE) {
+            if (mode == 0) file.write(chunk, BLOCK_SIZE);
+            else uploadWriterPut(writer, chunk, BLOCK_SIZE);
+        }
+        if (mode == 1) {
+            uploadWriterFinish(writer);
+            uploadWriterEnd(writer);
+        }
+        file.close();
+        us[mode] = micros() - start;
+        LittleFS.remove("bench.tmp");
+    }
+    auto kbps = [&](unsigned long t) { return String((unsigned long)((uint64_t)total * 1000000 / 1024 / max(t, 1UL))); };
+    pushSystemMessage("Flash: 512 B writes " + kbps(us[0]) + " KB/s, 4 KB blocks " + kbps(us[1]) + " KB/s");
+}
+// The transfer codec on text, 24-bit BMP rows, random bytes and optionally the start
+// of a file, in DL_MAX_CHUNK blocks: size on the link (raw blocks included) and time
+// per byte to compress and to decompress, with a round-trip check.
+void benchLz(const String &path) {
+    const size_t total = 16 * 1024, block = DL_MAX_CHUNK;
+    uint8_t *buf = (uint8_t *)malloc(total + 2 * block + LZ_HASH_SIZE * sizeof(uint16_t));
+    if (!buf) { pushSystemMessage("Error: Not enough RAM."); return; }
+    uint8_t *packed = buf + total, *unpacked = packed + block;
+    uint16_t *table = (uint16_t *)(unpacked + block);
+    const char *names[] = {"text", "bmp", "random", "file"};
+    for (int kind = 0; kind < 4; ++kind) {
+        size_t len = total;
+        if (kind == 0) { // Log lines
+            for (size_t n = 0, i = 0; n < total; ++i) {
+                char line[64];
+                int w = snprintf(line, sizeof(line), "%08lu sensor %u temp=%u.%u state=%s\n", (unsigned long)i * 250,
+                                 (unsigned)(i % 4), (unsigned)(20 + i * 7 % 9), (unsigned)(i % 10), i % 5 ? "OK" : "WARN");
+                memcpy(buf + n, line, min((size_t)w, total - n));
+                n += w;
             }
-        }
-    } else if (cmd == "pic") {
-        if (count < 2) {
-            pushSystemMessage("Usage: pic <filename.bmp>");
-        } else if (!fsReady) {
-            pushSystemMessage("Error: LittleFS not available.");
-        } else {
-            String filename = tokens[1];
-            if (!filename.endsWith(".bmp")) { // Basic check
-                pushSystemMessage("Error: Only .bmp files supported.");
-            } else if (!LittleFS.exists(filename)) {
-                pushSystemMessage("Error: File not found: " + filename);
-            } else {
-                displayImage(filename); // Call the display function
-                // NOTE: displayImage handles restoring the terminal
-                return; // Important: Don't redraw/clear command after image display
+        } else if (kind == 1) { // BGR rows of a gradient with a flat box, like a screenshot
+            for (size_t i = 0; i < total; ++i) {
+                size_t px = i / 3, x = px % SCREEN_WIDTH, y = px / SCREEN_WIDTH;
+                bool box = x >= 60 && x < 180 && y % 16 < 8;
+                uint8_t bgr[3] = {(uint8_t)x, (uint8_t)(y * 8), 128};
+                buf[i] = box ? 0x40 : bgr[i % 3];
             }
+        } else if (kind == 2) {
+            uint32_t x = 2463534242u;
+            for (size_t i = 0; i < total; ++i) {
+                x ^= x << 13;
+                x ^= x >> 17;
+                x ^= x << 5;
+                buf[i] = (uint8_t)x;
+            }
+        } else {
+            if (!path.length()) break;
+            File file = LittleFS.open(path, "r");
+            if (!file) { pushSystemMessage("Error: Could not open file."); break; }
+            len = file.read(buf, total);
+            file.close();
         }
-    } else if (cmd == "ls") {
-        pushScrollback(listFiles());
+        size_t linkBytes = 0;
+        unsigned long packUs = 0, unpackUs = 0;
+        bool ok = true;
+        for (size_t at = 0; at < len; at += block) {
+            const size_t n = min(block, len - at);
+            unsigned long start = micros();
+            size_t p = lzCompress(buf + at, n, packed, n - 1, table);
+            packUs += micros() - start;
+            linkBytes += p ? p : n;
+            if (!p) continue;
+            start = micros();
+            int u = lzDecompress(packed, p, unpacked, block);
+            unpackUs += micros() - start;
+            ok = ok && u == (int)n && memcmp(unpacked, buf + at, n) == 0;
+        }
+        len = max(len, (size_t)1);
+        pushSystemMessage("LZ " + String(names[kind]) + ": " + String(len) + " -> " + String(linkBytes) + " B (" +
+                          String(linkBytes * 100 / len) + "%), pack " + String(packUs * 1000 / len) + " ns/B, unpack " +
+                          String(unpackUs * 1000 / len) + " ns/B" + (ok ? "" : ", MISMATCH"));
+    }
+    free(buf);
+}
+// Golden-frame check and frame time for the mesh renderer. A fixed set of poses
+// is drawn in both modes, each from a clear screen; the frame hashes go to
+// <file>.gold on the first run and are compared against it afterwards.
+void benchModel(const String &path) {
+    File file = LittleFS.open(path, "r");
+    if (!file) { pushSystemMessage("Error: Could not open file."); return; }
+    Mesh *mesh = (Mesh *)malloc(sizeof(Mesh));
+    if (!mesh) { file.close(); pushSystemMessage("Error: Not enough RAM for the mesh."); return; }
+    const char *error = meshLoadObj(*mesh, file);
+    file.close();
+    if (error) { free(mesh); pushSystemMessage("Error: " + String(error) + "."); return; }
 
-    } else if (cmd == "cat") {
-        if (count < 2) pushSystemMessage("Usage: cat <filename>");
-        else pushScrollback(readFile(tokens[1]));
+    const int poses = 8;
+    String hashes;
+    uint32_t totalUs = 0;
+    resetHardwareScroll();
+    tft.fillScreen(ST77XX_BLACK);
+    for (int mode = 0; mode < 2; ++mode) {
+        mesh->wire = mode == 1;
+        for (int i = 0; i < poses; ++i) {
+            mesh->box = {0, 0, 0, 0};
+            uint16_t angle = i * FIX_DEG(45.0);
+            unsigned long startUs = micros();
+            uint32_t hash = meshDrawFrame(*mesh, fixRotationXYZ(angle, angle * 3 / 2, angle * 2));
+            totalUs += micros() - startUs;
+            char line[10];
+            snprintf(line, sizeof(line), "%08lx\n", (unsigned long)hash);
+            hashes += line;
+            dispFill(mesh->box.x0, mesh->box.y0, mesh->box.x1 - mesh->box.x0, mesh->box.y1 - mesh->box.y0, ST77XX_BLACK);
+        }
+    }
+    dispEndWindow();
+    int triCount = mesh->triCount;
+    free(mesh);
+    tft.fillScreen(ST77XX_BLACK);
+    invalidateTerminalCache();
 
-    } else if (cmd == "rm") {
-        if (count < 2) pushSystemMessage("Usage: rm <filename>");
-        else {
-            if (removeFile(tokens[1]))
-                pushSystemMessage("Deleted " + tokens[1] + ".");
-            else pushSystemMessage("Error: File not found or couldn't be deleted.");
-        }
-    } else if (cmd == "format") { 
-        if (!fsReady) {
-            pushSystemMessage("Error: LittleFS not available. Terminating...");
-        } else if (fkeyState != F_INACTIVE) {
-            pushSystemMessage("Error: Already in special input mode.");
-        } else {
-            // --- ENTER CONFIRMATION MODE ---
-            pushSystemMessage("WARNING: Select Y/N to confirm FORMAT!");
-            
-            fkeyState = F_AWAIT_FORMAT_CONFIRM; 
-            kbIndex = 0; // Start selection on 'Y' (kbIndex 0 = Y, 0 = N)
-            // No need to change kmode, as kbConfirm/draw functions will ignore it.
-            
-            // Draw the new confirmation prompt immediately.
-            drawFullTerminal(); 
+    String goldPath = path + ".gold";
+    File gold = LittleFS.open(goldPath, "r");
+    if (!gold) {
+        gold = LittleFS.open(goldPath, "w");
+        if (gold) gold.print(hashes);
+        pushSystemMessage("Model: wrote " + goldPath + " (" + String(2 * poses) + " frames)");
+    } else {
+        char expected[2 * poses * 9];
+        int got = gold.read((uint8_t *)expected, sizeof(expected));
+        int mismatches = 0;
+        for (int i = 0; i < 2 * poses; ++i) { // One "%08lx\n" line per frame
+            if ((i + 1) * 9 > got || memcmp(expected + i * 9, hashes.c_str() + i * 9, 9) != 0) ++mismatches;
         }
-    } else if (cmd == "df") {
-        if (!fsReady) { // Check if LittleFS is mounted 
-            pushSystemMessage("Error: LittleFS not available.");
-        } else {
-            #ifdef ESP32 // ESP32 uses totalBytes()/usedBytes() directly
-                size_t totalBytes = LittleFS.totalBytes();
-                size_t usedBytes = LittleFS.usedBytes();
-            #else // RP2040 uses FSInfo struct
-                FSInfo fs_info;
-                if (!LittleFS.info(fs_info)) {
-                     pushSystemMessage("Error: Could not get FS info.");
-                     drawFullTerminal(); // Redraw to show error
-                     clearCurrentCommand();
-                     return; // Exit early on error
-                }
-                size_t totalBytes = fs_info.totalBytes;
-                size_t usedBytes = fs_info.usedBytes;
-            #endif
-
-            size_t freeBytes = totalBytes - usedBytes;
-
-            // Format nicely in KB
-            String totalStr = String(totalBytes / 1024) + "KB";
-            String usedStr = String(usedBytes / 1024) + "KB";
-            String freeStr = String(freeBytes / 1024) + "KB";
-
-            // Add spaces for basic alignment (adjust spacing as needed)
-            String header = "Filesystem   Size   Used  Available";
-            String data   = "/           " + totalStr + "  " + usedStr + "   " + freeStr;
-
-            pushScrollback(header);
-            pushScrollback(data);
-        }
-    } else if (cmd == "pi") {
-        String piValue = String(PI_VALUE, 18);
-        String piString = "Pi = " + piValue;
-        String fullString = SYS_PROMPT + piString;
-        pushScrollback(fullString, ST77XX_BLACK);
-        int idx = (scrollbackHead + scrollbackCount - 1) % SCROLLBACK_SIZE;
-        storeRainbowData(idx, fullString);
-        int lineToDraw = MAX_LINES - 2;
-        tft.fillRect(0, lineToDraw * LINE_HEIGHT, SCREEN_WIDTH, LINE_HEIGHT, ST77XX_BLACK);
-        tft.setCursor(0, lineToDraw * LINE_HEIGHT);
-        tft.setTextColor(ST77XX_GREEN, ST77XX_BLACK); 
-        tft.print(SYS_PROMPT); 
-        drawMultiColorString(piString, lineToDraw, SYS_PROMPT.length() * CHAR_WIDTH);
-        tft.setTextColor(ST77XX_WHITE, ST77XX_BLACK);
-
-    } else if (cmd == "send") {
-        if (count < 2) pushSystemMessage("Usage: send <filename>");
-        else {
-            String filename = tokens[1];
-            if (!LittleFS.exists(filename)) {
-                pushSystemMessage("Error: File not found: " + filename);
-            } else {
-                File file = LittleFS.open(filename, "r");
-                if (!file) pushSystemMessage("Error: Could not open file: " + filename);
-                else {
-                    size_t filesize = file.size();
-                    Serial.printf("SEND %s %u\n", filename.c_str(), (unsigned)filesize);
-
-                    const size_t blockSize = 512;
-                    uint8_t buffer[blockSize];
-                    size_t sent = 0;
-
-                    while (file.available()) {
-                        size_t toRead = min(file.available(), blockSize);
-                        file.read(buffer, toRead);
-                        Serial.write(buffer, toRead);
-                        sent += toRead;
-                    }
-                    file.close();
-                    Serial.println("\nEND");
-                    pushSystemMessage("File sent: " + filename + " (" + String(sent) + " bytes)");
-                }
-            }
+        pushSystemMessage("Model: " + String(2 * poses - mismatches) + "/" + String(2 * poses) + " frames match " + goldPath);
+    }
+    if (gold) gold.close();
+    pushSystemMessage("Model: " + String(triCount) + " tris, " + String(totalUs / (2 * poses) / 1000) + " ms per full frame");
+}
+// Position-weighted FNV-1a of one row of native RGB565 pixels; summing rows in
+// any order gives the same image hash.
+uint32_t imgRowHash(const uint16_t *px, int count, int y) {
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < count; ++i) {
+        h = (h ^ (px[i] >> 8)) * 16777619u;
+        h = (h ^ (px[i] & 0xFF)) * 16777619u;
+    }
+    return h * (2u * y + 1);
+}
+// Round trip for PicoLink's converter: hashes every decoded .565 row and, given
+// the BMP it was made from, the same rows through the BMP decoder. Then times a
+// full image to the panel.
+void benchImg565(const String &path, const String &bmpPath) {
+    static BmpInfo bmp;
+    Img565Info ii;
+    File file = LittleFS.open(path, "r");
+    if (!file) { pushSystemMessage("Error: Could not open file."); return; }
+    const char *error = img565ReadHeader(file, ii);
+    if (error) { file.close(); pushSystemMessage("Error: " + String(error) + "."); return; }
+
+    // The panel is idle until the timed draw, so both DMA buffers are scratch.
+    uint8_t *wire = (uint8_t *)dispBuf[1];
+    uint16_t *pixels = dispBuf[0];
+    uint32_t hash565 = 0;
+    ImgReader rd = {&file, 0, 0};
+    imgStats = {0, 0, 0};
+    unsigned long startUs = micros();
+    file.seek(IMG565_HEADER_BYTES);
+    bool ok = true;
+    for (int y = 0; ok && y < ii.height; ++y) {
+        ok = img565NextRow(rd, ii, wire);
+        for (int x = 0; ok && x < ii.width; ++x) pixels[x] = (wire[2 * x] << 8) | wire[2 * x + 1];
+        if (ok) hash565 += imgRowHash(pixels, ii.width, y);
+    }
+    unsigned long decodeUs = micros() - startUs;
+    ImgStats decodeStats = imgStats;
+    if (!ok) { file.close(); pushSystemMessage("Error: Bad .565 row data."); return; }
+
+    if (bmpPath.length() > 0) {
+        File bmpFile = LittleFS.open(bmpPath, "r");
+        error = !bmpFile ? "Could not open BMP" : bmpReadHeader(bmpFile, bmp);
+        if (!error && (bmp.width != ii.width || bmp.height != ii.height)) error = "BMP size differs";
+        if (!error) {
+            uint32_t hashBmp = 0;
+            BmpSink sink = {pixels, [](BmpSink &s, int y, int count) {
+                *(uint32_t *)s.ctx += imgRowHash(s.buf, count, y);
+            }, &hashBmp};
+            if (!bmpDecode(bmpFile, bmp, 0, bmp.width, 0, bmp.height, sink)) error = "BMP read failed";
+            else pushSystemMessage(hashBmp == hash565 ? "565: Pixels match the BMP." : "565: Pixels DIFFER from the BMP.");
         }
+        if (bmpFile) bmpFile.close();
+        if (error) pushSystemMessage("Error: " + String(error) + ".");
+    }
 
-    } else {
-        pushSystemMessage("Error: Unknown command '" + cmd + "'. Type 'help'.");
+    int w = min((int)ii.width, SCREEN_WIDTH);
+    int h = min((int)ii.height, SCREEN_HEIGHT);
+    resetHardwareScroll();
+    startUs = micros();
+    ok = img565DrawToPanel(file, ii, (ii.width - w) / 2, w, (ii.height - h) / 2, h, (SCREEN_WIDTH - w) / 2, (SCREEN_HEIGHT - h) / 2);
+    unsigned long panelUs = micros() - startUs;
+    uint32_t fileBytes = file.size();
+    file.close();
+    tft.fillScreen(ST77XX_BLACK);
+    invalidateTerminalCache();
+
+    if (!ok) pushSystemMessage("Error: File read failed.");
+    pushSystemMessage("565 " + String(ii.width) + "x" + String(ii.height) + (ii.rle ? " rle" : " raw") + ": decode " +
+                      String(decodeUs / 1000) + " ms, full " + String(panelUs / 1000) + " ms");
+    pushSystemMessage("565: " + String(decodeStats.bytesRead) + " B in " + String(decodeStats.reads) +
+                      " reads, " + String(fileBytes) + " B file");
+}
+// Command lookup latency over every registered name (plus a miss), in ns per lookup.
+void benchDispatch() {
+    const int rounds = 200;
+    volatile int found = 0;
+    unsigned long startUs = micros();
+    for (int r = 0; r < rounds; ++r) {
+        for (size_t i = 0; i < COMMAND_COUNT; ++i) found += findCommand(COMMANDS, COMMAND_COUNT, COMMANDS[i].name, strlen(COMMANDS[i].name)) != nullptr;
+        found += findCommand(COMMANDS, COMMAND_COUNT, "nosuchcmd", 9) != nullptr;
+    }
+    unsigned long elapsedUs = micros() - startUs;
+    uint32_t lookups = rounds * (COMMAND_COUNT + 1);
+    pushSystemMessage("Dispatch: " + String((uint32_t)(elapsedUs * 1000ULL / lookups)) + " ns/lookup over " +
+                      String((uint32_t)COMMAND_COUNT) + " commands");
+}
+#endif
+// line is tokenized in place (see tokenizeInPlace); the caller adds it to history first.
+void executeCommandLine(char *line) {
+    static CmdArgs args; // ~140 bytes, kept off the stack
+    if (tokenizeInPlace(line, args) == 0) {
+        drawFullTerminal(); 
+        clearCurrentCommand();
+        return;         
+    }
+
+    const CommandSpec *spec = findCommand(COMMANDS, COMMAND_COUNT, args[0], args.tok[0].len);
+    if (!spec) {
+        pushSystemMessage("Error: Unknown command '" + String(args[0]) + "'. Type 'help'.");
+    } else if (args.overflow) {
+        pushSystemMessage("Error: Too many arguments (max " + String(MAX_ARGS - 1) + ").");
+    } else if (args.count - 1 < spec->minArgs) {
+        pushSystemMessage("Usage: " + String(spec->usage));
+    } else if (spec->handler(args) == CMD_OWNS_SCREEN) {
+        return; // Full-screen apps restore the terminal themselves
     }
 
     drawFullTerminal();
@@ -2705,29 +5862,13 @@ void drawMultiColorString(const String &text, int lineNum, int x_start) {
     // MAX_LINES, LINE_HEIGHT, CHAR_WIDTH, and SCREEN_WIDTH are assumed to be defined
     if (lineNum < 0 || lineNum >= MAX_LINES) return;
 
-    // Assumes 'tft' is the global Adafruit_ST7789 object
-    tft.setTextWrap(false);
-    tft.setFont(NULL);
-    tft.setTextSize(1);
-    
-    int x = x_start;
-    int y = lineNum * LINE_HEIGHT;
-    
     // RAINBOW_COUNT and RAINBOW_COLORS are assumed to be defined globally
-    for (int i = 0; i < text.length(); i++) {
-        char c = text.charAt(i);
-        uint16_t charColor = RAINBOW_COLORS[i % RAINBOW_COUNT];
-        
-        tft.setCursor(x, y);
-        tft.setTextColor(charColor, ST77XX_BLACK);
-        tft.write(c); 
-        
-        // CHAR_WIDTH is assumed to be defined
-        x += CHAR_WIDTH;
-        if (x + CHAR_WIDTH > SCREEN_WIDTH) {
-            break;
-        }
+    int colStart = x_start / CHAR_WIDTH;
+    int col = colStart;
+    for (int i = 0; i < text.length() && col < COLS; i++) {
+        termSetCell(lineNum, col++, text.charAt(i), RAINBOW_COLORS[i % RAINBOW_COUNT], ST77XX_BLACK);
     }
+    termFlushRowRange(lineNum, colStart, col);
 }
 // ----------------------------
 // File System (LittleFS) Wrappers
@@ -2765,17 +5906,29 @@ String listFiles() {
     if (output == "--- Files ---") return "--- No files on LittleFS ---";
     return output;
 }
-String readFile(const String &path) {
-    if (!LittleFS.exists(path)) return "Error: File not found.";
+// Streams a file into the scrollback in block reads, one logical line at a time.
+void catToScrollback(const String &path) {
+    if (!LittleFS.exists(path)) { pushScrollback("Error: File not found."); return; }
     File file = LittleFS.open(path, "r");
-    if (!file) return "Error: Could not open file.";
-
-    String content = "--- " + path + " ---\n";
-    while (file.available()) {
-        content += (char)file.read();
+    if (!file) { pushScrollback("Error: Could not open file."); return; }
+
+    pushScrollback("--- " + path + " ---");
+    uint8_t block[PAGER_BLOCK];
+    static char line[SB_MAX_LINE_CHARS];
+    int len = 0;
+    int n;
+    while ((n = file.read(block, sizeof(block))) > 0) {
+        for (int i = 0; i < n; ++i) {
+            if (block[i] == '\n' || len == SB_MAX_LINE_CHARS) {
+                pushScrollbackChars(line, len, ST77XX_WHITE);
+                len = 0;
+                if (block[i] == '\n') continue;
+            }
+            line[len++] = (char)block[i];
+        }
     }
+    if (len > 0) pushScrollbackChars(line, len, ST77XX_WHITE);
     file.close();
-    return content;
 }
 bool writeFile(const String &path, const String &data, bool append) {
     File file = LittleFS.open(path, append ? "a" : "w");
@@ -2872,23 +6025,38 @@ void executeUpload(String filename, size_t fileSize) {
         pushSystemMessage("DOWNLOAD FAILED: Cannot open file.");
         return;
     }
+    UploadWriter writer;
+    if (!uploadWriterBegin(writer, outFile)) {
+        outFile.close();
+        LittleFS.remove(filename);
+        Serial.println("FATAL ERROR: Not enough RAM.");
+        pushSystemMessage("DOWNLOAD FAILED: Not enough RAM.");
+        return;
+    }
 
     // 2. Send READY signal to the PC application
     Serial.print(READY_MSG);
     
     size_t bytesRemaining = fileSize;
-    uint8_t buffer[BLOCK_SIZE];
     bool success = true;
 
     // 3. Main data receiving loop with ACK flow control
     while (bytesRemaining > 0) {
         size_t bytesToRead = min((size_t)BLOCK_SIZE, bytesRemaining);
         
-        // A. BLOCKING READ: Wait until the entire block is received in RAM
-        if (!serialBlockRead(buffer, bytesToRead, 5000)) { 
+        // A. BLOCKING READ: Wait until the entire block is received, straight into
+        //    the write ring (BLOCK_SIZE divides UPLOAD_FLASH_BLOCK, so it fits)
+        uint8_t *buffer = uploadWriterSpace(writer, bytesToRead);
+        if (serialBlockRead(buffer, bytesToRead, 5000) != bytesToRead) {
             success = false;
             break; 
         }
+        uploadWriterCommit(writer, bytesToRead);
+        if (writer.failed) { // The write forced by a full ring failed: no ACK for this block
+            Serial.println("FATAL ERROR: FS write error.");
+            success = false;
+            break;
+        }
         
         // B. CRITICAL FIX: Send ACK immediately after receiving the data, 
         //    *before* the slow LittleFS write operation.
@@ -2898,8 +6066,9 @@ void executeUpload(String filename, size_t fileSize) {
             Serial.flush(); 
         }
 
-        // C. SLOW OPERATION: Now write the data to the slow filesystem
-        if (outFile.write(buffer, bytesToRead) != bytesToRead) {
+        // C. SLOW OPERATION: write a whole 4 KB block, but only while the link is idle
+        if (!Serial.available()) uploadWriterStep(writer);
+        if (writer.failed) {
             Serial.println("FATAL ERROR: FS write error.");
             success = false;
             break;
@@ -2910,8 +6079,13 @@ void executeUpload(String filename, size_t fileSize) {
         // Progress update (optional, but good for large files)
         // pushSystemMessage("Received " + String(fileSize - bytesRemaining) + " / " + String(fileSize));
     }
+    if (success && !uploadWriterFinish(writer)) {
+        Serial.println("FATAL ERROR: FS write error.");
+        success = false;
+    }
     
     // 4. Finalize
+    uploadWriterEnd(writer);
     outFile.close();
     while (Serial.available()) Serial.read(); // Clean up any remaining serial garbage
 
@@ -2930,16 +6104,345 @@ void executeUpload(String filename, size_t fileSize) {
     delay(50); // Pause briefly (50ms) to ensure the TFT completes the final draw
 }
 // ----------------------------
+// Upload write ring
+// ----------------------------
+// Takes the largest ring that fits, down to a single buffer.
+bool uploadWriterBegin(UploadWriter &w, File &file) {
+    w = {&file, nullptr, UPLOAD_RING_BUFS, 0, 0, 0, false};
+    while (!(w.bufs = (uint8_t *)malloc(w.count * UPLOAD_FLASH_BLOCK)) && w.count > 1) w.count /= 2;
+    return w.bufs != nullptr;
+}
+// Room for the next bytes, in the buffer being filled; len is cut to what fits in
+// it. With every buffer full, the oldest is written first.
+uint8_t *uploadWriterSpace(UploadWriter &w, size_t &len) {
+    if (w.head - w.tail == w.count) uploadWriterStep(w);
+    len = min(len, (size_t)UPLOAD_FLASH_BLOCK - w.fill);
+    return w.bufs + (w.head % w.count) * UPLOAD_FLASH_BLOCK + w.fill;
+}
+void uploadWriterCommit(UploadWriter &w, size_t len) {
+    w.fill += len;
+    if (w.fill == UPLOAD_FLASH_BLOCK) {
+        w.head++;
+        w.fill = 0;
+    }
+}
+bool uploadWriterPut(UploadWriter &w, const uint8_t *data, size_t len) {
+    while (len > 0) {
+        size_t n = len;
+        memcpy(uploadWriterSpace(w, n), data, n);
+        uploadWriterCommit(w, n);
+        data += n;
+        len -= n;
+    }
+    return !w.failed;
+}
+// Writes the oldest full buffer, if there is one.
+bool uploadWriterStep(UploadWriter &w) {
+    if (w.failed || w.tail == w.head) return !w.failed;
+    const uint8_t *buf = w.bufs + (w.tail % w.count) * UPLOAD_FLASH_BLOCK;
+    if (w.file->write(buf, UPLOAD_FLASH_BLOCK) != UPLOAD_FLASH_BLOCK) w.failed = true;
+    w.tail++;
+    return !w.failed;
+}
+// Writes every full buffer, then the partial last block.
+bool uploadWriterFinish(UploadWriter &w) {
+    while (w.tail != w.head && uploadWriterStep(w)) {}
+    if (!w.failed && w.fill > 0) {
+        if (w.file->write(w.bufs + (w.head % w.count) * UPLOAD_FLASH_BLOCK, w.fill) != w.fill) w.failed = true;
+        w.fill = 0;
+    }
+    return !w.failed;
+}
+void uploadWriterEnd(UploadWriter &w) {
+    free(w.bufs);
+    w.bufs = nullptr;
+}
+// ----------------------------
+// FILE SENDING (PC -> PICO) - WINDOWED
+// ----------------------------
+// UPLOAD2. The Pico answers "READY2 <block> <window>" with what it grants (no
+// more than asked), then the PC keeps up to `window` frames in flight. "ACK2 <n>"
+// is cumulative: blocks below n are taken. "NAK2 <n>" asks for block n again
+// after a CRC error or when later blocks arrive before it; those wait in their
+// window slot, so only the missing block is resent. The PC also resends the
+// oldest block when no ACK comes for it in time. With lz granted ("READY2 ... lz"),
+// frames may carry compressed blocks; they are unpacked into their slot.
+void executeUpload2(String filename, size_t fileSize, size_t blockSize, size_t window, bool lz) {
+    if (!fsReady) {
+        Serial.println("FATAL ERROR: LittleFS not available.");
+        pushSystemMessage("Error: LittleFS not available.");
+        drawFullTerminal();
+        return;
+    }
+    blockSize = constrain(blockSize, (size_t)16, UPLOAD2_MAX_BLOCK);
+    window = constrain(window, (size_t)1, UPLOAD2_MAX_WINDOW);
+    // One slot per window entry plus a spare that takes frames with nowhere to go,
+    // and with lz one more to unpack into
+    uint8_t *slots;
+    while (!(slots = (uint8_t *)malloc((window + 1 + lz) * blockSize)) && window > 1) window /= 2;
+    if (!slots) {
+        Serial.println("FATAL ERROR: Not enough RAM.");
+        pushSystemMessage("DOWNLOAD FAILED: Not enough RAM.");
+        return;
+    }
+
+    pushSystemMessage("DOWNLOADING: " + filename + " (" + String(fileSize) + " bytes)");
+    drawFullTerminal();
+
+    if (filename.startsWith("/")) {
+        filename = filename.substring(1);
+    }
+    File outFile = LittleFS.open(filename, "w");
+    if (!outFile) {
+        free(slots);
+        Serial.println("FATAL ERROR: Could not open file for writing.");
+        pushSystemMessage("DOWNLOAD FAILED: Cannot open file.");
+        return;
+    }
+    UploadWriter writer;
+    if (!uploadWriterBegin(writer, outFile)) {
+        free(slots);
+        outFile.close();
+        LittleFS.remove(filename);
+        Serial.println("FATAL ERROR: Not enough RAM.");
+        pushSystemMessage("DOWNLOAD FAILED: Not enough RAM.");
+        return;
+    }
+    Serial.printf("READY2 %u %u%s\r\n", (unsigned)blockSize, (unsigned)window, lz ? " lz" : "");
+
+    const uint32_t blocks = (fileSize + blockSize - 1) / blockSize;
+    uint16_t lengths[UPLOAD2_MAX_WINDOW];
+    bool have[UPLOAD2_MAX_WINDOW] = {};
+    uint32_t base = 0;             // First block not yet taken
+    uint32_t nakSent = UINT32_MAX; // One NAK per missing block; the PC's timeout covers the rest
+    uint32_t badFrames = 0;
+    uint8_t *spare = slots + window * blockSize;
+    uint8_t *unpack = spare + blockSize;
+    auto nak = [&]() {
+        if (nakSent == base) return;
+        Serial.printf("NAK2 %lu\r\n", (unsigned long)base);
+        nakSent = base;
+    };
+    bool success = true;
+
+    while (success && base < blocks) {
+        uint8_t header[UPLOAD2_HEADER_BYTES], crcBytes[4];
+        if (!upload2ReadHeader(header)) { success = false; break; }
+        uint32_t seq = le32(header + 2);
+        uint16_t len = le16(header + 6) & ~LZ_FRAME_FLAG;
+        const bool packed = le16(header + 6) & LZ_FRAME_FLAG;
+        if (len > blockSize || (packed && !lz)) { // Corrupt header: resynchronize on the next magic
+            badFrames++;
+            nak();
+            continue;
+        }
+        bool inWindow = seq >= base && seq < base + window && seq < blocks;
+        uint8_t *data = inWindow && !have[seq % window] ? slots + (seq % window) * blockSize : spare;
+        if (serialBlockRead(data, len, 5000) != len || serialBlockRead(crcBytes, 4, 5000) != 4) { success = false; break; }
+        if (crc32Update(crc32Update(0, header + 2, UPLOAD2_HEADER_BYTES - 2), data, len) != le32(crcBytes)) {
+            badFrames++;
+            nak();
+            continue;
+        }
+        if (seq < base) { // A resend of something already taken: the PC missed an ACK
+            Serial.printf("ACK2 %lu\r\n", (unsigned long)base);
+            continue;
+        }
+        if (data == spare) continue; // Beyond the window, or a copy of a block waiting in its slot
+        if (packed) {
+            int unpacked = lzDecompress(data, len, unpack, blockSize);
+            if (unpacked < 0) { badFrames++; nak(); continue; }
+            memcpy(data, unpack, unpacked);
+            len = unpacked;
+        }
+        if (len != min(blockSize, fileSize - (size_t)seq * blockSize)) { badFrames++; nak(); continue; }
+        have[seq % window] = true;
+        lengths[seq % window] = len;
+        if (seq != base) { nak(); continue; }
+
+        // Take the run of blocks from base and acknowledge it, so the PC refills the
+        // window, then stage it in the write ring. Flash writes wait for an idle link.
+        const uint32_t first = base;
+        while (base < blocks && base < first + window && have[base % window]) base++;
+        Serial.printf("ACK2 %lu\r\n", (unsigned long)base);
+        for (uint32_t b = first; b < base; ++b) {
+            const size_t slot = b % window;
+            have[slot] = false;
+            uploadWriterPut(writer, slots + slot * blockSize, lengths[slot]);
+        }
+        if (!Serial.available()) uploadWriterStep(writer);
+        if (writer.failed) {
+            Serial.println("FATAL ERROR: FS write error.");
+            success = false;
+        }
+    }
+    if (success && !uploadWriterFinish(writer)) {
+        Serial.println("FATAL ERROR: FS write error.");
+        success = false;
+    }
+
+    uploadWriterEnd(writer);
+    outFile.close();
+    free(slots);
+    while (Serial.available()) Serial.read();
+    if (success && base == blocks) {
+        Serial.printf("UPLOAD_OK %s %u\r\n", filename.c_str(), (unsigned)fileSize);
+        pushSystemMessage("SUCCESS: " + filename + " saved" + (badFrames ? ", " + String(badFrames) + " bad frames." : "."));
+    } else {
+        pushSystemMessage("DOWNLOAD FAILED. Removing file.");
+        LittleFS.remove(filename);
+    }
+    drawFullTerminal();
+}
+// Skips to the next frame magic and reads the header after it. False on timeout.
+bool upload2ReadHeader(uint8_t *header) {
+    uint8_t prev = 0, c = 0;
+    do {
+        prev = c;
+        if (serialBlockRead(&c, 1, 5000) != 1) return false;
+    } while (prev != (uint8_t)UPLOAD2_MAGIC[0] || c != (uint8_t)UPLOAD2_MAGIC[1]);
+    header[0] = prev;
+    header[1] = c;
+    return serialBlockRead(header + 2, UPLOAD2_HEADER_BYTES - 2, 5000) == UPLOAD2_HEADER_BYTES - 2;
+}
+// ----------------------------
+// DELTA SYNC (PC -> PICO)
+// ----------------------------
+// Re-uploading an edited file, rsync style. "HASH <file>" answers "HASH <size>
+// <crc>" (or "HASH NONE"), so the PC can skip a file the Pico already has. "SYNC
+// <file> <block>" answers "SYNCSIG <count> <block>", one line per block with its
+// weak checksum and CRC-32 (8 hex digits each), then "SYNCSIG_END". The PC finds
+// those blocks in its copy and uploads the delta with UPLOAD2 as <file>.dlt:
+// SYNC_COPY records (first block and block count, u32 LE each) and SYNC_LITERAL
+// records (length, u32 LE, then the bytes). "PATCH <file> <block> <size> <crc>"
+// rebuilds the file into <file>.tmp, checks it, and renames it over the old copy,
+// which LittleFS does in one metadata commit.
+// rsync's weak checksum: the byte sum and the position-weighted sum, 16 bits each.
+// The PC rolls it along its copy one byte at a time.
+uint32_t syncWeakSum(const uint8_t *data, size_t len) {
+    uint32_t a = 0, b = 0;
+    for (size_t i = 0; i < len; ++i) {
+        a += data[i];
+        b += (uint32_t)(len - i) * data[i];
+    }
+    return (a & 0xFFFF) | (b << 16);
+}
+void executeHash(String filename) {
+    if (filename.startsWith("/")) {
+        filename = filename.substring(1);
+    }
+    File file = fsReady ? LittleFS.open(filename, "r") : File();
+    if (!file) {
+        Serial.println("HASH NONE");
+        return;
+    }
+    uint8_t buffer[BLOCK_SIZE];
+    uint32_t crc = 0;
+    size_t got;
+    while ((got = file.read(buffer, sizeof(buffer))) > 0) crc = crc32Update(crc, buffer, got);
+    Serial.printf("HASH %lu %08lx\r\n", (unsigned long)file.size(), (unsigned long)crc);
+    file.close();
+}
+void executeSyncSignatures(String filename, size_t block) {
+    if (filename.startsWith("/")) {
+        filename = filename.substring(1);
+    }
+    block = constrain(block, SYNC_MIN_BLOCK, SYNC_MAX_BLOCK);
+    uint8_t *buffer = (uint8_t *)malloc(block);
+    if (!buffer) {
+        Serial.println("FATAL ERROR: Not enough RAM.");
+        return;
+    }
+    File file = fsReady ? LittleFS.open(filename, "r") : File();
+    const uint32_t count = file ? (file.size() + block - 1) / block : 0; // No copy: everything is literal
+    Serial.printf("SYNCSIG %lu %u\r\n", (unsigned long)count, (unsigned)block);
+    for (uint32_t i = 0; i < count; ++i) {
+        size_t got = file.read(buffer, block);
+        Serial.printf("%08lx%08lx\r\n", (unsigned long)syncWeakSum(buffer, got), (unsigned long)crc32Update(0, buffer, got));
+    }
+    Serial.println("SYNCSIG_END");
+    if (file) file.close();
+    free(buffer);
+}
+void executePatch(String filename, size_t block, size_t newSize, uint32_t newCrc) {
+    if (!fsReady) {
+        Serial.println("PATCH_FAIL LittleFS not available.");
+        return;
+    }
+    if (filename.startsWith("/")) {
+        filename = filename.substring(1);
+    }
+    const String deltaPath = filename + ".dlt", tmpPath = filename + ".tmp";
+    File delta = LittleFS.open(deltaPath, "r");
+    File old = LittleFS.open(filename, "r");
+    File out = LittleFS.open(tmpPath, "w");
+    const char *error = nullptr;
+    UploadWriter writer = {};
+    if (!delta) error = "No delta.";
+    else if (!out) error = "Could not open file for writing.";
+    else if (!uploadWriterBegin(writer, out)) error = "Not enough RAM.";
+
+    uint8_t buffer[BLOCK_SIZE];
+    uint32_t crc = 0;
+    size_t written = 0;
+    auto copy = [&](File &from, size_t len) {
+        while (len > 0 && !error) {
+            size_t got = from.read(buffer, min(len, sizeof(buffer)));
+            if (got == 0) {
+                error = "Truncated delta.";
+                break;
+            }
+            crc = crc32Update(crc, buffer, got);
+            written += got;
+            len -= got;
+            if (!uploadWriterPut(writer, buffer, got)) error = "FS write error.";
+        }
+    };
+    while (!error && delta.available()) {
+        uint8_t record[9];
+        if (delta.read(record, 1) != 1) break;
+        if (record[0] == SYNC_COPY && delta.read(record + 1, 8) == 8) {
+            const uint64_t from = (uint64_t)le32(record + 1) * block;
+            if (!old || from >= old.size() || !old.seek(from)) { error = "Bad block reference."; break; }
+            copy(old, (size_t)min((uint64_t)le32(record + 5) * block, old.size() - from));
+        } else if (record[0] == SYNC_LITERAL && delta.read(record + 1, 4) == 4) {
+            copy(delta, le32(record + 1));
+        } else {
+            error = "Bad delta.";
+        }
+    }
+    if (!error && !uploadWriterFinish(writer)) error = "FS write error.";
+    uploadWriterEnd(writer);
+    if (out) out.close();
+    if (old) old.close();
+    if (delta) delta.close();
+
+    if (!error && (written != newSize || crc != newCrc)) error = "Rebuilt file does not match.";
+    if (!error && !LittleFS.rename(tmpPath, filename)) error = "Rename failed.";
+    if (error) LittleFS.remove(tmpPath);
+    LittleFS.remove(deltaPath);
+    if (!error) {
+        Serial.printf("PATCH_OK %s %u\r\n", filename.c_str(), (unsigned)newSize);
+        pushSystemMessage("SUCCESS: " + filename + " synced.");
+    } else {
+        Serial.print("PATCH_FAIL ");
+        Serial.println(error);
+        pushSystemMessage("SYNC FAILED: " + filename + ": " + error);
+    }
+    drawFullTerminal();
+}
+// ----------------------------
 // FILE RECEIVING (PICO -> PC)
 // ----------------------------
-/**
- * @brief Reads the contents of a file and streams it to the serial port.
- * @param filename The name of the file to stream.
- */
-void executeCat(String filename) {
+// Credit-based: the PC grants `window` chunks past the last byte it acknowledged,
+// and "DLACK <n>" (cumulative, bytes below n are written) moves that mark. A frame
+// with a bad CRC or a gap before it gets "DLNAK <n>", and the Pico resends from n;
+// so does a stall with no ACK. The whole-file CRC in the offer lets the PC resume
+// a partial download of the same file and check the finished one.
+void executeDownload(String filename) {
     if (!fsReady) {
         pushSystemMessage("Error: LittleFS not available.");
-        Serial.println("CAT_ERROR LittleFS not available.");
+        Serial.println("DLERR LittleFS not available.");
         return;
     }
 
@@ -2947,40 +6450,153 @@ void executeCat(String filename) {
         filename = filename.substring(1);
     }
 
-    File file = LittleFS.open(filename, "r"); // Use "r" for read mode
-    
+    File file = LittleFS.open(filename, "r");
     if (!file) {
-        Serial.print("CAT_ERROR File not found: ");
+        Serial.print("DLERR File not found: ");
         Serial.println(filename);
         pushSystemMessage("Error: File not found: " + filename);
         return;
     }
+    uint8_t *frame = (uint8_t *)malloc(DL_HEADER_BYTES + DL_MAX_CHUNK + 4);
+    if (!frame) {
+        file.close();
+        Serial.println("DLERR Not enough RAM.");
+        pushSystemMessage("Error: Not enough RAM.");
+        return;
+    }
 
-    size_t fileSize = file.size();
-    
-    // 1. Send START Marker and file information
-    Serial.print("CAT_START ");
-    Serial.print(filename);
-    Serial.print(" ");
-    Serial.println(fileSize);
-    
-    pushSystemMessage("Streaming file: " + filename + " (" + String(fileSize) + " bytes)");
+    const uint32_t fileSize = file.size();
+    uint32_t fileCrc = 0;
+    size_t got;
+    while ((got = file.read(frame, DL_MAX_CHUNK)) > 0) fileCrc = crc32Update(fileCrc, frame, got);
 
-    // 2. Stream raw binary data
-    size_t bytesRead;
-    uint8_t buffer[512];
-    
-    while ((bytesRead = file.read(buffer, sizeof(buffer))) > 0) {
-        Serial.write(buffer, bytesRead);
+    while (Serial.available()) Serial.read();
+    Serial.printf("DLOFFER %s %lu %08lx\r\n", filename.c_str(), (unsigned long)fileSize, (unsigned long)fileCrc);
+    pushSystemMessage("Sending: " + filename + " (" + String(fileSize) + " bytes)");
+    drawFullTerminal();
+
+    // The PC's replies are read between frames, a line at a time
+    char line[64];
+    size_t lineLen = 0;
+    auto pollLine = [&]() {
+        while (Serial.available()) {
+            char c = Serial.read();
+            if (c != '\r' && c != '\n') {
+                if (lineLen < sizeof(line) - 1) line[lineLen++] = c;
+            } else if (lineLen > 0) {
+                line[lineLen] = '\0';
+                lineLen = 0;
+                return true;
+            }
+        }
+        return false;
+    };
+
+    const char *error = nullptr;
+    uint32_t offset = 0;
+    size_t chunk = 0, window = 0;
+    bool lz = false;
+    unsigned long start = millis();
+    while (!chunk && !error) {
+        unsigned long o, c, w;
+        char mode[4] = "";
+        if (!pollLine()) {
+            if (millis() - start > DL_OFFER_TIMEOUT_MS) error = "No receiver.";
+            yield();
+        } else if (strcmp(line, "DLCANCEL") == 0) {
+            error = "Canceled.";
+        } else if (sscanf(line, "DLGET %lu %lu %lu %3s", &o, &c, &w, mode) >= 3) {
+            offset = min((uint32_t)o, fileSize);
+            chunk = constrain((size_t)c, (size_t)16, DL_MAX_CHUNK);
+            window = constrain((size_t)w, (size_t)1, DL_MAX_WINDOW);
+            lz = strcmp(mode, "lz") == 0;
+        }
+    }
+    // Compressed chunks are read into raw first; without the RAM they just go raw
+    uint8_t *raw = lz ? (uint8_t *)malloc(DL_MAX_CHUNK + LZ_HASH_SIZE * sizeof(uint16_t)) : nullptr;
+    uint16_t *table = raw ? (uint16_t *)(raw + DL_MAX_CHUNK) : nullptr;
+    const bool compressing = raw != nullptr;
+
+    // Header and CRC around the len bytes already at frame + DL_HEADER_BYTES
+    auto sendFrame = [&](uint32_t at, uint16_t lengthField, size_t len) {
+        frame[0] = DL_MAGIC[0];
+        frame[1] = DL_MAGIC[1];
+        for (int i = 0; i < 4; ++i) frame[2 + i] = (uint8_t)(at >> (8 * i));
+        frame[6] = (uint8_t)lengthField;
+        frame[7] = (uint8_t)(lengthField >> 8);
+        uint32_t crc = crc32Update(0, frame + 2, DL_HEADER_BYTES - 2 + len);
+        for (int i = 0; i < 4; ++i) frame[DL_HEADER_BYTES + len + i] = (uint8_t)(crc >> (8 * i));
+        Serial.write(frame, DL_HEADER_BYTES + len + 4);
+    };
+    uint32_t acked = offset, sent = offset, highest = offset, resent = 0, wireBytes = 0;
+    unsigned long lastProgress = millis(), resendAt = lastProgress + DL_RESEND_MS;
+    auto rewind = [&](uint32_t to) {
+        if (!file.seek(to)) error = "Seek error.";
+        if (to < sent) resent += sent - to;
+        sent = to;
+        resendAt = millis() + DL_RESEND_MS;
+    };
+    if (!error) rewind(offset);
+    while (!error && acked < fileSize) {
+        while (!error && pollLine()) {
+            unsigned long n;
+            if (sscanf(line, "DLACK %lu", &n) == 1) {
+                if (n > acked && n <= highest) {
+                    acked = n;
+                    lastProgress = millis();
+                    resendAt = lastProgress + DL_RESEND_MS;
+                    if (sent < acked) rewind(acked);
+                }
+            } else if (sscanf(line, "DLNAK %lu", &n) == 1) {
+                if (n >= acked && n < sent) rewind(n);
+            } else if (strcmp(line, "DLCANCEL") == 0) {
+                error = "Canceled.";
+            }
+        }
+        if (error || acked == fileSize) break;
+
+        if (sent < fileSize && sent - acked < window * chunk) {
+            const uint16_t len = min(chunk, (size_t)(fileSize - sent));
+            uint8_t *data = frame + DL_HEADER_BYTES;
+            if (file.read(raw ? raw : data, len) != len) {
+                error = "Read error.";
+                break;
+            }
+            uint16_t wireLen = len, lengthField = len;
+            if (raw) {
+                size_t packed = lzCompress(raw, len, data, len - 1, table);
+                if (packed) wireLen = packed, lengthField = packed | LZ_FRAME_FLAG;
+                else memcpy(data, raw, len);
+            }
+            sendFrame(sent, lengthField, wireLen);
+            wireBytes += wireLen;
+            sent += len;
+            highest = max(highest, sent);
+            continue;
+        }
+        // Out of credit, or everything sent: wait for ACKs, going back if they stop
+        if (millis() - lastProgress > DL_IDLE_TIMEOUT_MS) error = "Timeout.";
+        else if ((long)(millis() - resendAt) >= 0) rewind(acked);
         yield();
     }
 
     file.close();
-    
-    // 3. Send END Marker
-    Serial.println("CAT_END");
-    
-    pushSystemMessage("Streaming complete: " + filename);
+    char *outcome = (char *)frame + DL_HEADER_BYTES;
+    int outcomeLen = error ? snprintf(outcome, DL_MAX_CHUNK, "DLERR %s", error)
+                           : snprintf(outcome, DL_MAX_CHUNK, "DLEND %lu %08lx", (unsigned long)fileSize, (unsigned long)fileCrc);
+    if (chunk) sendFrame(0, outcomeLen | DL_TEXT_FLAG, outcomeLen);
+    else Serial.println(outcome); // The PC never asked for frames
+    free(frame);
+    free(raw);
+    if (!error) {
+        pushSystemMessage("File sent: " + filename + " (" + String(fileSize - offset) + " bytes" +
+                          (offset ? ", resumed at " + String(offset) : String("")) +
+                          (compressing ? ", " + String(wireBytes) + " over the link" : String("")) +
+                          (resent ? ", " + String(resent) + " resent)" : String(")")));
+    } else {
+        pushSystemMessage("Send failed: " + filename + ": " + error);
+    }
+    drawFullTerminal();
 }
 // ----------------------------
 // Serial Command Handler (FIXED & CONSOLIDATED)
@@ -3007,62 +6623,21 @@ void handleSerialCommands() {
 
             if (commandBufLen > 0) {
                 buffer[commandBufLen] = '\0';
-                String cmdLine = String(buffer);
                 commandBufLen = 0;
 
-                cmdLine.trim();
-                if (cmdLine.length() == 0) continue;
-
-                // Extract command word for logic
-                int firstSpace = cmdLine.indexOf(' ');
-                String command = (firstSpace == -1) ? cmdLine : cmdLine.substring(0, firstSpace);
-                command.toUpperCase();
-
-                // ----------------------------
-                // UPLOAD command (Send file from PC to Pico)
-                // ----------------------------
-                if (command == "UPLOAD") {
-                    
-                    String args = cmdLine.substring(firstSpace + 1);
-                    int secondSpace = args.indexOf(' ');
-                    
-                    if (secondSpace > 0) {
-                        String filename = args.substring(0, secondSpace);
-                        String sizeStr = args.substring(secondSpace + 1);
-                        size_t fileSize = (size_t)sizeStr.toInt();
-                        
-                        // Clear any residual serial data before entering blocking routine
-                        while (Serial.available()) Serial.read(); 
-
-                        // CRITICAL: Call the flow-controlled, blocking upload function
-                        executeUpload(filename, fileSize);
-                        
-                    } else {
-                        pushSystemMessage("Error: UPLOAD command malformed (needs file & size).");
-                        Serial.println("FATAL ERROR: UPLOAD syntax error."); 
-                    }
-                }
-                
-                // ----------------------------
-                // CAT command (Receive file from Pico to PC)
-                // ----------------------------
-                else if (command == "CAT") {
-                    if (firstSpace != -1) {
-                        String filename = cmdLine.substring(firstSpace + 1);
-                        filename.trim();
-                        executeCat(filename); // Calls the file streaming function
-                    } else {
-                        pushSystemMessage("Error: CAT command requires a filename.");
-                        Serial.println("ERROR: CAT requires filename.");
-                    }
-                }
-                
-                // ----------------------------
-                // Other commands (e.g., LS, HELP, etc.)
-                // ----------------------------
-                
-                else {
-                    pushSystemMessage("Error: Unknown command: " + cmdLine);
+                char *cmdLine = buffer;
+                while (isspace((unsigned char)*cmdLine)) cmdLine++;
+                if (*cmdLine == '\0') continue;
+
+                // Look the command word up before tokenizing, so errors can echo the raw line
+                size_t nameLen = strcspn(cmdLine, " \t\r\n");
+                const CommandSpec *spec = findCommand(SERIAL_COMMANDS, SERIAL_COMMAND_COUNT, cmdLine, nameLen);
+                if (spec) {
+                    static CmdArgs args;
+                    tokenizeInPlace(cmdLine, args);
+                    spec->handler(args);
+                } else {
+                    pushSystemMessage("Error: Unknown command: " + String(cmdLine));
                     Serial.println("ERROR: Unknown command.");
                 }
             }
@@ -3081,8 +6656,60 @@ void handleSerialCommands() {
     }
 }
 // ----------------------------
+// App scheduler
+// ----------------------------
+bool appStart(const App &app) {
+    appQuitting = false;
+    appStats = {0, 0, 0};
+    if (!app.init()) return false;
+    renderSync(); // Terminal output init posted (mood's message) is on the panel before the app draws
+    activeApp = &app;
+    appNextFrame = millis();
+    return true;
+}
+// Ends the active app after the current hook returns.
+void appQuit() {
+    appQuitting = true;
+}
+// The usual edge-free button check: pressed and outside the cooldown.
+bool appPressed(int button, unsigned long now) {
+    if (digitalRead(buttonPins[button]) == HIGH && (now - lastPressTime[button] > pressCooldown)) {
+        lastPressTime[button] = now;
+        return true;
+    }
+    return false;
+}
+// One scheduler pass, from loop(): input, then a frame if one is due. A frame
+// that runs late moves the schedule instead of queueing catch-up frames.
+void appService(unsigned long now) {
+    const App &app = *activeApp;
+    if (!appQuitting && app.tick) app.tick(now);
+    if (!appQuitting && app.render && (long)(now - appNextFrame) >= 0) {
+        unsigned long startUs = micros();
+        app.render(now);
+        unsigned long elapsedUs = micros() - startUs;
+        appStats.frames++;
+        appStats.worstUs = max(appStats.worstUs, elapsedUs);
+        if (app.frameMs && elapsedUs > app.frameMs * 1000) appStats.overruns++;
+        appNextFrame += app.frameMs;
+        if ((long)(now - appNextFrame) >= 0) appNextFrame = now + app.frameMs;
+    }
+    if (appQuitting) {
+        activeApp = nullptr; // Lets exit() draw the terminal
+        app.exit();
+    }
+}
+// ----------------------------
 // Setup / Loop
 // ----------------------------
+#ifdef ARDUINO_ARCH_RP2040
+// Core 1 runs the cell renderer (see RENDER CORE) and nothing else.
+void setup1() {
+}
+void loop1() {
+    renderDrain();
+}
+#endif
 void setup() {
     // Setup serial for debugging (optional)
     Serial.begin(115200);
@@ -3131,6 +6758,36 @@ void setup() {
 void loop() {
     unsigned long now = millis();
 
+    serviceTimers(now);
+    if (activeApp) {
+        appService(now); // The app reads the buttons
+    } else {
+        // Cursor blinking
+        if (now - lastBlink >= BLINK_MS) {
+            lastBlink = now;
+            cursorVisible = !cursorVisible;
+            drawCursorAndPreview();
+        }
+
+        // Button handling
+        for (int i = 0; i < NUM_BUTTONS; ++i) {
+            if (digitalRead(buttonPins[i]) == HIGH && (now - lastPressTime[i] > pressCooldown)) {
+                lastPressTime[i] = now;
+                switch (i) {
+                    case IDX_PREV: kbPrev(); drawCursorAndPreview(); break;
+                    case IDX_NEXT: kbNext(); break;
+                    case IDX_SELECT: kbConfirm(); break;
+                    case IDX_BACK: backspaceAtCursor(); break;
+                }
+            }
+        }
+    }
+
+    // Handle serial commands and automatic file reception
+    handleSerialCommands();
+}
+// Timer expiry and the status LED; runs every pass, apps or not.
+void serviceTimers(unsigned long now) {
     //Timer:
     if (timerEndTime > 0 && now >= timerEndTime) {
         timerEndTime = 0; // Deactivate the main timer
@@ -3154,32 +6811,9 @@ void loop() {
         }
     }
 
-    // Cursor blinking
-    if (now - lastBlink >= BLINK_MS) {
-        lastBlink = now;
-        cursorVisible = !cursorVisible;
-        drawCursorAndPreview();
-    }
-
     // LED timeout
     if (ledBlinkEndTime != 0 && now > ledBlinkEndTime) {
         digitalWrite(STATUS_LED_PIN, LOW);
         ledBlinkEndTime = 0;
     }
-
-    // Button handling
-    for (int i = 0; i < NUM_BUTTONS; ++i) {
-        if (digitalRead(buttonPins[i]) == HIGH && (now - lastPressTime[i] > pressCooldown)) {
-            lastPressTime[i] = now;
-            switch (i) {
-                case IDX_PREV: kbPrev(); drawCursorAndPreview(); break;
-                case IDX_NEXT: kbNext(); break;
-                case IDX_SELECT: kbConfirm(); break;
-                case IDX_BACK: backspaceAtCursor(); break;
-            }
-        }
-    }
-
-    // Handle serial commands and automatic file reception
-    handleSerialCommands();
 }